@@ -9,6 +9,7 @@
 //              argv[7]: x_translation_distance (e.g., 10 or -10)
 //              argv[8]: y_translation_distance (e.g., 10 or -10)
 //              argv[9]: z_translation_distance (e.g., 10 or -10)
+//              argv[10...]: optional flags (see {TransformOptions.h})
 //
 // OUTPUT:      {../Output_Images/threshold_image.img}
 //
@@ -24,26 +25,1557 @@
 
 #include "itkImageFileReader.h"
 #include "itkImageFileWriter.h"
+#include "itkImageAlgorithm.h"
 #include "itkAffineTransform.h"
 #include "itkResampleImageFilter.h"
+#include "itkBinaryThresholdImageFilter.h"
 #include "itkWindowedSincInterpolateImageFunction.h"
+#include "itkLinearInterpolateImageFunction.h"
+#include "itkBSplineInterpolateImageFunction.h"
+#include "itkNearestNeighborInterpolateImageFunction.h"
+#include "itkMultiThreader.h"
+#include "itkVector.h"
+
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <mutex>
+
+#include "BSplineDeformation.h"
+#include "DisplacementField.h"
+#include "FixedPointLinearResampler.h"
+#include "FourierShiftResampler.h"
+#include "GaussianPyramid.h"
+#include "ImageGeometryAdaptor.h"
+#include "ImageRegistration.h"
+#include "IntegerMappingResampler.h"
+#include "LabelFusion.h"
+#include "LabelResampler.h"
+#include "ObliquePlane.h"
+#include "OutputThreshold.h"
+#include "ParallelFor.h"
+#include "PhaseCorrelation.h"
+#include "ResamplingPlan.h"
+#include "ResultCache.h"
+#include "SeparableKernelResampler.h"
+#include "ShearRotationResampler.h"
+#include "TransformOptions.h"
+#include "TransformParameters.h"
+#include "WindowedSincResampler.h"
+
+namespace
+{
+constexpr unsigned int Dimension = 3;
+using ScalarType = double;
+using PixelType = unsigned char;
+using ImageType = itk::Image< PixelType, Dimension >;
+using SeriesImageType = itk::Image< PixelType, Dimension + 1 >;
+using ReaderType = itk::ImageFileReader< ImageType >;
+using WriterType = itk::ImageFileWriter< ImageType >;
+using TransformType = itk::AffineTransform< ScalarType, Dimension >;
+using ResampleImageFilterType = itk::ResampleImageFilter< ImageType, ImageType >;
+constexpr unsigned int Radius = 3;
+
+// What every resampling below shares: the parsed options, the --threshold
+// or --otsu mask and the number of threads.
+struct ResampleSettings
+{
+  const TransformOptions & Options;
+  OutputThreshold Threshold;
+  unsigned int NumberOfThreads;
+};
+
+// Reads all voxels of an input of which `reader` has only read the header
+// so far. A --series input has no reader; it is loaded already.
+bool ReadWholeInput( ReaderType * reader )
+{
+  if( reader )
+    {
+    try
+      {
+      reader->UpdateLargestPossibleRegion();
+      }
+    catch( itk::ExceptionObject & error )
+      {
+      std::cerr << "Error: " << error << std::endl;
+      return false;
+      }
+    }
+  return true;
+}
+
+// --reference (or the fixed image of --register) and
+// --output-size/spacing/origin/direction replace the output grid, so the
+// transform and the change of resolution (e.g. to a 2 or 3 mm analysis
+// grid) happen in one resampling pass whose cost follows the number of
+// output voxels.
+ImageGeometry SelectGrid( const TransformOptions & options, const ImageGeometry & referenceGeometry,
+                          ImageGeometry grid )
+{
+  if( !options.ReferenceFile.empty() || !options.RegisterFile.empty() )
+    {
+    grid = referenceGeometry;
+    }
+  if( options.OutputSpacingSet )
+    {
+    grid = GetRespacedGrid( grid, options.OutputSpacing );
+    }
+  for( unsigned int i = 0; i < 3; i++ )
+    {
+    if( options.OutputSizeSet )
+      {
+      grid.Size[i] = options.OutputSize[i];
+      }
+    if( options.OutputOriginSet )
+      {
+      grid.Origin[i] = options.OutputOrigin[i];
+      }
+    for( unsigned int j = 0; options.OutputDirectionSet && j < 3; j++ )
+      {
+      grid.Direction[i][j] = options.OutputDirection[i][j];
+      }
+    }
+  return grid;
+}
+
+// --crop or --slice, then --pad, select the region of a grid that is
+// written.
+ImageGeometry SelectRegion( const TransformOptions & options, ImageGeometry grid )
+{
+  if( options.Crop )
+    {
+    grid = GetSubGrid( grid, options.CropStart, options.CropSize );
+    }
+  if( options.Slice >= 0 )
+    {
+    const long start[3] = { 0, 0, options.Slice };
+    const std::size_t sliceSize[3] = { grid.Size[0], grid.Size[1], 1 };
+    grid = GetSubGrid( grid, start, sliceSize );
+    }
+  if( options.Pad )
+    {
+    long start[3];
+    std::size_t paddedSize[3];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      start[d] = -static_cast< long >( options.PadLower[d] );
+      paddedSize[d] = grid.Size[d] + options.PadLower[d] + options.PadUpper[d];
+      }
+    grid = GetSubGrid( grid, start, paddedSize );
+    }
+  return grid;
+}
+
+// Direct resampling with the --interpolator kernel in the given
+// arithmetic: --precision, or "double" as the reference for
+// --validate-precision.
+void ResampleWithInterpolator( const ResampleSettings & settings, const std::string & precision,
+                               const PixelType * in, const std::size_t * inSize,
+                               PixelType * out, const std::size_t * outSize,
+                               const IndexMapping & m, unsigned int threads )
+{
+  const TransformOptions & options = settings.Options;
+  const OutputThreshold & threshold = settings.Threshold;
+  const bool single = ( precision == "float" );
+  if( precision == "fixed" )
+    {
+    FixedPointLinearResampler fixedResampler;
+    fixedResampler.SetInput( in, inSize );
+    fixedResampler.SetOutput( out, outSize );
+    fixedResampler.SetIndexMapping( m );
+    fixedResampler.SetDefaultPixelValue( threshold.Apply< PixelType >( 0.0 ) );
+    fixedResampler.SetOutputThreshold( threshold );
+    fixedResampler.SetNumberOfThreads( threads );
+    fixedResampler.Update();
+    }
+  else if( options.Interpolator == "nearest" || options.Interpolator == "majority" )
+    {
+    LabelResampler labelResampler;
+    labelResampler.SetMode( options.Interpolator == "nearest" ? LabelResampler::Nearest : LabelResampler::Majority );
+    labelResampler.SetInput( in, inSize );
+    labelResampler.SetOutput( out, outSize );
+    labelResampler.SetIndexMapping( m );
+    labelResampler.SetDefaultPixelValue( 0 );
+    labelResampler.SetNumberOfThreads( threads );
+    labelResampler.Update();
+    // Labels are copied, not interpolated, so the stored value is the
+    // value to threshold.
+    threshold.ApplyInPlace( out, outSize[0] * outSize[1] * outSize[2] );
+    }
+  else if( options.Interpolator == "linear" )
+    {
+    single ? ResampleWithKernel< LinearKernel, float >( in, inSize, out, outSize, m, threads, threshold )
+           : ResampleWithKernel< LinearKernel, double >( in, inSize, out, outSize, m, threads, threshold );
+    }
+  else if( options.Interpolator == "cubic" )
+    {
+    single ? ResampleWithKernel< CubicKernel, float >( in, inSize, out, outSize, m, threads, threshold )
+           : ResampleWithKernel< CubicKernel, double >( in, inSize, out, outSize, m, threads, threshold );
+    }
+  else if( single )
+    {
+    ResampleWithKernel< SincKernel, float >( in, inSize, out, outSize, m, threads, threshold );
+    }
+  else
+    {
+    WindowedSincResampler< PixelType, Radius > sincResampler;
+    sincResampler.SetInput( in, inSize );
+    sincResampler.SetOutput( out, outSize );
+    sincResampler.SetIndexMapping( m );
+    sincResampler.SetDefaultPixelValue( threshold.Apply< PixelType >( 0.0 ) );
+    sincResampler.SetOutputThreshold( threshold );
+    sincResampler.SetNumberOfThreads( threads );
+    sincResampler.Update();
+    }
+}
+
+// The same kernels through a --bspline deformation.
+void ResampleDeformed( const ResampleSettings & settings, const PixelType * in, const std::size_t * inSize,
+                       PixelType * out, const std::size_t * outSize, const BSplineDeformation & deformation,
+                       unsigned int threads )
+{
+  const TransformOptions & options = settings.Options;
+  const OutputThreshold & threshold = settings.Threshold;
+  const bool single = ( options.Precision == "float" );
+  if( options.Interpolator == "nearest" )
+    {
+    ResampleWithDeformation< NearestKernel, double >( in, inSize, out, outSize, deformation, threads, threshold );
+    }
+  else if( options.Interpolator == "linear" )
+    {
+    single ? ResampleWithDeformation< LinearKernel, float >( in, inSize, out, outSize, deformation, threads, threshold )
+           : ResampleWithDeformation< LinearKernel, double >( in, inSize, out, outSize, deformation, threads, threshold );
+    }
+  else if( options.Interpolator == "cubic" )
+    {
+    single ? ResampleWithDeformation< CubicKernel, float >( in, inSize, out, outSize, deformation, threads, threshold )
+           : ResampleWithDeformation< CubicKernel, double >( in, inSize, out, outSize, deformation, threads, threshold );
+    }
+  else
+    {
+    single ? ResampleWithDeformation< SincKernel, float >( in, inSize, out, outSize, deformation, threads, threshold )
+           : ResampleWithDeformation< SincKernel, double >( in, inSize, out, outSize, deformation, threads, threshold );
+    }
+}
+
+// And through a --displacement-field.
+void ResampleDisplaced( const ResampleSettings & settings, const PixelType * in, const std::size_t * inSize,
+                        PixelType * out, const std::size_t * outSize, const DisplacementField & field,
+                        unsigned int threads )
+{
+  const TransformOptions & options = settings.Options;
+  const OutputThreshold & threshold = settings.Threshold;
+  const bool single = ( options.Precision == "float" );
+  if( options.Interpolator == "nearest" )
+    {
+    ResampleWithDisplacementField< NearestKernel, double >( in, inSize, out, outSize, field, threads, threshold );
+    }
+  else if( options.Interpolator == "linear" )
+    {
+    single ? ResampleWithDisplacementField< LinearKernel, float >( in, inSize, out, outSize, field, threads, threshold )
+           : ResampleWithDisplacementField< LinearKernel, double >( in, inSize, out, outSize, field, threads, threshold );
+    }
+  else if( options.Interpolator == "cubic" )
+    {
+    single ? ResampleWithDisplacementField< CubicKernel, float >( in, inSize, out, outSize, field, threads, threshold )
+           : ResampleWithDisplacementField< CubicKernel, double >( in, inSize, out, outSize, field, threads, threshold );
+    }
+  else
+    {
+    single ? ResampleWithDisplacementField< SincKernel, float >( in, inSize, out, outSize, field, threads, threshold )
+           : ResampleWithDisplacementField< SincKernel, double >( in, inSize, out, outSize, field, threads, threshold );
+    }
+}
+
+// One volume on the calling thread, for the modes that run many volumes
+// in parallel (--augment, --series, --cohort): a copy where the mapping
+// allows it, shear passes if requested, else the direct kernel on the
+// pyramid level that matches the mapping. `pyramid` holds the input
+// volume, whose voxels are `inSpacing` apart.
+void ResampleVolume( const ResampleSettings & settings, GaussianPyramid< PixelType > & pyramid,
+                     const double * inSpacing, PixelType * out, const std::size_t * outSize, const IndexMapping & m )
+{
+  const TransformOptions & options = settings.Options;
+  const OutputThreshold & threshold = settings.Threshold;
+  std::size_t inSize[3];
+  const PixelType * in = pyramid.GetLevel( 0, inSize );
+  IntegerMappingResampler< PixelType > copyResampler;
+  ShearRotationResampler< PixelType, Radius > shearResampler;
+  copyResampler.SetNumberOfThreads( 1 );
+  shearResampler.SetNumberOfThreads( 1 );
+  if( copyResampler.SetIndexMapping( m ) )
+    {
+    copyResampler.SetInput( in, inSize );
+    copyResampler.SetOutput( out, outSize );
+    copyResampler.SetDefaultPixelValue( 0 );
+    copyResampler.Update();
+    threshold.ApplyInPlace( out, outSize[0] * outSize[1] * outSize[2] );
+    }
+  else if( options.RotationEngine == "shear" && options.Interpolator == "sinc"
+           && shearResampler.SetIndexMapping( m, inSpacing ) )
+    {
+    shearResampler.SetInput( in, inSize );
+    shearResampler.SetOutput( out, outSize );
+    shearResampler.SetOutputThreshold( threshold );
+    shearResampler.Update();
+    }
+  else
+    {
+    const unsigned int level = options.UsePyramid ? GaussianPyramid< PixelType >::SelectLevel( m, inSize ) : 0;
+    std::size_t levelSize[3];
+    const PixelType * levelBuffer = pyramid.GetLevel( level, levelSize );
+    ResampleWithInterpolator( settings, options.Precision, levelBuffer, levelSize, out, outSize,
+                              GaussianPyramid< PixelType >::GetLevelMapping( m, level ), 1 );
+    if( level > 0 )
+      {
+      GaussianPyramid< PixelType >::ClipToInput( m, inSize, out, outSize, threshold.Apply< PixelType >( 0.0 ) );
+      }
+    }
+}
+
+// --register: the fixed image side (RegistrationTemplate,
+// PhaseCorrelation), prepared once and shared by the input or by every
+// --cohort subject.
+struct RegistrationFixed
+{
+  ImageGeometry Geometry;
+  std::vector< float > Pixels;
+  RegistrationTemplate< float > Template;
+  PhaseCorrelation< float > Phase;
+  bool PhaseCorrelate;
+  bool MutualInformation;
+  // Without a starting transform the centers of the two images are
+  // aligned first.
+  bool CenterSubjects;
+  AffineMapping ArgumentTransform;
+};
+
+// Reads the fixed image of --register and prepares the template levels
+// and samples (and the phase correlation of --phase-correlate) for it.
+bool PrepareRegistration( const TransformOptions & options, const AffineMapping & argumentTransform,
+                          RegistrationFixed & fixed )
+{
+  fixed.PhaseCorrelate = options.PhaseCorrelate || options.RegisterType == "phase";
+  fixed.MutualInformation = options.Metric == "mi";
+  fixed.ArgumentTransform = argumentTransform;
+  fixed.CenterSubjects = true;
+  for( unsigned int i = 0; i < 3; i++ )
+    {
+    for( unsigned int j = 0; j < 3; j++ )
+      {
+      fixed.CenterSubjects = fixed.CenterSubjects && argumentTransform.Matrix[i][j] == ( i == j ? 1.0 : 0.0 );
+      }
+    fixed.CenterSubjects = fixed.CenterSubjects && argumentTransform.Offset[i] == 0.0;
+    }
+  ReaderType::Pointer fixedReader = ReaderType::New();
+  fixedReader->SetFileName( options.RegisterFile );
+  try
+    {
+    fixedReader->Update();
+    }
+  catch( itk::ExceptionObject & error )
+    {
+    std::cerr << "Error: " << error << std::endl;
+    return false;
+    }
+  fixed.Geometry = GetImageGeometry( fixedReader->GetOutput() );
+  // Float copies, so that the coarse levels keep sub-gray-level detail.
+  fixed.Pixels.assign( fixedReader->GetOutput()->GetBufferPointer(),
+                      fixedReader->GetOutput()->GetBufferPointer() + fixed.Geometry.GetNumberOfPixels() );
+  fixed.Template.SetImage( &fixed.Pixels[0], fixed.Geometry );
+  fixed.Template.SetNumberOfThreads( itk::MultiThreader::GetGlobalDefaultNumberOfThreads() );
+  fixed.Template.SetMetric( fixed.MutualInformation ? RegistrationTemplate< float >::MattesMutualInformation
+                                                    : RegistrationTemplate< float >::MeanSquares );
+  fixed.Template.SetNumberOfHistogramBins( static_cast< unsigned int >( options.HistogramBins ) );
+  fixed.Template.SetSampleSelection( options.Sampling == "random" ? RandomSamples : StratifiedSamples );
+  const double sampling =
+    options.MetricSampling > 0.0 ? options.MetricSampling : ( fixed.MutualInformation ? 2.0 : 100.0 );
+  fixed.Template.SetSamplingPercentage( sampling );
+  const std::chrono::steady_clock::time_point templateStart = std::chrono::steady_clock::now();
+  if( options.RegisterType != "phase" )
+    {
+    fixed.Template.Update();
+    }
+  if( fixed.PhaseCorrelate )
+    {
+    fixed.Phase.SetFixedImage( &fixed.Pixels[0], fixed.Geometry );
+    fixed.Phase.SetRotationAxis( options.PhaseCorrelateAxis );
+    fixed.Phase.SetNumberOfThreads( itk::MultiThreader::GetGlobalDefaultNumberOfThreads() );
+    fixed.Phase.Update();
+    }
+  if( !options.CohortFile.empty() )
+    {
+    std::cerr << "Template prepared in "
+              << std::chrono::duration< double >( std::chrono::steady_clock::now() - templateStart ).count() << " s"
+              << std::endl;
+    }
+  return true;
+}
+
+// Registers the loaded input to the fixed image and reports the estimate
+// (with --metric-benchmark, the metric at it for a range of sampling
+// percentages); `result` is the transform that replaces the one of the
+// arguments.
+bool RegisterInput( const TransformOptions & options, RegistrationFixed & fixed, const ImageType * input,
+                    AffineMapping & result )
+{
+  const ImageGeometry movingGeometry = GetImageGeometry( input );
+  const std::vector< float > movingPixels( input->GetBufferPointer(),
+                                           input->GetBufferPointer() + movingGeometry.GetNumberOfPixels() );
+  AffineMapping initial =
+    fixed.CenterSubjects ? GetCenteringTransform( fixed.Geometry, movingGeometry ) : fixed.ArgumentTransform;
+  if( fixed.PhaseCorrelate )
+    {
+    const std::chrono::steady_clock::time_point phaseStart = std::chrono::steady_clock::now();
+    const PhaseCorrelationResult phase = fixed.Phase.Estimate(
+      &movingPixels[0], movingGeometry, itk::MultiThreader::GetGlobalDefaultNumberOfThreads() );
+    initial = phase.Transform;
+    std::cerr << "Phase correlation in "
+              << std::chrono::duration< double >( std::chrono::steady_clock::now() - phaseStart ).count()
+              << " s: translation " << phase.Translation[0] << " " << phase.Translation[1] << " "
+              << phase.Translation[2] << " mm";
+    if( options.PhaseCorrelateAxis >= 0 )
+      {
+      std::cerr << ", rotation " << phase.Angle * 180.0 / std::acos( -1.0 ) << " degrees about "
+                << "xyz"[options.PhaseCorrelateAxis];
+      }
+    std::cerr << ", peak " << phase.Peak << std::endl;
+    }
+
+  ImageRegistration< float > registration;
+  registration.SetTemplate( &fixed.Template );
+  registration.SetMovingImage( &movingPixels[0], movingGeometry );
+  registration.SetInitialTransform( initial );
+  registration.SetTransformKind( options.RegisterType == "affine" ? ImageRegistration< float >::Affine
+                                                                  : ImageRegistration< float >::Rigid );
+  registration.SetNumberOfThreads( itk::MultiThreader::GetGlobalDefaultNumberOfThreads() );
+  AffineMapping estimate = initial;
+  if( options.RegisterType != "phase" )
+    {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    registration.Update();
+    const double seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+    estimate = registration.GetTransform();
+    std::cerr << "Registered (" << options.RegisterType << ") in " << seconds << " s, "
+              << registration.GetNumberOfIterations() << " iterations, "
+              << ( fixed.MutualInformation ? "mutual information " : "mean squared difference " )
+              << ( fixed.MutualInformation ? -registration.GetMetricValue() : registration.GetMetricValue() )
+              << std::endl;
+    }
+  result = estimate;
+  for( unsigned int i = 0; i < 3; i++ )
+    {
+    std::cerr << "  " << estimate.Matrix[i][0] << " " << estimate.Matrix[i][1] << " " << estimate.Matrix[i][2]
+              << "  " << estimate.Offset[i] << std::endl;
+    }
+  if( !options.TransformOutFile.empty() && !WriteAffineTransformFile( options.TransformOutFile, estimate ) )
+    {
+    std::cerr << "Cannot write " << options.TransformOutFile << std::endl;
+    return false;
+    }
+
+  // --metric-benchmark: the metric at the estimate, at full resolution,
+  // for a range of sampling percentages. The error of the value and the
+  // angle between the gradient and the one of all voxels show what the
+  // samples cost in accuracy; the time of one evaluation what they save.
+  if( options.MetricBenchmark )
+    {
+    const double percentages[] = { 100.0, 50.0, 25.0, 10.0, 5.0, 2.0, 1.0, 0.5 };
+    registration.SetInitialTransform( estimate );
+    double exactValue = 0.0;
+    std::vector< double > exactGradient;
+    std::cerr << "sampling %   ms/evaluation   metric   value error   gradient angle (deg)" << std::endl;
+    for( unsigned int n = 0; n < sizeof( percentages ) / sizeof( percentages[0] ); n++ )
+      {
+      fixed.Template.SetSamplingPercentage( percentages[n] );
+      fixed.Template.Update();
+      registration.PrepareMetric();
+      double value = 0.0;
+      std::vector< double > gradient;
+      double best = std::numeric_limits< double >::max();
+      for( unsigned int repeat = 0; repeat < 3; repeat++ )
+        {
+        const std::chrono::steady_clock::time_point evaluationStart = std::chrono::steady_clock::now();
+        registration.EvaluateMetric( value, gradient );
+        best = std::min( best, std::chrono::duration< double, std::milli >(
+                                 std::chrono::steady_clock::now() - evaluationStart ).count() );
+        }
+      if( n == 0 )
+        {
+        exactValue = value;
+        exactGradient = gradient;
+        }
+      double dot = 0.0;
+      double norm = 0.0;
+      double exactNorm = 0.0;
+      for( std::size_t p = 0; p < gradient.size(); p++ )
+        {
+        dot += gradient[p] * exactGradient[p];
+        norm += gradient[p] * gradient[p];
+        exactNorm += exactGradient[p] * exactGradient[p];
+        }
+      const double cosine = ( norm > 0.0 && exactNorm > 0.0 ) ? dot / std::sqrt( norm * exactNorm ) : 1.0;
+      std::cerr << percentages[n] << "   " << best << "   " << ( fixed.MutualInformation ? -value : value ) << "   "
+                << std::fabs( value - exactValue ) << "   "
+                << std::acos( std::max( -1.0, std::min( 1.0, cosine ) ) ) * 180.0 / std::acos( -1.0 ) << std::endl;
+      }
+    }
+  return true;
+}
+
+// Cohort: the input of the arguments and every subject of the list are
+// registered to the template of PrepareRegistration() and resampled onto
+// its grid (or the --output-* grid, with --crop/--pad), one subject per
+// thread. All subjects read the same template levels, samples and gray
+// level ranges; per subject only its own pyramid is built.
+int RunCohort( const ResampleSettings & settings, const char * inputFileName, const char * outputFileName,
+               RegistrationFixed & fixed, const ImageGeometry & cohortGeometry )
+{
+  const TransformOptions & options = settings.Options;
+  const unsigned int numberOfThreads = settings.NumberOfThreads;
+
+  std::vector< CohortSubject > subjects( 1 );
+  subjects[0].Input = inputFileName;
+  subjects[0].Output = outputFileName;
+  subjects[0].TransformOut = options.TransformOutFile;
+  if( !ReadCohortFile( options.CohortFile, subjects ) )
+    {
+    std::cerr << "Could not read subjects from " << options.CohortFile << std::endl;
+    return EXIT_FAILURE;
+    }
+  const ImageRegistration< float >::TransformKind kind =
+    options.RegisterType == "affine" ? ImageRegistration< float >::Affine : ImageRegistration< float >::Rigid;
+
+  std::mutex outputMutex;
+  std::atomic< std::size_t > failures( 0 );
+  auto registerSubjects = [&]( std::size_t first, std::size_t last, unsigned int )
+    {
+    for( std::size_t n = first; n < last; n++ )
+      {
+      const CohortSubject & subject = subjects[n];
+      const std::chrono::steady_clock::time_point subjectStart = std::chrono::steady_clock::now();
+      ReaderType::Pointer subjectReader = ReaderType::New();
+      subjectReader->SetFileName( subject.Input );
+      try
+        {
+        subjectReader->Update();
+        }
+      catch( itk::ExceptionObject & error )
+        {
+        ++failures;
+        std::lock_guard< std::mutex > lock( outputMutex );
+        std::cerr << "Error: " << error << std::endl;
+        continue;
+        }
+      ImageType::Pointer subjectImage = subjectReader->GetOutput();
+      const ImageGeometry subjectGeometry = GetImageGeometry( subjectImage.GetPointer() );
+      const std::vector< float > subjectPixels( subjectImage->GetBufferPointer(),
+                                                subjectImage->GetBufferPointer()
+                                                  + subjectGeometry.GetNumberOfPixels() );
+
+      AffineMapping initial =
+        fixed.CenterSubjects ? GetCenteringTransform( fixed.Geometry, subjectGeometry ) : fixed.ArgumentTransform;
+      if( fixed.PhaseCorrelate )
+        {
+        initial = fixed.Phase.Estimate( &subjectPixels[0], subjectGeometry, 1 ).Transform;
+        }
+      ImageRegistration< float > registration;
+      registration.SetTemplate( &fixed.Template );
+      registration.SetMovingImage( &subjectPixels[0], subjectGeometry );
+      registration.SetInitialTransform( initial );
+      registration.SetTransformKind( kind );
+      registration.SetNumberOfThreads( 1 );
+      AffineMapping estimate = initial;
+      if( options.RegisterType != "phase" )
+        {
+        registration.Update();
+        estimate = registration.GetTransform();
+        }
+
+      GaussianPyramid< PixelType > subjectPyramid;
+      subjectPyramid.SetNumberOfThreads( 1 );
+      subjectPyramid.SetInput( subjectImage->GetBufferPointer(), subjectGeometry.Size );
+      ImageType::Pointer output = ImageType::New();
+      SetImageGeometry( output.GetPointer(), cohortGeometry );
+      output->Allocate();
+      ResampleVolume( settings, subjectPyramid, subjectGeometry.Spacing, output->GetBufferPointer(),
+                      cohortGeometry.Size, ComputeIndexMapping( cohortGeometry, estimate, subjectGeometry ) );
+
+      WriterType::Pointer subjectWriter = WriterType::New();
+      subjectWriter->SetFileName( subject.Output );
+      subjectWriter->SetInput( output );
+      ResultCache::DetachFile( subject.Output );
+      try
+        {
+        subjectWriter->Update();
+        }
+      catch( itk::ExceptionObject & error )
+        {
+        ++failures;
+        std::lock_guard< std::mutex > lock( outputMutex );
+        std::cerr << "Error: " << error << std::endl;
+        continue;
+        }
+      if( !subject.TransformOut.empty() && !WriteAffineTransformFile( subject.TransformOut, estimate ) )
+        {
+        ++failures;
+        std::lock_guard< std::mutex > lock( outputMutex );
+        std::cerr << "Cannot write " << subject.TransformOut << std::endl;
+        continue;
+        }
+      const double subjectSeconds =
+        std::chrono::duration< double >( std::chrono::steady_clock::now() - subjectStart ).count();
+      // One line per subject: output, seconds, iterations, final metric.
+      std::lock_guard< std::mutex > lock( outputMutex );
+      std::cout << subject.Output << " " << subjectSeconds << " " << registration.GetNumberOfIterations() << " "
+                << ( fixed.MutualInformation ? -registration.GetMetricValue() : registration.GetMetricValue() )
+                << std::endl;
+      }
+    };
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  ParallelFor( 0, subjects.size(), 1, numberOfThreads, registerSubjects );
+  const double seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+  std::cerr << subjects.size() << " subjects in " << seconds << " s ("
+            << ( seconds > 0.0 ? subjects.size() / seconds : 0.0 ) << " subjects/s)" << std::endl;
+  return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Atlases: every label map of the list is read (only the box of it
+// that the output grid maps into) and fused onto the output grid by
+// LabelFusion, with no resampled volume per atlas. The input only
+// supplies the grid; its voxels are never read.
+int RunAtlases( const TransformOptions & options, const char * outputFileName, const double rotationCenter[3],
+                const AffineMapping & affine, const ImageGeometry & outputGeometry, unsigned int numberOfThreads )
+{
+  std::vector< AtlasEntry > atlases;
+  if( !ReadAtlasFile( options.AtlasFile, atlases ) || atlases.empty() )
+    {
+    std::cerr << "Could not read atlases from " << options.AtlasFile << std::endl;
+    return EXIT_FAILURE;
+    }
+  std::vector< ImageType::ConstPointer > atlasImages;
+  LabelFusion fusion;
+  fusion.SetMode( options.Interpolator == "majority" ? LabelResampler::Majority : LabelResampler::Nearest );
+  const std::chrono::steady_clock::time_point readStart = std::chrono::steady_clock::now();
+  for( std::size_t n = 0; n < atlases.size(); n++ )
+    {
+    AffineMapping atlasTransform;
+    SetIdentity( atlasTransform.Matrix );
+    atlasTransform.Offset[0] = atlasTransform.Offset[1] = atlasTransform.Offset[2] = 0.0;
+    if( atlases[n].Transform != "-" )
+      {
+      std::vector< AffineMapping > transforms;
+      if( !ReadAffineTransformFile( atlases[n].Transform, rotationCenter, transforms ) || transforms.size() != 1 )
+        {
+        std::cerr << "Could not read one transform from " << atlases[n].Transform << std::endl;
+        return EXIT_FAILURE;
+        }
+      atlasTransform = transforms[0];
+      }
+    ReaderType::Pointer atlasReader = ReaderType::New();
+    atlasReader->SetFileName( atlases[n].Labels );
+    try
+      {
+      atlasReader->UpdateOutputInformation();
+      const ImageGeometry atlasGeometry = GetImageGeometry( atlasReader->GetOutput() );
+      const AffineMapping toAtlas = ComposeAffineMappings( affine, atlasTransform );
+      long boxStart[3] = { 0, 0, 0 };
+      std::size_t boxSize[3] = { 1, 1, 1 };
+      ComputeInputRegion( ComputeIndexMapping( outputGeometry, toAtlas, atlasGeometry ), outputGeometry.Size,
+                          atlasGeometry.Size, 1, boxStart, boxSize );
+      ImageType::RegionType box = atlasReader->GetOutput()->GetLargestPossibleRegion();
+      for( unsigned int d = 0; d < Dimension; d++ )
+        {
+        box.SetIndex( d, box.GetIndex( d ) + boxStart[d] );
+        box.SetSize( d, boxSize[d] );
+        }
+      atlasReader->GetOutput()->SetRequestedRegion( box );
+      atlasReader->Update();
+      ImageType::ConstPointer atlas = atlasReader->GetOutput();
+      if( atlas->GetBufferedRegion() != box )
+        {
+        ImageType::Pointer boxImage = ImageType::New();
+        boxImage->CopyInformation( atlas );
+        boxImage->SetRegions( box );
+        boxImage->Allocate();
+        itk::ImageAlgorithm::Copy( atlas.GetPointer(), boxImage.GetPointer(), box, box );
+        atlas = boxImage.GetPointer();
+        }
+      atlasImages.push_back( atlas );
+      const ImageGeometry boxGeometry = GetSubGrid( atlasGeometry, boxStart, boxSize );
+      fusion.AddAtlas( atlas->GetBufferPointer(), boxGeometry.Size,
+                       ComputeIndexMapping( outputGeometry, toAtlas, boxGeometry ), atlases[n].Weight );
+      }
+    catch( itk::ExceptionObject & error )
+      {
+      std::cerr << "Error: " << error << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+  const double readSeconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - readStart ).count();
+
+  ImageType::Pointer fused = ImageType::New();
+  SetImageGeometry( fused.GetPointer(), outputGeometry );
+  fused->Allocate();
+  fusion.SetOutput( fused->GetBufferPointer(), outputGeometry.Size );
+  fusion.SetNumberOfThreads( numberOfThreads );
+  const std::chrono::steady_clock::time_point fuseStart = std::chrono::steady_clock::now();
+  fusion.Update();
+  std::cerr << atlases.size() << " atlases read in " << readSeconds << " s, fused in "
+            << std::chrono::duration< double >( std::chrono::steady_clock::now() - fuseStart ).count() << " s"
+            << std::endl;
+
+  WriterType::Pointer fusedWriter = WriterType::New();
+  fusedWriter->SetFileName( outputFileName );
+  fusedWriter->SetInput( fused );
+  ResultCache::DetachFile( outputFileName );
+  try
+    {
+    fusedWriter->Update();
+    }
+  catch( itk::ExceptionObject & error )
+    {
+    std::cerr << "Error: " << error << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+// Augmentation: many random transforms of the one loaded input, one
+// volume per thread, each written as soon as it is done. All outputs
+// are on the input grid (or the --reference/--output-* grid), with
+// --crop/--pad applied.
+int RunAugment( const ResampleSettings & settings, const TransformParameters & base, ReaderType * reader,
+                const ImageType * input, const ImageGeometry & inputGeometry, const ImageGeometry & augmentGeometry,
+                const double rotationCenter[3], const char * outputFileName )
+{
+  const TransformOptions & options = settings.Options;
+  const unsigned int numberOfThreads = settings.NumberOfThreads;
+
+  std::vector< TransformParameters > samples;
+  if( !options.AugmentFile.empty() )
+    {
+    if( !ReadTransformParameterFile( options.AugmentFile, samples ) )
+      {
+      std::cerr << "Could not read transform parameters from " << options.AugmentFile << std::endl;
+      return EXIT_FAILURE;
+      }
+    if( options.AugmentCount > 0 && options.AugmentCount < samples.size() )
+      {
+      samples.resize( options.AugmentCount );
+      }
+    }
+  else
+    {
+    samples = SampleTransformParameters( base, options.Ranges, options.AugmentCount, options.Seed );
+    }
+
+  if( !ReadWholeInput( reader ) )
+    {
+    return EXIT_FAILURE;
+    }
+
+  // Pyramid levels of the input for the samples that minify, built once
+  // up front and shared by all of them.
+  GaussianPyramid< PixelType > pyramid;
+  pyramid.SetInput( input->GetBufferPointer(), inputGeometry.Size );
+  pyramid.SetNumberOfThreads( numberOfThreads );
+  if( options.UsePyramid )
+    {
+    unsigned int coarsest = 0;
+    for( std::size_t n = 0; n < samples.size(); n++ )
+      {
+      const IndexMapping sampleMapping =
+        ComputeIndexMapping( augmentGeometry, ComposeTransform( samples[n], rotationCenter ), inputGeometry );
+      coarsest = std::max( coarsest, GaussianPyramid< PixelType >::SelectLevel( sampleMapping, inputGeometry.Size ) );
+      }
+    std::size_t levelSize[3];
+    pyramid.GetLevel( coarsest, levelSize );
+    }
+  std::mutex outputMutex;
+  std::atomic< std::size_t > failures( 0 );
+  auto augment = [&]( std::size_t first, std::size_t last, unsigned int )
+    {
+    for( std::size_t n = first; n < last; n++ )
+      {
+      const TransformParameters & sample = samples[n];
+      const IndexMapping sampleMapping =
+        ComputeIndexMapping( augmentGeometry, ComposeTransform( sample, rotationCenter ), inputGeometry );
+
+      ImageType::Pointer output = ImageType::New();
+      SetImageGeometry( output.GetPointer(), augmentGeometry );
+      output->Allocate();
+      ResampleVolume( settings, pyramid, inputGeometry.Spacing, output->GetBufferPointer(), augmentGeometry.Size,
+                      sampleMapping );
+
+      const std::string fileName = GetIndexedFileName( outputFileName, n );
+      WriterType::Pointer sampleWriter = WriterType::New();
+      sampleWriter->SetFileName( fileName );
+      sampleWriter->SetInput( output );
+      ResultCache::DetachFile( fileName );
+      try
+        {
+        sampleWriter->Update();
+        }
+      catch( itk::ExceptionObject & error )
+        {
+        ++failures;
+        std::lock_guard< std::mutex > lock( outputMutex );
+        std::cerr << "Error: " << error << std::endl;
+        continue;
+        }
+      // One line per volume with the parameters that produced it.
+      std::lock_guard< std::mutex > lock( outputMutex );
+      std::cout << fileName
+                << " " << sample.Rotation[0] << " " << sample.Rotation[1] << " " << sample.Rotation[2]
+                << " " << sample.Scale
+                << " " << sample.Translation[0] << " " << sample.Translation[1] << " " << sample.Translation[2]
+                << std::endl;
+      }
+    };
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  ParallelFor( 0, samples.size(), 1, numberOfThreads, augment );
+  const double seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+  std::cerr << samples.size() << " volumes in " << seconds << " s ("
+            << ( seconds > 0.0 ? samples.size() / seconds : 0.0 ) << " volumes/s)" << std::endl;
+  return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Reslicing: oblique planes of the transformed input, each resampled
+// straight from the input (no rotated volume is made), one plane per
+// thread. The input and its pyramid levels are shared by all planes.
+int RunReslice( const ResampleSettings & settings, ReaderType * reader, const ImageType * input,
+                const ImageGeometry & inputGeometry, const AffineMapping & affine, const char * outputFileName )
+{
+  const TransformOptions & options = settings.Options;
+  const unsigned int numberOfThreads = settings.NumberOfThreads;
+
+  std::vector< ObliquePlane > planes = options.ReslicePlanes;
+  if( !options.ResliceFile.empty() && !ReadPlaneFile( options.ResliceFile, planes ) )
+    {
+    std::cerr << "Could not read planes from " << options.ResliceFile << std::endl;
+    return EXIT_FAILURE;
+    }
+  std::size_t planeSize[2] = { options.ResliceSize[0], options.ResliceSize[1] };
+  double planeSpacing = options.ResliceSpacing;
+  if( planeSize[0] == 0 )
+    {
+    planeSize[0] = planeSize[1] = *std::max_element( inputGeometry.Size, inputGeometry.Size + 3 );
+    }
+  if( planeSpacing == 0.0 )
+    {
+    planeSpacing = *std::min_element( inputGeometry.Spacing, inputGeometry.Spacing + 3 );
+    }
+  std::vector< ImageGeometry > planeGeometries( planes.size() );
+  std::vector< IndexMapping > planeMappings( planes.size() );
+  for( std::size_t n = 0; n < planes.size(); n++ )
+    {
+    if( !GetPlaneGeometry( planes[n], planeSize, planeSpacing, planeGeometries[n] ) )
+      {
+      std::cerr << "Plane " << n << " has a zero normal or an up vector along its normal" << std::endl;
+      return EXIT_FAILURE;
+      }
+    // The thickness of the single slice does not change any voxel; the
+    // input spacing along the normal lets the copy engine take planes
+    // that lie on input slices.
+    double thickness = 0.0;
+    for( unsigned int d = 0; d < Dimension; d++ )
+      {
+      thickness += std::fabs( planeGeometries[n].Direction[d][2] ) * inputGeometry.Spacing[d];
+      }
+    planeGeometries[n].Spacing[2] = thickness;
+    planeGeometries[n] = SelectRegion( options, planeGeometries[n] );
+    planeMappings[n] = ComputeIndexMapping( planeGeometries[n], affine, inputGeometry );
+    }
+
+  if( !ReadWholeInput( reader ) )
+    {
+    return EXIT_FAILURE;
+    }
+  GaussianPyramid< PixelType > pyramid;
+  pyramid.SetInput( input->GetBufferPointer(), inputGeometry.Size );
+  pyramid.SetNumberOfThreads( numberOfThreads );
+  if( options.UsePyramid )
+    {
+    unsigned int coarsest = 0;
+    for( std::size_t n = 0; n < planes.size(); n++ )
+      {
+      coarsest = std::max( coarsest, GaussianPyramid< PixelType >::SelectLevel( planeMappings[n], inputGeometry.Size ) );
+      }
+    std::size_t levelSize[3];
+    pyramid.GetLevel( coarsest, levelSize );
+    }
+
+  std::mutex outputMutex;
+  std::atomic< std::size_t > failures( 0 );
+  double resliceSeconds = 0.0;
+  auto reslice = [&]( std::size_t first, std::size_t last, unsigned int )
+    {
+    for( std::size_t n = first; n < last; n++ )
+      {
+      ImageType::Pointer output = ImageType::New();
+      SetImageGeometry( output.GetPointer(), planeGeometries[n] );
+      output->Allocate();
+      const std::chrono::steady_clock::time_point planeStart = std::chrono::steady_clock::now();
+      ResampleVolume( settings, pyramid, inputGeometry.Spacing, output->GetBufferPointer(),
+                      planeGeometries[n].Size, planeMappings[n] );
+      const double planeSeconds =
+        std::chrono::duration< double >( std::chrono::steady_clock::now() - planeStart ).count();
+
+      const std::string fileName = planes.size() == 1 ? std::string( outputFileName )
+                                                      : GetIndexedFileName( outputFileName, n );
+      WriterType::Pointer planeWriter = WriterType::New();
+      planeWriter->SetFileName( fileName );
+      planeWriter->SetInput( output );
+      ResultCache::DetachFile( fileName );
+      try
+        {
+        planeWriter->Update();
+        }
+      catch( itk::ExceptionObject & error )
+        {
+        ++failures;
+        std::lock_guard< std::mutex > lock( outputMutex );
+        std::cerr << "Error: " << error << std::endl;
+        continue;
+        }
+      std::lock_guard< std::mutex > lock( outputMutex );
+      resliceSeconds += planeSeconds;
+      }
+    };
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  ParallelFor( 0, planes.size(), 1, numberOfThreads, reslice );
+  const double seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+  std::cerr << planes.size() << " planes in " << seconds << " s, "
+            << ( planes.empty() ? 0.0 : 1000.0 * resliceSeconds / planes.size() )
+            << " ms of resampling per plane" << std::endl;
+  return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// 4D series: volume t is resampled with the transform of the arguments
+// followed by line t of the --series file (e.g. its motion correction),
+// one volume per thread; threads that finish early take the next
+// volume. The volumes are written together as one 4D image.
+int RunSeries( const ResampleSettings & settings, const SeriesImageType * series, const ImageGeometry & inputGeometry,
+               const ImageGeometry & volumeGeometry, const AffineMapping & affine, const double rotationCenter[3],
+               const char * outputFileName )
+{
+  const TransformOptions & options = settings.Options;
+  const unsigned int numberOfThreads = settings.NumberOfThreads;
+
+  std::vector< AffineMapping > transforms;
+  if( !ReadAffineTransformFile( options.SeriesFile, rotationCenter, transforms ) )
+    {
+    std::cerr << "Could not read transforms from " << options.SeriesFile << std::endl;
+    return EXIT_FAILURE;
+    }
+  const std::size_t numberOfVolumes = series->GetLargestPossibleRegion().GetSize()[Dimension];
+  if( transforms.size() != numberOfVolumes )
+    {
+    std::cerr << options.SeriesFile << " has " << transforms.size() << " transforms for "
+              << numberOfVolumes << " volumes" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  SeriesImageType::Pointer seriesOutput = SeriesImageType::New();
+  SetSeriesGeometry( seriesOutput.GetPointer(), volumeGeometry, series );
+  seriesOutput->Allocate();
+  const PixelType * seriesBuffer = series->GetBufferPointer();
+  PixelType * seriesOutputBuffer = seriesOutput->GetBufferPointer();
+  auto transformVolumes = [&]( std::size_t first, std::size_t last, unsigned int )
+    {
+    for( std::size_t t = first; t < last; t++ )
+      {
+      GaussianPyramid< PixelType > volumePyramid;
+      volumePyramid.SetNumberOfThreads( 1 );
+      volumePyramid.SetInput( seriesBuffer + t * inputGeometry.GetNumberOfPixels(), inputGeometry.Size );
+      const IndexMapping volumeMapping =
+        ComputeIndexMapping( volumeGeometry, ComposeAffineMappings( affine, transforms[t] ), inputGeometry );
+      ResampleVolume( settings, volumePyramid, inputGeometry.Spacing,
+                      seriesOutputBuffer + t * volumeGeometry.GetNumberOfPixels(), volumeGeometry.Size,
+                      volumeMapping );
+      }
+    };
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  ParallelFor( 0, numberOfVolumes, 1, numberOfThreads, transformVolumes );
+  const double seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+  std::cerr << numberOfVolumes << " volumes in " << seconds << " s ("
+            << ( seconds > 0.0 ? numberOfVolumes / seconds : 0.0 ) << " volumes/s)" << std::endl;
+
+  using SeriesWriterType = itk::ImageFileWriter< SeriesImageType >;
+  SeriesWriterType::Pointer seriesWriter = SeriesWriterType::New();
+  seriesWriter->SetFileName( outputFileName );
+  seriesWriter->SetInput( seriesOutput );
+  ResultCache::DetachFile( outputFileName );
+  try
+    {
+    seriesWriter->Update();
+    }
+  catch( itk::ExceptionObject & error )
+    {
+    std::cerr << "Error: " << error << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+// The input (and every --apply-to volume) resampled onto `outputGeometry`
+// under `affine` by the engine that fits the transform and the options.
+// `resample` is the ITK filter of --itk-resample, already holding the
+// transform.
+int RunSingleVolume( const ResampleSettings & settings, const char * inputFileName, const char * outputFileName,
+                     ReaderType * reader, ImageType::ConstPointer input, const ImageGeometry & inputGeometry,
+                     const ImageGeometry & outputGeometry, const AffineMapping & affine, bool headerOnly,
+                     ResampleImageFilterType * resample )
+{
+  const TransformOptions & options = settings.Options;
+  const OutputThreshold & threshold = settings.Threshold;
+  const unsigned int numberOfThreads = settings.NumberOfThreads;
+
+  // write file to output destination
+  WriterType::Pointer writer = WriterType::New();
+
+  // Only the input voxels under the output grid are read: for --slice or a
+  // small --crop that is a slab or box of the file, streamed by ImageIOs
+  // that support it (NIfTI, MetaImage; others read the whole file and the
+  // box is copied out). The box covers the kernel support at the pyramid
+  // level the transform will use; the kernels then run on it as if it were
+  // the input. The ITK engine requests the whole input itself, the
+  // Fourier shift needs it, and a --bspline or --displacement-field
+  // deformation moves samples out of the box.
+  ImageType::RegionType inputRegion = input->GetLargestPossibleRegion();
+  if( !options.UseItkResample && !options.FourierTranslation && options.BSplineFile.empty()
+      && options.DisplacementFieldFile.empty() )
+    {
+    const IndexMapping inputMapping = ComputeIndexMapping( outputGeometry, affine, inputGeometry );
+    const unsigned int level =
+      options.UsePyramid ? GaussianPyramid< PixelType >::SelectLevel( inputMapping, inputGeometry.Size ) : 0;
+    long regionStart[3];
+    std::size_t regionSize[3];
+    if( !ComputeInputRegion( inputMapping, outputGeometry.Size, inputGeometry.Size,
+                             static_cast< std::size_t >( Radius + 3 ) << level, regionStart, regionSize ) )
+      {
+      // The output lies wholly outside the input; one voxel will do.
+      for( unsigned int d = 0; d < Dimension; d++ )
+        {
+        inputRegion.SetSize( d, 1 );
+        }
+      }
+    else
+      {
+      // The box starts on a multiple of 2^level, so its pyramid levels
+      // sample the same positions as those of the whole input.
+      for( unsigned int d = 0; d < Dimension; d++ )
+        {
+        const long aligned = regionStart[d] & ~( ( 1L << level ) - 1 );
+        inputRegion.SetIndex( d, inputRegion.GetIndex( d ) + aligned );
+        inputRegion.SetSize( d, regionSize[d] + static_cast< std::size_t >( regionStart[d] - aligned ) );
+        }
+      }
+    }
+  auto readRegion = [&inputRegion]( ReaderType * volumeReader ) -> ImageType::ConstPointer
+    {
+    volumeReader->GetOutput()->SetRequestedRegion( inputRegion );
+    volumeReader->Update();
+    ImageType::ConstPointer volume = volumeReader->GetOutput();
+    if( volume->GetBufferedRegion() == inputRegion )
+      {
+      return volume;
+      }
+    ImageType::Pointer box = ImageType::New();
+    box->CopyInformation( volume );
+    box->SetRegions( inputRegion );
+    box->Allocate();
+    itk::ImageAlgorithm::Copy( volume.GetPointer(), box.GetPointer(), inputRegion, inputRegion );
+    return box.GetPointer();
+    };
+  if( reader )
+    {
+    try
+      {
+      input = readRegion( reader );
+      }
+    catch( itk::ExceptionObject & error )
+      {
+      std::cerr << "Error: " << error << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+  long bufferStart[3];
+  std::size_t bufferSize[3];
+  for( unsigned int d = 0; d < Dimension; d++ )
+    {
+    bufferStart[d] = inputRegion.GetIndex( d ) - input->GetLargestPossibleRegion().GetIndex( d );
+    bufferSize[d] = inputRegion.GetSize( d );
+    }
+  const ImageGeometry bufferGeometry = GetSubGrid( inputGeometry, bufferStart, bufferSize );
+
+  const IndexMapping mapping = ComputeIndexMapping( outputGeometry, affine, bufferGeometry );
+
+  // --result-cache: the key covers everything the output depends on, i.e.
+  // the voxels that were read and their grid, the transform, the output
+  // grid and the options that choose the arithmetic; a hit links the stored
+  // output instead of resampling.
+  ResultCache resultCache;
+  resultCache.SetDirectory( options.ResultCache );
+  resultCache.SetSizeLimit( static_cast< std::uint64_t >( options.ResultCacheSize * 1048576.0 ) );
+  const std::string outputExtension = ResultCache::GetFileExtension( outputFileName );
+  const bool cacheResult = !options.ResultCache.empty() && ResultCache::IsCacheableFormat( outputExtension );
+  std::uint64_t resultKey = 0;
+  auto reportCache = [&options, &resultCache]()
+    {
+    if( options.CacheStats )
+      {
+      const ResultCacheStatistics statistics = resultCache.GetStatistics();
+      const std::size_t runs = statistics.Hits + statistics.Misses;
+      std::cerr << "Result cache " << options.ResultCache << ": " << statistics.Entries << " entries, "
+                << statistics.Bytes / 1048576.0 << " of " << options.ResultCacheSize << " MB; " << statistics.Hits
+                << " hits, " << statistics.Misses << " misses (" << ( runs > 0 ? 100.0 * statistics.Hits / runs : 0.0 )
+                << "% hits), " << statistics.Evictions << " evicted" << std::endl;
+      }
+    };
+  if( !options.ResultCache.empty() && !cacheResult )
+    {
+    std::cerr << "--result-cache: " << outputFileName << " is not in a format the cache holds (.nii, .nii.gz, "
+              << ".mha, .nrrd, .vtk, .hdr/.img); not cached." << std::endl;
+    }
+  if( cacheResult )
+    {
+    const std::chrono::steady_clock::time_point hashStart = std::chrono::steady_clock::now();
+    ResultCacheKey key;
+    key.Add( std::string( "3DTransform result 1" ) );
+    key.Add( HashBytes( input->GetBufferPointer(), bufferGeometry.GetNumberOfPixels() * sizeof( PixelType ) ) );
+    key.Add( bufferGeometry );
+    key.Add( affine );
+    key.Add( outputGeometry );
+    key.Add( static_cast< std::uint64_t >( headerOnly ) );
+    key.Add( options.Interpolator );
+    key.Add( options.Precision );
+    key.Add( options.RotationEngine );
+    key.Add( static_cast< std::uint64_t >( options.UseItkResample ) );
+    key.Add( static_cast< std::uint64_t >( options.FourierTranslation ) );
+    key.Add( static_cast< std::uint64_t >( options.UsePyramid ) );
+    key.Add( static_cast< std::uint64_t >( !options.PlanCache.empty() ) );
+    key.Add( static_cast< std::uint64_t >( threshold.Enabled ) );
+    key.Add( threshold.Threshold );
+    key.Add( threshold.InsideValue );
+    key.Add( threshold.OutsideValue );
+    key.Add( outputExtension );
+    resultKey = key.GetValue();
+    if( resultCache.Fetch( resultKey, outputExtension, outputFileName ) )
+      {
+      std::cerr << "Result cache hit: " << outputFileName << " from "
+                << resultCache.GetEntryName( resultKey, outputExtension ) << " in "
+                << std::chrono::duration< double >( std::chrono::steady_clock::now() - hashStart ).count() << " s"
+                << std::endl;
+      reportCache();
+      return EXIT_SUCCESS;
+      }
+    }
+
+  // The resampler is chosen and set up once, then run on the input and on
+  // every --apply-to volume, so the geometry work (spans, shear passes, FFT
+  // plans, the resampling plan) is shared by all of them.
+  enum EngineType { ItkEngine, CopyEngine, FourierEngine, ShearEngine, SincEngine, PlanEngine, KernelEngine,
+                    DeformableEngine, FieldEngine };
+  EngineType engine = SincEngine;
+  IntegerMappingResampler< PixelType > copyResampler;
+  FourierShiftResampler< PixelType > fourierResampler;
+  ShearRotationResampler< PixelType, Radius > shearResampler;
+  WindowedSincResampler< PixelType, Radius > sincResampler;
+  ResamplingPlan< Radius > plan;
+  BSplineDeformation deformation;
+  DisplacementField displacementField;
+  // With --threshold the reference path resamples to double, so the mask
+  // compares the interpolated values as the other engines do.
+  using RealImageType = itk::Image< double, Dimension >;
+  using RealResampleFilterType = itk::ResampleImageFilter< ImageType, RealImageType >;
+  using ThresholdFilterType = itk::BinaryThresholdImageFilter< RealImageType, ImageType >;
+  RealResampleFilterType::Pointer realResample = RealResampleFilterType::New();
+  ThresholdFilterType::Pointer thresholdFilter = ThresholdFilterType::New();
+  copyResampler.SetNumberOfThreads( numberOfThreads );
+  fourierResampler.SetNumberOfThreads( numberOfThreads );
+  shearResampler.SetNumberOfThreads( numberOfThreads );
+  sincResampler.SetNumberOfThreads( numberOfThreads );
+  plan.SetNumberOfThreads( numberOfThreads );
+
+  if( options.UseItkResample )
+    {
+    ImageType::Pointer reference = ImageType::New();
+    SetImageGeometry( reference.GetPointer(), outputGeometry );
+    resample->UseReferenceImageOff();
+    resample->SetOutputParametersFromImage( reference );
+    if( options.Interpolator == "nearest" )
+      {
+      using NearestInterpolatorType = itk::NearestNeighborInterpolateImageFunction< ImageType, ScalarType >;
+      resample->SetInterpolator( NearestInterpolatorType::New() );
+      }
+    else if( options.Interpolator == "linear" )
+      {
+      using LinearInterpolatorType = itk::LinearInterpolateImageFunction< ImageType, ScalarType >;
+      resample->SetInterpolator( LinearInterpolatorType::New() );
+      }
+    else if( options.Interpolator == "cubic" )
+      {
+      // ITK has no cubic convolution interpolator; its cubic B-spline is
+      // the closest reference.
+      using CubicInterpolatorType = itk::BSplineInterpolateImageFunction< ImageType, ScalarType >;
+      CubicInterpolatorType::Pointer cubicInterpolator = CubicInterpolatorType::New();
+      cubicInterpolator->SetSplineOrder( 3 );
+      resample->SetInterpolator( cubicInterpolator );
+      }
+    realResample->SetTransform( resample->GetTransform() );
+    realResample->SetInterpolator( resample->GetModifiableInterpolator() );
+    realResample->SetOutputParametersFromImage( reference );
+    realResample->SetDefaultPixelValue( 0.0 );
+    thresholdFilter->SetInput( realResample->GetOutput() );
+    thresholdFilter->SetLowerThreshold( threshold.Threshold );
+    thresholdFilter->SetInsideValue( static_cast< PixelType >( options.MaskValue ) );
+    thresholdFilter->SetOutsideValue( 0 );
+    engine = ItkEngine;
+    }
+  else if( !options.BSplineFile.empty() )
+    {
+    // Every output voxel is moved by its own displacement, so none of the
+    // affine engines apply: the --interpolator kernel is evaluated at each
+    // deformed position (see BSplineDeformation.h).
+    BSplineGrid grid;
+    if( !ReadBSplineTransformFile( options.BSplineFile, grid ) )
+      {
+      std::cerr << "Could not read a 3D cubic B-spline transform from " << options.BSplineFile << std::endl;
+      return EXIT_FAILURE;
+      }
+    if( !deformation.Prepare( grid, outputGeometry, affine, bufferGeometry ) )
+      {
+      std::cerr << "The control grid of " << options.BSplineFile << " is not parallel to the output grid" << std::endl;
+      return EXIT_FAILURE;
+      }
+    engine = DeformableEngine;
+    }
+  else if( !options.DisplacementFieldFile.empty() )
+    {
+    // The field is composed with the affine transform on its vectors (see
+    // DisplacementField.h); the image is interpolated once.
+    using FieldImageType = itk::Image< itk::Vector< float, Dimension >, Dimension >;
+    using FieldReaderType = itk::ImageFileReader< FieldImageType >;
+    FieldReaderType::Pointer fieldReader = FieldReaderType::New();
+    fieldReader->SetFileName( options.DisplacementFieldFile );
+    try
+      {
+      fieldReader->Update();
+      }
+    catch( itk::ExceptionObject & error )
+      {
+      std::cerr << "Error: " << error << std::endl;
+      return EXIT_FAILURE;
+      }
+    displacementField.Prepare( reinterpret_cast< const float * >( fieldReader->GetOutput()->GetBufferPointer() ),
+                               GetImageGeometry( fieldReader->GetOutput() ), outputGeometry, affine, bufferGeometry );
+    engine = FieldEngine;
+    }
+  else if( copyResampler.SetIndexMapping( mapping ) )
+    {
+    // Integer translations, axis permutations/flips and any crop or pad of
+    // those map every output voxel onto one input voxel: copy, don't
+    // interpolate.
+    engine = CopyEngine;
+    }
+
+  if( engine == SincEngine && options.FourierTranslation )
+    {
+    // A pure translation is a phase ramp in the frequency domain; the
+    // linear part of the index mapping must be the identity.
+    bool isTranslation = true;
+    for( unsigned int i = 0; i < Dimension; i++ )
+      {
+      for( unsigned int j = 0; j < Dimension; j++ )
+        {
+        const double expected = ( i == j ) ? 1.0 : 0.0;
+        if( std::fabs( mapping.Matrix[i][j] - expected ) > 1e-9 )
+          {
+          isTranslation = false;
+          }
+        }
+      }
+    bool sameGrid = true;
+    for( unsigned int d = 0; d < Dimension; d++ )
+      {
+      sameGrid = sameGrid && outputGeometry.Size[d] == bufferGeometry.Size[d];
+      }
+    if( isTranslation && sameGrid )
+      {
+      fourierResampler.SetShift( mapping.Offset );
+      engine = FourierEngine;
+      }
+    else if( !isTranslation )
+      {
+      std::cerr << "Transform is not a pure translation; using the sinc resampler." << std::endl;
+      }
+    else
+      {
+      std::cerr << "Fourier translation keeps the input grid; using the sinc resampler with --crop/--pad." << std::endl;
+      }
+    }
+
+  // A transform that minifies (e.g. a scaling factor of 2 or more) reads a
+  // Gaussian pyramid level of the input instead, band limited to the
+  // output grid, so it does not alias. The sinc, kernel and plan engines
+  // resample that level through sourceMapping.
+  unsigned int pyramidLevel = 0;
+  IndexMapping sourceMapping = mapping;
+  std::size_t sourceSize[3] = { bufferGeometry.Size[0], bufferGeometry.Size[1], bufferGeometry.Size[2] };
+  if( engine == SincEngine && options.UsePyramid )
+    {
+    // Chosen for the whole input, as above: a thin box would otherwise
+    // stop at a finer level than the full volume does.
+    pyramidLevel = GaussianPyramid< PixelType >::SelectLevel( mapping, inputGeometry.Size );
+    sourceMapping = GaussianPyramid< PixelType >::GetLevelMapping( mapping, pyramidLevel );
+    GaussianPyramid< PixelType >::GetLevelSize( bufferGeometry.Size, pyramidLevel, sourceSize );
+    }
+  GaussianPyramid< PixelType > pyramid;
+  pyramid.SetNumberOfThreads( numberOfThreads );
+
+  if( engine == SincEngine && ( options.Interpolator != "sinc" || options.Precision != "double" ) )
+    {
+    // Linear, cubic or label kernels, or single precision / fixed point
+    // arithmetic: the other engines are all double precision sinc.
+    engine = KernelEngine;
+    }
+
+  if( engine == SincEngine && options.RotationEngine == "shear" )
+    {
+    // Rotations can instead be done as 1D sinc shear passes; anything
+    // that is not a pure rotation falls through to the 3D kernel.
+    if( shearResampler.SetIndexMapping( mapping, bufferGeometry.Spacing ) )
+      {
+      engine = ShearEngine;
+      }
+    else
+      {
+      std::cerr << "Transform is not a pure rotation; using the sinc resampler." << std::endl;
+      }
+    }
+
+  // Several volumes, or a plan shared between processes through the cache
+  // directory: precompute the taps and weights once, unless the input is
+  // too large for the plan's 32-bit offsets.
+  bool usePlan = engine == SincEngine && ( !options.ApplyTo.empty() || !options.PlanCache.empty() );
+  if( usePlan && !ResamplingPlan< Radius >::CanAddress( sourceSize ) )
+    {
+    std::cerr << "The input has too many voxels for a resampling plan; using the sinc resampler." << std::endl;
+    usePlan = false;
+    }
+  if( usePlan )
+    {
+    if( options.PlanCache.empty() )
+      {
+      plan.Build( sourceMapping, sourceSize, outputGeometry.Size );
+      }
+    else
+      {
+      const std::string planFile = options.PlanCache + "/"
+        + ResamplingPlan< Radius >::GetCacheFileName( sourceMapping, sourceSize, outputGeometry.Size );
+      if( !plan.Load( planFile, sourceMapping, sourceSize, outputGeometry.Size ) )
+        {
+        plan.Build( sourceMapping, sourceSize, outputGeometry.Size );
+        if( !plan.Save( planFile ) )
+          {
+          std::cerr << "Could not write resampling plan " << planFile << std::endl;
+          }
+        }
+      }
+    engine = PlanEngine;
+    }
+  else if( engine == SincEngine )
+    {
+    // Output rows are split into spans so that samples whose whole sinc
+    // support lies inside the input skip the boundary condition; only the
+    // border shell takes the clamped path.
+    sincResampler.SetIndexMapping( sourceMapping );
+    sincResampler.SetDefaultPixelValue( threshold.Apply< PixelType >( 0.0 ) );
+    sincResampler.SetOutputThreshold( threshold );
+    }
+
+  std::vector< std::pair< std::string, std::string > > volumes( 1, std::make_pair( inputFileName, outputFileName ) );
+  volumes.insert( volumes.end(), options.ApplyTo.begin(), options.ApplyTo.end() );
+  for( std::size_t v = 0; v < volumes.size(); v++ )
+    {
+    ImageType::ConstPointer volume = input;
+    if( v > 0 )
+      {
+      ReaderType::Pointer volumeReader = ReaderType::New();
+      volumeReader->SetFileName( volumes[v].first );
+      try
+        {
+        volumeReader->UpdateOutputInformation();
+        // The plan and mapping were computed for the input's grid.
+        if( !IsSameGrid( GetImageGeometry( volumeReader->GetOutput() ), inputGeometry ) )
+          {
+          std::cerr << volumes[v].first << " is not on the grid of " << inputFileName << std::endl;
+          return EXIT_FAILURE;
+          }
+        volume = readRegion( volumeReader );
+        }
+      catch( itk::ExceptionObject & error )
+        {
+        std::cerr << "Error: " << error << std::endl;
+        return EXIT_FAILURE;
+        }
+      }
+
+    writer->SetFileName( volumes[v].second );
+    if( engine == ItkEngine )
+      {
+      resample->SetInput( volume );
+      realResample->SetInput( volume );
+      writer->SetInput( threshold.Enabled ? thresholdFilter->GetOutput() : resample->GetOutput() );
+      }
+    else
+      {
+      ImageType::Pointer output = ImageType::New();
+      SetImageGeometry( output.GetPointer(), outputGeometry );
+      output->Allocate();
+      const PixelType * inputBuffer = volume->GetBufferPointer();
+      PixelType * outputBuffer = output->GetBufferPointer();
+      const PixelType * sourceBuffer = inputBuffer;
+      if( pyramidLevel > 0 )
+        {
+        pyramid.SetInput( inputBuffer, bufferGeometry.Size );
+        sourceBuffer = pyramid.GetLevel( pyramidLevel, sourceSize );
+        }
+
+      const std::chrono::steady_clock::time_point engineStart = std::chrono::steady_clock::now();
+      switch( engine )
+        {
+        case CopyEngine:
+          copyResampler.SetInput( inputBuffer, bufferGeometry.Size );
+          copyResampler.SetOutput( outputBuffer, outputGeometry.Size );
+          copyResampler.SetDefaultPixelValue( 0 );
+          copyResampler.Update();
+          // A copy stores the input values exactly; thresholding them
+          // afterwards is the same as thresholding in the loop.
+          threshold.ApplyInPlace( outputBuffer, outputGeometry.GetNumberOfPixels() );
+          break;
+        case FourierEngine:
+          fourierResampler.SetInput( inputBuffer, bufferGeometry.Size );
+          fourierResampler.SetOutput( outputBuffer );
+          fourierResampler.SetOutputThreshold( threshold );
+          fourierResampler.Update();
+          break;
+        case ShearEngine:
+          shearResampler.SetInput( inputBuffer, bufferGeometry.Size );
+          shearResampler.SetOutput( outputBuffer, outputGeometry.Size );
+          shearResampler.SetOutputThreshold( threshold );
+          shearResampler.Update();
+          break;
+        case PlanEngine:
+          plan.Apply( sourceBuffer, outputBuffer, threshold.Apply< PixelType >( 0.0 ), threshold );
+          break;
+        case DeformableEngine:
+          ResampleDeformed( settings, inputBuffer, bufferGeometry.Size, outputBuffer, outputGeometry.Size, deformation,
+                            numberOfThreads );
+          break;
+        case FieldEngine:
+          ResampleDisplaced( settings, inputBuffer, bufferGeometry.Size, outputBuffer, outputGeometry.Size,
+                             displacementField, numberOfThreads );
+          break;
+        case KernelEngine:
+          ResampleWithInterpolator( settings, options.Precision, sourceBuffer, sourceSize,
+                                    outputBuffer, outputGeometry.Size, sourceMapping, numberOfThreads );
+          break;
+        default:
+          sincResampler.SetInput( sourceBuffer, sourceSize );
+          sincResampler.SetOutput( outputBuffer, outputGeometry.Size );
+          sincResampler.Update();
+          break;
+        }
+      if( pyramidLevel > 0 )
+        {
+        GaussianPyramid< PixelType >::ClipToInput( mapping, bufferGeometry.Size, outputBuffer, outputGeometry.Size,
+                                                   threshold.Apply< PixelType >( 0.0 ) );
+        }
+      const double engineSeconds =
+        std::chrono::duration< double >( std::chrono::steady_clock::now() - engineStart ).count();
+      writer->SetInput( output );
+
+      if( options.ValidatePrecision && engine == KernelEngine && options.Precision != "double" )
+        {
+        // Compare with the same kernel in double precision.
+        std::vector< PixelType > reference( outputGeometry.Size[0] * outputGeometry.Size[1] * outputGeometry.Size[2] );
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        ResampleWithInterpolator( settings, "double", sourceBuffer, sourceSize,
+                                  &reference[0], outputGeometry.Size, sourceMapping, numberOfThreads );
+        if( pyramidLevel > 0 )
+          {
+          GaussianPyramid< PixelType >::ClipToInput( mapping, bufferGeometry.Size, &reference[0], outputGeometry.Size,
+                                                     threshold.Apply< PixelType >( 0.0 ) );
+          }
+        const double referenceSeconds =
+          std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+        int largest = 0;
+        std::size_t differing = 0;
+        for( std::size_t n = 0; n < reference.size(); n++ )
+          {
+          const int difference = std::abs( static_cast< int >( outputBuffer[n] ) - static_cast< int >( reference[n] ) );
+          largest = std::max( largest, difference );
+          differing += ( difference != 0 );
+          }
+        std::cerr << options.Precision << ": " << engineSeconds << " s, double: " << referenceSeconds << " s; "
+                  << differing << " voxels differ, by at most " << largest << " gray level(s)" << std::endl;
+        if( largest > 1 )
+          {
+          std::cerr << "Precision check failed for " << volumes[v].second << std::endl;
+          return EXIT_FAILURE;
+          }
+        }
+      }
+    if( options.ValidatePrecision && v == 0 && ( engine != KernelEngine || options.Precision == "double" ) )
+      {
+      std::cerr << "--validate-precision: no single precision or fixed point resampling was done." << std::endl;
+      }
+
+    ResultCache::DetachFile( volumes[v].second );
+    try
+      {
+      writer->Update();
+      }
+    catch( itk::ExceptionObject & error )
+      {
+      std::cerr << "Error: " << error << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+  if( cacheResult )
+    {
+    if( !resultCache.Store( resultKey, outputExtension, outputFileName ) )
+      {
+      std::cerr << "Could not store " << outputFileName << " in the result cache " << options.ResultCache << std::endl;
+      }
+    reportCache();
+    }
+
+  return EXIT_SUCCESS;
+}
+
+} // end namespace
 
 // ensure correct number of arguments are entered.
 int main( int argc, char* argv[] )
 {
-  if( argc != 10 )
+  TransformOptions options;
+  if( argc < 10 || !ParseTransformOptions( argc, argv, 10, options ) )
     {
     std::cerr << "Usage: "<< std::endl;
     std::cerr << argv[0];
-    std::cerr << " <InputFileName> <OutputFileName> <xRotationTheta> <yRotationTheta> <zRotationTheta> <scalingFactor> <xTranslation> <yTranslation> <zTranslation>";
+    std::cerr << " <InputFileName> <OutputFileName> <xRotationTheta> <yRotationTheta> <zRotationTheta> <scalingFactor> <xTranslation> <yTranslation> <zTranslation> [options]";
     std::cerr << std::endl;
     return EXIT_FAILURE;
     }
 
-  // Define image dimensions
-  constexpr unsigned int Dimension = 3;
-  using ScalarType = double;
-
   const char * inputFileName = argv[1];
   const char * outputFileName = argv[2];
 
@@ -172,15 +1704,51 @@ int main( int argc, char* argv[] )
   translationMatrix[3][3] = 1.;
 
   // Read in the input image
-  using PixelType = unsigned char;
-  using ImageType = itk::Image< PixelType, Dimension >;
-
-  using ReaderType = itk::ImageFileReader< ImageType >;
-  ReaderType::Pointer reader = ReaderType::New();
-  reader->SetFileName( inputFileName );
-  reader->Update();
-
-  ImageType::ConstPointer input = reader->GetOutput();
+  SeriesImageType::Pointer series;
+  ImageType::ConstPointer input;
+  ReaderType::Pointer reader;
+  if( options.SeriesFile.empty() )
+    {
+    // Only the header for now: the voxels are read once it is known which
+    // of them the output needs (see below).
+    reader = ReaderType::New();
+    reader->SetFileName( inputFileName );
+    try
+      {
+      reader->UpdateOutputInformation();
+      }
+    catch( itk::ExceptionObject & error )
+      {
+      std::cerr << "Error: " << error << std::endl;
+      return EXIT_FAILURE;
+      }
+    input = reader->GetOutput();
+    }
+  else
+    {
+    // A 4D series is read once. Its first volume stands in for the input
+    // (grid, center of rotation) until the series is resampled below.
+    using SeriesReaderType = itk::ImageFileReader< SeriesImageType >;
+    SeriesReaderType::Pointer seriesReader = SeriesReaderType::New();
+    seriesReader->SetFileName( inputFileName );
+    try
+      {
+      seriesReader->Update();
+      }
+    catch( itk::ExceptionObject & error )
+      {
+      std::cerr << "Error: " << error << std::endl;
+      return EXIT_FAILURE;
+      }
+    series = seriesReader->GetOutput();
+    const ImageGeometry volumeGeometry = GetImageGeometry( series.GetPointer() );
+    ImageType::Pointer firstVolume = ImageType::New();
+    SetImageGeometry( firstVolume.GetPointer(), volumeGeometry );
+    firstVolume->Allocate();
+    std::copy( series->GetBufferPointer(), series->GetBufferPointer() + volumeGeometry.GetNumberOfPixels(),
+               firstVolume->GetBufferPointer() );
+    input = firstVolume;
+    }
 
   typedef ImageType::SpacingType    SpacingType;
   typedef ImageType::PointType      OriginType;
@@ -201,15 +1769,14 @@ int main( int argc, char* argv[] )
   const OriginType  origin  = input->GetOrigin();
   const ImageType::SizeType& size = input->GetLargestPossibleRegion().GetSize();
 
-  using TransformType = itk::AffineTransform< ScalarType, Dimension >;
   TransformType::InputPointType center;
 
   center[0] = origin[0] + spacing[0] * size[0] / 2.0;
   center[1] = origin[1] + spacing[1] * size[1] / 2.0;
+  center[2] = origin[2] + spacing[2] * size[2] / 2.0;
 
 
   // Initialize the transform
-  using ResampleImageFilterType = itk::ResampleImageFilter< ImageType, ImageType >;
   ResampleImageFilterType::Pointer resample = ResampleImageFilterType::New();
   resample->SetInput( input );
   resample->SetReferenceImage( input );
@@ -218,12 +1785,15 @@ int main( int argc, char* argv[] )
   resample->SetDefaultPixelValue( 0 );
 
   // Initialize the interpolator
-  constexpr unsigned int Radius = 3;
   using InterpolatorType = itk::WindowedSincInterpolateImageFunction< ImageType, Radius >;
   InterpolatorType::Pointer interpolator = InterpolatorType::New();
 
   resample->SetInterpolator( interpolator );
 
+  // The individual transforms below are composed into a single affine
+  // transform, applied in the order x, y, z rotation, scaling, translation.
+  TransformType::Pointer transform = TransformType::New();
+
   // Perform rotation along x-axis, if nonzero angle was given as a parameter.
   if (atof(argv[3]) != 0) {
     using TransformType = itk::AffineTransform< ScalarType, Dimension >;
@@ -247,7 +1817,7 @@ int main( int argc, char* argv[] )
       }
     xRotationTransform->SetParameters( xRotationParameters );
 
-    resample->SetTransform( xRotationTransform );
+    transform->Compose( xRotationTransform );
   }
 
   // Perform rotation along y-axis, if nonzero angle was given as a parameter.
@@ -273,7 +1843,7 @@ int main( int argc, char* argv[] )
       }
     yRotationTransform->SetParameters( yRotationParameters );
 
-    resample->SetTransform( yRotationTransform );
+    transform->Compose( yRotationTransform );
   }
 
   // Perform rotation along z-axis, if nonzero angle was given as a parameter.
@@ -299,7 +1869,7 @@ int main( int argc, char* argv[] )
       }
     zRotationTransform->SetParameters( zRotationParameters );
 
-    resample->SetTransform( zRotationTransform );
+    transform->Compose( zRotationTransform );
   }
 
   // Perform glabal scaling, if scaling factor was given as a parameter.
@@ -325,7 +1895,7 @@ int main( int argc, char* argv[] )
       }
     scalingTransform->SetParameters( scalingParameters );
 
-    resample->SetTransform( scalingTransform );
+    transform->Compose( scalingTransform );
   }
 
   // Perform translation, if nonzero distance was given as a parameter.
@@ -351,23 +1921,143 @@ int main( int argc, char* argv[] )
       }
     translationTransform->SetParameters( translationParameters );
 
-    resample->SetTransform( translationTransform );
+    transform->Compose( translationTransform );
   }
 
-  // write file to output destination
-  using WriterType = itk::ImageFileWriter< ImageType >;
-  WriterType::Pointer writer = WriterType::New();
-  writer->SetFileName( outputFileName );
-  writer->SetInput( resample->GetOutput() );
-  try
+  resample->SetTransform( transform );
+
+  // --register: the transform given by the arguments is only the starting
+  // point; the one that best aligns the input to the fixed image (mean
+  // squared difference over a Gaussian pyramid, coarse to fine) replaces
+  // it, and the fixed grid becomes the output grid. Without a starting
+  // transform the centers of the two images are aligned first; with
+  // --phase-correlate the phase correlation estimate is the starting point
+  // instead (and with --register-type phase the result). The fixed image
+  // side (RegistrationTemplate, PhaseCorrelation) is kept for --cohort,
+  // which registers its subjects further below instead of the input here.
+  RegistrationFixed fixed;
+  if( !options.RegisterFile.empty()
+      && !PrepareRegistration( options, GetAffineMapping( transform.GetPointer() ), fixed ) )
     {
-    writer->Update();
+    return EXIT_FAILURE;
     }
-  catch( itk::ExceptionObject & error )
+  if( !options.RegisterFile.empty() && options.CohortFile.empty() )
     {
-    std::cerr << "Error: " << error << std::endl;
-    return EXIT_FAILURE;
+    AffineMapping estimate;
+    if( !ReadWholeInput( reader ) || !RegisterInput( options, fixed, input.GetPointer(), estimate ) )
+      {
+      return EXIT_FAILURE;
+      }
+    SetAffineMapping( transform.GetPointer(), estimate );
     }
 
-  return EXIT_SUCCESS;
-}
+  // Output grid. Transforms that only permute or flip the axes (multiples
+  // of 90 degree rotations, mirroring) are pure data movement: the grid is
+  // rewritten to hold the transformed input exactly, see
+  // ComputePermutedGeometry(). With --header-only, a rigid transform moves
+  // the whole input grid instead, so the voxels are written unchanged and
+  // only the origin and direction (the NIfTI qform/sform) differ. --crop
+  // and --pad then select a region of the grid.
+  const ImageGeometry inputGeometry = GetImageGeometry( input.GetPointer() );
+  const AffineMapping affine = GetAffineMapping( transform.GetPointer() );
+  ImageGeometry outputGeometry = inputGeometry;
+  bool headerOnly = false;
+  if( options.HeaderOnly )
+    {
+    headerOnly = ComputeRigidGeometry( inputGeometry, affine, outputGeometry );
+    if( !headerOnly )
+      {
+      std::cerr << "Transform is not rigid; resampling instead of --header-only." << std::endl;
+      }
+    }
+  if( !headerOnly )
+    {
+    int permutedAxis[3];
+    int permutedSign[3];
+    ComputePermutedGeometry( inputGeometry, affine, outputGeometry, permutedAxis, permutedSign );
+    }
+  // --reference and the --output-* options replace the grid (see
+  // SelectGrid()).
+  ImageGeometry referenceGeometry = options.RegisterFile.empty() ? inputGeometry : fixed.Geometry;
+  if( !options.ReferenceFile.empty() )
+    {
+    ReaderType::Pointer referenceReader = ReaderType::New();
+    referenceReader->SetFileName( options.ReferenceFile );
+    try
+      {
+      referenceReader->UpdateOutputInformation();
+      }
+    catch( itk::ExceptionObject & error )
+      {
+      std::cerr << "Error: " << error << std::endl;
+      return EXIT_FAILURE;
+      }
+    referenceGeometry = GetImageGeometry( referenceReader->GetOutput() );
+    }
+  const ImageGeometry selectedGrid = SelectGrid( options, referenceGeometry, outputGeometry );
+  if( options.Slice >= 0 && static_cast< std::size_t >( options.Slice ) >= selectedGrid.Size[2] )
+    {
+    std::cerr << "--slice " << options.Slice << " is outside the " << selectedGrid.Size[2]
+              << " slices of the output" << std::endl;
+    return EXIT_FAILURE;
+    }
+  outputGeometry = SelectRegion( options, selectedGrid );
+  const unsigned int numberOfThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+
+  // --threshold or --otsu: every resampler stores a mask instead of gray
+  // levels (see OutputThreshold.h), so no gray-level volume is written or
+  // kept. Otsu's threshold comes from the histogram of the whole input.
+  OutputThreshold threshold;
+  if( options.ThresholdSet || options.Otsu )
+    {
+    double thresholdValue = options.Threshold;
+    if( options.Otsu )
+      {
+      if( !ReadWholeInput( reader ) )
+        {
+        return EXIT_FAILURE;
+        }
+      thresholdValue = ComputeOtsuThreshold( input->GetBufferPointer(), inputGeometry.GetNumberOfPixels() );
+      std::cerr << "Otsu threshold: " << thresholdValue << std::endl;
+      }
+    threshold = OutputThreshold( thresholdValue, static_cast< double >( options.MaskValue ), 0.0 );
+    }
+  // The modes that write many volumes (or fuse atlases) each have their
+  // own function; otherwise the input is resampled on its own.
+  const ResampleSettings settings = { options, threshold, numberOfThreads };
+  const double rotationCenter[3] = { center[0], center[1], center[2] };
+  if( !options.CohortFile.empty() )
+    {
+    return RunCohort( settings, inputFileName, outputFileName, fixed,
+                      SelectRegion( options, SelectGrid( options, referenceGeometry, fixed.Geometry ) ) );
+    }
+  if( !options.AtlasFile.empty() )
+    {
+    return RunAtlases( options, outputFileName, rotationCenter, affine, outputGeometry, numberOfThreads );
+    }
+  if( options.AugmentCount > 0 || !options.AugmentFile.empty() )
+    {
+    TransformParameters base;
+    for( unsigned int d = 0; d < Dimension; d++ )
+      {
+      base.Rotation[d] = atof( argv[3 + d] );
+      base.Translation[d] = atof( argv[7 + d] );
+      }
+    base.Scale = atof( argv[6] );
+    return RunAugment( settings, base, reader, input, inputGeometry,
+                       SelectRegion( options, SelectGrid( options, referenceGeometry, inputGeometry ) ), rotationCenter,
+                       outputFileName );
+    }
+  if( !options.ReslicePlanes.empty() || !options.ResliceFile.empty() )
+    {
+    return RunReslice( settings, reader, input, inputGeometry, affine, outputFileName );
+    }
+  if( !options.SeriesFile.empty() )
+    {
+    return RunSeries( settings, series, inputGeometry,
+                      SelectRegion( options, SelectGrid( options, referenceGeometry, inputGeometry ) ), affine,
+                      rotationCenter, outputFileName );
+    }
+  return RunSingleVolume( settings, inputFileName, outputFileName, reader, input, inputGeometry, outputGeometry, affine,
+                          headerOnly, resample );
+}
\ No newline at end of file
@@ -0,0 +1,438 @@
+// AUTHOR: Christian McDaniel
+//
+// Cubic B-spline free-form deformation (ITK's BSplineTransform) applied
+// together with the affine transform of {3DTransform}: output point x is
+// first moved to x + u(x), u being the B-spline of a grid of control point
+// displacements, and then mapped into the input by the affine transform,
+// x_in = Matrix * ( x + u( x ) ) + Offset. The control grid is read from
+// an ITK transform file.
+//
+// When the axes of the control grid are parallel to those of the output
+// grid, the 4 x 4 x 4 basis weights of a voxel are the product of one
+// weight table per axis (the first control point and four weights of every
+// output index), built once per output grid. The 64-term sum over the
+// control points of a voxel is then contracted one axis at a time: once
+// per output slice along z, once per output row along y, and per voxel
+// only the four x terms remain. The coefficients are stored already mapped
+// into input index units by the linear part of the affine transform, so a
+// voxel costs its affine position, 12 multiply-adds and the interpolation
+// kernel. Each slice is traversed in square tiles, so the input voxels that
+// a row of a tile reads are still cached for the next row, whatever the
+// rotation.
+
+#ifndef BSplineDeformation_h
+#define BSplineDeformation_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "OutputThreshold.h"
+#include "ParallelFor.h"
+#include "ResampleGeometry.h"
+#include "SeparableKernelResampler.h"
+
+// The control points of a cubic B-spline deformation: their grid (Size
+// control points per axis, the first one at Origin) and the x, y and z
+// displacement of each, interleaved, in physical units.
+struct BSplineGrid
+{
+  ImageGeometry         Geometry;
+  std::vector< double > Coefficients;
+};
+
+// Reads a 3D cubic BSplineTransform (or BSplineDeformableTransform) from an
+// ITK transform file: the "Parameters:" are all x displacements, then all
+// y, then all z; the "FixedParameters:" are the grid size, origin, spacing
+// and direction (row major). Returns false if the file cannot be read or
+// holds anything else.
+inline bool ReadBSplineTransformFile( const std::string & fileName, BSplineGrid & grid )
+{
+  std::ifstream file( fileName.c_str() );
+  if( !file )
+    {
+    return false;
+    }
+  std::string type;
+  std::vector< double > parameters;
+  std::vector< double > fixed;
+  std::string line;
+  while( std::getline( file, line ) )
+    {
+    std::istringstream fields( line );
+    std::string key;
+    if( !( fields >> key ) || key[0] == '#' )
+      {
+      continue;
+      }
+    if( key == "Transform:" )
+      {
+      if( !type.empty() || !( fields >> type ) )
+        {
+        return false;
+        }
+      continue;
+      }
+    std::vector< double > * values = ( key == "Parameters:" ) ? &parameters
+                                   : ( key == "FixedParameters:" ) ? &fixed : 0;
+    if( values == 0 )
+      {
+      return false;
+      }
+    double value;
+    while( fields >> value )
+      {
+      values->push_back( value );
+      }
+    if( !fields.eof() )
+      {
+      return false;
+      }
+    }
+  // e.g. BSplineTransform_double_3_3: 3 dimensions, spline order 3.
+  const std::string suffix = "_3_3";
+  if( ( type.compare( 0, 17, "BSplineTransform_" ) != 0 && type.compare( 0, 27, "BSplineDeformableTransform_" ) != 0 )
+      || type.size() < suffix.size() || type.compare( type.size() - suffix.size(), suffix.size(), suffix ) != 0
+      || fixed.size() != 18 )
+    {
+    return false;
+    }
+  std::size_t count = 1;
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    // At least the four control points of one cubic span per axis.
+    if( !( fixed[d] >= 4.0 ) || fixed[d] != std::floor( fixed[d] ) || !( fixed[6 + d] > 0.0 ) )
+      {
+      return false;
+      }
+    grid.Geometry.Size[d] = static_cast< std::size_t >( fixed[d] );
+    grid.Geometry.Origin[d] = fixed[3 + d];
+    grid.Geometry.Spacing[d] = fixed[6 + d];
+    for( unsigned int e = 0; e < 3; e++ )
+      {
+      grid.Geometry.Direction[d][e] = fixed[9 + 3 * d + e];
+      }
+    count *= grid.Geometry.Size[d];
+    }
+  if( parameters.size() != 3 * count || std::fabs( Determinant( grid.Geometry.Direction ) ) < 1e-6 )
+    {
+    return false;
+    }
+  grid.Coefficients.resize( 3 * count );
+  for( std::size_t n = 0; n < count; n++ )
+    {
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      grid.Coefficients[3 * n + d] = parameters[d * count + n];
+      }
+    }
+  return true;
+}
+
+class BSplineDeformation
+{
+public:
+  BSplineDeformation()
+    {
+    SetIdentity( m_Mapping.Matrix );
+    m_Mapping.Offset[0] = m_Mapping.Offset[1] = m_Mapping.Offset[2] = 0.0;
+    m_GridSize[0] = m_GridSize[1] = m_GridSize[2] = 0;
+    }
+
+  // Tables for resampling `input` onto `output` through x_in = transform(
+  // x + u( x ) ). Returns false if the axes of the control grid are not
+  // parallel to those of the output grid.
+  bool Prepare( const BSplineGrid & grid, const ImageGeometry & output, const AffineMapping & transform,
+                const ImageGeometry & input )
+    {
+    // Output index -> continuous control point index, t = Scale * index +
+    // Start along every axis when the grids are parallel.
+    double outputIndexToPhysical[3][3];
+    double gridIndexToPhysical[3][3];
+    double physicalToGridIndex[3][3];
+    double outputToGrid[3][3];
+    GetIndexToPhysicalMatrix( output, outputIndexToPhysical );
+    GetIndexToPhysicalMatrix( grid.Geometry, gridIndexToPhysical );
+    if( !InvertMatrix( gridIndexToPhysical, physicalToGridIndex ) )
+      {
+      return false;
+      }
+    MultiplyMatrices( physicalToGridIndex, outputIndexToPhysical, outputToGrid );
+    for( unsigned int i = 0; i < 3; i++ )
+      {
+      for( unsigned int j = 0; j < 3; j++ )
+        {
+        if( i != j && std::fabs( outputToGrid[i][j] ) > 1e-6 * std::fabs( outputToGrid[i][i] ) )
+          {
+          return false;
+          }
+        }
+      }
+    double shift[3];
+    double start[3];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      shift[d] = output.Origin[d] - grid.Geometry.Origin[d];
+      }
+    MultiplyMatrixVector( physicalToGridIndex, shift, start );
+
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_GridSize[d] = grid.Geometry.Size[d];
+      m_First[d].assign( output.Size[d], -1 );
+      m_Weights[d].assign( 4 * output.Size[d], 0.0 );
+      // ITK's valid region of a cubic B-spline: 1 <= t < size - 2, where
+      // all four control points of a voxel exist. Outside it the
+      // displacement is 0.
+      const double upper = static_cast< double >( m_GridSize[d] ) - 2.0;
+      for( std::size_t n = 0; n < output.Size[d]; n++ )
+        {
+        const double t = outputToGrid[d][d] * static_cast< double >( n ) + start[d];
+        if( !( t >= 1.0 && t < upper ) )
+          {
+          continue;
+          }
+        const double base = std::floor( t );
+        const double s = t - base;
+        const double r = 1.0 - s;
+        double * weights = &m_Weights[d][4 * n];
+        weights[0] = r * r * r / 6.0;
+        weights[1] = ( 3.0 * s * s * s - 6.0 * s * s + 4.0 ) / 6.0;
+        weights[3] = s * s * s / 6.0;
+        weights[2] = 1.0 - weights[0] - weights[1] - weights[3];
+        m_First[d][n] = static_cast< long >( base ) - 1;
+        }
+      }
+
+    // Coefficients in input index units: a physical displacement u moves
+    // the input position by PhysicalToIndex * Matrix * u.
+    double inputIndexToPhysical[3][3];
+    double physicalToInputIndex[3][3];
+    double linear[3][3];
+    GetIndexToPhysicalMatrix( input, inputIndexToPhysical );
+    InvertMatrix( inputIndexToPhysical, physicalToInputIndex );
+    MultiplyMatrices( physicalToInputIndex, transform.Matrix, linear );
+    m_Coefficients.resize( grid.Coefficients.size() );
+    for( std::size_t n = 0; n < grid.Coefficients.size(); n += 3 )
+      {
+      MultiplyMatrixVector( linear, &grid.Coefficients[n], &m_Coefficients[n] );
+      }
+    m_Mapping = ComputeIndexMapping( output, transform, input );
+    return true;
+    }
+
+  // The affine part of the mapping, output index -> continuous input index.
+  const IndexMapping & GetIndexMapping() const { return m_Mapping; }
+
+  // The four control point planes of output slice k summed along z into
+  // `slice` ( (cy * nx + cx) * 3 + component ). False if the slice lies
+  // outside the valid region, where nothing is displaced.
+  bool ContractSlice( std::size_t k, std::vector< double > & slice ) const
+    {
+    const long first = m_First[2][k];
+    if( first < 0 )
+      {
+      return false;
+      }
+    const std::size_t plane = 3 * m_GridSize[0] * m_GridSize[1];
+    const double * weights = &m_Weights[2][4 * k];
+    slice.assign( plane, 0.0 );
+    for( unsigned int b = 0; b < 4; b++ )
+      {
+      const double * source = &m_Coefficients[( static_cast< std::size_t >( first ) + b ) * plane];
+      const double w = weights[b];
+      for( std::size_t n = 0; n < plane; n++ )
+        {
+        slice[n] += w * source[n];
+        }
+      }
+    return true;
+    }
+
+  // The contracted slice summed along y for output row j into `row` (cx * 3
+  // + component), only for the control points that output voxels [iFirst,
+  // iLast) use. False if the row lies outside the valid region.
+  bool ContractRow( const std::vector< double > & slice, std::size_t j, std::size_t iFirst, std::size_t iLast,
+                    std::vector< double > & row ) const
+    {
+    const long first = m_First[1][j];
+    if( first < 0 )
+      {
+      return false;
+      }
+    long xFirst = static_cast< long >( m_GridSize[0] );
+    long xLast = -1;
+    for( std::size_t i = iFirst; i < iLast; i++ )
+      {
+      if( m_First[0][i] >= 0 )
+        {
+        xFirst = std::min( xFirst, m_First[0][i] );
+        xLast = std::max( xLast, m_First[0][i] + 3 );
+        }
+      }
+    if( xLast < 0 )
+      {
+      return false;
+      }
+    row.resize( 3 * m_GridSize[0] );
+    const double * weights = &m_Weights[1][4 * j];
+    const std::size_t stride = 3 * m_GridSize[0];
+    const double * source = &slice[static_cast< std::size_t >( first ) * stride];
+    for( std::size_t n = 3 * static_cast< std::size_t >( xFirst ); n < 3 * static_cast< std::size_t >( xLast + 1 ); n++ )
+      {
+      row[n] = weights[0] * source[n] + weights[1] * source[n + stride] + weights[2] * source[n + 2 * stride]
+             + weights[3] * source[n + 3 * stride];
+      }
+    return true;
+    }
+
+  // Moves continuous input index c by the displacement of voxel i of the
+  // contracted row.
+  void AddDisplacement( const std::vector< double > & row, std::size_t i, double c[3] ) const
+    {
+    const long first = m_First[0][i];
+    if( first < 0 )
+      {
+      return;
+      }
+    const double * weights = &m_Weights[0][4 * i];
+    const double * p = &row[3 * static_cast< std::size_t >( first )];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      c[d] += weights[0] * p[d] + weights[1] * p[3 + d] + weights[2] * p[6 + d] + weights[3] * p[9 + d];
+      }
+    }
+
+private:
+  IndexMapping          m_Mapping;
+  std::size_t           m_GridSize[3];
+  std::vector< long >   m_First[3];
+  std::vector< double > m_Weights[3];
+  std::vector< double > m_Coefficients;
+};
+
+// Resamples a 3D buffer through a prepared BSplineDeformation with the
+// separable kernel TKernel in TReal arithmetic; voxels that map outside the
+// input get the default value. Threads take whole output slices.
+template< typename TPixel, typename TKernel, typename TReal = double >
+class BSplineResampler
+{
+public:
+  // Output voxels per side of a tile of a slice.
+  static const std::size_t TileSize = 32;
+
+  BSplineResampler()
+    : m_Output( 0 ), m_Deformation( 0 ), m_DefaultPixelValue( 0 ),
+      m_NumberOfThreads( std::thread::hardware_concurrency() )
+    {
+    m_OutputSize[0] = m_OutputSize[1] = m_OutputSize[2] = 0;
+    }
+
+  void SetInput( const TPixel * buffer, const std::size_t size[3] ) { m_Kernel.SetInput( buffer, size ); }
+
+  void SetOutput( TPixel * buffer, const std::size_t size[3] )
+    {
+    m_Output = buffer;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_OutputSize[d] = size[d];
+      }
+    }
+
+  void SetDeformation( const BSplineDeformation * deformation ) { m_Deformation = deformation; }
+  void SetDefaultPixelValue( TPixel value ) { m_DefaultPixelValue = value; }
+  void SetOutputThreshold( const OutputThreshold & threshold ) { m_Threshold = threshold; }
+  void SetNumberOfThreads( unsigned int threads ) { m_NumberOfThreads = threads > 0 ? threads : 1; }
+
+  void Update()
+    {
+    SliceFunctor functor( this );
+    ParallelFor( 0, m_OutputSize[2], 1, m_NumberOfThreads, functor );
+    }
+
+private:
+  struct SliceFunctor
+  {
+    explicit SliceFunctor( const BSplineResampler * self ) : m_Self( self ) {}
+
+    void operator()( std::size_t first, std::size_t last, unsigned int ) const
+      {
+      std::vector< double > slice;
+      std::vector< double > row;
+      for( std::size_t k = first; k < last; k++ )
+        {
+        m_Self->ResampleSlice( k, slice, row );
+        }
+      }
+
+    const BSplineResampler * m_Self;
+  };
+
+  void ResampleSlice( std::size_t k, std::vector< double > & slice, std::vector< double > & row ) const
+    {
+    const IndexMapping & mapping = m_Deformation->GetIndexMapping();
+    const bool sliceInside = m_Deformation->ContractSlice( k, slice );
+    TPixel * out = m_Output + k * m_OutputSize[0] * m_OutputSize[1];
+    const double dk = static_cast< double >( k );
+    for( std::size_t tileY = 0; tileY < m_OutputSize[1]; tileY += TileSize )
+      {
+      const std::size_t yLast = std::min( tileY + TileSize, m_OutputSize[1] );
+      for( std::size_t tileX = 0; tileX < m_OutputSize[0]; tileX += TileSize )
+        {
+        const std::size_t xLast = std::min( tileX + TileSize, m_OutputSize[0] );
+        for( std::size_t j = tileY; j < yLast; j++ )
+          {
+          const bool rowInside = sliceInside && m_Deformation->ContractRow( slice, j, tileX, xLast, row );
+          const double dj = static_cast< double >( j );
+          for( std::size_t i = tileX; i < xLast; i++ )
+            {
+            double c[3];
+            mapping.Map( static_cast< double >( i ), dj, dk, c );
+            if( rowInside )
+              {
+              m_Deformation->AddDisplacement( row, i, c );
+              }
+            TReal value;
+            out[j * m_OutputSize[0] + i] = m_Kernel.EvaluateAt( c, value )
+                                             ? m_Threshold.Apply< TPixel >( static_cast< double >( value ) )
+                                             : m_DefaultPixelValue;
+            }
+          }
+        }
+      }
+    }
+
+  SeparableKernelResampler< TPixel, TKernel, TReal > m_Kernel;
+  TPixel *                                           m_Output;
+  std::size_t                                        m_OutputSize[3];
+  const BSplineDeformation *                         m_Deformation;
+  TPixel                                             m_DefaultPixelValue;
+  OutputThreshold                                    m_Threshold;
+  unsigned int                                       m_NumberOfThreads;
+};
+
+// Resamples `input` into `output` through `deformation` with TKernel in
+// TReal arithmetic; voxels that map outside the input are set to 0 (or to
+// the thresholded 0).
+template< typename TKernel, typename TReal, typename TPixel >
+void ResampleWithDeformation( const TPixel * input, const std::size_t inputSize[3],
+                              TPixel * output, const std::size_t outputSize[3],
+                              const BSplineDeformation & deformation, unsigned int numberOfThreads,
+                              const OutputThreshold & threshold = OutputThreshold() )
+{
+  BSplineResampler< TPixel, TKernel, TReal > resampler;
+  resampler.SetInput( input, inputSize );
+  resampler.SetOutput( output, outputSize );
+  resampler.SetDeformation( &deformation );
+  resampler.SetDefaultPixelValue( threshold.Apply< TPixel >( 0.0 ) );
+  resampler.SetOutputThreshold( threshold );
+  resampler.SetNumberOfThreads( numberOfThreads );
+  resampler.Update();
+}
+
+#endif
@@ -0,0 +1,429 @@
+// AUTHOR: Christian McDaniel
+//
+// Small bundled FFT for the frequency-domain modes of {3DTransform}. A plan
+// holds the factorization and twiddle factors of one transform length, so
+// the same plan can be reused for every line of every volume of that size.
+// Any length is supported (mixed radix, generic butterflies after the
+// factors 2 to 5); lengths whose prime factors are small are fastest, see
+// NextFastFFTLength().
+//
+// The factorization, the radix 2, 3, 4, 5 and generic butterflies and the
+// packed real transform follow KISS FFT, which is under this license:
+//
+// Copyright (c) 2003-2010, Mark Borgerding
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the
+//       distribution.
+//     * Neither the author nor the names of any contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// (also in THIRD_PARTY_NOTICES at the top of the repository).
+
+#ifndef FFTPlan_h
+#define FFTPlan_h
+
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+typedef std::complex< double > FFTComplex;
+
+// Plain complex product. std::complex operator* must handle inf/nan per
+// C99 Annex G and compiles to a library call without -ffast-math.
+inline FFTComplex FFTMultiply( const FFTComplex & a, const FFTComplex & b )
+{
+  return FFTComplex( a.real() * b.real() - a.imag() * b.imag(),
+                     a.real() * b.imag() + a.imag() * b.real() );
+}
+
+// Smallest length >= n whose prime factors are 2, 3 and 5.
+inline std::size_t NextFastFFTLength( std::size_t n )
+{
+  if( n < 1 )
+    {
+    return 1;
+    }
+  for( std::size_t candidate = n;; candidate++ )
+    {
+    std::size_t rest = candidate;
+    const std::size_t primes[3] = { 2, 3, 5 };
+    for( unsigned int i = 0; i < 3; i++ )
+      {
+      while( rest % primes[i] == 0 )
+        {
+        rest /= primes[i];
+        }
+      }
+    if( rest == 1 )
+      {
+      return candidate;
+      }
+    }
+}
+
+// Complex-to-complex transform of one length. Forward uses exp(-2 pi i k n / N);
+// neither direction is normalized.
+class FFTPlan
+{
+public:
+  explicit FFTPlan( std::size_t length = 1 )
+    {
+    Initialize( length );
+    }
+
+  void Initialize( std::size_t length )
+    {
+    m_Length = length > 0 ? length : 1;
+    const double pi = 3.14159265358979323846;
+    m_Forward.resize( m_Length );
+    m_Inverse.resize( m_Length );
+    for( std::size_t k = 0; k < m_Length; k++ )
+      {
+      const double phase = -2.0 * pi * static_cast< double >( k ) / static_cast< double >( m_Length );
+      m_Forward[k] = FFTComplex( std::cos( phase ), std::sin( phase ) );
+      m_Inverse[k] = std::conj( m_Forward[k] );
+      }
+
+    // Factor as 4s first, then 2, 3, 5, ...; stored as (radix, remaining) pairs.
+    m_Factors.clear();
+    m_LargestFactor = 1;
+    std::size_t rest = m_Length;
+    std::size_t p = 4;
+    while( rest > 1 )
+      {
+      while( rest % p != 0 )
+        {
+        switch( p )
+          {
+          case 4: p = 2; break;
+          case 2: p = 3; break;
+          default: p += 2; break;
+          }
+        if( p * p > rest )
+          {
+          p = rest;
+          }
+        }
+      rest /= p;
+      m_Factors.push_back( p );
+      m_Factors.push_back( rest );
+      if( p > m_LargestFactor )
+        {
+        m_LargestFactor = p;
+        }
+      }
+    if( m_Factors.empty() )
+      {
+      m_Factors.push_back( 1 );
+      m_Factors.push_back( 1 );
+      }
+    }
+
+  std::size_t GetLength() const { return m_Length; }
+
+  // Scratch needed by Transform(); one buffer per thread.
+  std::size_t GetScratchSize() const { return m_LargestFactor; }
+
+  // out = DFT(in) with in and out distinct buffers of GetLength() elements.
+  void Transform( const FFTComplex * in, FFTComplex * out, bool inverse, FFTComplex * scratch ) const
+    {
+    if( m_Length == 1 )
+      {
+      out[0] = in[0];
+      return;
+      }
+    const std::vector< FFTComplex > & twiddles = inverse ? m_Inverse : m_Forward;
+    Work( out, in, 1, &m_Factors[0], twiddles, scratch );
+    }
+
+private:
+  void Work( FFTComplex * out, const FFTComplex * in, std::size_t stride,
+             const std::size_t * factors, const std::vector< FFTComplex > & twiddles,
+             FFTComplex * scratch ) const
+    {
+    const std::size_t p = factors[0];
+    const std::size_t m = factors[1];
+    FFTComplex * begin = out;
+    FFTComplex * end = out + p * m;
+    if( m == 1 )
+      {
+      for( ; out != end; ++out, in += stride )
+        {
+        *out = *in;
+        }
+      }
+    else
+      {
+      for( ; out != end; out += m, in += stride )
+        {
+        Work( out, in, stride * p, factors + 2, twiddles, scratch );
+        }
+      }
+    out = begin;
+
+    switch( p )
+      {
+      case 2: Butterfly2( out, stride, m, twiddles ); break;
+      case 3: Butterfly3( out, stride, m, twiddles ); break;
+      case 4: Butterfly4( out, stride, m, twiddles ); break;
+      case 5: Butterfly5( out, stride, m, twiddles ); break;
+      default: ButterflyGeneric( out, stride, m, p, twiddles, scratch ); break;
+      }
+    }
+
+  static void Butterfly2( FFTComplex * out, std::size_t stride, std::size_t m,
+                          const std::vector< FFTComplex > & twiddles )
+    {
+    for( std::size_t u = 0; u < m; u++ )
+      {
+      const FFTComplex t = FFTMultiply( out[u + m], twiddles[u * stride] );
+      out[u + m] = out[u] - t;
+      out[u] += t;
+      }
+    }
+
+  static void Butterfly3( FFTComplex * out, std::size_t stride, std::size_t m,
+                          const std::vector< FFTComplex > & twiddles )
+    {
+    const double epsilon = twiddles[stride * m].imag();
+    for( std::size_t u = 0; u < m; u++ )
+      {
+      const FFTComplex s1 = FFTMultiply( out[u + m], twiddles[u * stride] );
+      const FFTComplex s2 = FFTMultiply( out[u + 2 * m], twiddles[2 * u * stride] );
+      const FFTComplex s3 = s1 + s2;
+      const FFTComplex s0 = ( s1 - s2 ) * epsilon;
+      const FFTComplex half = out[u] - 0.5 * s3;
+      out[u] += s3;
+      out[u + m] = FFTComplex( half.real() - s0.imag(), half.imag() + s0.real() );
+      out[u + 2 * m] = FFTComplex( half.real() + s0.imag(), half.imag() - s0.real() );
+      }
+    }
+
+  void Butterfly4( FFTComplex * out, std::size_t stride, std::size_t m,
+                   const std::vector< FFTComplex > & twiddles ) const
+    {
+    // Forward and inverse differ only in the sign of the +-i rotation.
+    const bool inverse = ( &twiddles == &m_Inverse );
+    for( std::size_t u = 0; u < m; u++ )
+      {
+      const FFTComplex s0 = FFTMultiply( out[u + m], twiddles[u * stride] );
+      const FFTComplex s1 = FFTMultiply( out[u + 2 * m], twiddles[2 * u * stride] );
+      const FFTComplex s2 = FFTMultiply( out[u + 3 * m], twiddles[3 * u * stride] );
+      const FFTComplex s5 = out[u] - s1;
+      out[u] += s1;
+      const FFTComplex s3 = s0 + s2;
+      const FFTComplex s4 = s0 - s2;
+      out[u + 2 * m] = out[u] - s3;
+      out[u] += s3;
+      // s4 * -i (forward) or s4 * i (inverse)
+      const FFTComplex rotated = inverse ? FFTComplex( -s4.imag(), s4.real() )
+                                         : FFTComplex( s4.imag(), -s4.real() );
+      out[u + m] = s5 + rotated;
+      out[u + 3 * m] = s5 - rotated;
+      }
+    }
+
+  static void Butterfly5( FFTComplex * out, std::size_t stride, std::size_t m,
+                          const std::vector< FFTComplex > & twiddles )
+    {
+    const FFTComplex ya = twiddles[stride * m];
+    const FFTComplex yb = twiddles[2 * stride * m];
+    for( std::size_t u = 0; u < m; u++ )
+      {
+      const FFTComplex s0 = out[u];
+      const FFTComplex s1 = FFTMultiply( out[u + m], twiddles[u * stride] );
+      const FFTComplex s2 = FFTMultiply( out[u + 2 * m], twiddles[2 * u * stride] );
+      const FFTComplex s3 = FFTMultiply( out[u + 3 * m], twiddles[3 * u * stride] );
+      const FFTComplex s4 = FFTMultiply( out[u + 4 * m], twiddles[4 * u * stride] );
+      const FFTComplex s7 = s1 + s4;
+      const FFTComplex s10 = s1 - s4;
+      const FFTComplex s8 = s2 + s3;
+      const FFTComplex s9 = s2 - s3;
+      out[u] = s0 + s7 + s8;
+
+      const FFTComplex s5 = s0 + s7 * ya.real() + s8 * yb.real();
+      const FFTComplex s6( s10.imag() * ya.imag() + s9.imag() * yb.imag(),
+                           -s10.real() * ya.imag() - s9.real() * yb.imag() );
+      out[u + m] = s5 - s6;
+      out[u + 4 * m] = s5 + s6;
+
+      const FFTComplex s11 = s0 + s7 * yb.real() + s8 * ya.real();
+      const FFTComplex s12( -s10.imag() * yb.imag() + s9.imag() * ya.imag(),
+                            s10.real() * yb.imag() - s9.real() * ya.imag() );
+      out[u + 2 * m] = s11 + s12;
+      out[u + 3 * m] = s11 - s12;
+      }
+    }
+
+  void ButterflyGeneric( FFTComplex * out, std::size_t stride, std::size_t m, std::size_t p,
+                         const std::vector< FFTComplex > & twiddles, FFTComplex * scratch ) const
+    {
+    for( std::size_t u = 0; u < m; u++ )
+      {
+      std::size_t k = u;
+      for( std::size_t q = 0; q < p; q++, k += m )
+        {
+        scratch[q] = out[k];
+        }
+      k = u;
+      for( std::size_t q1 = 0; q1 < p; q1++, k += m )
+        {
+        std::size_t index = 0;
+        FFTComplex sum = scratch[0];
+        for( std::size_t q = 1; q < p; q++ )
+          {
+          index += stride * k;
+          if( index >= m_Length )
+            {
+            index %= m_Length;
+            }
+          sum += FFTMultiply( scratch[q], twiddles[index] );
+          }
+        out[k] = sum;
+        }
+      }
+    }
+
+  std::size_t                m_Length;
+  std::size_t                m_LargestFactor;
+  std::vector< std::size_t > m_Factors;
+  std::vector< FFTComplex >  m_Forward;
+  std::vector< FFTComplex >  m_Inverse;
+};
+
+// Real-to-complex transform of one length N, producing the N/2 + 1
+// non-redundant coefficients. Even lengths run a complex transform of
+// length N/2 on the packed samples.
+class RealFFTPlan
+{
+public:
+  explicit RealFFTPlan( std::size_t length = 2 )
+    {
+    Initialize( length );
+    }
+
+  void Initialize( std::size_t length )
+    {
+    m_Length = length > 0 ? length : 1;
+    m_Even = ( m_Length % 2 == 0 );
+    m_Complex.Initialize( m_Even ? m_Length / 2 : m_Length );
+    const double pi = 3.14159265358979323846;
+    m_Twiddles.resize( m_Length / 2 + 1 );
+    for( std::size_t k = 0; k < m_Twiddles.size(); k++ )
+      {
+      const double phase = -2.0 * pi * static_cast< double >( k ) / static_cast< double >( m_Length );
+      m_Twiddles[k] = FFTComplex( std::cos( phase ), std::sin( phase ) );
+      }
+    }
+
+  std::size_t GetLength() const { return m_Length; }
+  std::size_t GetNumberOfCoefficients() const { return m_Length / 2 + 1; }
+
+  // Workspace for Forward()/Inverse(); one buffer per thread.
+  std::size_t GetWorkSize() const
+    {
+    return 2 * m_Complex.GetLength() + m_Complex.GetScratchSize();
+    }
+
+  void Forward( const double * in, FFTComplex * out, FFTComplex * work ) const
+    {
+    const std::size_t n = m_Complex.GetLength();
+    FFTComplex * packed = work;
+    FFTComplex * spectrum = work + n;
+    FFTComplex * scratch = work + 2 * n;
+    if( !m_Even )
+      {
+      for( std::size_t i = 0; i < n; i++ )
+        {
+        packed[i] = FFTComplex( in[i], 0.0 );
+        }
+      m_Complex.Transform( packed, spectrum, false, scratch );
+      for( std::size_t k = 0; k <= m_Length / 2; k++ )
+        {
+        out[k] = spectrum[k];
+        }
+      return;
+      }
+    for( std::size_t i = 0; i < n; i++ )
+      {
+      packed[i] = FFTComplex( in[2 * i], in[2 * i + 1] );
+      }
+    m_Complex.Transform( packed, spectrum, false, scratch );
+    for( std::size_t k = 0; k <= n; k++ )
+      {
+      const FFTComplex a = spectrum[k == n ? 0 : k];
+      const FFTComplex b = std::conj( spectrum[k == 0 ? 0 : n - k] );
+      const FFTComplex even = 0.5 * ( a + b );
+      const FFTComplex d = a - b;
+      const FFTComplex odd( 0.5 * d.imag(), -0.5 * d.real() );
+      out[k] = even + FFTMultiply( m_Twiddles[k], odd );
+      }
+    }
+
+  // Inverse of Forward(), scaled by N (unnormalized like FFTPlan).
+  void Inverse( const FFTComplex * in, double * out, FFTComplex * work ) const
+    {
+    const std::size_t n = m_Complex.GetLength();
+    FFTComplex * packed = work;
+    FFTComplex * signal = work + n;
+    FFTComplex * scratch = work + 2 * n;
+    if( !m_Even )
+      {
+      for( std::size_t k = 0; k < n; k++ )
+        {
+        packed[k] = ( k <= n / 2 ) ? in[k] : std::conj( in[n - k] );
+        }
+      m_Complex.Transform( packed, signal, true, scratch );
+      for( std::size_t i = 0; i < n; i++ )
+        {
+        out[i] = signal[i].real();
+        }
+      return;
+      }
+    for( std::size_t k = 0; k < n; k++ )
+      {
+      const FFTComplex a = in[k];
+      const FFTComplex b = std::conj( in[n - k] );
+      const FFTComplex even = a + b;
+      const FFTComplex odd = FFTMultiply( a - b, std::conj( m_Twiddles[k] ) );
+      packed[k] = even + FFTComplex( -odd.imag(), odd.real() );
+      }
+    m_Complex.Transform( packed, signal, true, scratch );
+    for( std::size_t i = 0; i < n; i++ )
+      {
+      out[2 * i] = signal[i].real();
+      out[2 * i + 1] = signal[i].imag();
+      }
+    }
+
+private:
+  std::size_t               m_Length;
+  bool                      m_Even;
+  FFTPlan                   m_Complex;
+  std::vector< FFTComplex > m_Twiddles;
+};
+
+#endif
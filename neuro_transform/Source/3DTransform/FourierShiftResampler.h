@@ -0,0 +1,322 @@
+// AUTHOR: Christian McDaniel
+//
+// Exact band-limited translation: the volume is zero padded, transformed
+// with real-to-complex FFTs, multiplied by the phase ramp of the shift and
+// transformed back. This is the ideal (unwindowed) sinc interpolation of a
+// shift, in O(N log N) instead of one 216-tap sinc per voxel.
+//
+// Padding is large enough that the circular shift never wraps image content
+// around; voxels whose source lies outside the input get 0, as in
+// ResampleImageFilter. The FFT plans are kept for as long as the padded
+// size does not change, so one resampler translates any number of volumes
+// of the same size without re-planning.
+
+#ifndef FourierShiftResampler_h
+#define FourierShiftResampler_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "FFTPlan.h"
+#include "OutputThreshold.h"
+#include "ParallelFor.h"
+
+template< typename TPixel >
+class FourierShiftResampler
+{
+public:
+  FourierShiftResampler()
+    : m_Input( 0 ), m_Output( 0 ),
+      m_NumberOfThreads( std::thread::hardware_concurrency() )
+    {
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_Size[d] = 0;
+      m_PaddedSize[d] = 0;
+      m_Shift[d] = 0.0;
+      }
+    }
+
+  void SetInput( const TPixel * buffer, const std::size_t size[3] )
+    {
+    m_Input = buffer;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_Size[d] = size[d];
+      }
+    }
+
+  // Output has the size of the input.
+  void SetOutput( TPixel * buffer ) { m_Output = buffer; }
+
+  // out(p) = in(p + shift), in voxels.
+  void SetShift( const double shift[3] )
+    {
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_Shift[d] = shift[d];
+      }
+    }
+
+  void SetNumberOfThreads( unsigned int threads ) { m_NumberOfThreads = threads > 0 ? threads : 1; }
+
+  // Applied to the shifted values before they are rounded.
+  void SetOutputThreshold( const OutputThreshold & threshold ) { m_Threshold = threshold; }
+
+  const std::size_t * GetPaddedSize() const { return m_PaddedSize; }
+
+  void Update()
+    {
+    // Guard band for the sinc tails of content shifted next to the border.
+    const std::size_t guard = 8;
+    std::size_t padded[3];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      const std::size_t reach = static_cast< std::size_t >( std::ceil( std::fabs( m_Shift[d] ) ) );
+      padded[d] = NextFastFFTLength( m_Size[d] + std::min( reach, m_Size[d] ) + guard );
+      }
+    if( padded[0] != m_PaddedSize[0] || padded[1] != m_PaddedSize[1] || padded[2] != m_PaddedSize[2] )
+      {
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        m_PaddedSize[d] = padded[d];
+        }
+      m_RowPlan.Initialize( m_PaddedSize[0] );
+      m_ColumnPlan.Initialize( m_PaddedSize[1] );
+      m_SlicePlan.Initialize( m_PaddedSize[2] );
+      }
+
+    const std::size_t width = m_RowPlan.GetNumberOfCoefficients();
+    m_Spectrum.assign( width * m_PaddedSize[1] * m_PaddedSize[2], FFTComplex( 0.0, 0.0 ) );
+
+    // Rows of the zero padding stay zero in the spectrum; only the input
+    // rows need a real-to-complex transform.
+    RowFunctor forwardRows( this, false );
+    ParallelFor( 0, m_Size[1] * m_Size[2], 64, m_NumberOfThreads, forwardRows );
+    ColumnFunctor forwardColumns( this, 1, false );
+    ParallelFor( 0, m_Size[2], 1, m_NumberOfThreads, forwardColumns );
+    ColumnFunctor forwardSlices( this, 2, false );
+    ParallelFor( 0, m_PaddedSize[1], 1, m_NumberOfThreads, forwardSlices );
+
+    ApplyPhaseRamp( width );
+
+    // Going back, only the slices and rows that hold output voxels matter.
+    ColumnFunctor inverseSlices( this, 2, true );
+    ParallelFor( 0, m_PaddedSize[1], 1, m_NumberOfThreads, inverseSlices );
+    ColumnFunctor inverseColumns( this, 1, true );
+    ParallelFor( 0, m_Size[2], 1, m_NumberOfThreads, inverseColumns );
+    RowFunctor inverseRows( this, true );
+    ParallelFor( 0, m_Size[1] * m_Size[2], 64, m_NumberOfThreads, inverseRows );
+    }
+
+private:
+  // Separable phase factors exp(2 pi i k s / N) per axis; the Nyquist bin of
+  // an even axis gets the real cos(pi s) so the result stays real.
+  static void PhaseFactors( std::size_t length, std::size_t count, double shift, std::vector< FFTComplex > & factors )
+    {
+    const double pi = 3.14159265358979323846;
+    factors.resize( count );
+    for( std::size_t k = 0; k < count; k++ )
+      {
+      if( length % 2 == 0 && k == length / 2 )
+        {
+        factors[k] = FFTComplex( std::cos( pi * shift ), 0.0 );
+        continue;
+        }
+      const double frequency = ( k <= length / 2 ) ? static_cast< double >( k )
+                                                   : static_cast< double >( k ) - static_cast< double >( length );
+      const double phase = 2.0 * pi * frequency * shift / static_cast< double >( length );
+      factors[k] = FFTComplex( std::cos( phase ), std::sin( phase ) );
+      }
+    }
+
+  void ApplyPhaseRamp( std::size_t width )
+    {
+    std::vector< FFTComplex > fx;
+    std::vector< FFTComplex > fy;
+    std::vector< FFTComplex > fz;
+    PhaseFactors( m_PaddedSize[0], width, m_Shift[0], fx );
+    PhaseFactors( m_PaddedSize[1], m_PaddedSize[1], m_Shift[1], fy );
+    PhaseFactors( m_PaddedSize[2], m_PaddedSize[2], m_Shift[2], fz );
+    // Fold the inverse transform's 1/N normalization in here.
+    const double scale = 1.0 / ( static_cast< double >( m_PaddedSize[0] )
+                               * static_cast< double >( m_PaddedSize[1] )
+                               * static_cast< double >( m_PaddedSize[2] ) );
+    for( std::size_t z = 0; z < m_PaddedSize[2]; z++ )
+      {
+      for( std::size_t y = 0; y < m_PaddedSize[1]; y++ )
+        {
+        const FFTComplex fyz = FFTMultiply( fy[y], fz[z] ) * scale;
+        FFTComplex * row = &m_Spectrum[( z * m_PaddedSize[1] + y ) * width];
+        for( std::size_t x = 0; x < width; x++ )
+          {
+          row[x] = FFTMultiply( row[x], FFTMultiply( fx[x], fyz ) );
+          }
+        }
+      }
+    }
+
+  struct RowFunctor
+  {
+    RowFunctor( FourierShiftResampler * self, bool inverse ) : m_Self( self ), m_Inverse( inverse ) {}
+
+    void operator()( std::size_t first, std::size_t last, unsigned int ) const
+      {
+      FourierShiftResampler & s = *m_Self;
+      const std::size_t width = s.m_RowPlan.GetNumberOfCoefficients();
+      std::vector< FFTComplex > work( s.m_RowPlan.GetWorkSize() );
+      std::vector< double > line( s.m_PaddedSize[0], 0.0 );
+      for( std::size_t row = first; row < last; row++ )
+        {
+        const std::size_t y = row % s.m_Size[1];
+        const std::size_t z = row / s.m_Size[1];
+        FFTComplex * spectrum = &s.m_Spectrum[( z * s.m_PaddedSize[1] + y ) * width];
+        if( !m_Inverse )
+          {
+          const TPixel * in = s.m_Input + row * s.m_Size[0];
+          for( std::size_t x = 0; x < s.m_Size[0]; x++ )
+            {
+            line[x] = static_cast< double >( in[x] );
+            }
+          s.m_RowPlan.Forward( &line[0], spectrum, &work[0] );
+          continue;
+          }
+
+        s.m_RowPlan.Inverse( spectrum, &line[0], &work[0] );
+        TPixel * out = s.m_Output + row * s.m_Size[0];
+        const double fy = static_cast< double >( y ) + s.m_Shift[1];
+        const double fz = static_cast< double >( z ) + s.m_Shift[2];
+        const bool rowInside = fy >= -0.5 && fy < static_cast< double >( s.m_Size[1] ) - 0.5
+                            && fz >= -0.5 && fz < static_cast< double >( s.m_Size[2] ) - 0.5;
+        for( std::size_t x = 0; x < s.m_Size[0]; x++ )
+          {
+          const double fx = static_cast< double >( x ) + s.m_Shift[0];
+          if( !rowInside || !( fx >= -0.5 && fx < static_cast< double >( s.m_Size[0] ) - 0.5 ) )
+            {
+            out[x] = s.m_Threshold.template Apply< TPixel >( 0.0 );
+            continue;
+            }
+          out[x] = s.Store( line[x] );
+          }
+        }
+      }
+
+    FourierShiftResampler * m_Self;
+    bool                    m_Inverse;
+  };
+
+  // Complex transforms along y (axis 1, one task per z slice) or z (axis 2,
+  // one task per y row). Blocks of neighboring x columns are gathered
+  // together so the strided reads use whole cache lines.
+  struct ColumnFunctor
+  {
+    ColumnFunctor( FourierShiftResampler * self, unsigned int axis, bool inverse )
+      : m_Self( self ), m_Axis( axis ), m_Inverse( inverse ) {}
+
+    void operator()( std::size_t first, std::size_t last, unsigned int ) const
+      {
+      FourierShiftResampler & s = *m_Self;
+      const std::size_t width = s.m_RowPlan.GetNumberOfCoefficients();
+      const FFTPlan & plan = ( m_Axis == 1 ) ? s.m_ColumnPlan : s.m_SlicePlan;
+      const std::size_t length = plan.GetLength();
+      const std::size_t stride = ( m_Axis == 1 ) ? width : width * s.m_PaddedSize[1];
+      const std::size_t block = 16;
+      std::vector< FFTComplex > gathered( block * length );
+      std::vector< FFTComplex > transformed( length );
+      std::vector< FFTComplex > scratch( plan.GetScratchSize() + 1 );
+      for( std::size_t outer = first; outer < last; outer++ )
+        {
+        FFTComplex * base = ( m_Axis == 1 )
+          ? &s.m_Spectrum[outer * s.m_PaddedSize[1] * width]
+          : &s.m_Spectrum[outer * width];
+        for( std::size_t x0 = 0; x0 < width; x0 += block )
+          {
+          const std::size_t count = std::min( block, width - x0 );
+          for( std::size_t t = 0; t < length; t++ )
+            {
+            const FFTComplex * in = base + t * stride + x0;
+            for( std::size_t b = 0; b < count; b++ )
+              {
+              gathered[b * length + t] = in[b];
+              }
+            }
+          for( std::size_t b = 0; b < count; b++ )
+            {
+            plan.Transform( &gathered[b * length], &transformed[0], m_Inverse, &scratch[0] );
+            std::copy( transformed.begin(), transformed.end(), gathered.begin() + b * length );
+            }
+          for( std::size_t t = 0; t < length; t++ )
+            {
+            FFTComplex * out = base + t * stride + x0;
+            for( std::size_t b = 0; b < count; b++ )
+              {
+              out[b] = gathered[b * length + t];
+              }
+            }
+          }
+        }
+      }
+
+    FourierShiftResampler * m_Self;
+    unsigned int            m_Axis;
+    bool                    m_Inverse;
+  };
+
+  // Nearest-integer conversion clamped to the pixel range. Unlike the sinc
+  // kernels, which truncate like ResampleImageFilter, the FFT result carries
+  // round-off around exact values (an integer shift gives 99.9999...), so
+  // it is rounded.
+  static TPixel RoundCast( double value )
+    {
+    const double minimum = static_cast< double >( std::numeric_limits< TPixel >::lowest() );
+    const double maximum = static_cast< double >( std::numeric_limits< TPixel >::max() );
+    if( std::numeric_limits< TPixel >::is_integer )
+      {
+      value = std::floor( value + 0.5 );
+      }
+    if( value < minimum )
+      {
+      return std::numeric_limits< TPixel >::lowest();
+      }
+    if( value > maximum )
+      {
+      return std::numeric_limits< TPixel >::max();
+      }
+    return static_cast< TPixel >( value );
+    }
+
+  // Without a threshold the value is rounded; with one, it is compared with
+  // the FFT round-off removed, so an exact gray level g still meets a
+  // threshold of g.
+  TPixel Store( double value ) const
+    {
+    if( !m_Threshold.Enabled )
+      {
+      return RoundCast( value );
+      }
+    const double nearest = std::floor( value + 0.5 );
+    if( std::fabs( value - nearest ) < 1e-6 )
+      {
+      value = nearest;
+      }
+    return m_Threshold.Apply< TPixel >( value );
+    }
+
+  const TPixel *            m_Input;
+  TPixel *                  m_Output;
+  std::size_t               m_Size[3];
+  std::size_t               m_PaddedSize[3];
+  double                    m_Shift[3];
+  unsigned int              m_NumberOfThreads;
+  RealFFTPlan               m_RowPlan;
+  FFTPlan                   m_ColumnPlan;
+  FFTPlan                   m_SlicePlan;
+  std::vector< FFTComplex > m_Spectrum;
+  OutputThreshold           m_Threshold;
+};
+
+#endif
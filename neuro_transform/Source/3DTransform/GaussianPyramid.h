@@ -0,0 +1,317 @@
+// AUTHOR: Christian McDaniel
+//
+// Gaussian pyramid of a 3D buffer for anti-aliased minification. Each
+// level halves every axis after a separable [1 3 3 1] / 8 binomial blur
+// (an approximation of a Gaussian with sigma ~ 0.9 voxel of the finer
+// level); the voxels of level l+1 lie halfway between pairs of voxels of
+// level l, so all levels cover the extent of the input.
+//
+// A transform that minifies by a factor s resamples level ~log2(s) with
+// its mapping rescaled (GetLevelMapping), so the interpolation kernel sees
+// an image that is already band limited for the output grid instead of
+// point-sampling the full resolution input. Levels are built on first use
+// and kept, so any number of transforms of one volume share them.
+
+#ifndef GaussianPyramid_h
+#define GaussianPyramid_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ParallelFor.h"
+#include "ResampleGeometry.h"
+
+template< typename TPixel >
+class GaussianPyramid
+{
+public:
+  // Levels are not made smaller than this along any axis.
+  static const std::size_t MinimumSize = 8;
+
+  GaussianPyramid()
+    : m_Input( 0 ), m_NumberOfThreads( std::thread::hardware_concurrency() )
+    {
+    m_Size[0] = m_Size[1] = m_Size[2] = 0;
+    }
+
+  // Discards the levels of a previous input.
+  void SetInput( const TPixel * buffer, const std::size_t size[3] )
+    {
+    std::lock_guard< std::mutex > lock( m_Mutex );
+    m_Input = buffer;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_Size[d] = size[d];
+      }
+    m_Levels.clear();
+    m_LevelSizes.clear();
+    }
+
+  void SetNumberOfThreads( unsigned int threads ) { m_NumberOfThreads = threads > 0 ? threads : 1; }
+
+  // Size of level `level` along every axis: ceil( size / 2^level ). When
+  // `size` is not a multiple of 2^level the level reaches past the input:
+  // its last voxel is centred 2^level (n - 1) + (2^level - 1) / 2 input
+  // voxels from the first, and its extent ends up to 2^level - 1 input
+  // voxels after the input's (see ClipToInput).
+  static void GetLevelSize( const std::size_t size[3], unsigned int level, std::size_t levelSize[3] )
+    {
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      levelSize[d] = size[d];
+      for( unsigned int l = 0; l < level; l++ )
+        {
+        levelSize[d] = ( levelSize[d] + 1 ) / 2;
+        }
+      }
+    }
+
+  // The level for a mapping from output to input indices: the nearest
+  // power of two to the smallest input step per output voxel, so no axis is
+  // blurred more than it is minified. 0 when the mapping does not minify.
+  static unsigned int SelectLevel( const IndexMapping & mapping, const std::size_t size[3] )
+    {
+    double step = std::numeric_limits< double >::max();
+    for( unsigned int j = 0; j < 3; j++ )
+      {
+      double norm = 0.0;
+      for( unsigned int i = 0; i < 3; i++ )
+        {
+        norm += mapping.Matrix[i][j] * mapping.Matrix[i][j];
+        }
+      step = std::min( step, std::sqrt( norm ) );
+      }
+    if( !( step > 1.0 ) )
+      {
+      return 0;
+      }
+    unsigned int level = static_cast< unsigned int >( std::floor( std::log2( step ) + 0.5 ) );
+    std::size_t levelSize[3];
+    while( level > 0 )
+      {
+      GetLevelSize( size, level, levelSize );
+      if( levelSize[0] >= MinimumSize && levelSize[1] >= MinimumSize && levelSize[2] >= MinimumSize )
+        {
+        break;
+        }
+      level--;
+      }
+    return level;
+    }
+
+  // The mapping to the indices of level `level`: a level voxel i sits at
+  // input index 2^level i + (2^level - 1) / 2.
+  static IndexMapping GetLevelMapping( const IndexMapping & mapping, unsigned int level )
+    {
+    const double factor = std::ldexp( 1.0, static_cast< int >( level ) );
+    IndexMapping scaled;
+    for( unsigned int i = 0; i < 3; i++ )
+      {
+      for( unsigned int j = 0; j < 3; j++ )
+        {
+        scaled.Matrix[i][j] = mapping.Matrix[i][j] / factor;
+        }
+      scaled.Offset[i] = ( mapping.Offset[i] - 0.5 * ( factor - 1.0 ) ) / factor;
+      }
+    return scaled;
+    }
+
+  // The physical grid of level `level` of an input on `geometry`, i.e. the
+  // voxel positions that GetLevelMapping assumes (so, like GetLevelSize,
+  // possibly extending past the input on the far side).
+  static ImageGeometry GetLevelGeometry( const ImageGeometry & geometry, unsigned int level )
+    {
+    const double factor = std::ldexp( 1.0, static_cast< int >( level ) );
+    ImageGeometry grid = geometry;
+    GetLevelSize( geometry.Size, level, grid.Size );
+    double shift[3];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      shift[d] = 0.5 * ( factor - 1.0 ) * geometry.Spacing[d];
+      grid.Spacing[d] = factor * geometry.Spacing[d];
+      }
+    double offset[3];
+    MultiplyMatrixVector( geometry.Direction, shift, offset );
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      grid.Origin[d] += offset[d];
+      }
+    return grid;
+    }
+
+  // Sets the output voxels that `mapping` (to the indices of the input,
+  // not of a level) takes outside the input, [-0.5, size - 0.5) as for the
+  // resampling kernels, to `value`. Resampling a level leaves samples in
+  // the part of the level past the input (GetLevelSize) with blurred edge
+  // values; this gives them the default value, as at level 0.
+  static void ClipToInput( const IndexMapping & mapping, const std::size_t inputSize[3], TPixel * output,
+                           const std::size_t outputSize[3], TPixel value )
+    {
+    double lower[3];
+    double upper[3];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      lower[d] = -0.5;
+      upper[d] = static_cast< double >( inputSize[d] ) - 0.5;
+      }
+    for( std::size_t k = 0; k < outputSize[2]; k++ )
+      {
+      for( std::size_t j = 0; j < outputSize[1]; j++ )
+        {
+        std::size_t first;
+        std::size_t last;
+        ComputeRowSpan( mapping, j, k, outputSize[0], lower, upper, first, last );
+        TPixel * row = output + ( k * outputSize[1] + j ) * outputSize[0];
+        std::fill( row, row + first, value );
+        std::fill( row + std::max( first, last ), row + outputSize[0], value );
+        }
+      }
+    }
+
+  // Buffer of level `level` (0 is the input), building the missing levels.
+  // Safe to call from several threads.
+  const TPixel * GetLevel( unsigned int level, std::size_t size[3] )
+    {
+    std::lock_guard< std::mutex > lock( m_Mutex );
+    if( level == 0 )
+      {
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        size[d] = m_Size[d];
+        }
+      return m_Input;
+      }
+    while( m_Levels.size() < level )
+      {
+      const TPixel * finer = m_Levels.empty() ? m_Input : &m_Levels.back()[0];
+      std::vector< std::size_t > finerSize( m_Size, m_Size + 3 );
+      if( !m_LevelSizes.empty() )
+        {
+        finerSize = m_LevelSizes.back();
+        }
+      std::vector< std::size_t > coarserSize( 3 );
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        coarserSize[d] = ( finerSize[d] + 1 ) / 2;
+        }
+      m_Levels.push_back( std::vector< TPixel >() );
+      Reduce( finer, &finerSize[0], &coarserSize[0], m_Levels.back() );
+      m_LevelSizes.push_back( coarserSize );
+      }
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      size[d] = m_LevelSizes[level - 1][d];
+      }
+    return &m_Levels[level - 1][0];
+    }
+
+private:
+  // One separable pass along `axis`: out(i) = (in(2i-1) + 3 in(2i) +
+  // 3 in(2i+1) + in(2i+2)) / 8 with clamped indices. Rows are the lines
+  // along `axis`; the buffers are x-fastest with the given sizes.
+  struct ReduceFunctor
+  {
+    void operator()( std::size_t first, std::size_t last, unsigned int ) const
+      {
+      const std::size_t stride = ( m_Axis == 0 ) ? 1 : ( m_Axis == 1 ? m_InSize[0] : m_InSize[0] * m_InSize[1] );
+      const std::size_t outStride = ( m_Axis == 0 ) ? 1 : ( m_Axis == 1 ? m_OutSize[0] : m_OutSize[0] * m_OutSize[1] );
+      const std::ptrdiff_t lastIndex = static_cast< std::ptrdiff_t >( m_InSize[m_Axis] ) - 1;
+      for( std::size_t line = first; line < last; line++ )
+        {
+        // line enumerates the positions in the two other axes.
+        std::size_t inStart;
+        std::size_t outStart;
+        if( m_Axis == 0 )
+          {
+          inStart = line * m_InSize[0];
+          outStart = line * m_OutSize[0];
+          }
+        else if( m_Axis == 1 )
+          {
+          const std::size_t x = line % m_InSize[0];
+          const std::size_t z = line / m_InSize[0];
+          inStart = z * m_InSize[0] * m_InSize[1] + x;
+          outStart = z * m_OutSize[0] * m_OutSize[1] + x;
+          }
+        else
+          {
+          inStart = line;
+          outStart = line;
+          }
+        const float * in = m_In + inStart;
+        for( std::size_t i = 0; i < m_OutSize[m_Axis]; i++ )
+          {
+          const std::ptrdiff_t center = 2 * static_cast< std::ptrdiff_t >( i );
+          float sum = 0.0f;
+          for( std::ptrdiff_t t = -1; t <= 2; t++ )
+            {
+            std::ptrdiff_t index = center + t;
+            index = index < 0 ? 0 : ( index > lastIndex ? lastIndex : index );
+            sum += ( ( t == 0 || t == 1 ) ? 3.0f : 1.0f ) * in[static_cast< std::size_t >( index ) * stride];
+            }
+          m_Out[outStart + i * outStride] = sum * 0.125f;
+          }
+        }
+      }
+
+    const float *       m_In;
+    float *             m_Out;
+    const std::size_t * m_InSize;
+    const std::size_t * m_OutSize;
+    unsigned int        m_Axis;
+  };
+
+  void Reduce( const TPixel * input, const std::size_t inSize[3], const std::size_t outSize[3],
+               std::vector< TPixel > & output ) const
+    {
+    std::vector< float > current( input, input + inSize[0] * inSize[1] * inSize[2] );
+    std::size_t size[3] = { inSize[0], inSize[1], inSize[2] };
+    for( unsigned int axis = 0; axis < 3; axis++ )
+      {
+      std::size_t reduced[3] = { size[0], size[1], size[2] };
+      reduced[axis] = outSize[axis];
+      std::vector< float > next( reduced[0] * reduced[1] * reduced[2] );
+      ReduceFunctor functor;
+      functor.m_In = &current[0];
+      functor.m_Out = &next[0];
+      functor.m_InSize = size;
+      functor.m_OutSize = reduced;
+      functor.m_Axis = axis;
+      const std::size_t lines = ( size[0] * size[1] * size[2] ) / size[axis];
+      ParallelFor( 0, lines, 64, m_NumberOfThreads, functor );
+      current.swap( next );
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        size[d] = reduced[d];
+        }
+      }
+
+    output.resize( current.size() );
+    const double minimum = static_cast< double >( std::numeric_limits< TPixel >::lowest() );
+    const double maximum = static_cast< double >( std::numeric_limits< TPixel >::max() );
+    for( std::size_t n = 0; n < current.size(); n++ )
+      {
+      double value = current[n];
+      if( std::numeric_limits< TPixel >::is_integer )
+        {
+        value = std::floor( value + 0.5 );
+        }
+      value = value < minimum ? minimum : ( value > maximum ? maximum : value );
+      output[n] = static_cast< TPixel >( value );
+      }
+    }
+
+  const TPixel *                              m_Input;
+  std::size_t                                 m_Size[3];
+  unsigned int                                m_NumberOfThreads;
+  std::vector< std::vector< TPixel > >        m_Levels;
+  std::vector< std::vector< std::size_t > >   m_LevelSizes;
+  std::mutex                                  m_Mutex;
+};
+
+#endif
@@ -0,0 +1,131 @@
+// AUTHOR: Christian McDaniel
+//
+// Conversions between ITK images/transforms and the plain structures in
+// {ResampleGeometry.h} used by the raw-buffer resampling kernels.
+
+#ifndef ImageGeometryAdaptor_h
+#define ImageGeometryAdaptor_h
+
+#include "itkImage.h"
+
+#include "ResampleGeometry.h"
+
+// Geometry of the largest possible region of a 3D image.
+template< typename TImage >
+ImageGeometry GetImageGeometry( const TImage * image )
+{
+  ImageGeometry geometry;
+  const typename TImage::SizeType & size = image->GetLargestPossibleRegion().GetSize();
+  for( unsigned int i = 0; i < 3; i++ )
+    {
+    geometry.Origin[i] = image->GetOrigin()[i];
+    geometry.Spacing[i] = image->GetSpacing()[i];
+    geometry.Size[i] = size[i];
+    for( unsigned int j = 0; j < 3; j++ )
+      {
+      geometry.Direction[i][j] = image->GetDirection()[i][j];
+      }
+    }
+  return geometry;
+}
+
+// Sets regions, origin, spacing and direction; the caller allocates.
+template< typename TImage >
+void SetImageGeometry( TImage * image, const ImageGeometry & geometry )
+{
+  typename TImage::SizeType size;
+  typename TImage::PointType origin;
+  typename TImage::SpacingType spacing;
+  typename TImage::DirectionType direction;
+  for( unsigned int i = 0; i < 3; i++ )
+    {
+    size[i] = geometry.Size[i];
+    origin[i] = geometry.Origin[i];
+    spacing[i] = geometry.Spacing[i];
+    for( unsigned int j = 0; j < 3; j++ )
+      {
+      direction[i][j] = geometry.Direction[i][j];
+      }
+    }
+  typename TImage::RegionType region;
+  region.SetSize( size );
+  image->SetRegions( region );
+  image->SetOrigin( origin );
+  image->SetSpacing( spacing );
+  image->SetDirection( direction );
+}
+
+// For a 4D series: the first three axes from `geometry`, the fourth (time)
+// axis from `series`; the caller allocates.
+template< typename TSeries >
+void SetSeriesGeometry( TSeries * image, const ImageGeometry & geometry, const TSeries * series )
+{
+  const unsigned int dimension = TSeries::ImageDimension;
+  typename TSeries::SizeType size = series->GetLargestPossibleRegion().GetSize();
+  typename TSeries::PointType origin = series->GetOrigin();
+  typename TSeries::SpacingType spacing = series->GetSpacing();
+  typename TSeries::DirectionType direction = series->GetDirection();
+  for( unsigned int i = 0; i < dimension; i++ )
+    {
+    for( unsigned int j = 0; j < dimension; j++ )
+      {
+      if( i < 3 && j < 3 )
+        {
+        direction[i][j] = geometry.Direction[i][j];
+        }
+      else if( i < 3 || j < 3 )
+        {
+        direction[i][j] = 0.0;
+        }
+      }
+    if( i < 3 )
+      {
+      size[i] = geometry.Size[i];
+      origin[i] = geometry.Origin[i];
+      spacing[i] = geometry.Spacing[i];
+      }
+    }
+  typename TSeries::RegionType region;
+  region.SetSize( size );
+  image->SetRegions( region );
+  image->SetOrigin( origin );
+  image->SetSpacing( spacing );
+  image->SetDirection( direction );
+}
+
+// Matrix and offset of any MatrixOffsetTransformBase-derived transform.
+template< typename TTransform >
+AffineMapping GetAffineMapping( const TTransform * transform )
+{
+  AffineMapping mapping;
+  for( unsigned int i = 0; i < 3; i++ )
+    {
+    for( unsigned int j = 0; j < 3; j++ )
+      {
+      mapping.Matrix[i][j] = transform->GetMatrix()[i][j];
+      }
+    mapping.Offset[i] = transform->GetOffset()[i];
+    }
+  return mapping;
+}
+
+// Sets the matrix and offset of such a transform (its center is kept, the
+// translation follows from the offset).
+template< typename TTransform >
+void SetAffineMapping( TTransform * transform, const AffineMapping & mapping )
+{
+  typename TTransform::MatrixType matrix;
+  typename TTransform::OffsetType offset;
+  for( unsigned int i = 0; i < 3; i++ )
+    {
+    for( unsigned int j = 0; j < 3; j++ )
+      {
+      matrix[i][j] = mapping.Matrix[i][j];
+      }
+    offset[i] = mapping.Offset[i];
+    }
+  transform->SetMatrix( matrix );
+  transform->SetOffset( offset );
+}
+
+#endif
@@ -0,0 +1,1034 @@
+// AUTHOR: Christian McDaniel
+//
+// Multi-resolution rigid or affine registration of two 3D buffers, in the
+// spirit of ITK's ImageRegistration5 example but on the raw buffers the
+// resamplers in this directory use. The estimated transform maps points of
+// the fixed image to points of the moving image (x_moving = Matrix *
+// x_fixed + Offset), i.e. exactly the AffineMapping that resamples the
+// moving image onto the fixed grid.
+//
+//   - Both images are reduced with GaussianPyramid; the coarsest level is
+//     registered first and each finer level starts from its result.
+//   - The metric is the mean squared difference of the gray levels (for
+//     images of the same contrast) or Mattes' mutual information (for
+//     different modalities, see MattesMutualInformation.h), over the fixed
+//     voxels that map into the moving image (trilinear interpolation), with
+//     its analytic gradient. The fixed voxels are all those of a regular
+//     grid of at most about 2M voxels, or a random or stratified selection
+//     of a given percentage of them (fixed for each level). The samples are
+//     split over threads; every thread sums into its own accumulator (for
+//     mutual information its own joint histogram) and the sums are added at
+//     the end.
+//   - The optimizer is LBFGS with a backtracking line search. Rotations
+//     and matrix entries are scaled by the radius of the fixed image so
+//     that all parameters move points by comparable distances (mm); a
+//     level is done when a step moves points by less than 1/100 voxel.
+//
+// The transform is parameterized as a correction applied before an
+// initial transform: x_moving = Initial( A ( x - c ) + c + t ), with c the
+// center of the fixed image, t a translation and A either a rotation
+// (Euler angles about x, then y, then z) or a general matrix.
+//
+// Everything that depends on the fixed image alone (its pyramid, the
+// samples and gray level range of each level, c) lives in a
+// RegistrationTemplate that is computed once and only read afterwards, so
+// one template serves the registrations of many moving images, in
+// parallel. The metric gradient is that of the moving image, so the
+// template holds no gradient images.
+
+#ifndef ImageRegistration_h
+#define ImageRegistration_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "GaussianPyramid.h"
+#include "MattesMutualInformation.h"
+#include "ParallelFor.h"
+#include "ResampleGeometry.h"
+
+// The fixed image of a registration and everything derived from it alone:
+// its pyramid levels, the samples of each level, the gray level range of
+// each level (the rows of the joint histogram) and the center and radius
+// the transform parameters refer to. Update() computes them once; any
+// number of ImageRegistration objects, on any threads, then read them,
+// e.g. when every subject of a cohort is aligned to one template.
+template< typename TPixel >
+class RegistrationTemplate
+{
+public:
+  enum Metric { MeanSquares, MattesMutualInformation };
+
+  // Samples of the fixed image per level and metric evaluation, at most.
+  static const std::size_t MaximumNumberOfSamples = std::size_t( 1 ) << 21;
+  // Samples of a sampled metric, at least (or all voxels of a level).
+  static const std::size_t MinimumNumberOfSamples = std::size_t( 1 ) << 14;
+
+  struct Level
+  {
+    const TPixel *             Fixed;
+    ImageGeometry              FixedGeometry;
+    // The samples: Samples if not empty, else the regular grid of Stride.
+    // The work items of the threads are samples or rows of the grid.
+    std::size_t                Stride;
+    std::vector< std::size_t > Samples;
+    std::size_t                NumberOfItems;
+    std::size_t                Grain;
+    double                     FixedMinimum;
+    double                     FixedMaximum;
+  };
+
+  RegistrationTemplate()
+    : m_Metric( MeanSquares ), m_NumberOfLevels( 4 ), m_NumberOfThreads( std::thread::hardware_concurrency() ),
+      m_NumberOfHistogramBins( 32 ), m_SamplingPercentage( 100.0 ), m_SampleSelection( StratifiedSamples ),
+      m_Seed( 0 ), m_Radius( 0.0 )
+    {
+    m_Center[0] = m_Center[1] = m_Center[2] = 0.0;
+    }
+
+  void SetImage( const TPixel * buffer, const ImageGeometry & geometry )
+    {
+    m_Pyramid.SetInput( buffer, geometry.Size );
+    m_Geometry = geometry;
+    }
+
+  void SetMetric( Metric metric ) { m_Metric = metric; }
+  // Bins per axis of the joint histogram of mutual information.
+  void SetNumberOfHistogramBins( unsigned int bins ) { m_NumberOfHistogramBins = bins; }
+  // Percentage of the fixed voxels of each level at which the metric is
+  // evaluated (100: a regular grid of all of them, or of at most
+  // MaximumNumberOfSamples), how they are selected, and the seed of the
+  // selection.
+  void SetSamplingPercentage( double percentage ) { m_SamplingPercentage = percentage; }
+  void SetSampleSelection( SampleSelection selection ) { m_SampleSelection = selection; }
+  void SetSeed( unsigned long seed ) { m_Seed = seed; }
+  // Pyramid levels, coarsest first: n - 1, ..., 0. Levels whose images
+  // would be smaller than GaussianPyramid::MinimumSize are skipped.
+  void SetNumberOfLevels( unsigned int levels ) { m_NumberOfLevels = levels > 0 ? levels : 1; }
+  void SetNumberOfThreads( unsigned int threads )
+    {
+    m_NumberOfThreads = threads > 0 ? threads : 1;
+    m_Pyramid.SetNumberOfThreads( m_NumberOfThreads );
+    }
+
+  void Update()
+    {
+    double middle[3];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      middle[d] = 0.5 * ( static_cast< double >( m_Geometry.Size[d] ) - 1.0 );
+      }
+    double indexToPhysical[3][3];
+    GetIndexToPhysicalMatrix( m_Geometry, indexToPhysical );
+    MultiplyMatrixVector( indexToPhysical, middle, m_Center );
+    m_Radius = 0.0;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_Center[d] += m_Geometry.Origin[d];
+      const double extent = 0.5 * m_Geometry.Size[d] * m_Geometry.Spacing[d];
+      m_Radius += extent * extent;
+      }
+    m_Radius = std::sqrt( m_Radius );
+
+    m_Levels.clear();
+    m_Levels.resize( m_NumberOfLevels );
+    m_Valid.assign( m_NumberOfLevels, false );
+    for( unsigned int level = 0; level < m_NumberOfLevels; level++ )
+      {
+      m_Valid[level] = BuildLevel( level, m_Levels[level] );
+      }
+    }
+
+  Metric GetMetric() const { return m_Metric; }
+  unsigned int GetNumberOfHistogramBins() const { return m_NumberOfHistogramBins; }
+  unsigned int GetNumberOfLevels() const { return m_NumberOfLevels; }
+  const ImageGeometry & GetGeometry() const { return m_Geometry; }
+  // Center of the fixed image, about which the rotation or matrix of the
+  // parameters acts, and the radius of the image.
+  const double * GetCenter() const { return m_Center; }
+  double GetRadius() const { return m_Radius; }
+  // Level `level`, or 0 if its image is smaller than
+  // GaussianPyramid::MinimumSize (never for level 0).
+  const Level * GetLevel( unsigned int level ) const
+    {
+    return ( level < m_Levels.size() && m_Valid[level] ) ? &m_Levels[level] : 0;
+    }
+
+private:
+  bool BuildLevel( unsigned int level, Level & data )
+    {
+    std::size_t size[3];
+    GaussianPyramid< TPixel >::GetLevelSize( m_Geometry.Size, level, size );
+    for( unsigned int d = 0; level > 0 && d < 3; d++ )
+      {
+      if( size[d] < GaussianPyramid< TPixel >::MinimumSize )
+        {
+        return false;
+        }
+      }
+    data.Fixed = m_Pyramid.GetLevel( level, size );
+    data.FixedGeometry = GaussianPyramid< TPixel >::GetLevelGeometry( m_Geometry, level );
+
+    const std::size_t voxels = data.FixedGeometry.GetNumberOfPixels();
+    data.Stride = static_cast< std::size_t >( std::max(
+      1.0, std::ceil( std::cbrt( static_cast< double >( voxels ) / static_cast< double >( MaximumNumberOfSamples ) ) ) ) );
+    std::size_t gridSize[3];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      gridSize[d] = ( size[d] + data.Stride - 1 ) / data.Stride;
+      }
+    data.NumberOfItems = gridSize[1] * gridSize[2];
+    data.Grain = 4;
+    data.Samples.clear();
+    if( m_SamplingPercentage < 100.0 )
+      {
+      std::size_t count = static_cast< std::size_t >( m_SamplingPercentage / 100.0 * static_cast< double >( voxels ) );
+      count = std::max( count, std::min( voxels, MinimumNumberOfSamples ) );
+      if( count < gridSize[0] * gridSize[1] * gridSize[2] )
+        {
+        SelectSamples( size, count, m_SampleSelection, m_Seed + level, data.Samples );
+        data.NumberOfItems = data.Samples.size();
+        data.Grain = 1024;
+        }
+      }
+    const std::pair< const TPixel *, const TPixel * > range = std::minmax_element( data.Fixed, data.Fixed + voxels );
+    data.FixedMinimum = *range.first;
+    data.FixedMaximum = *range.second;
+    return true;
+    }
+
+  Metric                       m_Metric;
+  unsigned int                 m_NumberOfLevels;
+  unsigned int                 m_NumberOfThreads;
+  unsigned int                 m_NumberOfHistogramBins;
+  double                       m_SamplingPercentage;
+  SampleSelection              m_SampleSelection;
+  unsigned long                m_Seed;
+  GaussianPyramid< TPixel >    m_Pyramid;
+  ImageGeometry                m_Geometry;
+  std::vector< Level >         m_Levels;
+  std::vector< bool >          m_Valid;
+  double                       m_Center[3];
+  double                       m_Radius;
+};
+
+// Aligns a moving image to a RegistrationTemplate (see the top of this
+// file). Only the moving image's pyramid is built here.
+template< typename TPixel >
+class ImageRegistration
+{
+public:
+  typedef RegistrationTemplate< TPixel > TemplateType;
+  enum TransformKind { Rigid, Affine };
+
+  // Curvature pairs kept by the LBFGS optimizer.
+  static const std::size_t HistorySize = 5;
+
+  ImageRegistration()
+    : m_Template( 0 ), m_Kind( Rigid ), m_MaximumNumberOfIterations( 100 ),
+      m_NumberOfThreads( std::thread::hardware_concurrency() ), m_MetricValue( 0.0 ), m_NumberOfIterations( 0 )
+    {
+    SetIdentity( m_Initial.Matrix );
+    m_Initial.Offset[0] = m_Initial.Offset[1] = m_Initial.Offset[2] = 0.0;
+    m_Transform = m_Initial;
+    }
+
+  // The fixed side, after its Update(); it must outlive this object.
+  void SetTemplate( const TemplateType * fixed ) { m_Template = fixed; }
+
+  void SetMovingImage( const TPixel * buffer, const ImageGeometry & geometry )
+    {
+    m_MovingPyramid.SetInput( buffer, geometry.Size );
+    m_MovingGeometry = geometry;
+    }
+
+  // The transform the estimate starts from (and is composed with).
+  void SetInitialTransform( const AffineMapping & transform ) { m_Initial = transform; }
+  void SetTransformKind( TransformKind kind ) { m_Kind = kind; }
+  void SetMaximumNumberOfIterations( unsigned int iterations ) { m_MaximumNumberOfIterations = iterations; }
+  // Threads of the metric (1 when many registrations run in parallel).
+  void SetNumberOfThreads( unsigned int threads )
+    {
+    m_NumberOfThreads = threads > 0 ? threads : 1;
+    m_MovingPyramid.SetNumberOfThreads( m_NumberOfThreads );
+    }
+
+  void Update()
+    {
+    const unsigned int numberOfParameters = ( m_Kind == Rigid ) ? 6 : 12;
+    const unsigned int numberOfLinear = numberOfParameters - 3;
+    std::vector< double > parameters = GetIdentityParameters();
+    std::vector< double > scales( numberOfParameters, 1.0 );
+    for( unsigned int p = 0; p < numberOfLinear; p++ )
+      {
+      scales[p] = m_Template->GetRadius();
+      }
+
+    m_NumberOfIterations = 0;
+    for( unsigned int level = m_Template->GetNumberOfLevels(); level-- > 0; )
+      {
+      Level data;
+      if( !BuildLevel( level, data ) )
+        {
+        continue;
+        }
+      const ImageGeometry & grid = data.Fixed->FixedGeometry;
+      const double spacing = std::cbrt( grid.Spacing[0] * grid.Spacing[1] * grid.Spacing[2] );
+      m_NumberOfIterations += Optimize( data, parameters, scales, spacing, 0.01 * spacing );
+      }
+    m_Transform = GetTransform( parameters );
+    }
+
+  // For measuring what sampling saves and costs: PrepareMetric() pairs
+  // the full resolution level of the template with the moving image (as
+  // Update() does once per level), EvaluateMetric() then returns the
+  // metric of the initial transform and its gradient with respect to the
+  // parameters (6 or 12).
+  void PrepareMetric()
+    {
+    BuildLevel( 0, m_EvaluationLevel );
+    }
+
+  bool EvaluateMetric( double & value, std::vector< double > & gradient ) const
+    {
+    const std::vector< double > parameters = GetIdentityParameters();
+    double values[12];
+    if( !Evaluate( m_EvaluationLevel, parameters, value, values ) )
+      {
+      return false;
+      }
+    gradient.assign( values, values + parameters.size() );
+    return true;
+    }
+
+  AffineMapping GetTransform() const { return m_Transform; }
+  // The metric at the finest level, after the last step (for mutual
+  // information its negative, in nats).
+  double GetMetricValue() const { return m_MetricValue; }
+  unsigned int GetNumberOfIterations() const { return m_NumberOfIterations; }
+
+private:
+  struct Level
+  {
+    const typename TemplateType::Level * Fixed;
+    const TPixel *                       Moving;
+    ImageGeometry                        MovingGeometry;
+    ParzenJointHistogram                 Histogram;
+  };
+
+  // The parameters of the initial transform (no correction).
+  std::vector< double > GetIdentityParameters() const
+    {
+    std::vector< double > parameters( ( m_Kind == Rigid ) ? 6 : 12, 0.0 );
+    if( m_Kind == Affine )
+      {
+      parameters[0] = parameters[4] = parameters[8] = 1.0;
+      }
+    return parameters;
+    }
+
+  // The template level `level` with the moving level and the histogram
+  // ranges; false if either image of a coarse level is smaller than
+  // GaussianPyramid::MinimumSize.
+  bool BuildLevel( unsigned int level, Level & data )
+    {
+    data.Fixed = m_Template->GetLevel( level );
+    std::size_t movingSize[3];
+    GaussianPyramid< TPixel >::GetLevelSize( m_MovingGeometry.Size, level, movingSize );
+    for( unsigned int d = 0; level > 0 && d < 3; d++ )
+      {
+      if( movingSize[d] < GaussianPyramid< TPixel >::MinimumSize )
+        {
+        return false;
+        }
+      }
+    if( !data.Fixed )
+      {
+      return false;
+      }
+    data.Moving = m_MovingPyramid.GetLevel( level, movingSize );
+    data.MovingGeometry = GaussianPyramid< TPixel >::GetLevelGeometry( m_MovingGeometry, level );
+    if( m_Template->GetMetric() == TemplateType::MattesMutualInformation )
+      {
+      const std::pair< const TPixel *, const TPixel * > movingRange =
+        std::minmax_element( data.Moving, data.Moving + data.MovingGeometry.GetNumberOfPixels() );
+      data.Histogram.SetNumberOfBins( m_Template->GetNumberOfHistogramBins() );
+      data.Histogram.SetRanges( data.Fixed->FixedMinimum, data.Fixed->FixedMaximum, *movingRange.first,
+                                *movingRange.second );
+      }
+    return true;
+    }
+
+  // Limited-memory BFGS from `parameters`, in parameters multiplied by
+  // `scales` so that a unit step moves points by about 1 mm. The first
+  // step (and any step after the curvature history is dropped) is a
+  // steepest-descent step of length `initialStep`; every step is
+  // backtracked until the metric decreases enough. Stops when a step is
+  // shorter than `minimumStep`, no step decreases the metric or the
+  // iterations run out; returns the
+  // number of iterations taken.
+  unsigned int Optimize( const Level & level, std::vector< double > & parameters, const std::vector< double > & scales,
+                         double initialStep, double minimumStep )
+    {
+    const std::size_t n = parameters.size();
+    std::vector< double > x( n );
+    std::vector< double > g( n );
+    std::vector< double > trial( n );
+    std::vector< double > trialGradient( n );
+    std::vector< double > direction( n );
+    std::vector< std::vector< double > > steps;
+    std::vector< std::vector< double > > changes;
+    double gradient[12];
+    double value;
+    if( !Evaluate( level, parameters, value, gradient ) )
+      {
+      return 0;
+      }
+    for( std::size_t p = 0; p < n; p++ )
+      {
+      x[p] = parameters[p] * scales[p];
+      g[p] = gradient[p] / scales[p];
+      }
+
+    unsigned int iteration = 0;
+    while( iteration < m_MaximumNumberOfIterations )
+      {
+      iteration++;
+      // Two-loop recursion: direction = -H g.
+      const std::size_t m = steps.size();
+      std::vector< double > alpha( m );
+      direction = g;
+      for( std::size_t h = m; h-- > 0; )
+        {
+        alpha[h] = Dot( steps[h], direction ) / Dot( steps[h], changes[h] );
+        for( std::size_t p = 0; p < n; p++ )
+          {
+          direction[p] -= alpha[h] * changes[h][p];
+          }
+        }
+      const double norm = std::sqrt( Dot( g, g ) );
+      if( !( norm > 0.0 ) )
+        {
+        break;
+        }
+      double gamma = initialStep / norm;
+      if( m > 0 )
+        {
+        gamma = Dot( steps[m - 1], changes[m - 1] ) / Dot( changes[m - 1], changes[m - 1] );
+        }
+      for( std::size_t p = 0; p < n; p++ )
+        {
+        direction[p] *= gamma;
+        }
+      for( std::size_t h = 0; h < m; h++ )
+        {
+        const double beta = Dot( changes[h], direction ) / Dot( steps[h], changes[h] );
+        for( std::size_t p = 0; p < n; p++ )
+          {
+          direction[p] += ( alpha[h] - beta ) * steps[h][p];
+          }
+        }
+      for( std::size_t p = 0; p < n; p++ )
+        {
+        direction[p] = -direction[p];
+        }
+      double slope = Dot( g, direction );
+      if( !( slope < 0.0 ) )
+        {
+        steps.clear();
+        changes.clear();
+        for( std::size_t p = 0; p < n; p++ )
+          {
+          direction[p] = -g[p] * initialStep / norm;
+          }
+        slope = Dot( g, direction );
+        }
+
+      // Backtracking line search with the Armijo condition.
+      double length = 1.0;
+      double trialValue = value;
+      bool accepted = false;
+      for( unsigned int attempt = 0; attempt < 16 && !accepted; attempt++, length *= 0.5 )
+        {
+        for( std::size_t p = 0; p < n; p++ )
+          {
+          trial[p] = x[p] + length * direction[p];
+          parameters[p] = trial[p] / scales[p];
+          }
+        accepted = Evaluate( level, parameters, trialValue, gradient )
+                   && trialValue <= value + 1e-4 * length * slope;
+        }
+      if( !accepted )
+        {
+        for( std::size_t p = 0; p < n; p++ )
+          {
+          parameters[p] = x[p] / scales[p];
+          }
+        if( steps.empty() )
+          {
+          break;
+          }
+        // Retry along the gradient.
+        steps.clear();
+        changes.clear();
+        continue;
+        }
+
+      std::vector< double > step( n );
+      std::vector< double > change( n );
+      for( std::size_t p = 0; p < n; p++ )
+        {
+        trialGradient[p] = gradient[p] / scales[p];
+        step[p] = trial[p] - x[p];
+        change[p] = trialGradient[p] - g[p];
+        }
+      x = trial;
+      g = trialGradient;
+      value = trialValue;
+      if( Dot( step, change ) > 0.0 )
+        {
+        if( steps.size() == HistorySize )
+          {
+          steps.erase( steps.begin() );
+          changes.erase( changes.begin() );
+          }
+        steps.push_back( step );
+        changes.push_back( change );
+        }
+      if( std::sqrt( Dot( step, step ) ) < minimumStep )
+        {
+        break;
+        }
+      }
+    m_MetricValue = value;
+    return iteration;
+    }
+
+  static double Dot( const std::vector< double > & a, const std::vector< double > & b )
+    {
+    double sum = 0.0;
+    for( std::size_t p = 0; p < a.size(); p++ )
+      {
+      sum += a[p] * b[p];
+      }
+    return sum;
+    }
+
+  void GetMatrix( const std::vector< double > & parameters, double matrix[3][3] ) const
+    {
+    if( m_Kind == Affine )
+      {
+      for( unsigned int i = 0; i < 3; i++ )
+        {
+        for( unsigned int j = 0; j < 3; j++ )
+          {
+          matrix[i][j] = parameters[3 * i + j];
+          }
+        }
+      return;
+      }
+    double rotations[3][3][3];
+    double derivatives[3][3][3];
+    GetRotations( parameters, rotations, derivatives );
+    double zy[3][3];
+    MultiplyMatrices( rotations[2], rotations[1], zy );
+    MultiplyMatrices( zy, rotations[0], matrix );
+    }
+
+  // Rotation about axis a by parameters[a], and its derivative.
+  static void GetRotations( const std::vector< double > & parameters, double rotation[3][3][3],
+                            double derivative[3][3][3] )
+    {
+    for( unsigned int a = 0; a < 3; a++ )
+      {
+      const double c = std::cos( parameters[a] );
+      const double s = std::sin( parameters[a] );
+      const unsigned int u = ( a + 1 ) % 3;
+      const unsigned int v = ( a + 2 ) % 3;
+      for( unsigned int i = 0; i < 3; i++ )
+        {
+        for( unsigned int j = 0; j < 3; j++ )
+          {
+          rotation[a][i][j] = ( i == j ) ? 1.0 : 0.0;
+          derivative[a][i][j] = 0.0;
+          }
+        }
+      rotation[a][u][u] = c;
+      rotation[a][u][v] = -s;
+      rotation[a][v][u] = s;
+      rotation[a][v][v] = c;
+      derivative[a][u][u] = -s;
+      derivative[a][u][v] = -c;
+      derivative[a][v][u] = c;
+      derivative[a][v][v] = -s;
+      }
+    }
+
+  // x_moving = Initial( A ( x - c ) + c + t ).
+  AffineMapping GetTransform( const std::vector< double > & parameters ) const
+    {
+    const std::size_t t = parameters.size() - 3;
+    AffineMapping correction;
+    GetMatrix( parameters, correction.Matrix );
+    const double * center = m_Template->GetCenter();
+    MultiplyMatrixVector( correction.Matrix, center, correction.Offset );
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      correction.Offset[d] = center[d] + parameters[t + d] - correction.Offset[d];
+      }
+    return ComposeAffineMappings( correction, m_Initial );
+    }
+
+  // Maps the samples of a level through the current parameters. The
+  // metric functors below derive from it and add their own accumulators.
+  struct SampleFunctor
+  {
+    // Calls visitor( i, j, k ) for the samples of work items [first, last):
+    // selected voxels, or rows of the regular grid of Stride.
+    template< typename TVisitor >
+    void VisitSamples( std::size_t first, std::size_t last, TVisitor & visitor ) const
+      {
+      const typename TemplateType::Level & level = *m_Level->Fixed;
+      const std::size_t * size = level.FixedGeometry.Size;
+      if( !level.Samples.empty() )
+        {
+        for( std::size_t id = first; id < last; id++ )
+          {
+          const std::size_t n = level.Samples[id];
+          visitor( n % size[0], ( n / size[0] ) % size[1], n / ( size[0] * size[1] ) );
+          }
+        return;
+        }
+      const std::size_t stride = level.Stride;
+      const std::size_t rowsPerSlice = ( size[1] + stride - 1 ) / stride;
+      for( std::size_t row = first; row < last; row++ )
+        {
+        const std::size_t j = ( row % rowsPerSlice ) * stride;
+        const std::size_t k = ( row / rowsPerSlice ) * stride;
+        for( std::size_t i = 0; i < size[0]; i += stride )
+          {
+          visitor( i, j, k );
+          }
+        }
+      }
+
+    // Fixed and moving values of the sample at fixed voxel index ( i, j, k )
+    // and the derivatives of the moving value with respect to the
+    // parameters; false if the sample maps outside the moving image.
+    bool Sample( std::size_t index[3], double & fixed, double & moving, double derivative[12] ) const
+      {
+      const Level & level = *m_Level;
+      const std::size_t * fixedSize = level.Fixed->FixedGeometry.Size;
+      const std::size_t * movingSize = level.MovingGeometry.Size;
+      const double i = static_cast< double >( index[0] );
+      const double j = static_cast< double >( index[1] );
+      const double k = static_cast< double >( index[2] );
+      double c[3];
+      m_Mapping.Map( i, j, k, c );
+      if( !( c[0] >= 0.0 && c[0] <= m_Upper[0] && c[1] >= 0.0 && c[1] <= m_Upper[1]
+             && c[2] >= 0.0 && c[2] <= m_Upper[2] ) )
+        {
+        return false;
+        }
+      double indexGradient[3];
+      moving = Interpolate( level.Moving, movingSize, c, indexGradient );
+      fixed = static_cast< double >( level.Fixed->Fixed[( index[2] * fixedSize[1] + index[1] ) * fixedSize[0] + index[0]] );
+
+      // g: gradient of the moving image with respect to the corrected
+      // point A ( x - c ) + c + t.
+      double g[3];
+      MultiplyMatrixVector( m_PointToIndex, indexGradient, g );
+      double u[3];
+      m_Centered.Map( i, j, k, u );
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        derivative[m_NumberOfLinear + d] = g[d];
+        }
+      if( m_NumberOfLinear == 9 )
+        {
+        for( unsigned int r = 0; r < 3; r++ )
+          {
+          for( unsigned int q = 0; q < 3; q++ )
+            {
+            derivative[3 * r + q] = g[r] * u[q];
+            }
+          }
+        }
+      else
+        {
+        for( unsigned int a = 0; a < 3; a++ )
+          {
+          double du[3];
+          MultiplyMatrixVector( m_Derivatives[a], u, du );
+          derivative[a] = g[0] * du[0] + g[1] * du[1] + g[2] * du[2];
+          }
+        }
+      return true;
+      }
+
+    // Trilinear value at continuous index c (inside [0, size - 1]) and its
+    // derivative along each index axis.
+    static double Interpolate( const TPixel * buffer, const std::size_t size[3], const double c[3], double gradient[3] )
+      {
+      std::size_t base[3];
+      double f[3];
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        const double b = std::floor( c[d] );
+        base[d] = static_cast< std::size_t >( b );
+        f[d] = c[d] - b;
+        if( size[d] < 2 )
+          {
+          base[d] = 0;
+          f[d] = 0.0;
+          }
+        else if( base[d] >= size[d] - 1 )
+          {
+          base[d] = size[d] - 2;
+          f[d] = 1.0;
+          }
+        }
+      const std::size_t strideY = size[0];
+      const std::size_t strideZ = size[0] * size[1];
+      const std::size_t dx = size[0] > 1 ? 1 : 0;
+      const std::size_t dy = size[1] > 1 ? strideY : 0;
+      const std::size_t dz = size[2] > 1 ? strideZ : 0;
+      const TPixel * p = buffer + base[2] * strideZ + base[1] * strideY + base[0];
+      const double v000 = p[0];
+      const double v100 = p[dx];
+      const double v010 = p[dy];
+      const double v110 = p[dy + dx];
+      const double v001 = p[dz];
+      const double v101 = p[dz + dx];
+      const double v011 = p[dz + dy];
+      const double v111 = p[dz + dy + dx];
+      const double c00 = v000 + f[0] * ( v100 - v000 );
+      const double c10 = v010 + f[0] * ( v110 - v010 );
+      const double c01 = v001 + f[0] * ( v101 - v001 );
+      const double c11 = v011 + f[0] * ( v111 - v011 );
+      const double c0 = c00 + f[1] * ( c10 - c00 );
+      const double c1 = c01 + f[1] * ( c11 - c01 );
+      const double x0 = ( v100 - v000 ) + f[1] * ( ( v110 - v010 ) - ( v100 - v000 ) );
+      const double x1 = ( v101 - v001 ) + f[1] * ( ( v111 - v011 ) - ( v101 - v001 ) );
+      gradient[0] = x0 + f[2] * ( x1 - x0 );
+      gradient[1] = ( c10 - c00 ) + f[2] * ( ( c11 - c01 ) - ( c10 - c00 ) );
+      gradient[2] = c1 - c0;
+      return c0 + f[2] * ( c1 - c0 );
+      }
+
+    const Level * m_Level;
+    double        m_Upper[3];
+    IndexMapping  m_Mapping;
+    IndexMapping  m_Centered;
+    double        m_PointToIndex[3][3];
+    double        m_Derivatives[3][3][3];
+    unsigned int  m_NumberOfLinear;
+  };
+
+  // Per-thread sums of one mean squares evaluation.
+  struct SquaresAccumulator
+  {
+    double      Sum;
+    std::size_t Count;
+    double      Gradient[12];
+  };
+
+  struct MeanSquaresFunctor : public SampleFunctor
+  {
+    struct Visitor
+    {
+      void operator()( std::size_t i, std::size_t j, std::size_t k )
+        {
+        std::size_t index[3] = { i, j, k };
+        double fixed;
+        double moving;
+        double derivative[12];
+        if( !m_Functor->Sample( index, fixed, moving, derivative ) )
+          {
+          return;
+          }
+        const double error = moving - fixed;
+        m_Sums->Sum += error * error;
+        ++m_Sums->Count;
+        for( unsigned int p = 0; p < m_NumberOfParameters; p++ )
+          {
+          m_Sums->Gradient[p] += error * derivative[p];
+          }
+        }
+
+      const SampleFunctor * m_Functor;
+      SquaresAccumulator *  m_Sums;
+      unsigned int          m_NumberOfParameters;
+    };
+
+    void operator()( std::size_t first, std::size_t last, unsigned int threadId ) const
+      {
+      Visitor visitor;
+      visitor.m_Functor = this;
+      visitor.m_Sums = &( *m_Sums )[threadId];
+      visitor.m_NumberOfParameters = this->m_NumberOfLinear + 3;
+      this->VisitSamples( first, last, visitor );
+      }
+
+    std::vector< SquaresAccumulator > * m_Sums;
+  };
+
+  // Per-thread joint histogram of one mutual information evaluation, and
+  // the derivatives of its bins with respect to the parameters (in units of
+  // the moving bin position).
+  struct HistogramAccumulator
+  {
+    std::vector< std::uint32_t > Joint;
+    std::vector< double >        Derivatives;
+    std::size_t                  Count;
+  };
+
+  struct MutualInformationFunctor : public SampleFunctor
+  {
+    struct Visitor
+    {
+      void operator()( std::size_t i, std::size_t j, std::size_t k )
+        {
+        std::size_t index[3] = { i, j, k };
+        double fixed;
+        double moving;
+        double derivative[12];
+        if( !m_Functor->Sample( index, fixed, moving, derivative ) )
+          {
+          return;
+          }
+        unsigned int column;
+        double t;
+        m_Histogram->GetMovingBin( moving, column, t );
+        const std::size_t bin = m_Histogram->GetFixedBin( fixed ) * m_Histogram->GetNumberOfBins() + column;
+        std::uint32_t weights[4];
+        ParzenJointHistogram::GetWeights( t, weights );
+        ParzenJointHistogram::AddWeights( &m_Sums->Joint[bin], weights );
+        ++m_Sums->Count;
+
+        double weightDerivatives[4];
+        ParzenJointHistogram::GetWeightDerivatives( t, weightDerivatives );
+        double * target = &m_Sums->Derivatives[bin * m_NumberOfParameters];
+        for( unsigned int q = 0; q < 4; q++, target += m_NumberOfParameters )
+          {
+          for( unsigned int p = 0; p < m_NumberOfParameters; p++ )
+            {
+            target[p] += weightDerivatives[q] * derivative[p];
+            }
+          }
+        }
+
+      const SampleFunctor *        m_Functor;
+      const ParzenJointHistogram * m_Histogram;
+      HistogramAccumulator *       m_Sums;
+      unsigned int                 m_NumberOfParameters;
+    };
+
+    void operator()( std::size_t first, std::size_t last, unsigned int threadId ) const
+      {
+      Visitor visitor;
+      visitor.m_Functor = this;
+      visitor.m_Histogram = &this->m_Level->Histogram;
+      visitor.m_Sums = &( *m_Sums )[threadId];
+      visitor.m_NumberOfParameters = this->m_NumberOfLinear + 3;
+      this->VisitSamples( first, last, visitor );
+      }
+
+    std::vector< HistogramAccumulator > * m_Sums;
+  };
+
+  // Sets up `functor` for `parameters` on `level`.
+  void Prepare( const Level & level, const std::vector< double > & parameters, SampleFunctor & functor ) const
+    {
+    functor.m_Level = &level;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      functor.m_Upper[d] = static_cast< double >( level.MovingGeometry.Size[d] ) - 1.0;
+      }
+    functor.m_NumberOfLinear = static_cast< unsigned int >( parameters.size() ) - 3;
+    functor.m_Mapping = ComputeIndexMapping( level.Fixed->FixedGeometry, GetTransform( parameters ), level.MovingGeometry );
+
+    // u = x - c as a function of the fixed index.
+    AffineMapping shift;
+    SetIdentity( shift.Matrix );
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      shift.Offset[d] = -m_Template->GetCenter()[d];
+      }
+    ImageGeometry physical;
+    SetIdentity( physical.Direction );
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      physical.Origin[d] = 0.0;
+      physical.Spacing[d] = 1.0;
+      physical.Size[d] = 1;
+      }
+    functor.m_Centered = ComputeIndexMapping( level.Fixed->FixedGeometry, shift, physical );
+
+    // d(moving index) / d(corrected point) = MovingIndexToPhysical^-1 *
+    // Initial.Matrix; g = its transpose times the index gradient.
+    double movingIndexToPhysical[3][3];
+    double physicalToMovingIndex[3][3];
+    GetIndexToPhysicalMatrix( level.MovingGeometry, movingIndexToPhysical );
+    InvertMatrix( movingIndexToPhysical, physicalToMovingIndex );
+    double chain[3][3];
+    MultiplyMatrices( physicalToMovingIndex, m_Initial.Matrix, chain );
+    for( unsigned int i = 0; i < 3; i++ )
+      {
+      for( unsigned int j = 0; j < 3; j++ )
+        {
+        functor.m_PointToIndex[i][j] = chain[j][i];
+        }
+      }
+    if( m_Kind == Rigid )
+      {
+      // dA / d(angle a) for A = Rz Ry Rx.
+      double rotations[3][3][3];
+      double derivatives[3][3][3];
+      GetRotations( parameters, rotations, derivatives );
+      double zy[3][3];
+      double product[3][3];
+      MultiplyMatrices( rotations[2], rotations[1], zy );
+      MultiplyMatrices( zy, derivatives[0], functor.m_Derivatives[0] );
+      MultiplyMatrices( rotations[2], derivatives[1], product );
+      MultiplyMatrices( product, rotations[0], functor.m_Derivatives[1] );
+      MultiplyMatrices( derivatives[2], rotations[1], product );
+      MultiplyMatrices( product, rotations[0], functor.m_Derivatives[2] );
+      }
+    }
+
+  // The metric and its gradient with respect to the parameters; false if no
+  // sample maps into the moving image. Mean squares is the mean squared
+  // difference; mutual information is minimized as its negative.
+  bool Evaluate( const Level & level, const std::vector< double > & parameters, double & value, double gradient[12] ) const
+    {
+    const unsigned int numberOfParameters = static_cast< unsigned int >( parameters.size() );
+    const typename TemplateType::Level & fixed = *level.Fixed;
+    if( m_Template->GetMetric() == TemplateType::MeanSquares )
+      {
+      MeanSquaresFunctor functor;
+      Prepare( level, parameters, functor );
+      SquaresAccumulator zero;
+      zero.Sum = 0.0;
+      zero.Count = 0;
+      std::fill( zero.Gradient, zero.Gradient + 12, 0.0 );
+      std::vector< SquaresAccumulator > sums( m_NumberOfThreads, zero );
+      functor.m_Sums = &sums;
+      ParallelFor( 0, fixed.NumberOfItems, fixed.Grain, m_NumberOfThreads, functor );
+
+      SquaresAccumulator total = zero;
+      for( std::size_t t = 0; t < sums.size(); t++ )
+        {
+        total.Sum += sums[t].Sum;
+        total.Count += sums[t].Count;
+        for( unsigned int p = 0; p < numberOfParameters; p++ )
+          {
+          total.Gradient[p] += sums[t].Gradient[p];
+          }
+        }
+      if( total.Count == 0 )
+        {
+        return false;
+        }
+      value = total.Sum / static_cast< double >( total.Count );
+      for( unsigned int p = 0; p < numberOfParameters; p++ )
+        {
+        gradient[p] = 2.0 * total.Gradient[p] / static_cast< double >( total.Count );
+        }
+      return true;
+      }
+
+    MutualInformationFunctor functor;
+    Prepare( level, parameters, functor );
+    const unsigned int bins = level.Histogram.GetNumberOfBins();
+    HistogramAccumulator zero;
+    zero.Joint.assign( bins * bins, 0 );
+    zero.Derivatives.assign( bins * bins * numberOfParameters, 0.0 );
+    zero.Count = 0;
+    std::vector< HistogramAccumulator > sums( m_NumberOfThreads, zero );
+    functor.m_Sums = &sums;
+    ParallelFor( 0, fixed.NumberOfItems, fixed.Grain, m_NumberOfThreads, functor );
+
+    std::vector< std::uint64_t > joint( bins * bins, 0 );
+    std::vector< double > derivatives( bins * bins * numberOfParameters, 0.0 );
+    std::size_t count = 0;
+    for( std::size_t t = 0; t < sums.size(); t++ )
+      {
+      count += sums[t].Count;
+      for( std::size_t b = 0; b < joint.size(); b++ )
+        {
+        joint[b] += sums[t].Joint[b];
+        }
+      for( std::size_t b = 0; b < derivatives.size(); b++ )
+        {
+        derivatives[b] += sums[t].Derivatives[b];
+        }
+      }
+    if( count == 0 )
+      {
+      return false;
+      }
+    // MI = sum p log( p / ( p_f p_m ) ) with p = joint / total; its
+    // derivative reduces to sum dp log( p / p_m ), where dp of a bin is the
+    // sum of its weight derivatives over N samples, per moving bin size.
+    std::vector< double > logRatio;
+    value = -level.Histogram.ComputeMutualInformation( joint, logRatio );
+    const double normalization = -1.0 / ( static_cast< double >( count ) * level.Histogram.GetMovingBinSize() );
+    for( unsigned int p = 0; p < numberOfParameters; p++ )
+      {
+      double sum = 0.0;
+      for( std::size_t b = 0; b < joint.size(); b++ )
+        {
+        sum += derivatives[b * numberOfParameters + p] * logRatio[b];
+        }
+      gradient[p] = normalization * sum;
+      }
+    return true;
+    }
+
+  const TemplateType *         m_Template;
+  TransformKind                m_Kind;
+  unsigned int                 m_MaximumNumberOfIterations;
+  unsigned int                 m_NumberOfThreads;
+  GaussianPyramid< TPixel >    m_MovingPyramid;
+  ImageGeometry                m_MovingGeometry;
+  AffineMapping                m_Initial;
+  AffineMapping                m_Transform;
+  Level                        m_EvaluationLevel;
+  double                       m_MetricValue;
+  unsigned int                 m_NumberOfIterations;
+};
+
+// The translation that takes the center of the fixed grid to the center of
+// the moving grid, the usual starting point when no transform is given.
+inline AffineMapping GetCenteringTransform( const ImageGeometry & fixed, const ImageGeometry & moving )
+{
+  AffineMapping transform;
+  SetIdentity( transform.Matrix );
+  const ImageGeometry * grids[2] = { &fixed, &moving };
+  double centers[2][3];
+  for( unsigned int g = 0; g < 2; g++ )
+    {
+    double middle[3];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      middle[d] = 0.5 * ( static_cast< double >( grids[g]->Size[d] ) - 1.0 );
+      }
+    double indexToPhysical[3][3];
+    GetIndexToPhysicalMatrix( *grids[g], indexToPhysical );
+    MultiplyMatrixVector( indexToPhysical, middle, centers[g] );
+    }
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    transform.Offset[d] = ( moving.Origin[d] + centers[1][d] ) - ( fixed.Origin[d] + centers[0][d] );
+    }
+  return transform;
+}
+
+#endif
@@ -0,0 +1,296 @@
+// AUTHOR: Christian McDaniel
+//
+// Exact resampling for index mappings that send every output voxel onto
+// one input voxel: integer translations, 90 degree rotations, flips and
+// axis swaps (see ComputePermutedGeometry() in {ResampleGeometry.h}), plus
+// any crop or pad of the output grid. Nothing is interpolated; each output
+// row is the overlap with the input, copied with memcpy (or a strided
+// gather when the row runs along another input axis), and the default
+// value everywhere else. Strided rows are processed in 16^3 tiles so that
+// the input reads stay in cache.
+
+#ifndef IntegerMappingResampler_h
+#define IntegerMappingResampler_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <thread>
+
+#include "ParallelFor.h"
+#include "ResampleGeometry.h"
+
+template< typename TPixel >
+class IntegerMappingResampler
+{
+public:
+  IntegerMappingResampler()
+    : m_Input( 0 ), m_Output( 0 ), m_Start( 0 ), m_DefaultPixelValue( 0 ),
+      m_NumberOfThreads( std::thread::hardware_concurrency() )
+    {
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_InputSize[d] = 0;
+      m_OutputSize[d] = 0;
+      m_Axis[d] = static_cast< int >( d );
+      m_Sign[d] = 1;
+      m_Offset[d] = 0;
+      m_Stride[d] = 0;
+      }
+    }
+
+  void SetInput( const TPixel * buffer, const std::size_t size[3] )
+    {
+    m_Input = buffer;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_InputSize[d] = size[d];
+      }
+    }
+
+  void SetOutput( TPixel * buffer, const std::size_t size[3] )
+    {
+    m_Output = buffer;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_OutputSize[d] = size[d];
+      }
+    }
+
+  // Accepts the mapping if its matrix is a signed permutation and its offset
+  // is integral (to 1e-6 voxel); returns false otherwise.
+  bool SetIndexMapping( const IndexMapping & mapping )
+    {
+    bool used[3] = { false, false, false };
+    for( unsigned int j = 0; j < 3; j++ )
+      {
+      int found = -1;
+      for( unsigned int i = 0; i < 3; i++ )
+        {
+        const double value = mapping.Matrix[i][j];
+        if( std::fabs( value ) < 1e-9 )
+          {
+          continue;
+          }
+        if( found >= 0 || std::fabs( std::fabs( value ) - 1.0 ) >= 1e-9 )
+          {
+          return false;
+          }
+        found = static_cast< int >( i );
+        m_Sign[j] = value > 0.0 ? 1 : -1;
+        }
+      if( found < 0 || used[found] )
+        {
+        return false;
+        }
+      used[found] = true;
+      m_Axis[j] = found;
+      }
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      const double rounded = std::floor( mapping.Offset[d] + 0.5 );
+      if( std::fabs( mapping.Offset[d] - rounded ) > 1e-6 )
+        {
+        return false;
+        }
+      m_Offset[d] = static_cast< std::ptrdiff_t >( rounded );
+      }
+    return true;
+    }
+
+  void SetDefaultPixelValue( TPixel value ) { m_DefaultPixelValue = value; }
+
+  void SetNumberOfThreads( unsigned int threads ) { m_NumberOfThreads = threads > 0 ? threads : 1; }
+
+  void Update()
+    {
+    const std::ptrdiff_t inputStride[3] = {
+      1,
+      static_cast< std::ptrdiff_t >( m_InputSize[0] ),
+      static_cast< std::ptrdiff_t >( m_InputSize[0] * m_InputSize[1] ) };
+    m_Start = 0;
+    for( unsigned int j = 0; j < 3; j++ )
+      {
+      m_Stride[j] = m_Sign[j] * inputStride[m_Axis[j]];
+      m_Start += m_Offset[j] * inputStride[j];
+      }
+
+    if( m_Stride[0] == 1 || m_Stride[0] == -1 )
+      {
+      RowFunctor rows( this );
+      ParallelFor( 0, m_OutputSize[1] * m_OutputSize[2], 64, m_NumberOfThreads, rows );
+      return;
+      }
+    const std::size_t tilesY = ( m_OutputSize[1] + TileSize - 1 ) / TileSize;
+    const std::size_t tilesZ = ( m_OutputSize[2] + TileSize - 1 ) / TileSize;
+    TileFunctor tiles( this, tilesY );
+    ParallelFor( 0, tilesY * tilesZ, 1, m_NumberOfThreads, tiles );
+    }
+
+private:
+  static const std::size_t TileSize = 16;
+
+  // Finds the run [first, last) of output row (y, z) that lands inside the
+  // input and the input offset of its voxel x = 0. Returns false if the
+  // whole row lies outside.
+  bool GetRowOverlap( std::size_t y, std::size_t z, std::ptrdiff_t & rowStart,
+                      std::size_t & first, std::size_t & last ) const
+    {
+    const std::ptrdiff_t position[3] = { 0, static_cast< std::ptrdiff_t >( y ), static_cast< std::ptrdiff_t >( z ) };
+    std::ptrdiff_t lower = 0;
+    std::ptrdiff_t upper = static_cast< std::ptrdiff_t >( m_OutputSize[0] );
+    for( unsigned int i = 0; i < 3; i++ )
+      {
+      // Input coordinate i along the row is c + step * x.
+      std::ptrdiff_t c = m_Offset[i];
+      std::ptrdiff_t step = 0;
+      for( unsigned int j = 0; j < 3; j++ )
+        {
+        if( m_Axis[j] == static_cast< int >( i ) )
+          {
+          if( j == 0 )
+            {
+            step = m_Sign[j];
+            }
+          else
+            {
+            c += m_Sign[j] * position[j];
+            }
+          }
+        }
+      const std::ptrdiff_t n = static_cast< std::ptrdiff_t >( m_InputSize[i] );
+      if( step == 0 )
+        {
+        if( c < 0 || c >= n )
+          {
+          return false;
+          }
+        }
+      else if( step > 0 )
+        {
+        lower = std::max( lower, -c );
+        upper = std::min( upper, n - c );
+        }
+      else
+        {
+        lower = std::max( lower, c - n + 1 );
+        upper = std::min( upper, c + 1 );
+        }
+      }
+    if( lower >= upper )
+      {
+      return false;
+      }
+    first = static_cast< std::size_t >( lower );
+    last = static_cast< std::size_t >( upper );
+    rowStart = m_Start + static_cast< std::ptrdiff_t >( y ) * m_Stride[1]
+                       + static_cast< std::ptrdiff_t >( z ) * m_Stride[2];
+    return true;
+    }
+
+  // Output rows that run along input x: contiguous or reversed copies.
+  struct RowFunctor
+  {
+    explicit RowFunctor( const IntegerMappingResampler * self ) : m_Self( self ) {}
+
+    void operator()( std::size_t first, std::size_t last, unsigned int ) const
+      {
+      const IntegerMappingResampler & s = *m_Self;
+      const std::size_t length = s.m_OutputSize[0];
+      for( std::size_t row = first; row < last; row++ )
+        {
+        TPixel * out = s.m_Output + row * length;
+        std::ptrdiff_t rowStart;
+        std::size_t begin;
+        std::size_t end;
+        if( !s.GetRowOverlap( row % s.m_OutputSize[1], row / s.m_OutputSize[1], rowStart, begin, end ) )
+          {
+          std::fill( out, out + length, s.m_DefaultPixelValue );
+          continue;
+          }
+        std::fill( out, out + begin, s.m_DefaultPixelValue );
+        const TPixel * in = s.m_Input + ( rowStart + static_cast< std::ptrdiff_t >( begin ) * s.m_Stride[0] );
+        if( s.m_Stride[0] == 1 )
+          {
+          std::memcpy( out + begin, in, ( end - begin ) * sizeof( TPixel ) );
+          }
+        else
+          {
+          std::reverse_copy( in - ( end - begin - 1 ), in + 1, out + begin );
+          }
+        std::fill( out + end, out + length, s.m_DefaultPixelValue );
+        }
+      }
+
+    const IntegerMappingResampler * m_Self;
+  };
+
+  // Output rows that run along input y or z. One task per (y, z) tile
+  // column of the output; x is walked in tiles too, so each tile reads at
+  // most TileSize^2 input cache lines.
+  struct TileFunctor
+  {
+    TileFunctor( const IntegerMappingResampler * self, std::size_t tilesY )
+      : m_Self( self ), m_TilesY( tilesY ) {}
+
+    void operator()( std::size_t first, std::size_t last, unsigned int ) const
+      {
+      const IntegerMappingResampler & s = *m_Self;
+      const std::size_t * size = s.m_OutputSize;
+      const std::ptrdiff_t stride = s.m_Stride[0];
+      for( std::size_t tile = first; tile < last; tile++ )
+        {
+        const std::size_t y0 = ( tile % m_TilesY ) * TileSize;
+        const std::size_t z0 = ( tile / m_TilesY ) * TileSize;
+        const std::size_t y1 = std::min( y0 + TileSize, size[1] );
+        const std::size_t z1 = std::min( z0 + TileSize, size[2] );
+        for( std::size_t x0 = 0; x0 < size[0]; x0 += TileSize )
+          {
+          const std::size_t x1 = std::min( x0 + TileSize, size[0] );
+          for( std::size_t z = z0; z < z1; z++ )
+            {
+            for( std::size_t y = y0; y < y1; y++ )
+              {
+              TPixel * out = s.m_Output + ( z * size[1] + y ) * size[0];
+              std::ptrdiff_t rowStart = 0;
+              std::size_t begin;
+              std::size_t end;
+              if( !s.GetRowOverlap( y, z, rowStart, begin, end ) )
+                {
+                begin = end = x1;
+                }
+              begin = std::min( std::max( begin, x0 ), x1 );
+              end = std::min( std::max( end, begin ), x1 );
+              std::fill( out + x0, out + begin, s.m_DefaultPixelValue );
+              const TPixel * in = s.m_Input;
+              std::ptrdiff_t index = rowStart + static_cast< std::ptrdiff_t >( begin ) * stride;
+              for( std::size_t x = begin; x < end; x++, index += stride )
+                {
+                out[x] = in[index];
+                }
+              std::fill( out + end, out + x1, s.m_DefaultPixelValue );
+              }
+            }
+          }
+        }
+      }
+
+    const IntegerMappingResampler * m_Self;
+    std::size_t                     m_TilesY;
+  };
+
+  const TPixel * m_Input;
+  TPixel *       m_Output;
+  std::size_t    m_InputSize[3];
+  std::size_t    m_OutputSize[3];
+  int            m_Axis[3];
+  int            m_Sign[3];
+  std::ptrdiff_t m_Offset[3];
+  std::ptrdiff_t m_Stride[3];
+  std::ptrdiff_t m_Start;
+  TPixel         m_DefaultPixelValue;
+  unsigned int   m_NumberOfThreads;
+};
+
+#endif
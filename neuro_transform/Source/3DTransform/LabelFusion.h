@@ -0,0 +1,196 @@
+// AUTHOR: Christian McDaniel
+//
+// Multi-atlas label fusion: several atlas label maps, each with its own
+// mapping into the output (subject) grid, are resampled with
+// {LabelResampler.h} and combined by (weighted) voting into one label map.
+// Every output voxel takes the label with the largest sum of atlas weights
+// (the number of atlases for plain majority voting); ties go to the
+// smaller label. Atlases vote 0 where they do not reach.
+//
+// Nothing the size of the output is kept per atlas. The output is fused
+// brick by brick, one brick at a time per thread: every atlas is
+// resampled into a per-thread vote buffer of one label per brick voxel
+// (120 kB for 30 atlases, cached), and each voxel then sums its votes in a
+// per-thread table of label weights, which is cleared again by the labels
+// it touched. Memory is the atlases and the output, whatever the number of
+// atlases.
+
+#ifndef LabelFusion_h
+#define LabelFusion_h
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include "LabelResampler.h"
+#include "ParallelFor.h"
+#include "ResampleGeometry.h"
+
+class LabelFusion
+{
+public:
+  // Output voxels of a brick along x, and along y and z. Bricks are long
+  // in x because an atlas is resampled a row at a time, and each row
+  // first has to find where it enters and leaves the atlas.
+  static const std::size_t BrickWidth = 256;
+  static const std::size_t BrickHeight = 4;
+
+  // Distance between the votes of two atlases in the vote buffer: a brick
+  // and one cache line, so that the votes for one voxel do not all fall
+  // into the same cache set (as with a 4 kB stride).
+  static const std::size_t VoteStride = BrickWidth * BrickHeight * BrickHeight + 64;
+
+  LabelFusion()
+    : m_Mode( LabelResampler::Nearest ), m_Output( 0 ), m_NumberOfThreads( std::thread::hardware_concurrency() )
+    {
+    m_OutputSize[0] = m_OutputSize[1] = m_OutputSize[2] = 0;
+    m_Bricks[0] = m_Bricks[1] = m_Bricks[2] = 0;
+    }
+
+  // How each atlas is sampled at an output voxel: its nearest label or the
+  // majority of its 8 neighbors. Set before adding atlases.
+  void SetMode( LabelResampler::Mode mode ) { m_Mode = mode; }
+
+  // An atlas `buffer` of `size` voxels, `mapping` taking output indices to
+  // its continuous indices, and the weight of its votes.
+  void AddAtlas( const unsigned char * buffer, const std::size_t size[3], const IndexMapping & mapping,
+                 double weight )
+    {
+    m_Atlases.push_back( LabelResampler() );
+    m_Atlases.back().SetMode( m_Mode );
+    m_Atlases.back().SetInput( buffer, size );
+    m_Atlases.back().SetIndexMapping( mapping );
+    m_Weights.push_back( weight );
+    }
+
+  void SetOutput( unsigned char * buffer, const std::size_t size[3] )
+    {
+    m_Output = buffer;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_OutputSize[d] = size[d];
+      const std::size_t extent = d == 0 ? BrickWidth : BrickHeight;
+      m_Bricks[d] = ( size[d] + extent - 1 ) / extent;
+      }
+    }
+
+  void SetNumberOfThreads( unsigned int threads ) { m_NumberOfThreads = threads > 0 ? threads : 1; }
+
+  void Update()
+    {
+    const std::size_t bricks = m_Bricks[0] * m_Bricks[1] * m_Bricks[2];
+    std::vector< BrickScratch > scratch( std::max( 1u, std::min< unsigned int >(
+                                           m_NumberOfThreads, static_cast< unsigned int >( bricks ) ) ) );
+    for( std::size_t t = 0; t < scratch.size(); t++ )
+      {
+      scratch[t].Votes.resize( m_Atlases.size() * VoteStride );
+      scratch[t].Totals.assign( 256, 0.0 );
+      }
+    BrickFunctor functor( this, &scratch );
+    ParallelFor( 0, bricks, 1, static_cast< unsigned int >( scratch.size() ), functor );
+    }
+
+private:
+  // The votes of every atlas for the voxels of one brick, atlas by atlas,
+  // and the label weights of one voxel (all 0 between voxels).
+  struct BrickScratch
+  {
+    std::vector< unsigned char > Votes;
+    std::vector< double >        Totals;
+  };
+
+  struct BrickFunctor
+  {
+    BrickFunctor( const LabelFusion * self, std::vector< BrickScratch > * scratch )
+      : m_Self( self ), m_Scratch( scratch ) {}
+
+    void operator()( std::size_t first, std::size_t last, unsigned int threadId ) const
+      {
+      BrickScratch & scratch = ( *m_Scratch )[threadId];
+      for( std::size_t brick = first; brick < last; brick++ )
+        {
+        m_Self->FuseBrick( brick % m_Self->m_Bricks[0], ( brick / m_Self->m_Bricks[0] ) % m_Self->m_Bricks[1],
+                           brick / ( m_Self->m_Bricks[0] * m_Self->m_Bricks[1] ), scratch );
+        }
+      }
+
+    const LabelFusion *           m_Self;
+    std::vector< BrickScratch > * m_Scratch;
+  };
+
+  void FuseBrick( std::size_t bx, std::size_t by, std::size_t bz, BrickScratch & scratch ) const
+    {
+    const std::size_t first[3] = { bx * BrickWidth, by * BrickHeight, bz * BrickHeight };
+    std::size_t extent[3];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      extent[d] = std::min( first[d] + ( d == 0 ? BrickWidth : BrickHeight ), m_OutputSize[d] ) - first[d];
+      }
+    const std::size_t atlases = m_Atlases.size();
+    for( std::size_t a = 0; a < atlases; a++ )
+      {
+      unsigned char * votes = &scratch.Votes[a * VoteStride];
+      for( std::size_t k = 0; k < extent[2]; k++ )
+        {
+        for( std::size_t j = 0; j < extent[1]; j++ )
+          {
+          m_Atlases[a].Resample( first[0], first[0] + extent[0], first[1] + j, first[2] + k,
+                                 votes + ( k * extent[1] + j ) * extent[0] );
+          }
+        }
+      }
+
+    double * totals = &scratch.Totals[0];
+    std::size_t v = 0;
+    for( std::size_t k = 0; k < extent[2]; k++ )
+      {
+      for( std::size_t j = 0; j < extent[1]; j++ )
+        {
+        unsigned char * out = m_Output + ( ( first[2] + k ) * m_OutputSize[1] + first[1] + j ) * m_OutputSize[0] + first[0];
+        for( std::size_t i = 0; i < extent[0]; i++, v++ )
+          {
+          // Unanimous (background, the inside of structures): no counting.
+          const unsigned char firstVote = scratch.Votes[v];
+          std::size_t a = 1;
+          while( a < atlases && scratch.Votes[a * VoteStride + v] == firstVote )
+            {
+            a++;
+            }
+          if( a == atlases )
+            {
+            out[i] = firstVote;
+            continue;
+            }
+          // Totals only grow, so the leader after the last vote is the
+          // label with the largest total.
+          unsigned char best = firstVote;
+          for( a = 0; a < atlases; a++ )
+            {
+            const unsigned char label = scratch.Votes[a * VoteStride + v];
+            totals[label] += m_Weights[a];
+            if( totals[label] > totals[best] || ( totals[label] == totals[best] && label < best ) )
+              {
+              best = label;
+              }
+            }
+          for( a = 0; a < atlases; a++ )
+            {
+            totals[scratch.Votes[a * VoteStride + v]] = 0.0;
+            }
+          out[i] = best;
+          }
+        }
+      }
+    }
+
+  LabelResampler::Mode           m_Mode;
+  std::vector< LabelResampler >  m_Atlases;
+  std::vector< double >          m_Weights;
+  unsigned char *                m_Output;
+  std::size_t                    m_OutputSize[3];
+  std::size_t                    m_Bricks[3];
+  unsigned int                   m_NumberOfThreads;
+};
+
+#endif
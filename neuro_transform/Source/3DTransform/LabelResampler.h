@@ -0,0 +1,298 @@
+// AUTHOR: Christian McDaniel
+//
+// Resampling of label maps and masks (unsigned char), where every output
+// voxel must hold one of the labels of the input. Gray-level kernels
+// produce values between labels instead (halfway between labels 2 and 4
+// is 3, another structure) and ring around the edges of masks.
+//
+// Nearest: the label at the rounded position (ITK's
+// NearestNeighborInterpolateImageFunction, halves rounded up). Positions
+// are stepped along each output row in 32.32 fixed point as in
+// {FixedPointLinearResampler.h} and rounded by a shift, so a voxel costs
+// three integer adds and one load.
+//
+// Majority: the label that holds the largest share of the trilinear
+// weights of the 2x2x2 neighbors (ties to the smaller label), i.e. the
+// label whose indicator interpolates highest; boundaries come out smooth
+// instead of staircased. The eight neighbor labels are packed into one
+// 64-bit word. Inside a region they are all equal, which takes a single
+// comparison; otherwise the neighbors that hold each distinct label are
+// found as an 8-bit mask by a byte-wise comparison within the word, and
+// their weights summed.
+
+#ifndef LabelResampler_h
+#define LabelResampler_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+#include "ParallelFor.h"
+#include "ResampleGeometry.h"
+
+class LabelResampler
+{
+public:
+  enum Mode { Nearest, Majority };
+
+  LabelResampler()
+    : m_Mode( Nearest ), m_Input( 0 ), m_Output( 0 ), m_DefaultPixelValue( 0 ),
+      m_NumberOfThreads( std::thread::hardware_concurrency() )
+    {
+    m_InputSize[0] = m_InputSize[1] = m_InputSize[2] = 0;
+    m_OutputSize[0] = m_OutputSize[1] = m_OutputSize[2] = 0;
+    SetIdentity( m_Mapping.Matrix );
+    m_Mapping.Offset[0] = m_Mapping.Offset[1] = m_Mapping.Offset[2] = 0.0;
+    }
+
+  void SetMode( Mode mode ) { m_Mode = mode; }
+
+  void SetInput( const unsigned char * buffer, const std::size_t size[3] )
+    {
+    m_Input = buffer;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_InputSize[d] = size[d];
+      }
+    }
+
+  void SetOutput( unsigned char * buffer, const std::size_t size[3] )
+    {
+    m_Output = buffer;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_OutputSize[d] = size[d];
+      }
+    }
+
+  void SetIndexMapping( const IndexMapping & mapping ) { m_Mapping = mapping; }
+  void SetDefaultPixelValue( unsigned char value ) { m_DefaultPixelValue = value; }
+  void SetNumberOfThreads( unsigned int threads ) { m_NumberOfThreads = threads > 0 ? threads : 1; }
+
+  void Update()
+    {
+    RowFunctor functor( this );
+    ParallelFor( 0, m_OutputSize[1] * m_OutputSize[2], 16, m_NumberOfThreads, functor );
+    }
+
+  // Output voxels [first, last) of row j of slice k, into out[0 .. last -
+  // first); for callers that resample pieces of rows (LabelFusion.h).
+  void Resample( std::size_t first, std::size_t last, std::size_t j, std::size_t k, unsigned char * out ) const
+    {
+    // Interior: no tap needs clamping. Nearest rounds [0, size - 1) into
+    // the buffer; the rounded majority position may land on the last
+    // sample, whose upper neighbor must still exist.
+    double insideLower[3];
+    double insideUpper[3];
+    double interiorLower[3];
+    double interiorUpper[3];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      insideLower[d] = -0.5;
+      insideUpper[d] = static_cast< double >( m_InputSize[d] ) - 0.5;
+      interiorLower[d] = 0.0;
+      interiorUpper[d] = static_cast< double >( m_InputSize[d] ) - 1.0 - ( m_Mode == Majority ? 1.0 / 256.0 : 0.0 );
+      }
+    std::size_t insideFirst;
+    std::size_t insideLast;
+    ComputeRowSpan( m_Mapping, j, k, last, insideLower, insideUpper, insideFirst, insideLast );
+    std::size_t interiorFirst;
+    std::size_t interiorLast;
+    ComputeRowSpan( m_Mapping, j, k, last, interiorLower, interiorUpper, interiorFirst, interiorLast );
+    if( interiorFirst == interiorLast )
+      {
+      interiorFirst = interiorLast = insideLast;
+      }
+    insideFirst = std::max( insideFirst, first );
+    insideLast = std::max( insideLast, insideFirst );
+
+    double c0[3];
+    m_Mapping.Map( 0.0, static_cast< double >( j ), static_cast< double >( k ), c0 );
+    std::int64_t position[3];
+    std::int64_t step[3];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      step[d] = ToFixed( m_Mapping.Matrix[d][0] );
+      position[d] = ToFixed( c0[d] ) + static_cast< std::int64_t >( insideFirst ) * step[d];
+      }
+    const std::size_t strideY = m_InputSize[0];
+    const std::size_t strideZ = strideY * m_InputSize[1];
+    const std::int64_t half = std::int64_t( 1 ) << 31;
+
+    std::size_t i = first;
+    for( ; i < insideFirst; i++ )
+      {
+      out[i - first] = m_DefaultPixelValue;
+      }
+    if( m_Mode == Nearest )
+      {
+      for( ; i < insideLast; i++ )
+        {
+        std::size_t index[3];
+        if( i >= interiorFirst && i < interiorLast )
+          {
+          for( unsigned int d = 0; d < 3; d++ )
+            {
+            index[d] = static_cast< std::size_t >( ( position[d] + half ) >> 32 );
+            }
+          }
+        else
+          {
+          for( unsigned int d = 0; d < 3; d++ )
+            {
+            index[d] = ClampIndex( ( position[d] + half ) >> 32, m_InputSize[d] );
+            }
+          }
+        out[i - first] = m_Input[index[2] * strideZ + index[1] * strideY + index[0]];
+        position[0] += step[0];
+        position[1] += step[1];
+        position[2] += step[2];
+        }
+      }
+    else
+      {
+      for( ; i < insideLast; i++ )
+        {
+        // 1/256 voxel units, rounded; base sample and 8-bit fraction.
+        std::int64_t base[3];
+        std::uint32_t fraction[3];
+        for( unsigned int d = 0; d < 3; d++ )
+          {
+          const std::int64_t quantized = ( position[d] + ( std::int64_t( 1 ) << 23 ) ) >> 24;
+          base[d] = quantized >> 8;
+          fraction[d] = static_cast< std::uint32_t >( quantized & 255 );
+          position[d] += step[d];
+          }
+        std::size_t x0, x1, y0, y1, z0, z1;
+        if( i >= interiorFirst && i < interiorLast )
+          {
+          x0 = static_cast< std::size_t >( base[0] );
+          y0 = static_cast< std::size_t >( base[1] );
+          z0 = static_cast< std::size_t >( base[2] );
+          x1 = x0 + 1;
+          y1 = y0 + 1;
+          z1 = z0 + 1;
+          }
+        else
+          {
+          Clamp( base[0], m_InputSize[0], x0, x1 );
+          Clamp( base[1], m_InputSize[1], y0, y1 );
+          Clamp( base[2], m_InputSize[2], z0, z1 );
+          }
+        const unsigned char * p00 = m_Input + z0 * strideZ + y0 * strideY;
+        const unsigned char * p01 = m_Input + z0 * strideZ + y1 * strideY;
+        const unsigned char * p10 = m_Input + z1 * strideZ + y0 * strideY;
+        const unsigned char * p11 = m_Input + z1 * strideZ + y1 * strideY;
+        const std::uint64_t labels = static_cast< std::uint64_t >( p00[x0] ) | static_cast< std::uint64_t >( p00[x1] ) << 8
+                                   | static_cast< std::uint64_t >( p01[x0] ) << 16 | static_cast< std::uint64_t >( p01[x1] ) << 24
+                                   | static_cast< std::uint64_t >( p10[x0] ) << 32 | static_cast< std::uint64_t >( p10[x1] ) << 40
+                                   | static_cast< std::uint64_t >( p11[x0] ) << 48 | static_cast< std::uint64_t >( p11[x1] ) << 56;
+        out[i - first] = Vote( labels, fraction );
+        }
+      }
+    for( ; i < last; i++ )
+      {
+      out[i - first] = m_DefaultPixelValue;
+      }
+    }
+
+  // Bit n set for every byte n of `labels` that equals `label`.
+  static unsigned int MatchLabel( std::uint64_t labels, unsigned char label )
+    {
+    const std::uint64_t low = 0x7F7F7F7F7F7F7F7FULL;
+    const std::uint64_t difference = labels ^ ( 0x0101010101010101ULL * label );
+    // 0x80 in every byte of difference that is zero (no carries between
+    // bytes, so exact), then the eight high bits gathered into one byte.
+    const std::uint64_t zero = ~( ( ( difference & low ) + low ) | difference | low );
+    return static_cast< unsigned int >( ( ( zero >> 7 ) * 0x0102040810204080ULL ) >> 56 );
+    }
+
+private:
+  struct RowFunctor
+  {
+    explicit RowFunctor( const LabelResampler * self ) : m_Self( self ) {}
+
+    void operator()( std::size_t first, std::size_t last, unsigned int ) const
+      {
+      for( std::size_t row = first; row < last; row++ )
+        {
+        m_Self->Resample( 0, m_Self->m_OutputSize[0], row % m_Self->m_OutputSize[1], row / m_Self->m_OutputSize[1],
+                          m_Self->m_Output + row * m_Self->m_OutputSize[0] );
+        }
+      }
+
+    const LabelResampler * m_Self;
+  };
+
+  static std::int64_t ToFixed( double value )
+    {
+    return static_cast< std::int64_t >( std::floor( value * 4294967296.0 + 0.5 ) );
+    }
+
+  static std::size_t ClampIndex( std::int64_t index, std::size_t size )
+    {
+    const std::int64_t last = static_cast< std::int64_t >( size ) - 1;
+    return static_cast< std::size_t >( index < 0 ? 0 : ( index > last ? last : index ) );
+    }
+
+  // Neighbor samples of `base` clamped to [0, size - 1].
+  static void Clamp( std::int64_t base, std::size_t size, std::size_t & lower, std::size_t & upper )
+    {
+    lower = ClampIndex( base, size );
+    upper = ClampIndex( base + 1, size );
+    }
+
+  // The majority label of the eight neighbors (corner n = x + 2 y + 4 z)
+  // with 8-bit fractional positions.
+  static unsigned char Vote( std::uint64_t labels, const std::uint32_t fraction[3] )
+    {
+    const unsigned char first = static_cast< unsigned char >( labels );
+    if( labels == 0x0101010101010101ULL * first )
+      {
+      return first;
+      }
+    std::uint32_t weights[8];
+    for( unsigned int n = 0; n < 8; n++ )
+      {
+      weights[n] = ( ( n & 1 ) ? fraction[0] : 256 - fraction[0] ) * ( ( n & 2 ) ? fraction[1] : 256 - fraction[1] )
+                 * ( ( n & 4 ) ? fraction[2] : 256 - fraction[2] );
+      }
+    unsigned int remaining = 0xFF;
+    unsigned char best = 0;
+    std::uint32_t bestWeight = 0;
+    for( unsigned int n = 0; remaining != 0; n++ )
+      {
+      if( !( remaining & ( 1u << n ) ) )
+        {
+        continue;
+        }
+      const unsigned char label = static_cast< unsigned char >( labels >> ( 8 * n ) );
+      const unsigned int match = MatchLabel( labels, label );
+      remaining &= ~match;
+      std::uint32_t weight = 0;
+      for( unsigned int m = n; m < 8; m++ )
+        {
+        weight += ( match & ( 1u << m ) ) ? weights[m] : 0;
+        }
+      if( weight > bestWeight || ( weight == bestWeight && label < best ) )
+        {
+        best = label;
+        bestWeight = weight;
+        }
+      }
+    return best;
+    }
+
+  Mode                  m_Mode;
+  const unsigned char * m_Input;
+  unsigned char *       m_Output;
+  std::size_t           m_InputSize[3];
+  std::size_t           m_OutputSize[3];
+  IndexMapping          m_Mapping;
+  unsigned char         m_DefaultPixelValue;
+  unsigned int          m_NumberOfThreads;
+};
+
+#endif
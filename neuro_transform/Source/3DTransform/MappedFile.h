@@ -0,0 +1,100 @@
+// AUTHOR: Christian McDaniel
+//
+// Read-only view of a whole file. On POSIX systems the file is mapped
+// (mmap) so that processes opening the same file share its pages through
+// the page cache; elsewhere it is read into memory.
+
+#ifndef MappedFile_h
+#define MappedFile_h
+
+#include <cstddef>
+#include <string>
+
+#if defined( _WIN32 )
+#include <fstream>
+#include <vector>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class MappedFile
+{
+public:
+  MappedFile() : m_Data( 0 ), m_Size( 0 ) {}
+  ~MappedFile() { Close(); }
+
+  // Returns false if the file cannot be opened or is empty.
+  bool Open( const std::string & fileName )
+    {
+    Close();
+#if defined( _WIN32 )
+    std::ifstream file( fileName.c_str(), std::ios::binary | std::ios::ate );
+    if( !file )
+      {
+      return false;
+      }
+    m_Buffer.resize( static_cast< std::size_t >( file.tellg() ) );
+    file.seekg( 0 );
+    if( m_Buffer.empty() || !file.read( &m_Buffer[0], m_Buffer.size() ) )
+      {
+      m_Buffer.clear();
+      return false;
+      }
+    m_Data = &m_Buffer[0];
+    m_Size = m_Buffer.size();
+#else
+    const int descriptor = open( fileName.c_str(), O_RDONLY );
+    if( descriptor < 0 )
+      {
+      return false;
+      }
+    struct stat status;
+    if( fstat( descriptor, &status ) != 0 || status.st_size <= 0 )
+      {
+      close( descriptor );
+      return false;
+      }
+    void * data = mmap( 0, static_cast< std::size_t >( status.st_size ), PROT_READ, MAP_SHARED, descriptor, 0 );
+    close( descriptor );
+    if( data == MAP_FAILED )
+      {
+      return false;
+      }
+    m_Data = static_cast< const char * >( data );
+    m_Size = static_cast< std::size_t >( status.st_size );
+#endif
+    return true;
+    }
+
+  void Close()
+    {
+#if defined( _WIN32 )
+    m_Buffer.clear();
+#else
+    if( m_Data )
+      {
+      munmap( const_cast< char * >( m_Data ), m_Size );
+      }
+#endif
+    m_Data = 0;
+    m_Size = 0;
+    }
+
+  const char * GetData() const { return m_Data; }
+  std::size_t GetSize() const { return m_Size; }
+
+private:
+  MappedFile( const MappedFile & );
+  MappedFile & operator=( const MappedFile & );
+
+  const char *        m_Data;
+  std::size_t         m_Size;
+#if defined( _WIN32 )
+  std::vector< char > m_Buffer;
+#endif
+};
+
+#endif
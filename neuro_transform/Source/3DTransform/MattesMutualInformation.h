@@ -0,0 +1,237 @@
+// AUTHOR: Christian McDaniel
+//
+// The parts of Mattes' mutual information metric (Mattes et al., "PET-CT
+// image registration in the chest using free-form deformations", IEEE TMI
+// 2003; ITK's MattesMutualInformationImageToImageMetric) that do not
+// depend on the transform: the choice of fixed voxels at which it is
+// evaluated and the Parzen-windowed joint histogram of fixed and moving
+// gray levels.
+//
+// The fixed image is binned with a box window and the moving image with a
+// cubic B-spline, so that the histogram, and the mutual information
+// computed from it, are smooth functions of the moving values. Each
+// sample adds four weights to four adjacent bins of one row. The weights
+// are fixed point (1 / 1024 units, always summing to exactly 1024), so the
+// histogram is a table of 32-bit integers: a sample is one 128-bit
+// integer add (SSE2), per-thread histograms are added without rounding,
+// and the result does not depend on the number of threads.
+
+#ifndef MattesMutualInformation_h
+#define MattesMutualInformation_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+// How the fixed voxels of a sampled metric are chosen: uniformly at
+// random, or one at a random position in each cell of a regular grid of
+// cells (stratified, which covers the image evenly and has a lower
+// variance for the same number of samples).
+enum SampleSelection { RandomSamples, StratifiedSamples };
+
+// About `count` linear indices of voxels of an image of `size`, in
+// increasing order (for locality). The same seed gives the same samples.
+inline void SelectSamples( const std::size_t size[3], std::size_t count, SampleSelection selection,
+                           unsigned long seed, std::vector< std::size_t > & samples )
+{
+  samples.clear();
+  const std::size_t voxels = size[0] * size[1] * size[2];
+  if( voxels == 0 || count == 0 )
+    {
+    return;
+    }
+  std::mt19937_64 generator( seed );
+  if( selection == RandomSamples )
+    {
+    std::uniform_int_distribution< std::size_t > voxel( 0, voxels - 1 );
+    samples.resize( count );
+    for( std::size_t n = 0; n < count; n++ )
+      {
+      samples[n] = voxel( generator );
+      }
+    std::sort( samples.begin(), samples.end() );
+    return;
+    }
+
+  // Cells of about voxels / count voxels, with the same number of voxels
+  // along every axis where the image allows it.
+  const double side = std::cbrt( static_cast< double >( voxels ) / static_cast< double >( count ) );
+  std::size_t cells[3];
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    cells[d] = static_cast< std::size_t >( std::max( 1.0, std::floor( size[d] / side + 0.5 ) ) );
+    cells[d] = std::min( cells[d], size[d] );
+    }
+  std::uniform_real_distribution< double > unit( 0.0, 1.0 );
+  samples.reserve( cells[0] * cells[1] * cells[2] );
+  for( std::size_t ck = 0; ck < cells[2]; ck++ )
+    {
+    for( std::size_t cj = 0; cj < cells[1]; cj++ )
+      {
+      for( std::size_t ci = 0; ci < cells[0]; ci++ )
+        {
+        const std::size_t cell[3] = { ci, cj, ck };
+        std::size_t index[3];
+        for( unsigned int d = 0; d < 3; d++ )
+          {
+          // Voxels [first, last) of the cell along d.
+          const std::size_t first = cell[d] * size[d] / cells[d];
+          const std::size_t last = ( cell[d] + 1 ) * size[d] / cells[d];
+          index[d] = first + std::min( last - first - 1,
+                                       static_cast< std::size_t >( unit( generator ) * ( last - first ) ) );
+          }
+        samples.push_back( ( index[2] * size[1] + index[1] ) * size[0] + index[0] );
+        }
+      }
+    }
+  std::sort( samples.begin(), samples.end() );
+}
+
+class ParzenJointHistogram
+{
+public:
+  // Bins kept empty at both ends of each axis, so the four B-spline taps of
+  // any value fall inside the histogram.
+  static const unsigned int Padding = 2;
+  // Fixed-point scale of the weights: a sample adds 1 << WeightBits.
+  static const unsigned int WeightBits = 10;
+
+  ParzenJointHistogram()
+    : m_NumberOfBins( 32 ), m_FixedMinimum( 0.0 ), m_FixedBinSize( 1.0 ), m_MovingMinimum( 0.0 ),
+      m_MovingBinSize( 1.0 )
+    {
+    }
+
+  // At least 2 * Padding + 1 bins per axis.
+  void SetNumberOfBins( unsigned int bins ) { m_NumberOfBins = std::max( bins, 2 * Padding + 1 ); }
+  unsigned int GetNumberOfBins() const { return m_NumberOfBins; }
+
+  // The gray level ranges of the two images, mapped onto the unpadded bins.
+  void SetRanges( double fixedMinimum, double fixedMaximum, double movingMinimum, double movingMaximum )
+    {
+    const double bins = static_cast< double >( m_NumberOfBins - 2 * Padding );
+    m_FixedMinimum = fixedMinimum;
+    m_MovingMinimum = movingMinimum;
+    m_FixedBinSize = std::max( fixedMaximum - fixedMinimum, 1e-6 ) / bins;
+    m_MovingBinSize = std::max( movingMaximum - movingMinimum, 1e-6 ) / bins;
+    }
+
+  double GetMovingBinSize() const { return m_MovingBinSize; }
+
+  // Row of a fixed gray level (box window).
+  unsigned int GetFixedBin( double value ) const
+    {
+    const double position = ( value - m_FixedMinimum ) / m_FixedBinSize + Padding;
+    const double last = static_cast< double >( m_NumberOfBins - Padding - 1 );
+    return static_cast< unsigned int >( std::min( std::max( position, static_cast< double >( Padding ) ), last ) );
+    }
+
+  // First of the four columns a moving gray level falls on, and its
+  // offset t in [0, 1] from the second one.
+  void GetMovingBin( double value, unsigned int & first, double & t ) const
+    {
+    double position = ( value - m_MovingMinimum ) / m_MovingBinSize + Padding;
+    const double low = static_cast< double >( Padding );
+    const double high = static_cast< double >( m_NumberOfBins - Padding );
+    position = std::min( std::max( position, low ), high );
+    double base = std::floor( position );
+    if( base > high - 1.0 )
+      {
+      base = high - 1.0;
+      }
+    t = position - base;
+    first = static_cast< unsigned int >( base ) - 1;
+    }
+
+  // The cubic B-spline weights of the four columns, in fixed point.
+  static void GetWeights( double t, std::uint32_t weights[4] )
+    {
+    const double scale = static_cast< double >( 1u << WeightBits );
+    const double u = 1.0 - t;
+    weights[0] = static_cast< std::uint32_t >( scale * u * u * u / 6.0 + 0.5 );
+    weights[1] = static_cast< std::uint32_t >( scale * ( 3.0 * t * t * t - 6.0 * t * t + 4.0 ) / 6.0 + 0.5 );
+    weights[3] = static_cast< std::uint32_t >( scale * t * t * t / 6.0 + 0.5 );
+    weights[2] = ( 1u << WeightBits ) - weights[0] - weights[1] - weights[3];
+    }
+
+  // Derivatives of the four weights with respect to the bin position.
+  static void GetWeightDerivatives( double t, double derivatives[4] )
+    {
+    const double u = 1.0 - t;
+    derivatives[0] = -0.5 * u * u;
+    derivatives[1] = 1.5 * t * t - 2.0 * t;
+    derivatives[2] = -1.5 * t * t + t + 0.5;
+    derivatives[3] = 0.5 * t * t;
+    }
+
+  // Adds four weights to four adjacent bins.
+  static void AddWeights( std::uint32_t * bins, const std::uint32_t weights[4] )
+    {
+#if defined( __SSE2__ )
+    __m128i * target = reinterpret_cast< __m128i * >( bins );
+    _mm_storeu_si128( target, _mm_add_epi32( _mm_loadu_si128( target ),
+                                             _mm_loadu_si128( reinterpret_cast< const __m128i * >( weights ) ) ) );
+#else
+    bins[0] += weights[0];
+    bins[1] += weights[1];
+    bins[2] += weights[2];
+    bins[3] += weights[3];
+#endif
+    }
+
+  // Mutual information of a joint histogram (row = fixed bin), and for
+  // every bin log( p( f, m ) / p( m ) ), the factor of its derivative in
+  // the metric gradient (0 for empty bins).
+  double ComputeMutualInformation( const std::vector< std::uint64_t > & joint, std::vector< double > & logRatio ) const
+    {
+    const unsigned int bins = m_NumberOfBins;
+    std::vector< double > fixedMarginal( bins, 0.0 );
+    std::vector< double > movingMarginal( bins, 0.0 );
+    double total = 0.0;
+    for( unsigned int f = 0; f < bins; f++ )
+      {
+      for( unsigned int m = 0; m < bins; m++ )
+        {
+        const double value = static_cast< double >( joint[f * bins + m] );
+        fixedMarginal[f] += value;
+        movingMarginal[m] += value;
+        total += value;
+        }
+      }
+    logRatio.assign( joint.size(), 0.0 );
+    if( !( total > 0.0 ) )
+      {
+      return 0.0;
+      }
+    double information = 0.0;
+    for( unsigned int f = 0; f < bins; f++ )
+      {
+      for( unsigned int m = 0; m < bins; m++ )
+        {
+        const double value = static_cast< double >( joint[f * bins + m] );
+        if( value > 0.0 )
+          {
+          logRatio[f * bins + m] = std::log( value / movingMarginal[m] );
+          information += value * std::log( value * total / ( fixedMarginal[f] * movingMarginal[m] ) );
+          }
+        }
+      }
+    return information / total;
+    }
+
+private:
+  unsigned int m_NumberOfBins;
+  double       m_FixedMinimum;
+  double       m_FixedBinSize;
+  double       m_MovingMinimum;
+  double       m_MovingBinSize;
+};
+
+#endif
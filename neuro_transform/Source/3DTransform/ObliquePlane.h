@@ -0,0 +1,129 @@
+// AUTHOR: Christian McDaniel
+//
+// Oblique planes for reslicing: a plane is given by its center (a world
+// point), its normal and an "up" vector, and becomes an output grid of a
+// single slice whose direction cosines are the in-plane axes and the
+// normal. Any resampler in this directory then fills it like a 3D output,
+// so a plane costs only its own voxels.
+
+#ifndef ObliquePlane_h
+#define ObliquePlane_h
+
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ResampleGeometry.h"
+
+struct ObliquePlane
+{
+  double Center[3];
+  double Normal[3];
+  double Up[3];
+};
+
+// The single-slice grid of `size[0]` x `size[1]` voxels of `spacing`
+// centered on the plane. Its axes are right = up x normal, the part of
+// up orthogonal to the normal, and the normal (a right-handed frame).
+// Returns false if the normal is zero or parallel to up.
+inline bool GetPlaneGeometry( const ObliquePlane & plane, const std::size_t size[2], double spacing,
+                              ImageGeometry & geometry )
+{
+  double axes[3][3];
+  const double * normal = plane.Normal;
+  const double * up = plane.Up;
+  axes[0][0] = up[1] * normal[2] - up[2] * normal[1];
+  axes[0][1] = up[2] * normal[0] - up[0] * normal[2];
+  axes[0][2] = up[0] * normal[1] - up[1] * normal[0];
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    axes[2][d] = normal[d];
+    }
+  axes[1][0] = normal[1] * axes[0][2] - normal[2] * axes[0][1];
+  axes[1][1] = normal[2] * axes[0][0] - normal[0] * axes[0][2];
+  axes[1][2] = normal[0] * axes[0][1] - normal[1] * axes[0][0];
+  for( unsigned int a = 0; a < 3; a++ )
+    {
+    const double length = std::sqrt( axes[a][0] * axes[a][0] + axes[a][1] * axes[a][1] + axes[a][2] * axes[a][2] );
+    if( !( length > 1e-12 ) )
+      {
+      return false;
+      }
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      axes[a][d] /= length;
+      }
+    }
+
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    for( unsigned int a = 0; a < 3; a++ )
+      {
+      geometry.Direction[d][a] = axes[a][d];
+      }
+    geometry.Spacing[d] = spacing;
+    geometry.Origin[d] = plane.Center[d]
+      - 0.5 * spacing * ( static_cast< double >( size[0] ) - 1.0 ) * axes[0][d]
+      - 0.5 * spacing * ( static_cast< double >( size[1] ) - 1.0 ) * axes[1][d];
+    }
+  geometry.Size[0] = size[0];
+  geometry.Size[1] = size[1];
+  geometry.Size[2] = 1;
+  return true;
+}
+
+// Reads one plane per line, "cx cy cz nx ny nz ux uy uz"; blank lines and
+// lines starting with '#' are skipped. Returns false if the file cannot be
+// read or a line is malformed.
+inline bool ReadPlaneFile( const std::string & fileName, std::vector< ObliquePlane > & planes )
+{
+  std::ifstream file( fileName.c_str() );
+  if( !file )
+    {
+    return false;
+    }
+  std::string line;
+  while( std::getline( file, line ) )
+    {
+    std::istringstream fields( line );
+    std::vector< double > values;
+    std::string field;
+    while( fields >> field )
+      {
+      if( values.empty() && field[0] == '#' )
+        {
+        break;
+        }
+      std::istringstream number( field );
+      double value;
+      std::string rest;
+      if( !( number >> value ) || ( number >> rest ) )
+        {
+        return false;
+        }
+      values.push_back( value );
+      }
+    if( values.empty() )
+      {
+      continue;
+      }
+    if( values.size() != 9 )
+      {
+      return false;
+      }
+    ObliquePlane plane;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      plane.Center[d] = values[d];
+      plane.Normal[d] = values[3 + d];
+      plane.Up[d] = values[6 + d];
+      }
+    planes.push_back( plane );
+    }
+  return true;
+}
+
+#endif
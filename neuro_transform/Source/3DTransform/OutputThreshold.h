@@ -0,0 +1,120 @@
+// AUTHOR: Christian McDaniel
+//
+// How the resamplers in this directory store an interpolated value:
+// clamped to the pixel range and truncated, as ResampleImageFilter does,
+// or, with an OutputThreshold, as a binary mask (value >= threshold). The
+// threshold is applied to each interpolated value inside the resampling
+// loop, before it is truncated or rounded, so a transformed mask is
+// written without the gray-level volume in between and a fractional
+// threshold gives the same mask with every engine. For an integer
+// threshold the mask is the same as thresholding the stored gray levels
+// afterwards.
+
+#ifndef OutputThreshold_h
+#define OutputThreshold_h
+
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+// Clamps to the pixel range and truncates, as ResampleImageFilter's
+// CastPixelWithBoundsChecking does.
+template< typename TPixel >
+inline TPixel ClampCast( double value )
+{
+  const double minimum = static_cast< double >( std::numeric_limits< TPixel >::lowest() );
+  const double maximum = static_cast< double >( std::numeric_limits< TPixel >::max() );
+  if( value < minimum )
+    {
+    return std::numeric_limits< TPixel >::lowest();
+    }
+  if( value > maximum )
+    {
+    return std::numeric_limits< TPixel >::max();
+    }
+  return static_cast< TPixel >( value );
+}
+
+struct OutputThreshold
+{
+  OutputThreshold()
+    : Enabled( false ), Threshold( 0.0 ), InsideValue( 1.0 ), OutsideValue( 0.0 ) {}
+
+  OutputThreshold( double threshold, double insideValue, double outsideValue )
+    : Enabled( true ), Threshold( threshold ), InsideValue( insideValue ), OutsideValue( outsideValue ) {}
+
+  // The stored pixel for an interpolated value.
+  template< typename TPixel >
+  TPixel Apply( double value ) const
+    {
+    if( !Enabled )
+      {
+      return ClampCast< TPixel >( value );
+      }
+    return static_cast< TPixel >( value >= Threshold ? InsideValue : OutsideValue );
+    }
+
+  // Thresholds a buffer of already stored pixels in place, for the
+  // resamplers that copy input values instead of interpolating them
+  // (integer mappings, labels); there the stored value is the exact one.
+  template< typename TPixel >
+  void ApplyInPlace( TPixel * buffer, std::size_t count ) const
+    {
+    if( !Enabled )
+      {
+      return;
+      }
+    for( std::size_t n = 0; n < count; n++ )
+      {
+      buffer[n] = Apply< TPixel >( static_cast< double >( buffer[n] ) );
+      }
+    }
+
+  bool   Enabled;
+  double Threshold;
+  double InsideValue;
+  double OutsideValue;
+};
+
+// Otsu's threshold of an 8-bit buffer: the gray level t that maximizes the
+// between-class variance of [0, t] and [t + 1, 255]. Returned as t + 1, the
+// smallest value of the upper class, to be used with OutputThreshold.
+inline double ComputeOtsuThreshold( const unsigned char * buffer, std::size_t count )
+{
+  std::vector< double > histogram( 256, 0.0 );
+  for( std::size_t n = 0; n < count; n++ )
+    {
+    histogram[buffer[n]] += 1.0;
+    }
+  double total = 0.0;
+  double totalSum = 0.0;
+  for( unsigned int g = 0; g < 256; g++ )
+    {
+    total += histogram[g];
+    totalSum += g * histogram[g];
+    }
+  double lowerCount = 0.0;
+  double lowerSum = 0.0;
+  double bestVariance = -1.0;
+  unsigned int best = 0;
+  for( unsigned int t = 0; t < 255; t++ )
+    {
+    lowerCount += histogram[t];
+    lowerSum += t * histogram[t];
+    const double upperCount = total - lowerCount;
+    if( lowerCount == 0.0 || upperCount == 0.0 )
+      {
+      continue;
+      }
+    const double difference = lowerSum / lowerCount - ( totalSum - lowerSum ) / upperCount;
+    const double variance = lowerCount * upperCount * difference * difference;
+    if( variance > bestVariance )
+      {
+      bestVariance = variance;
+      best = t;
+      }
+    }
+  return static_cast< double >( best ) + 1.0;
+}
+
+#endif
@@ -0,0 +1,73 @@
+// AUTHOR: Christian McDaniel
+//
+// Minimal thread pool helper for the raw-buffer kernels. Work items
+// [begin, end) are handed out in chunks of `grain` from a shared atomic
+// counter, so threads that finish early keep pulling work instead of
+// idling behind a static partition.
+
+#ifndef ParallelFor_h
+#define ParallelFor_h
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Calls body( first, last, threadId ) for consecutive chunks of the range.
+template< typename TBody >
+void ParallelFor( std::size_t begin, std::size_t end, std::size_t grain,
+                  unsigned int numberOfThreads, const TBody & body )
+{
+  if( end <= begin )
+    {
+    return;
+    }
+  if( grain == 0 )
+    {
+    grain = 1;
+    }
+  const std::size_t chunks = ( end - begin + grain - 1 ) / grain;
+  if( numberOfThreads > chunks )
+    {
+    numberOfThreads = static_cast< unsigned int >( chunks );
+    }
+  if( numberOfThreads <= 1 )
+    {
+    body( begin, end, 0u );
+    return;
+    }
+
+  std::atomic< std::size_t > next( begin );
+  std::vector< std::thread > threads;
+  threads.reserve( numberOfThreads - 1 );
+
+  struct Worker
+  {
+    static void Run( std::atomic< std::size_t > * counter, std::size_t last,
+                     std::size_t chunk, unsigned int threadId, const TBody * function )
+      {
+      for(;;)
+        {
+        const std::size_t first = counter->fetch_add( chunk );
+        if( first >= last )
+          {
+          break;
+          }
+        ( *function )( first, std::min( first + chunk, last ), threadId );
+        }
+      }
+  };
+
+  for( unsigned int t = 1; t < numberOfThreads; t++ )
+    {
+    threads.push_back( std::thread( &Worker::Run, &next, end, grain, t, &body ) );
+    }
+  Worker::Run( &next, end, grain, 0u, &body );
+  for( std::size_t t = 0; t < threads.size(); t++ )
+    {
+    threads[t].join();
+    }
+}
+
+#endif
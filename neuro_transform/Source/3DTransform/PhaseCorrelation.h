@@ -0,0 +1,695 @@
+// AUTHOR: Christian McDaniel
+//
+// Translation, and optionally the rotation about one axis, between two 3D
+// images by phase correlation (Kuglin and Hines 1975; Reddy and
+// Chatterji, "An FFT-based technique for translation, rotation, and
+// scale-invariant image registration", IEEE TIP 1996), with the bundled
+// FFT of FFTPlan.h.
+//
+// The normalized cross-power spectrum of two images that differ by a shift
+// is a pure phase ramp, and its inverse transform a single peak at the
+// shift: one forward and one inverse FFT find any translation up to half
+// the field of view, without a starting point or local minima. The peak is
+// located to a fraction of a voxel from its two neighbors along each axis
+// (Foroosh et al., IEEE TIP 2002). A rotation about an axis rotates the
+// magnitude spectrum, which does not depend on the translation, by the
+// same angle; sampled on a grid of log radius and angle in the plane
+// normal to the axis it becomes a shift along the angle, found by the
+// same correlation. The magnitude spectrum of a real image is symmetric,
+// so the angle is only known modulo 180 degrees; both candidates are
+// tried and the one with the higher translation peak is kept.
+//
+// Both images are taken at the first Gaussian pyramid level with at most
+// about 2M voxels; the moving image is resampled (trilinear) onto that
+// level of the fixed grid, and both are windowed (Hann) against the
+// wrap-around of the circular correlation. The fixed side (level, window,
+// spectrum, polar magnitude) is computed once by Update(); Estimate() does
+// not change the object and may run for several moving images at once.
+
+#ifndef PhaseCorrelation_h
+#define PhaseCorrelation_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "FFTPlan.h"
+#include "GaussianPyramid.h"
+#include "ParallelFor.h"
+#include "ResampleGeometry.h"
+
+struct PhaseCorrelationResult
+{
+  // x_moving = Matrix * x_fixed + Offset.
+  AffineMapping Transform;
+  // The translation in mm, in the fixed image's axes, and the rotation in
+  // radians about the chosen axis through the fixed image's center.
+  double        Translation[3];
+  double        Angle;
+  // Height of the correlation peak, 1 for images that differ only by an
+  // integer shift (without windowing) and near 0 for unrelated images.
+  double        Peak;
+};
+
+template< typename TPixel >
+class PhaseCorrelation
+{
+public:
+  // Voxels of the level both images are correlated at, at most (unless the
+  // fixed image is too small to be reduced).
+  static const std::size_t MaximumNumberOfVoxels = std::size_t( 1 ) << 21;
+  // Samples of the polar magnitude spectrum: log radii, and angles over
+  // 180 degrees.
+  static const std::size_t NumberOfRadii = 64;
+  static const std::size_t NumberOfAngles = 360;
+
+  PhaseCorrelation()
+    : m_Axis( -1 ), m_NumberOfThreads( std::thread::hardware_concurrency() ), m_Level( 0 )
+    {
+    m_Center[0] = m_Center[1] = m_Center[2] = 0.0;
+    m_PaddedSize[0] = m_PaddedSize[1] = m_PaddedSize[2] = 0;
+    }
+
+  void SetFixedImage( const TPixel * buffer, const ImageGeometry & geometry )
+    {
+    m_Pyramid.SetInput( buffer, geometry.Size );
+    m_Geometry = geometry;
+    }
+
+  // -1: translation only; 0, 1 or 2: also the rotation about that axis of
+  // the fixed grid (from axis a + 1 towards axis a + 2).
+  void SetRotationAxis( int axis ) { m_Axis = ( axis >= 0 && axis < 3 ) ? axis : -1; }
+
+  void SetNumberOfThreads( unsigned int threads )
+    {
+    m_NumberOfThreads = threads > 0 ? threads : 1;
+    m_Pyramid.SetNumberOfThreads( m_NumberOfThreads );
+    }
+
+  // The fixed side: level, padded size and FFT plans, windows, spectrum and
+  // (with a rotation axis) polar magnitude spectrum.
+  void Update()
+    {
+    double middle[3];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      middle[d] = 0.5 * ( static_cast< double >( m_Geometry.Size[d] ) - 1.0 );
+      }
+    double indexToPhysical[3][3];
+    GetIndexToPhysicalMatrix( m_Geometry, indexToPhysical );
+    MultiplyMatrixVector( indexToPhysical, middle, m_Center );
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_Center[d] += m_Geometry.Origin[d];
+      }
+
+    m_Level = 0;
+    std::size_t size[3];
+    GaussianPyramid< TPixel >::GetLevelSize( m_Geometry.Size, 0, size );
+    while( size[0] * size[1] * size[2] > MaximumNumberOfVoxels )
+      {
+      std::size_t coarser[3];
+      GaussianPyramid< TPixel >::GetLevelSize( m_Geometry.Size, m_Level + 1, coarser );
+      if( coarser[0] < GaussianPyramid< TPixel >::MinimumSize || coarser[1] < GaussianPyramid< TPixel >::MinimumSize
+          || coarser[2] < GaussianPyramid< TPixel >::MinimumSize )
+        {
+        break;
+        }
+      m_Level++;
+      std::copy( coarser, coarser + 3, size );
+      }
+    const TPixel * fixed = m_Pyramid.GetLevel( m_Level, size );
+    m_Grid = GaussianPyramid< TPixel >::GetLevelGeometry( m_Geometry, m_Level );
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_PaddedSize[d] = NextFastFFTLength( size[d] );
+      m_Window[d].resize( size[d] );
+      const double pi = 3.14159265358979323846;
+      for( std::size_t i = 0; i < size[d]; i++ )
+        {
+        m_Window[d][i] = 0.5 - 0.5 * std::cos( 2.0 * pi * ( static_cast< double >( i ) + 0.5 ) / size[d] );
+        }
+      }
+    m_RowPlan.Initialize( m_PaddedSize[0] );
+    m_ColumnPlan.Initialize( m_PaddedSize[1] );
+    m_SlicePlan.Initialize( m_PaddedSize[2] );
+    m_AnglePlan.Initialize( NumberOfAngles );
+
+    std::vector< double > volume( m_PaddedSize[0] * m_PaddedSize[1] * m_PaddedSize[2], 0.0 );
+    for( std::size_t k = 0; k < size[2]; k++ )
+      {
+      for( std::size_t j = 0; j < size[1]; j++ )
+        {
+        const TPixel * in = fixed + ( k * size[1] + j ) * size[0];
+        double * out = &volume[( k * m_PaddedSize[1] + j ) * m_PaddedSize[0]];
+        for( std::size_t i = 0; i < size[0]; i++ )
+          {
+          out[i] = static_cast< double >( in[i] );
+          }
+        }
+      }
+    Window( volume );
+    Forward( volume, m_FixedSpectrum, m_NumberOfThreads );
+    m_FixedPolar.clear();
+    if( m_Axis >= 0 )
+      {
+      ComputePolarSpectrum( m_FixedSpectrum, m_FixedPolar );
+      }
+    }
+
+  // The transform that takes the fixed image to `moving`, on
+  // `numberOfThreads` threads.
+  PhaseCorrelationResult Estimate( const TPixel * moving, const ImageGeometry & movingGeometry,
+                                   unsigned int numberOfThreads ) const
+    {
+    GaussianPyramid< TPixel > pyramid;
+    pyramid.SetNumberOfThreads( numberOfThreads );
+    pyramid.SetInput( moving, movingGeometry.Size );
+
+    AffineMapping identity;
+    SetIdentity( identity.Matrix );
+    identity.Offset[0] = identity.Offset[1] = identity.Offset[2] = 0.0;
+    std::vector< double > volume;
+    std::vector< FFTComplex > spectrum;
+    std::vector< double > angles( 1, 0.0 );
+    if( m_Axis >= 0 )
+      {
+      Sample( pyramid, movingGeometry, identity, volume, numberOfThreads );
+      Forward( volume, spectrum, numberOfThreads );
+      std::vector< FFTComplex > polar;
+      ComputePolarSpectrum( spectrum, polar );
+      const double angle = CorrelateAngles( polar );
+      const double pi = 3.14159265358979323846;
+      angles[0] = angle;
+      angles.push_back( angle > 0.0 ? angle - pi : angle + pi );
+      }
+
+    PhaseCorrelationResult result;
+    result.Peak = -std::numeric_limits< double >::max();
+    for( std::size_t n = 0; n < angles.size(); n++ )
+      {
+      AffineMapping rotation = GetRotation( angles[n] );
+      Sample( pyramid, movingGeometry, rotation, volume, numberOfThreads );
+      Forward( volume, spectrum, numberOfThreads );
+      double shift[3];
+      const double peak = CorrelateShift( spectrum, shift, numberOfThreads );
+      if( !( peak > result.Peak ) )
+        {
+        continue;
+        }
+      // x_moving = R ( x + t - c ) + c with t the shift in mm.
+      double step[3];
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        step[d] = shift[d] * m_Grid.Spacing[d];
+        result.Translation[d] = step[d];
+        }
+      double t[3];
+      MultiplyMatrixVector( m_Grid.Direction, step, t );
+      double rotated[3];
+      MultiplyMatrixVector( rotation.Matrix, t, rotated );
+      result.Transform = rotation;
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        result.Transform.Offset[d] += rotated[d];
+        }
+      result.Angle = angles[n];
+      result.Peak = peak;
+      }
+    return result;
+    }
+
+private:
+  // Rotation by `angle` about the fixed grid axis m_Axis through the center
+  // of the fixed image, in physical coordinates: D Ra D^T.
+  AffineMapping GetRotation( double angle ) const
+    {
+    AffineMapping rotation;
+    SetIdentity( rotation.Matrix );
+    if( m_Axis >= 0 )
+      {
+      double axisRotation[3][3];
+      SetIdentity( axisRotation );
+      const unsigned int u = ( m_Axis + 1 ) % 3;
+      const unsigned int v = ( m_Axis + 2 ) % 3;
+      axisRotation[u][u] = std::cos( angle );
+      axisRotation[u][v] = -std::sin( angle );
+      axisRotation[v][u] = std::sin( angle );
+      axisRotation[v][v] = std::cos( angle );
+      double transpose[3][3];
+      for( unsigned int i = 0; i < 3; i++ )
+        {
+        for( unsigned int j = 0; j < 3; j++ )
+          {
+          transpose[i][j] = m_Grid.Direction[j][i];
+          }
+        }
+      double product[3][3];
+      MultiplyMatrices( m_Grid.Direction, axisRotation, product );
+      MultiplyMatrices( product, transpose, rotation.Matrix );
+      }
+    double rotated[3];
+    MultiplyMatrixVector( rotation.Matrix, m_Center, rotated );
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      rotation.Offset[d] = m_Center[d] - rotated[d];
+      }
+    return rotation;
+    }
+
+  // Trilinear value at continuous index c; false outside [0, size - 1].
+  static bool Interpolate( const TPixel * buffer, const std::size_t size[3], const double c[3], double & value )
+    {
+    std::size_t base[3];
+    double f[3];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      const double upper = static_cast< double >( size[d] ) - 1.0;
+      if( !( c[d] >= 0.0 && c[d] <= upper ) )
+        {
+        return false;
+        }
+      const double b = std::min( std::floor( c[d] ), std::max( upper - 1.0, 0.0 ) );
+      base[d] = static_cast< std::size_t >( b );
+      f[d] = size[d] > 1 ? c[d] - b : 0.0;
+      }
+    const std::size_t dx = size[0] > 1 ? 1 : 0;
+    const std::size_t dy = size[1] > 1 ? size[0] : 0;
+    const std::size_t dz = size[2] > 1 ? size[0] * size[1] : 0;
+    const TPixel * p = buffer + ( base[2] * size[1] + base[1] ) * size[0] + base[0];
+    const double c00 = p[0] + f[0] * ( static_cast< double >( p[dx] ) - p[0] );
+    const double c10 = p[dy] + f[0] * ( static_cast< double >( p[dy + dx] ) - p[dy] );
+    const double c01 = p[dz] + f[0] * ( static_cast< double >( p[dz + dx] ) - p[dz] );
+    const double c11 = p[dz + dy] + f[0] * ( static_cast< double >( p[dz + dy + dx] ) - p[dz + dy] );
+    const double c0 = c00 + f[1] * ( c10 - c00 );
+    const double c1 = c01 + f[1] * ( c11 - c01 );
+    value = c0 + f[2] * ( c1 - c0 );
+    return true;
+    }
+
+  // The moving image through `transform` on the correlation grid, padded;
+  // voxels outside the moving image are NaN until Window() fills them.
+  struct SampleFunctor
+  {
+    void operator()( std::size_t first, std::size_t last, unsigned int ) const
+      {
+      for( std::size_t row = first; row < last; row++ )
+        {
+        const std::size_t j = row % m_Size[1];
+        const std::size_t k = row / m_Size[1];
+        double * out = m_Output + ( k * m_PaddedSize[1] + j ) * m_PaddedSize[0];
+        for( std::size_t i = 0; i < m_Size[0]; i++ )
+          {
+          double c[3];
+          m_Mapping.Map( static_cast< double >( i ), static_cast< double >( j ), static_cast< double >( k ), c );
+          if( !Interpolate( m_Input, m_InputSize, c, out[i] ) )
+            {
+            out[i] = std::numeric_limits< double >::quiet_NaN();
+            }
+          }
+        }
+      }
+
+    const TPixel *      m_Input;
+    std::size_t         m_InputSize[3];
+    IndexMapping        m_Mapping;
+    const std::size_t * m_Size;
+    const std::size_t * m_PaddedSize;
+    double *            m_Output;
+  };
+
+  void Sample( GaussianPyramid< TPixel > & pyramid, const ImageGeometry & movingGeometry,
+               const AffineMapping & transform, std::vector< double > & volume, unsigned int numberOfThreads ) const
+    {
+    const IndexMapping mapping = ComputeIndexMapping( m_Grid, transform, movingGeometry );
+    const unsigned int level = GaussianPyramid< TPixel >::SelectLevel( mapping, movingGeometry.Size );
+    SampleFunctor functor;
+    functor.m_Input = pyramid.GetLevel( level, functor.m_InputSize );
+    functor.m_Mapping = GaussianPyramid< TPixel >::GetLevelMapping( mapping, level );
+    functor.m_Size = m_Grid.Size;
+    functor.m_PaddedSize = m_PaddedSize;
+    volume.assign( m_PaddedSize[0] * m_PaddedSize[1] * m_PaddedSize[2], 0.0 );
+    functor.m_Output = &volume[0];
+    ParallelFor( 0, m_Grid.Size[1] * m_Grid.Size[2], 16, numberOfThreads, functor );
+    Window( volume );
+    }
+
+  // Subtracts the mean of the defined voxels, sets undefined (NaN) voxels
+  // to it (i.e. to 0) and applies the Hann window.
+  void Window( std::vector< double > & volume ) const
+    {
+    const std::size_t * size = m_Grid.Size;
+    double sum = 0.0;
+    std::size_t count = 0;
+    for( std::size_t k = 0; k < size[2]; k++ )
+      {
+      for( std::size_t j = 0; j < size[1]; j++ )
+        {
+        const double * row = &volume[( k * m_PaddedSize[1] + j ) * m_PaddedSize[0]];
+        for( std::size_t i = 0; i < size[0]; i++ )
+          {
+          if( row[i] == row[i] )
+            {
+            sum += row[i];
+            ++count;
+            }
+          }
+        }
+      }
+    const double mean = count > 0 ? sum / static_cast< double >( count ) : 0.0;
+    for( std::size_t k = 0; k < size[2]; k++ )
+      {
+      for( std::size_t j = 0; j < size[1]; j++ )
+        {
+        double * row = &volume[( k * m_PaddedSize[1] + j ) * m_PaddedSize[0]];
+        const double weight = m_Window[1][j] * m_Window[2][k];
+        for( std::size_t i = 0; i < size[0]; i++ )
+          {
+          row[i] = ( row[i] == row[i] ) ? ( row[i] - mean ) * weight * m_Window[0][i] : 0.0;
+          }
+        }
+      }
+    }
+
+  // Real transforms of the rows of the padded volume (forward: only the
+  // rows that hold image voxels, the others transform to 0).
+  struct RowFunctor
+  {
+    void operator()( std::size_t first, std::size_t last, unsigned int ) const
+      {
+      const std::size_t width = m_Plan->GetNumberOfCoefficients();
+      std::vector< FFTComplex > work( m_Plan->GetWorkSize() );
+      for( std::size_t row = first; row < last; row++ )
+        {
+        const std::size_t j = row % m_Rows;
+        const std::size_t k = row / m_Rows;
+        const std::size_t line = k * m_PaddedSize[1] + j;
+        if( m_Inverse )
+          {
+          m_Plan->Inverse( &( *m_Spectrum )[line * width], &( *m_Volume )[line * m_PaddedSize[0]], &work[0] );
+          }
+        else
+          {
+          m_Plan->Forward( &( *m_Volume )[line * m_PaddedSize[0]], &( *m_Spectrum )[line * width], &work[0] );
+          }
+        }
+      }
+
+    const RealFFTPlan *         m_Plan;
+    const std::size_t *         m_PaddedSize;
+    std::size_t                 m_Rows;
+    std::vector< double > *     m_Volume;
+    std::vector< FFTComplex > * m_Spectrum;
+    bool                        m_Inverse;
+  };
+
+  // Complex transforms along y (axis 1, one task per z slice) or z (axis
+  // 2, one task per y row), in blocks of neighboring x columns.
+  struct ColumnFunctor
+  {
+    void operator()( std::size_t first, std::size_t last, unsigned int ) const
+      {
+      const std::size_t length = m_Plan->GetLength();
+      const std::size_t block = 16;
+      std::vector< FFTComplex > gathered( block * length );
+      std::vector< FFTComplex > transformed( length );
+      std::vector< FFTComplex > scratch( m_Plan->GetScratchSize() + 1 );
+      for( std::size_t outer = first; outer < last; outer++ )
+        {
+        FFTComplex * base = ( m_Axis == 1 ) ? &( *m_Spectrum )[outer * m_PaddedSize[1] * m_Width]
+                                            : &( *m_Spectrum )[outer * m_Width];
+        for( std::size_t x0 = 0; x0 < m_Width; x0 += block )
+          {
+          const std::size_t count = std::min( block, m_Width - x0 );
+          for( std::size_t t = 0; t < length; t++ )
+            {
+            const FFTComplex * in = base + t * m_Stride + x0;
+            for( std::size_t b = 0; b < count; b++ )
+              {
+              gathered[b * length + t] = in[b];
+              }
+            }
+          for( std::size_t b = 0; b < count; b++ )
+            {
+            m_Plan->Transform( &gathered[b * length], &transformed[0], m_Inverse, &scratch[0] );
+            std::copy( transformed.begin(), transformed.end(), gathered.begin() + b * length );
+            }
+          for( std::size_t t = 0; t < length; t++ )
+            {
+            FFTComplex * out = base + t * m_Stride + x0;
+            for( std::size_t b = 0; b < count; b++ )
+              {
+              out[b] = gathered[b * length + t];
+              }
+            }
+          }
+        }
+      }
+
+    const FFTPlan *             m_Plan;
+    const std::size_t *         m_PaddedSize;
+    std::size_t                 m_Width;
+    std::size_t                 m_Stride;
+    unsigned int                m_Axis;
+    std::vector< FFTComplex > * m_Spectrum;
+    bool                        m_Inverse;
+  };
+
+  void TransformColumns( std::vector< FFTComplex > & spectrum, unsigned int axis, std::size_t count, bool inverse,
+                         unsigned int numberOfThreads ) const
+    {
+    ColumnFunctor functor;
+    functor.m_Plan = ( axis == 1 ) ? &m_ColumnPlan : &m_SlicePlan;
+    functor.m_PaddedSize = m_PaddedSize;
+    functor.m_Width = m_RowPlan.GetNumberOfCoefficients();
+    functor.m_Stride = ( axis == 1 ) ? functor.m_Width : functor.m_Width * m_PaddedSize[1];
+    functor.m_Axis = axis;
+    functor.m_Spectrum = &spectrum;
+    functor.m_Inverse = inverse;
+    ParallelFor( 0, count, 1, numberOfThreads, functor );
+    }
+
+  void Forward( std::vector< double > & volume, std::vector< FFTComplex > & spectrum,
+                unsigned int numberOfThreads ) const
+    {
+    const std::size_t width = m_RowPlan.GetNumberOfCoefficients();
+    spectrum.assign( width * m_PaddedSize[1] * m_PaddedSize[2], FFTComplex( 0.0, 0.0 ) );
+    RowFunctor rows;
+    rows.m_Plan = &m_RowPlan;
+    rows.m_PaddedSize = m_PaddedSize;
+    rows.m_Rows = m_Grid.Size[1];
+    rows.m_Volume = &volume;
+    rows.m_Spectrum = &spectrum;
+    rows.m_Inverse = false;
+    ParallelFor( 0, m_Grid.Size[1] * m_Grid.Size[2], 16, numberOfThreads, rows );
+    TransformColumns( spectrum, 1, m_Grid.Size[2], false, numberOfThreads );
+    TransformColumns( spectrum, 2, m_PaddedSize[1], false, numberOfThreads );
+    }
+
+  void Inverse( std::vector< FFTComplex > & spectrum, std::vector< double > & volume,
+                unsigned int numberOfThreads ) const
+    {
+    TransformColumns( spectrum, 2, m_PaddedSize[1], true, numberOfThreads );
+    TransformColumns( spectrum, 1, m_PaddedSize[2], true, numberOfThreads );
+    volume.assign( m_PaddedSize[0] * m_PaddedSize[1] * m_PaddedSize[2], 0.0 );
+    RowFunctor rows;
+    rows.m_Plan = &m_RowPlan;
+    rows.m_PaddedSize = m_PaddedSize;
+    rows.m_Rows = m_PaddedSize[1];
+    rows.m_Volume = &volume;
+    rows.m_Spectrum = &spectrum;
+    rows.m_Inverse = true;
+    ParallelFor( 0, m_PaddedSize[1] * m_PaddedSize[2], 16, numberOfThreads, rows );
+    }
+
+  // Offset in [-1/2, 1/2] of the true peak from sample 0 of a correlation
+  // with neighbors `previous` and `next` (Foroosh et al.).
+  static double RefinePeak( double previous, double peak, double next )
+    {
+    if( !( peak > 0.0 ) )
+      {
+      return 0.0;
+      }
+    const double offset = ( next > previous ) ? next / ( next + peak ) : -previous / ( previous + peak );
+    return std::max( -0.5, std::min( 0.5, offset ) );
+    }
+
+  // The shift t (in voxels of the correlation grid) with
+  // moving( x + t ) ~ fixed( x ), and the height of the peak.
+  double CorrelateShift( std::vector< FFTComplex > & spectrum, double shift[3], unsigned int numberOfThreads ) const
+    {
+    for( std::size_t n = 0; n < spectrum.size(); n++ )
+      {
+      const FFTComplex cross = FFTMultiply( spectrum[n], std::conj( m_FixedSpectrum[n] ) );
+      const double magnitude = std::abs( cross );
+      spectrum[n] = magnitude > 0.0 ? cross / magnitude : FFTComplex( 0.0, 0.0 );
+      }
+    std::vector< double > correlation;
+    Inverse( spectrum, correlation, numberOfThreads );
+    const std::size_t * size = m_PaddedSize;
+    const std::size_t maximum =
+      static_cast< std::size_t >( std::max_element( correlation.begin(), correlation.end() ) - correlation.begin() );
+    const std::size_t peak[3] = { maximum % size[0], ( maximum / size[0] ) % size[1], maximum / ( size[0] * size[1] ) };
+    const std::size_t strides[3] = { 1, size[0], size[0] * size[1] };
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      const std::size_t before = ( peak[d] + size[d] - 1 ) % size[d];
+      const std::size_t after = ( peak[d] + 1 ) % size[d];
+      const double offset = RefinePeak( correlation[maximum + ( before - peak[d] ) * strides[d]],
+                                        correlation[maximum], correlation[maximum + ( after - peak[d] ) * strides[d]] );
+      double position = static_cast< double >( peak[d] ) + offset;
+      if( position > 0.5 * static_cast< double >( size[d] ) )
+        {
+        position -= static_cast< double >( size[d] );
+        }
+      shift[d] = position;
+      }
+    return correlation[maximum] / ( static_cast< double >( size[0] ) * size[1] * size[2] );
+    }
+
+  // log( 1 + |F| ) summed along m_Axis, sampled at NumberOfRadii log
+  // spaced frequencies and NumberOfAngles angles in [0, 180) degrees of
+  // the plane normal to it; each radius is normalized to zero mean and
+  // unit variance and transformed along the angle.
+  void ComputePolarSpectrum( const std::vector< FFTComplex > & spectrum, std::vector< FFTComplex > & polar ) const
+    {
+    const unsigned int u = ( m_Axis + 1 ) % 3;
+    const unsigned int v = ( m_Axis + 2 ) % 3;
+    const std::size_t * size = m_PaddedSize;
+    const std::size_t width = m_RowPlan.GetNumberOfCoefficients();
+    std::vector< double > plane( size[u] * size[v], 0.0 );
+    for( std::size_t z = 0; z < size[2]; z++ )
+      {
+      for( std::size_t y = 0; y < size[1]; y++ )
+        {
+        const FFTComplex * row = &spectrum[( z * size[1] + y ) * width];
+        for( std::size_t x = 0; x < width; x++ )
+          {
+          const double value = std::log( 1.0 + std::abs( row[x] ) );
+          const std::size_t k[3] = { x, y, z };
+          plane[k[u] * size[v] + k[v]] += value;
+          // The conjugate half that the real transform does not store.
+          if( x != 0 && !( size[0] % 2 == 0 && x == size[0] / 2 ) )
+            {
+            const std::size_t mirror[3] = { size[0] - x, ( size[1] - y ) % size[1], ( size[2] - z ) % size[2] };
+            plane[mirror[u] * size[v] + mirror[v]] += value;
+            }
+          }
+        }
+      }
+
+    // Frequencies in cycles per mm, from a few bins to 80% of Nyquist.
+    double lowest = 0.0;
+    double highest = std::numeric_limits< double >::max();
+    const unsigned int axes[2] = { u, v };
+    for( unsigned int a = 0; a < 2; a++ )
+      {
+      const double spacing = m_Grid.Spacing[axes[a]];
+      lowest = std::max( lowest, 2.0 / ( static_cast< double >( size[axes[a]] ) * spacing ) );
+      highest = std::min( highest, 0.4 / spacing );
+      }
+    const double pi = 3.14159265358979323846;
+    polar.assign( NumberOfRadii * NumberOfAngles, FFTComplex( 0.0, 0.0 ) );
+    std::vector< FFTComplex > line( NumberOfAngles );
+    std::vector< FFTComplex > scratch( m_AnglePlan.GetScratchSize() + 1 );
+    for( std::size_t r = 0; r < NumberOfRadii; r++ )
+      {
+      const double radius = lowest * std::pow( highest / lowest, static_cast< double >( r ) / ( NumberOfRadii - 1 ) );
+      double sum = 0.0;
+      double squares = 0.0;
+      for( std::size_t a = 0; a < NumberOfAngles; a++ )
+        {
+        const double angle = pi * static_cast< double >( a ) / NumberOfAngles;
+        double position[2] = { radius * std::cos( angle ), radius * std::sin( angle ) };
+        std::size_t base[2];
+        double f[2];
+        for( unsigned int p = 0; p < 2; p++ )
+          {
+          const double length = static_cast< double >( size[axes[p]] );
+          double index = position[p] * length * m_Grid.Spacing[axes[p]];
+          index = index < 0.0 ? index + length : index;
+          const double b = std::floor( index );
+          base[p] = static_cast< std::size_t >( b ) % size[axes[p]];
+          f[p] = index - b;
+          }
+        const std::size_t u1 = ( base[0] + 1 ) % size[u];
+        const std::size_t v1 = ( base[1] + 1 ) % size[v];
+        const double v00 = plane[base[0] * size[v] + base[1]];
+        const double v10 = plane[u1 * size[v] + base[1]];
+        const double v01 = plane[base[0] * size[v] + v1];
+        const double v11 = plane[u1 * size[v] + v1];
+        const double value = ( 1.0 - f[1] ) * ( v00 + f[0] * ( v10 - v00 ) ) + f[1] * ( v01 + f[0] * ( v11 - v01 ) );
+        line[a] = FFTComplex( value, 0.0 );
+        sum += value;
+        squares += value * value;
+        }
+      const double mean = sum / NumberOfAngles;
+      const double variance = squares / NumberOfAngles - mean * mean;
+      const double scale = variance > 0.0 ? 1.0 / std::sqrt( variance ) : 0.0;
+      for( std::size_t a = 0; a < NumberOfAngles; a++ )
+        {
+        line[a] = FFTComplex( ( line[a].real() - mean ) * scale, 0.0 );
+        }
+      m_AnglePlan.Transform( &line[0], &polar[r * NumberOfAngles], false, &scratch[0] );
+      }
+    }
+
+  // The angle in ( -90, 90 ] degrees (in radians) by which the polar
+  // magnitude of the moving image is shifted against the fixed one.
+  double CorrelateAngles( const std::vector< FFTComplex > & polar ) const
+    {
+    std::vector< FFTComplex > cross( NumberOfAngles, FFTComplex( 0.0, 0.0 ) );
+    for( std::size_t r = 0; r < NumberOfRadii; r++ )
+      {
+      for( std::size_t a = 0; a < NumberOfAngles; a++ )
+        {
+        cross[a] += FFTMultiply( polar[r * NumberOfAngles + a], std::conj( m_FixedPolar[r * NumberOfAngles + a] ) );
+        }
+      }
+    for( std::size_t a = 0; a < NumberOfAngles; a++ )
+      {
+      const double magnitude = std::abs( cross[a] );
+      cross[a] = magnitude > 0.0 ? cross[a] / magnitude : FFTComplex( 0.0, 0.0 );
+      }
+    std::vector< FFTComplex > correlation( NumberOfAngles );
+    std::vector< FFTComplex > scratch( m_AnglePlan.GetScratchSize() + 1 );
+    m_AnglePlan.Transform( &cross[0], &correlation[0], true, &scratch[0] );
+    std::size_t peak = 0;
+    for( std::size_t a = 1; a < NumberOfAngles; a++ )
+      {
+      if( correlation[a].real() > correlation[peak].real() )
+        {
+        peak = a;
+        }
+      }
+    const double previous = correlation[( peak + NumberOfAngles - 1 ) % NumberOfAngles].real();
+    const double next = correlation[( peak + 1 ) % NumberOfAngles].real();
+    double position = static_cast< double >( peak ) + RefinePeak( previous, correlation[peak].real(), next );
+    if( position > 0.5 * NumberOfAngles )
+      {
+      position -= static_cast< double >( NumberOfAngles );
+      }
+    return 3.14159265358979323846 * position / NumberOfAngles;
+    }
+
+  int                        m_Axis;
+  unsigned int               m_NumberOfThreads;
+  GaussianPyramid< TPixel >  m_Pyramid;
+  ImageGeometry              m_Geometry;
+  ImageGeometry              m_Grid;
+  unsigned int               m_Level;
+  double                     m_Center[3];
+  std::size_t                m_PaddedSize[3];
+  std::vector< double >      m_Window[3];
+  RealFFTPlan                m_RowPlan;
+  FFTPlan                    m_ColumnPlan;
+  FFTPlan                    m_SlicePlan;
+  FFTPlan                    m_AnglePlan;
+  std::vector< FFTComplex >  m_FixedSpectrum;
+  std::vector< FFTComplex >  m_FixedPolar;
+};
+
+#endif
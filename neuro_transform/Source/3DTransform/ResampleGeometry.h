@@ -0,0 +1,525 @@
+// AUTHOR: Christian McDaniel
+//
+// Plain-array description of an image grid and of the affine mapping that
+// ResampleImageFilter uses to go from an output voxel to a position in the
+// input image. The custom resampling kernels in this directory work on raw
+// buffers, so they only need these few numbers instead of the ITK objects.
+
+#ifndef ResampleGeometry_h
+#define ResampleGeometry_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+// Origin, spacing, direction cosines and size of a 3D image, following the
+// ITK convention: point = Origin + Direction * diag(Spacing) * index.
+struct ImageGeometry
+{
+  double      Origin[3];
+  double      Spacing[3];
+  double      Direction[3][3];
+  std::size_t Size[3];
+
+  std::size_t GetNumberOfPixels() const
+    {
+    return Size[0] * Size[1] * Size[2];
+    }
+};
+
+// Affine map between physical points, x_in = Matrix * x_out + Offset, as
+// returned by MatrixOffsetTransformBase::GetMatrix() and GetOffset().
+struct AffineMapping
+{
+  double Matrix[3][3];
+  double Offset[3];
+};
+
+// Affine map from an output index to a continuous input index,
+// c = Matrix * index + Offset.
+struct IndexMapping
+{
+  double Matrix[3][3];
+  double Offset[3];
+
+  // Continuous input index of output voxel (i, j, k). Every kernel evaluates
+  // positions through this function so that span classification and
+  // sampling agree to the last bit.
+  void Map( double i, double j, double k, double c[3] ) const
+    {
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      c[d] = Offset[d] + Matrix[d][0] * i + Matrix[d][1] * j + Matrix[d][2] * k;
+      }
+    }
+};
+
+// Finds the run [first, last) of voxels on output row (j, k) whose mapped
+// continuous index satisfies lower[d] <= c[d] < upper[d] in every dimension.
+// The mapping is linear along the row, so the run is a single interval; the
+// analytic estimate is snapped to the exact predicate at both ends.
+inline void ComputeRowSpan( const IndexMapping & mapping, std::size_t j, std::size_t k,
+                            std::size_t length, const double lower[3], const double upper[3],
+                            std::size_t & first, std::size_t & last )
+{
+  struct Predicate
+  {
+    static bool Inside( const IndexMapping & m, double i, double j, double k,
+                        const double * lo, const double * hi )
+      {
+      double c[3];
+      m.Map( i, j, k, c );
+      return c[0] >= lo[0] && c[0] < hi[0]
+          && c[1] >= lo[1] && c[1] < hi[1]
+          && c[2] >= lo[2] && c[2] < hi[2];
+      }
+  };
+
+  const double dj = static_cast< double >( j );
+  const double dk = static_cast< double >( k );
+  double c0[3];
+  mapping.Map( 0.0, dj, dk, c0 );
+
+  double start = 0.0;
+  double end = static_cast< double >( length );
+  for( unsigned int d = 0; d < 3 && start < end; d++ )
+    {
+    const double step = mapping.Matrix[d][0];
+    if( step == 0.0 )
+      {
+      if( !( c0[d] >= lower[d] && c0[d] < upper[d] ) )
+        {
+        end = start;
+        }
+      continue;
+      }
+    double t0 = ( lower[d] - c0[d] ) / step;
+    double t1 = ( upper[d] - c0[d] ) / step;
+    if( step < 0.0 )
+      {
+      const double tmp = t0;
+      t0 = t1;
+      t1 = tmp;
+      }
+    start = std::max( start, t0 );
+    end = std::min( end, t1 );
+    }
+
+  first = 0;
+  last = 0;
+  if( !( start < end ) )
+    {
+    // The estimate can miss a single voxel through rounding; probe it.
+    if( start >= 0.0 && start < static_cast< double >( length ) )
+      {
+      const std::size_t probe = static_cast< std::size_t >( start );
+      if( Predicate::Inside( mapping, static_cast< double >( probe ), dj, dk, lower, upper ) )
+        {
+        first = probe;
+        last = probe + 1;
+        }
+      }
+    if( first == last )
+      {
+      return;
+      }
+    }
+  else
+    {
+    first = static_cast< std::size_t >( std::ceil( start ) );
+    last = static_cast< std::size_t >( std::min( std::ceil( end ), static_cast< double >( length ) ) );
+    if( first > last )
+      {
+      first = last;
+      }
+    }
+
+  while( first < last && !Predicate::Inside( mapping, static_cast< double >( first ), dj, dk, lower, upper ) )
+    {
+    ++first;
+    }
+  while( last > first && !Predicate::Inside( mapping, static_cast< double >( last - 1 ), dj, dk, lower, upper ) )
+    {
+    --last;
+    }
+  if( first == last )
+    {
+    first = 0;
+    last = 0;
+    return;
+    }
+  while( first > 0 && Predicate::Inside( mapping, static_cast< double >( first - 1 ), dj, dk, lower, upper ) )
+    {
+    --first;
+    }
+  while( last < length && Predicate::Inside( mapping, static_cast< double >( last ), dj, dk, lower, upper ) )
+    {
+    ++last;
+    }
+}
+
+inline void SetIdentity( double m[3][3] )
+{
+  for( unsigned int i = 0; i < 3; i++ )
+    {
+    for( unsigned int j = 0; j < 3; j++ )
+      {
+      m[i][j] = ( i == j ) ? 1.0 : 0.0;
+      }
+    }
+}
+
+inline void MultiplyMatrices( const double a[3][3], const double b[3][3], double out[3][3] )
+{
+  double tmp[3][3];
+  for( unsigned int i = 0; i < 3; i++ )
+    {
+    for( unsigned int j = 0; j < 3; j++ )
+      {
+      tmp[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j];
+      }
+    }
+  for( unsigned int i = 0; i < 3; i++ )
+    {
+    for( unsigned int j = 0; j < 3; j++ )
+      {
+      out[i][j] = tmp[i][j];
+      }
+    }
+}
+
+inline void MultiplyMatrixVector( const double m[3][3], const double v[3], double out[3] )
+{
+  double tmp[3];
+  for( unsigned int i = 0; i < 3; i++ )
+    {
+    tmp[i] = m[i][0] * v[0] + m[i][1] * v[1] + m[i][2] * v[2];
+    }
+  for( unsigned int i = 0; i < 3; i++ )
+    {
+    out[i] = tmp[i];
+    }
+}
+
+inline double Determinant( const double m[3][3] )
+{
+  return m[0][0] * ( m[1][1] * m[2][2] - m[1][2] * m[2][1] )
+       - m[0][1] * ( m[1][0] * m[2][2] - m[1][2] * m[2][0] )
+       + m[0][2] * ( m[1][0] * m[2][1] - m[1][1] * m[2][0] );
+}
+
+// Returns false when the matrix is singular.
+inline bool InvertMatrix( const double m[3][3], double out[3][3] )
+{
+  const double det = Determinant( m );
+  if( det == 0.0 )
+    {
+    return false;
+    }
+  double tmp[3][3];
+  tmp[0][0] =  ( m[1][1] * m[2][2] - m[1][2] * m[2][1] ) / det;
+  tmp[0][1] = -( m[0][1] * m[2][2] - m[0][2] * m[2][1] ) / det;
+  tmp[0][2] =  ( m[0][1] * m[1][2] - m[0][2] * m[1][1] ) / det;
+  tmp[1][0] = -( m[1][0] * m[2][2] - m[1][2] * m[2][0] ) / det;
+  tmp[1][1] =  ( m[0][0] * m[2][2] - m[0][2] * m[2][0] ) / det;
+  tmp[1][2] = -( m[0][0] * m[1][2] - m[0][2] * m[1][0] ) / det;
+  tmp[2][0] =  ( m[1][0] * m[2][1] - m[1][1] * m[2][0] ) / det;
+  tmp[2][1] = -( m[0][0] * m[2][1] - m[0][1] * m[2][0] ) / det;
+  tmp[2][2] =  ( m[0][0] * m[1][1] - m[0][1] * m[1][0] ) / det;
+  for( unsigned int i = 0; i < 3; i++ )
+    {
+    for( unsigned int j = 0; j < 3; j++ )
+      {
+      out[i][j] = tmp[i][j];
+      }
+    }
+  return true;
+}
+
+// The map x -> second( first( x ) ).
+inline AffineMapping ComposeAffineMappings( const AffineMapping & first, const AffineMapping & second )
+{
+  AffineMapping composed;
+  MultiplyMatrices( second.Matrix, first.Matrix, composed.Matrix );
+  MultiplyMatrixVector( second.Matrix, first.Offset, composed.Offset );
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    composed.Offset[d] += second.Offset[d];
+    }
+  return composed;
+}
+
+// Direction * diag(Spacing), i.e. the index-to-physical linear part.
+inline void GetIndexToPhysicalMatrix( const ImageGeometry & geometry, double out[3][3] )
+{
+  for( unsigned int i = 0; i < 3; i++ )
+    {
+    for( unsigned int j = 0; j < 3; j++ )
+      {
+      out[i][j] = geometry.Direction[i][j] * geometry.Spacing[j];
+      }
+    }
+}
+
+// Composes output index -> output point -> (transform) -> input point ->
+// input continuous index into a single affine map.
+inline IndexMapping ComputeIndexMapping( const ImageGeometry & output,
+                                         const AffineMapping & transform,
+                                         const ImageGeometry & input )
+{
+  double outputIndexToPhysical[3][3];
+  double inputIndexToPhysical[3][3];
+  double inputPhysicalToIndex[3][3];
+  GetIndexToPhysicalMatrix( output, outputIndexToPhysical );
+  GetIndexToPhysicalMatrix( input, inputIndexToPhysical );
+  InvertMatrix( inputIndexToPhysical, inputPhysicalToIndex );
+
+  IndexMapping mapping;
+  double linear[3][3];
+  MultiplyMatrices( transform.Matrix, outputIndexToPhysical, linear );
+  MultiplyMatrices( inputPhysicalToIndex, linear, mapping.Matrix );
+
+  double point[3];
+  MultiplyMatrixVector( transform.Matrix, output.Origin, point );
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    point[d] += transform.Offset[d] - input.Origin[d];
+    }
+  MultiplyMatrixVector( inputPhysicalToIndex, point, mapping.Offset );
+  return mapping;
+}
+
+// Whether `a` and `b` are the same grid, so that one index mapping serves
+// both: equal sizes, and spacing, origin (relative to the spacing) and
+// direction cosines equal to 1e-6, the tolerance ITK's filters use when
+// they check that their inputs share a grid.
+inline bool IsSameGrid( const ImageGeometry & a, const ImageGeometry & b )
+{
+  const double tolerance = 1e-6;
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    if( a.Size[d] != b.Size[d] || std::fabs( a.Spacing[d] - b.Spacing[d] ) > tolerance * std::fabs( a.Spacing[d] )
+        || std::fabs( a.Origin[d] - b.Origin[d] ) > tolerance * std::fabs( a.Spacing[0] ) )
+      {
+      return false;
+      }
+    for( unsigned int e = 0; e < 3; e++ )
+      {
+      if( std::fabs( a.Direction[d][e] - b.Direction[d][e] ) > tolerance )
+        {
+        return false;
+        }
+      }
+    }
+  return true;
+}
+
+// The grid of `size` voxels starting at (possibly negative) index `start`
+// of `geometry`; used for cropping and padding the output.
+inline ImageGeometry GetSubGrid( const ImageGeometry & geometry, const long start[3], const std::size_t size[3] )
+{
+  ImageGeometry grid = geometry;
+  double shift[3];
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    shift[d] = static_cast< double >( start[d] );
+    grid.Size[d] = size[d];
+    }
+  double indexToPhysical[3][3];
+  double offset[3];
+  GetIndexToPhysicalMatrix( geometry, indexToPhysical );
+  MultiplyMatrixVector( indexToPhysical, shift, offset );
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    grid.Origin[d] += offset[d];
+    }
+  return grid;
+}
+
+// The box of input voxels [start, start + size) read by resampling an
+// output grid of `outputSize` voxels through `mapping` with a kernel that
+// reaches `margin` voxels around each mapped position, clipped to the
+// input. The mapping is affine, so the corners of the output grid bound
+// all mapped positions. Returns false if the box is empty, i.e. no output
+// voxel maps near the input.
+inline bool ComputeInputRegion( const IndexMapping & mapping, const std::size_t outputSize[3],
+                                const std::size_t inputSize[3], std::size_t margin,
+                                long start[3], std::size_t size[3] )
+{
+  double lower[3];
+  double upper[3];
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    lower[d] = std::numeric_limits< double >::max();
+    upper[d] = -std::numeric_limits< double >::max();
+    }
+  for( unsigned int corner = 0; corner < 8; corner++ )
+    {
+    double index[3];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      index[d] = ( corner & ( 1u << d ) ) ? static_cast< double >( outputSize[d] ) - 1.0 : 0.0;
+      }
+    double c[3];
+    mapping.Map( index[0], index[1], index[2], c );
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      lower[d] = std::min( lower[d], c[d] );
+      upper[d] = std::max( upper[d], c[d] );
+      }
+    }
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    const double last = static_cast< double >( inputSize[d] ) - 1.0;
+    const double first = std::max( 0.0, std::floor( lower[d] ) - static_cast< double >( margin ) );
+    const double end = std::min( last, std::floor( upper[d] ) + 1.0 + static_cast< double >( margin ) );
+    if( end < first )
+      {
+      return false;
+      }
+    start[d] = static_cast< long >( first );
+    size[d] = static_cast< std::size_t >( end - first ) + 1;
+    }
+  return true;
+}
+
+// `geometry` with a new spacing, covering the same physical box: the size
+// is rounded to the nearest number of voxels (at least 1) and the outer
+// corner of voxel 0 stays where it was.
+inline ImageGeometry GetRespacedGrid( const ImageGeometry & geometry, const double spacing[3] )
+{
+  ImageGeometry grid = geometry;
+  double shift[3];
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    const double extent = static_cast< double >( geometry.Size[d] ) * geometry.Spacing[d];
+    grid.Size[d] = static_cast< std::size_t >( std::max( 1.0, std::floor( extent / spacing[d] + 0.5 ) ) );
+    grid.Spacing[d] = spacing[d];
+    shift[d] = 0.5 * ( spacing[d] - geometry.Spacing[d] );
+    }
+  double offset[3];
+  MultiplyMatrixVector( geometry.Direction, shift, offset );
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    grid.Origin[d] += offset[d];
+    }
+  return grid;
+}
+
+// Checks whether the transform only permutes and/or flips the input axes,
+// i.e. Direction^-1 * Matrix * Direction is a signed permutation. If so,
+// fills the output grid that holds exactly the transformed input voxels:
+// output axis j walks input axis axis[j] forward (sign[j] = 1) or backward
+// (sign[j] = -1), spacing and size follow the permuted axes and the
+// direction cosines stay those of the input. No interpolation is needed on
+// that grid; every output voxel is one input voxel. The identity is not
+// reported, so pure translations keep the input grid.
+inline bool ComputePermutedGeometry( const ImageGeometry & input, const AffineMapping & transform,
+                                     ImageGeometry & output, int axis[3], int sign[3] )
+{
+  const double tolerance = 1e-9;
+  double inverseDirection[3][3];
+  if( !InvertMatrix( input.Direction, inverseDirection ) )
+    {
+    return false;
+    }
+  double frame[3][3];
+  MultiplyMatrices( inverseDirection, transform.Matrix, frame );
+  MultiplyMatrices( frame, input.Direction, frame );
+
+  bool used[3] = { false, false, false };
+  for( unsigned int j = 0; j < 3; j++ )
+    {
+    int found = -1;
+    for( unsigned int i = 0; i < 3; i++ )
+      {
+      const double value = frame[i][j];
+      if( std::fabs( value ) < tolerance )
+        {
+        continue;
+        }
+      if( found >= 0 || std::fabs( std::fabs( value ) - 1.0 ) >= tolerance )
+        {
+        return false;
+        }
+      found = static_cast< int >( i );
+      sign[j] = value > 0.0 ? 1 : -1;
+      }
+    if( found < 0 || used[found] )
+      {
+      return false;
+      }
+    used[found] = true;
+    axis[j] = found;
+    }
+
+  if( axis[0] == 0 && axis[1] == 1 && axis[2] == 2 && sign[0] > 0 && sign[1] > 0 && sign[2] > 0 )
+    {
+    return false;
+    }
+
+  // Input index of output voxel 0, and its physical point in output space.
+  double corner[3];
+  for( unsigned int j = 0; j < 3; j++ )
+    {
+    const int i = axis[j];
+    output.Size[j] = input.Size[i];
+    output.Spacing[j] = input.Spacing[i];
+    corner[i] = ( sign[j] > 0 ) ? 0.0 : static_cast< double >( input.Size[i] - 1 );
+    }
+  double inputIndexToPhysical[3][3];
+  double point[3];
+  GetIndexToPhysicalMatrix( input, inputIndexToPhysical );
+  MultiplyMatrixVector( inputIndexToPhysical, corner, point );
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    point[d] += input.Origin[d] - transform.Offset[d];
+    for( unsigned int e = 0; e < 3; e++ )
+      {
+      output.Direction[d][e] = input.Direction[d][e];
+      }
+    }
+  double inverseMatrix[3][3];
+  InvertMatrix( transform.Matrix, inverseMatrix );
+  MultiplyMatrixVector( inverseMatrix, point, output.Origin );
+  return true;
+}
+
+// For a rigid transform (orthonormal matrix), fills the grid that carries
+// the input voxels unchanged to their transformed positions: same size and
+// spacing, Origin = Matrix^-1 (Origin_in - Offset) and Direction =
+// Matrix^-1 Direction_in. Returns false if the matrix is not orthonormal.
+inline bool ComputeRigidGeometry( const ImageGeometry & input, const AffineMapping & transform,
+                                  ImageGeometry & output )
+{
+  for( unsigned int i = 0; i < 3; i++ )
+    {
+    for( unsigned int j = 0; j < 3; j++ )
+      {
+      const double dot = transform.Matrix[0][i] * transform.Matrix[0][j]
+                       + transform.Matrix[1][i] * transform.Matrix[1][j]
+                       + transform.Matrix[2][i] * transform.Matrix[2][j];
+      if( std::fabs( dot - ( i == j ? 1.0 : 0.0 ) ) > 1e-9 )
+        {
+        return false;
+        }
+      }
+    }
+  double inverseMatrix[3][3];
+  if( !InvertMatrix( transform.Matrix, inverseMatrix ) )
+    {
+    return false;
+    }
+  output = input;
+  double point[3];
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    point[d] = input.Origin[d] - transform.Offset[d];
+    }
+  MultiplyMatrixVector( inverseMatrix, point, output.Origin );
+  MultiplyMatrices( inverseMatrix, input.Direction, output.Direction );
+  return true;
+}
+
+#endif
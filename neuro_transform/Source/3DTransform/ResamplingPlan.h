@@ -0,0 +1,706 @@
+// AUTHOR: Christian McDaniel
+//
+// Precomputed windowed sinc resampling for applying one transform to many
+// volumes on the same grid (e.g. T1, masks and maps of one subject).
+//
+// Build() does all of the geometry once: every output row is split into the
+// same outside / boundary / interior spans as {WindowedSincResampler.h},
+// and every sample inside the input stores where its taps start and its
+// sub-voxel position per axis, quantized to 1/256 voxel. The arrays are
+// kept separately (structure of arrays) so that Apply() streams through
+// them. Apply() is then a gather-multiply-add per voxel with the weights
+// read from a 256-phase table, with no coordinate or sin/cos evaluation.
+//
+// Quantizing the sub-voxel position moves each sample by at most 1/512
+// voxel, which changes 8-bit outputs by a gray level at most on edges.
+//
+// Plans can be written to disk with Save() and mapped back with Load(), so
+// that separate processes applying the same transform share one copy from
+// the page cache instead of each building it.
+
+#ifndef ResamplingPlan_h
+#define ResamplingPlan_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MappedFile.h"
+#include "ParallelFor.h"
+#include "ResampleGeometry.h"
+#include "WindowedSincResampler.h"
+
+template< unsigned int VRadius = 3 >
+class ResamplingPlan
+{
+public:
+  static const unsigned int WindowSize = 2 * VRadius;
+  static const unsigned int NumberOfPhases = 256;
+
+  // Spans of one output row, in voxels: [0, InsideFirst) and
+  // [InsideLast, length) are outside the input, [InteriorFirst,
+  // InteriorLast) has its whole support inside, the rest is boundary.
+  struct RowSpans
+  {
+    uint32_t InsideFirst;
+    uint32_t InteriorFirst;
+    uint32_t InteriorLast;
+    uint32_t InsideLast;
+  };
+
+  ResamplingPlan()
+    : m_NumberOfThreads( std::thread::hardware_concurrency() )
+    {
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_InputSize[d] = 0;
+      m_OutputSize[d] = 0;
+      }
+    std::memset( &m_View, 0, sizeof( m_View ) );
+    }
+
+  void SetNumberOfThreads( unsigned int threads ) { m_NumberOfThreads = threads > 0 ? threads : 1; }
+
+  const std::size_t * GetInputSize() const { return m_InputSize; }
+  const std::size_t * GetOutputSize() const { return m_OutputSize; }
+
+  std::size_t GetNumberOfInteriorPixels() const { return m_View.NumberOfInterior; }
+  std::size_t GetNumberOfBoundaryPixels() const { return m_View.NumberOfBoundary; }
+
+  // Whether the 32-bit tap offsets can address an input of `inputSize`
+  // voxels, i.e. it has fewer than 2^31 voxels.
+  static bool CanAddress( const std::size_t inputSize[3] )
+    {
+    const std::size_t limit = static_cast< std::size_t >( std::numeric_limits< int32_t >::max() );
+    return inputSize[0] <= limit && inputSize[1] <= limit / std::max< std::size_t >( inputSize[0], 1 )
+           && inputSize[2] <= limit / std::max< std::size_t >( inputSize[0] * inputSize[1], 1 );
+    }
+
+  // Returns false, and builds nothing, if the input is too large for the
+  // plan (CanAddress()).
+  bool Build( const IndexMapping & mapping, const std::size_t inputSize[3], const std::size_t outputSize[3] )
+    {
+    if( !CanAddress( inputSize ) )
+      {
+      return false;
+      }
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_InputSize[d] = inputSize[d];
+      m_OutputSize[d] = outputSize[d];
+      }
+    m_Mapping = mapping;
+    ComputeWeightTable();
+
+    // First pass: spans of every row, in parallel, so that each row knows
+    // where its samples go in the arrays.
+    const std::size_t rows = m_OutputSize[1] * m_OutputSize[2];
+    m_Rows.resize( rows );
+    SpanFunctor spans( this );
+    ParallelFor( 0, rows, 64, m_NumberOfThreads, spans );
+
+    m_InteriorStart.resize( rows + 1 );
+    m_BoundaryStart.resize( rows + 1 );
+    m_InteriorStart[0] = 0;
+    m_BoundaryStart[0] = 0;
+    for( std::size_t row = 0; row < rows; row++ )
+      {
+      const RowSpans & s = m_Rows[row];
+      m_InteriorStart[row + 1] = m_InteriorStart[row] + ( s.InteriorLast - s.InteriorFirst );
+      m_BoundaryStart[row + 1] = m_BoundaryStart[row]
+                               + ( s.InsideLast - s.InsideFirst ) - ( s.InteriorLast - s.InteriorFirst );
+      }
+    m_Offsets.resize( m_InteriorStart[rows] );
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_InteriorPhase[d].resize( m_InteriorStart[rows] );
+      m_BoundaryBase[d].resize( m_BoundaryStart[rows] );
+      m_BoundaryPhase[d].resize( m_BoundaryStart[rows] );
+      }
+
+    // Second pass: fill the arrays.
+    FillFunctor fill( this );
+    ParallelFor( 0, rows, 64, m_NumberOfThreads, fill );
+
+    m_File.Close();
+    m_View.NumberOfRows = rows;
+    m_View.NumberOfInterior = m_Offsets.size();
+    m_View.NumberOfBoundary = m_BoundaryBase[0].size();
+    m_View.Rows = m_Rows.empty() ? 0 : &m_Rows[0];
+    m_View.InteriorStart = &m_InteriorStart[0];
+    m_View.BoundaryStart = &m_BoundaryStart[0];
+    m_View.Offsets = m_Offsets.empty() ? 0 : &m_Offsets[0];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_View.InteriorPhase[d] = m_InteriorPhase[d].empty() ? 0 : &m_InteriorPhase[d][0];
+      m_View.BoundaryBase[d] = m_BoundaryBase[d].empty() ? 0 : &m_BoundaryBase[d][0];
+      m_View.BoundaryPhase[d] = m_BoundaryPhase[d].empty() ? 0 : &m_BoundaryPhase[d][0];
+      }
+    return true;
+    }
+
+  // Name of the cache file of the plan for these parameters, "plan-<key>.bin"
+  // with a 64-bit FNV-1a hash of the format version, kernel, grids and
+  // mapping as the key.
+  static std::string GetCacheFileName( const IndexMapping & mapping, const std::size_t inputSize[3],
+                                       const std::size_t outputSize[3] )
+    {
+    FileHeader header;
+    FillHeader( mapping, inputSize, outputSize, header );
+    char name[32];
+    std::snprintf( name, sizeof( name ), "plan-%016llx.bin", static_cast< unsigned long long >( header.Key ) );
+    return name;
+    }
+
+  // Writes the plan to a temporary file next to `fileName` and renames it
+  // into place, so readers never see a partial file. Returns false on error.
+  bool Save( const std::string & fileName ) const
+    {
+    FileHeader header;
+    FillHeader( m_Mapping, m_InputSize, m_OutputSize, header );
+    header.NumberOfRows = m_View.NumberOfRows;
+    header.NumberOfInterior = m_View.NumberOfInterior;
+    header.NumberOfBoundary = m_View.NumberOfBoundary;
+
+    std::ostringstream suffix;
+    suffix << ".tmp." << std::random_device()();
+    const std::string temporary = fileName + suffix.str();
+    {
+    std::ofstream file( temporary.c_str(), std::ios::binary );
+    if( !file )
+      {
+      return false;
+      }
+    const std::size_t interior = m_View.NumberOfInterior;
+    const std::size_t boundary = m_View.NumberOfBoundary;
+    Write( file, &header, sizeof( header ) );
+    Write( file, m_View.Rows, m_View.NumberOfRows * sizeof( RowSpans ) );
+    Write( file, m_View.InteriorStart, ( m_View.NumberOfRows + 1 ) * sizeof( uint64_t ) );
+    Write( file, m_View.BoundaryStart, ( m_View.NumberOfRows + 1 ) * sizeof( uint64_t ) );
+    Write( file, m_View.Offsets, interior * sizeof( int32_t ) );
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      Write( file, m_View.InteriorPhase[d], interior );
+      }
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      Write( file, m_View.BoundaryBase[d], boundary * sizeof( int32_t ) );
+      }
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      Write( file, m_View.BoundaryPhase[d], boundary );
+      }
+    if( !file.flush() )
+      {
+      file.close();
+      std::remove( temporary.c_str() );
+      return false;
+      }
+    }
+    if( std::rename( temporary.c_str(), fileName.c_str() ) != 0 )
+      {
+      std::remove( temporary.c_str() );
+      return false;
+      }
+    return true;
+    }
+
+  // Maps a plan written by Save(). Returns false (and leaves the plan
+  // unusable until Build()) if the file is missing, was written by another
+  // format version or machine, or belongs to other parameters, if the
+  // input is too large for a plan, or if its arrays would index outside
+  // the input or the output (a corrupted or foreign file).
+  bool Load( const std::string & fileName, const IndexMapping & mapping,
+             const std::size_t inputSize[3], const std::size_t outputSize[3] )
+    {
+    FileHeader expected;
+    FillHeader( mapping, inputSize, outputSize, expected );
+    std::memset( &m_View, 0, sizeof( m_View ) );
+    if( !CanAddress( inputSize ) || !m_File.Open( fileName ) || m_File.GetSize() < sizeof( FileHeader ) )
+      {
+      m_File.Close();
+      return false;
+      }
+    FileHeader header;
+    std::memcpy( &header, m_File.GetData(), sizeof( header ) );
+    const std::size_t rows = static_cast< std::size_t >( header.NumberOfRows );
+    const std::size_t interior = static_cast< std::size_t >( header.NumberOfInterior );
+    const std::size_t boundary = static_cast< std::size_t >( header.NumberOfBoundary );
+    header.NumberOfRows = header.NumberOfInterior = header.NumberOfBoundary = 0;
+    if( std::memcmp( &header, &expected, sizeof( header ) ) != 0
+        || rows != outputSize[1] * outputSize[2]
+        || m_File.GetSize() != GetFileSize( rows, interior, boundary ) )
+      {
+      m_File.Close();
+      return false;
+      }
+
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_InputSize[d] = inputSize[d];
+      m_OutputSize[d] = outputSize[d];
+      }
+    m_Mapping = mapping;
+    ComputeWeightTable();
+    const char * data = m_File.GetData() + sizeof( FileHeader );
+    m_View.NumberOfRows = rows;
+    m_View.NumberOfInterior = interior;
+    m_View.NumberOfBoundary = boundary;
+    m_View.Rows = reinterpret_cast< const RowSpans * >( Advance( data, rows * sizeof( RowSpans ) ) );
+    m_View.InteriorStart = reinterpret_cast< const uint64_t * >( Advance( data, ( rows + 1 ) * sizeof( uint64_t ) ) );
+    m_View.BoundaryStart = reinterpret_cast< const uint64_t * >( Advance( data, ( rows + 1 ) * sizeof( uint64_t ) ) );
+    m_View.Offsets = reinterpret_cast< const int32_t * >( Advance( data, interior * sizeof( int32_t ) ) );
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_View.InteriorPhase[d] = reinterpret_cast< const uint8_t * >( Advance( data, interior ) );
+      }
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_View.BoundaryBase[d] = reinterpret_cast< const int32_t * >( Advance( data, boundary * sizeof( int32_t ) ) );
+      }
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_View.BoundaryPhase[d] = reinterpret_cast< const uint8_t * >( Advance( data, boundary ) );
+      }
+    if( !IsConsistent() )
+      {
+      std::memset( &m_View, 0, sizeof( m_View ) );
+      m_File.Close();
+      return false;
+      }
+    ClearStorage();
+    return true;
+    }
+
+  // Resamples `input` (of the plan's input size) into `output` (of its
+  // output size), optionally storing a thresholded mask.
+  template< typename TPixel >
+  void Apply( const TPixel * input, TPixel * output, TPixel defaultValue,
+              const OutputThreshold & threshold = OutputThreshold() ) const
+    {
+    ApplyFunctor< TPixel > functor( this, input, output, defaultValue, threshold );
+    ParallelFor( 0, m_View.NumberOfRows, 16, m_NumberOfThreads, functor );
+    }
+
+private:
+  ResamplingPlan( const ResamplingPlan & );
+  ResamplingPlan & operator=( const ResamplingPlan & );
+
+  static const uint32_t FileVersion = 1;
+
+  // Fixed-size file header; every field is 8-byte aligned so the arrays
+  // that follow (each padded to 8 bytes) can be used in place.
+  struct FileHeader
+  {
+    char     Magic[8];
+    uint32_t Version;
+    uint32_t ByteOrder;
+    uint32_t Radius;
+    uint32_t Phases;
+    uint64_t Key;
+    uint64_t InputSize[3];
+    uint64_t OutputSize[3];
+    double   Matrix[9];
+    double   Offset[3];
+    uint64_t NumberOfRows;
+    uint64_t NumberOfInterior;
+    uint64_t NumberOfBoundary;
+  };
+
+  // Read-only view of the plan arrays, either into the vectors below (after
+  // Build()) or into the mapped plan file (after Load()).
+  struct ArrayView
+  {
+    std::size_t      NumberOfRows;
+    std::size_t      NumberOfInterior;
+    std::size_t      NumberOfBoundary;
+    const RowSpans * Rows;
+    const uint64_t * InteriorStart;
+    const uint64_t * BoundaryStart;
+    const int32_t *  Offsets;
+    const uint8_t *  InteriorPhase[3];
+    const int32_t *  BoundaryBase[3];
+    const uint8_t *  BoundaryPhase[3];
+  };
+
+  static std::size_t Padded( std::size_t bytes ) { return ( bytes + 7 ) & ~static_cast< std::size_t >( 7 ); }
+
+  static const char * Advance( const char * & data, std::size_t bytes )
+    {
+    const char * current = data;
+    data += Padded( bytes );
+    return current;
+    }
+
+  static void Write( std::ofstream & file, const void * data, std::size_t bytes )
+    {
+    static const char zeros[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    if( bytes > 0 )
+      {
+      file.write( static_cast< const char * >( data ), static_cast< std::streamsize >( bytes ) );
+      }
+    file.write( zeros, static_cast< std::streamsize >( Padded( bytes ) - bytes ) );
+    }
+
+  static std::size_t GetFileSize( std::size_t rows, std::size_t interior, std::size_t boundary )
+    {
+    return sizeof( FileHeader ) + Padded( rows * sizeof( RowSpans ) ) + 2 * Padded( ( rows + 1 ) * sizeof( uint64_t ) )
+           + Padded( interior * sizeof( int32_t ) ) + 3 * Padded( interior )
+           + 3 * Padded( boundary * sizeof( int32_t ) ) + 3 * Padded( boundary );
+    }
+
+  // Header of the plan for these parameters, without the array lengths.
+  static void FillHeader( const IndexMapping & mapping, const std::size_t inputSize[3],
+                          const std::size_t outputSize[3], FileHeader & header )
+    {
+    std::memset( &header, 0, sizeof( header ) );
+    std::memcpy( header.Magic, "3DTPLAN", 8 );
+    header.Version = FileVersion;
+    header.ByteOrder = 0x01020304;
+    header.Radius = VRadius;
+    header.Phases = NumberOfPhases;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      header.InputSize[d] = inputSize[d];
+      header.OutputSize[d] = outputSize[d];
+      header.Offset[d] = mapping.Offset[d];
+      for( unsigned int e = 0; e < 3; e++ )
+        {
+        header.Matrix[3 * d + e] = mapping.Matrix[d][e];
+        }
+      }
+    // FNV-1a over everything that determines the plan.
+    uint64_t key = 14695981039346656037ULL;
+    const unsigned char * bytes = reinterpret_cast< const unsigned char * >( &header );
+    for( std::size_t i = 0; i < offsetof( FileHeader, NumberOfRows ); i++ )
+      {
+      key = ( key ^ bytes[i] ) * 1099511628211ULL;
+      }
+    header.Key = key;
+    }
+
+  // Checks the arrays of a loaded plan before Apply() indexes with them:
+  // the spans of every row are ordered and within the row, the start
+  // arrays count exactly the samples of the spans, every interior sample
+  // has its whole window inside the input, and every boundary sample its
+  // first taps near it (they are clamped, but a far value is no plan).
+  bool IsConsistent() const
+    {
+    const std::size_t length = m_OutputSize[0];
+    if( m_View.InteriorStart[0] != 0 || m_View.BoundaryStart[0] != 0 )
+      {
+      return false;
+      }
+    for( std::size_t row = 0; row < m_View.NumberOfRows; row++ )
+      {
+      const RowSpans & s = m_View.Rows[row];
+      if( !( s.InsideFirst <= s.InteriorFirst && s.InteriorFirst <= s.InteriorLast
+             && s.InteriorLast <= s.InsideLast && s.InsideLast <= length )
+          || m_View.InteriorStart[row + 1] != m_View.InteriorStart[row] + ( s.InteriorLast - s.InteriorFirst )
+          || m_View.BoundaryStart[row + 1] != m_View.BoundaryStart[row] + ( s.InsideLast - s.InsideFirst )
+                                                - ( s.InteriorLast - s.InteriorFirst ) )
+        {
+        return false;
+        }
+      }
+    if( m_View.InteriorStart[m_View.NumberOfRows] != m_View.NumberOfInterior
+        || m_View.BoundaryStart[m_View.NumberOfRows] != m_View.NumberOfBoundary )
+      {
+      return false;
+      }
+    const int64_t strideY = static_cast< int64_t >( m_InputSize[0] );
+    const int64_t strideZ = strideY * static_cast< int64_t >( m_InputSize[1] );
+    const int64_t lastOffset = strideZ * static_cast< int64_t >( m_InputSize[2] ) - 1
+                             - ( WindowSize - 1 ) * ( strideZ + strideY + 1 );
+    for( std::size_t n = 0; n < m_View.NumberOfInterior; n++ )
+      {
+      if( m_View.Offsets[n] < 0 || m_View.Offsets[n] > lastOffset )
+        {
+        return false;
+        }
+      }
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      const int32_t lower = -static_cast< int32_t >( WindowSize );
+      const int32_t upper = static_cast< int32_t >( m_InputSize[d] );
+      for( std::size_t n = 0; n < m_View.NumberOfBoundary; n++ )
+        {
+        if( m_View.BoundaryBase[d][n] < lower || m_View.BoundaryBase[d][n] > upper )
+          {
+          return false;
+          }
+        }
+      }
+    return true;
+    }
+
+  void ComputeWeightTable()
+    {
+    for( unsigned int p = 0; p < NumberOfPhases; p++ )
+      {
+      WindowedSincResampler< unsigned char, VRadius >::ComputeWeights(
+        static_cast< double >( p ) / NumberOfPhases, &m_Weights[p * WindowSize] );
+      }
+    }
+
+  void ClearStorage()
+    {
+    std::vector< RowSpans >().swap( m_Rows );
+    std::vector< uint64_t >().swap( m_InteriorStart );
+    std::vector< uint64_t >().swap( m_BoundaryStart );
+    std::vector< int32_t >().swap( m_Offsets );
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      std::vector< uint8_t >().swap( m_InteriorPhase[d] );
+      std::vector< int32_t >().swap( m_BoundaryBase[d] );
+      std::vector< uint8_t >().swap( m_BoundaryPhase[d] );
+      }
+    }
+
+  // Splits c into the first tap and a phase, rounding to the nearest phase.
+  static void Quantize( double c, int32_t & first, uint8_t & phase )
+    {
+    double b = std::floor( c );
+    long p = static_cast< long >( ( c - b ) * NumberOfPhases + 0.5 );
+    if( p == static_cast< long >( NumberOfPhases ) )
+      {
+      b += 1.0;
+      p = 0;
+      }
+    first = static_cast< int32_t >( b ) - static_cast< int32_t >( VRadius - 1 );
+    phase = static_cast< uint8_t >( p );
+    }
+
+  struct SpanFunctor
+  {
+    explicit SpanFunctor( ResamplingPlan * self ) : m_Self( self ) {}
+
+    void operator()( std::size_t first, std::size_t last, unsigned int ) const
+      {
+      ResamplingPlan & s = *m_Self;
+      double insideLower[3];
+      double insideUpper[3];
+      double interiorLower[3];
+      double interiorUpper[3];
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        insideLower[d] = -0.5;
+        insideUpper[d] = static_cast< double >( s.m_InputSize[d] ) - 0.5;
+        // Rounding up to the next phase may move the taps by one voxel.
+        interiorLower[d] = VRadius - 1.0;
+        interiorUpper[d] = static_cast< double >( s.m_InputSize[d] ) - VRadius - 0.5 / NumberOfPhases;
+        }
+      const std::size_t length = s.m_OutputSize[0];
+      for( std::size_t row = first; row < last; row++ )
+        {
+        const std::size_t j = row % s.m_OutputSize[1];
+        const std::size_t k = row / s.m_OutputSize[1];
+        std::size_t insideFirst;
+        std::size_t insideLast;
+        std::size_t interiorFirst;
+        std::size_t interiorLast;
+        ComputeRowSpan( s.m_Mapping, j, k, length, insideLower, insideUpper, insideFirst, insideLast );
+        ComputeRowSpan( s.m_Mapping, j, k, length, interiorLower, interiorUpper, interiorFirst, interiorLast );
+        if( interiorFirst == interiorLast )
+          {
+          interiorFirst = interiorLast = insideLast;
+          }
+        RowSpans & spans = s.m_Rows[row];
+        spans.InsideFirst = static_cast< uint32_t >( insideFirst );
+        spans.InteriorFirst = static_cast< uint32_t >( interiorFirst );
+        spans.InteriorLast = static_cast< uint32_t >( interiorLast );
+        spans.InsideLast = static_cast< uint32_t >( insideLast );
+        }
+      }
+
+    ResamplingPlan * m_Self;
+  };
+
+  struct FillFunctor
+  {
+    explicit FillFunctor( ResamplingPlan * self ) : m_Self( self ) {}
+
+    void operator()( std::size_t first, std::size_t last, unsigned int ) const
+      {
+      ResamplingPlan & s = *m_Self;
+      const int32_t strideY = static_cast< int32_t >( s.m_InputSize[0] );
+      const int32_t strideZ = strideY * static_cast< int32_t >( s.m_InputSize[1] );
+      for( std::size_t row = first; row < last; row++ )
+        {
+        const RowSpans & spans = s.m_Rows[row];
+        const double dj = static_cast< double >( row % s.m_OutputSize[1] );
+        const double dk = static_cast< double >( row / s.m_OutputSize[1] );
+        std::size_t interior = s.m_InteriorStart[row];
+        std::size_t boundary = s.m_BoundaryStart[row];
+        for( uint32_t i = spans.InsideFirst; i < spans.InsideLast; i++ )
+          {
+          double c[3];
+          int32_t base[3];
+          uint8_t phase[3];
+          s.m_Mapping.Map( static_cast< double >( i ), dj, dk, c );
+          for( unsigned int d = 0; d < 3; d++ )
+            {
+            Quantize( c[d], base[d], phase[d] );
+            }
+          if( i >= spans.InteriorFirst && i < spans.InteriorLast )
+            {
+            s.m_Offsets[interior] = base[2] * strideZ + base[1] * strideY + base[0];
+            for( unsigned int d = 0; d < 3; d++ )
+              {
+              s.m_InteriorPhase[d][interior] = phase[d];
+              }
+            ++interior;
+            }
+          else
+            {
+            for( unsigned int d = 0; d < 3; d++ )
+              {
+              s.m_BoundaryBase[d][boundary] = base[d];
+              s.m_BoundaryPhase[d][boundary] = phase[d];
+              }
+            ++boundary;
+            }
+          }
+        }
+      }
+
+    ResamplingPlan * m_Self;
+  };
+
+  template< typename TPixel >
+  struct ApplyFunctor
+  {
+    ApplyFunctor( const ResamplingPlan * self, const TPixel * input, TPixel * output, TPixel defaultValue,
+                  const OutputThreshold & threshold )
+      : m_Self( self ), m_Input( input ), m_Output( output ), m_DefaultValue( defaultValue ),
+        m_Threshold( threshold ) {}
+
+    void operator()( std::size_t first, std::size_t last, unsigned int ) const
+      {
+      const ResamplingPlan & s = *m_Self;
+      const std::size_t length = s.m_OutputSize[0];
+      const std::ptrdiff_t strideY = static_cast< std::ptrdiff_t >( s.m_InputSize[0] );
+      const std::ptrdiff_t strideZ = strideY * static_cast< std::ptrdiff_t >( s.m_InputSize[1] );
+      for( std::size_t row = first; row < last; row++ )
+        {
+        const RowSpans & spans = s.m_View.Rows[row];
+        TPixel * out = m_Output + row * length;
+        std::size_t interior = s.m_View.InteriorStart[row];
+        std::size_t boundary = s.m_View.BoundaryStart[row];
+        std::size_t i = 0;
+        for( ; i < spans.InsideFirst; i++ )
+          {
+          out[i] = m_DefaultValue;
+          }
+        for( ; i < spans.InteriorFirst; i++, boundary++ )
+          {
+          out[i] = m_Threshold.Apply< TPixel >( EvaluateBoundary( boundary ) );
+          }
+        for( ; i < spans.InteriorLast; i++, interior++ )
+          {
+          const double * wx = &s.m_Weights[s.m_View.InteriorPhase[0][interior] * WindowSize];
+          const double * wy = &s.m_Weights[s.m_View.InteriorPhase[1][interior] * WindowSize];
+          const double * wz = &s.m_Weights[s.m_View.InteriorPhase[2][interior] * WindowSize];
+          const TPixel * pz = m_Input + s.m_View.Offsets[interior];
+          double value = 0.0;
+          for( unsigned int kz = 0; kz < WindowSize; kz++, pz += strideZ )
+            {
+            const TPixel * py = pz;
+            double plane = 0.0;
+            for( unsigned int ky = 0; ky < WindowSize; ky++, py += strideY )
+              {
+              double sum = 0.0;
+              for( unsigned int kx = 0; kx < WindowSize; kx++ )
+                {
+                sum += wx[kx] * static_cast< double >( py[kx] );
+                }
+              plane += wy[ky] * sum;
+              }
+            value += wz[kz] * plane;
+            }
+          out[i] = m_Threshold.Apply< TPixel >( value );
+          }
+        for( ; i < spans.InsideLast; i++, boundary++ )
+          {
+          out[i] = m_Threshold.Apply< TPixel >( EvaluateBoundary( boundary ) );
+          }
+        for( ; i < length; i++ )
+          {
+          out[i] = m_DefaultValue;
+          }
+        }
+      }
+
+    // Taps clamped to the buffer (zero-flux Neumann), as in
+    // WindowedSincResampler::EvaluateGuarded().
+    double EvaluateBoundary( std::size_t boundary ) const
+      {
+      const ResamplingPlan & s = *m_Self;
+      const double * weights[3];
+      std::size_t taps[3][WindowSize];
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        weights[d] = &s.m_Weights[s.m_View.BoundaryPhase[d][boundary] * WindowSize];
+        const std::ptrdiff_t lastIndex = static_cast< std::ptrdiff_t >( s.m_InputSize[d] ) - 1;
+        for( unsigned int t = 0; t < WindowSize; t++ )
+          {
+          std::ptrdiff_t index = s.m_View.BoundaryBase[d][boundary] + static_cast< std::ptrdiff_t >( t );
+          index = index < 0 ? 0 : ( index > lastIndex ? lastIndex : index );
+          taps[d][t] = static_cast< std::size_t >( index );
+          }
+        }
+      const std::size_t strideY = s.m_InputSize[0];
+      const std::size_t strideZ = strideY * s.m_InputSize[1];
+      double value = 0.0;
+      for( unsigned int kz = 0; kz < WindowSize; kz++ )
+        {
+        double plane = 0.0;
+        for( unsigned int ky = 0; ky < WindowSize; ky++ )
+          {
+          const TPixel * row = m_Input + taps[2][kz] * strideZ + taps[1][ky] * strideY;
+          double sum = 0.0;
+          for( unsigned int kx = 0; kx < WindowSize; kx++ )
+            {
+            sum += weights[0][kx] * static_cast< double >( row[taps[0][kx]] );
+            }
+          plane += weights[1][ky] * sum;
+          }
+        value += weights[2][kz] * plane;
+        }
+      return value;
+      }
+
+    const ResamplingPlan * m_Self;
+    const TPixel *         m_Input;
+    TPixel *               m_Output;
+    TPixel                 m_DefaultValue;
+    OutputThreshold        m_Threshold;
+  };
+
+  std::size_t                m_InputSize[3];
+  std::size_t                m_OutputSize[3];
+  IndexMapping               m_Mapping;
+  unsigned int               m_NumberOfThreads;
+  double                     m_Weights[NumberOfPhases * WindowSize];
+  ArrayView                  m_View;
+  MappedFile                 m_File;
+  std::vector< RowSpans >    m_Rows;
+  std::vector< uint64_t >    m_InteriorStart;
+  std::vector< uint64_t >    m_BoundaryStart;
+  std::vector< int32_t >     m_Offsets;
+  std::vector< uint8_t >     m_InteriorPhase[3];
+  std::vector< int32_t >     m_BoundaryBase[3];
+  std::vector< uint8_t >     m_BoundaryPhase[3];
+};
+
+#endif
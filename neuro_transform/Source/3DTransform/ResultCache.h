@@ -0,0 +1,545 @@
+// AUTHOR: Christian McDaniel
+//
+// Content-addressed cache of output files. A result is keyed by everything
+// that determines it: a hash of the input voxels, the transform, the
+// output grid and the resampling options (ResultCacheKey). A rerun with
+// the same key hard-links the stored file to its output name (or copies
+// it, across file systems) instead of resampling, so it costs reading and
+// hashing the input and one link.
+//
+// Entries are files "result-<key><extension>" in the cache directory (two,
+// "result-<key>.hdr" and "result-<key>.img", for an Analyze/NIfTI pair):
+// copies of the outputs, written under a temporary name and renamed when
+// complete, and made read-only, since an output fetched by a link shares
+// the entry's data and a program that rewrote it in place would change the
+// entry; this program removes such a link before writing the output
+// (DetachFile()).
+// Each use of an entry sets its modification time, and when the entries
+// exceed the size limit the least recently used ones are removed. Hits,
+// misses and evictions are appended to "history" (one character each;
+// appends of a byte do not interleave between processes) for the
+// statistics.
+//
+// The voxel hash is XXH64 (32 bytes per round in four independent lanes,
+// several GB/s); the key mixes it with the parameters by 64-bit FNV-1a, as
+// {ResamplingPlan.h} does for its cache files.
+
+#ifndef ResultCache_h
+#define ResultCache_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if !defined( _WIN32 )
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#include "ResampleGeometry.h"
+
+// XXH64 of `size` bytes.
+inline std::uint64_t HashBytes( const void * data, std::size_t size, std::uint64_t seed = 0 )
+{
+  struct Round
+  {
+    static std::uint64_t Rotate( std::uint64_t x, unsigned int bits ) { return ( x << bits ) | ( x >> ( 64 - bits ) ); }
+
+    static std::uint64_t Read64( const unsigned char * p )
+      {
+      std::uint64_t value;
+      std::memcpy( &value, p, sizeof( value ) );
+      return value;
+      }
+
+    static std::uint64_t Read32( const unsigned char * p )
+      {
+      std::uint32_t value;
+      std::memcpy( &value, p, sizeof( value ) );
+      return value;
+      }
+
+    static std::uint64_t Accumulate( std::uint64_t lane, std::uint64_t input )
+      {
+      return Rotate( lane + input * 14029467366897019727ULL, 31 ) * 11400714785074694791ULL;
+      }
+
+    static std::uint64_t Merge( std::uint64_t hash, std::uint64_t lane )
+      {
+      return ( hash ^ Accumulate( 0, lane ) ) * 11400714785074694791ULL + 9650029242287828579ULL;
+      }
+  };
+
+  const std::uint64_t prime1 = 11400714785074694791ULL;
+  const std::uint64_t prime2 = 14029467366897019727ULL;
+  const std::uint64_t prime3 = 1609587929392839161ULL;
+  const std::uint64_t prime4 = 9650029242287828579ULL;
+  const std::uint64_t prime5 = 2870177450012600261ULL;
+  const unsigned char * p = static_cast< const unsigned char * >( data );
+  const unsigned char * const end = p + size;
+  std::uint64_t hash;
+  if( size >= 32 )
+    {
+    std::uint64_t lanes[4] = { seed + prime1 + prime2, seed + prime2, seed, seed - prime1 };
+    for( ; p + 32 <= end; p += 32 )
+      {
+      lanes[0] = Round::Accumulate( lanes[0], Round::Read64( p ) );
+      lanes[1] = Round::Accumulate( lanes[1], Round::Read64( p + 8 ) );
+      lanes[2] = Round::Accumulate( lanes[2], Round::Read64( p + 16 ) );
+      lanes[3] = Round::Accumulate( lanes[3], Round::Read64( p + 24 ) );
+      }
+    hash = Round::Rotate( lanes[0], 1 ) + Round::Rotate( lanes[1], 7 ) + Round::Rotate( lanes[2], 12 )
+         + Round::Rotate( lanes[3], 18 );
+    for( unsigned int n = 0; n < 4; n++ )
+      {
+      hash = Round::Merge( hash, lanes[n] );
+      }
+    }
+  else
+    {
+    hash = seed + prime5;
+    }
+  hash += static_cast< std::uint64_t >( size );
+  for( ; p + 8 <= end; p += 8 )
+    {
+    hash = Round::Rotate( hash ^ Round::Accumulate( 0, Round::Read64( p ) ), 27 ) * prime1 + prime4;
+    }
+  if( p + 4 <= end )
+    {
+    hash = Round::Rotate( hash ^ ( Round::Read32( p ) * prime1 ), 23 ) * prime2 + prime3;
+    p += 4;
+    }
+  for( ; p < end; p++ )
+    {
+    hash = Round::Rotate( hash ^ ( *p * prime5 ), 11 ) * prime1;
+    }
+  hash ^= hash >> 33;
+  hash *= prime2;
+  hash ^= hash >> 29;
+  hash *= prime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+// 64-bit FNV-1a over the parameters of a result, added one at a time.
+// Numbers are added by value (their bytes), strings with their length.
+class ResultCacheKey
+{
+public:
+  ResultCacheKey() : m_Value( 14695981039346656037ULL ) {}
+
+  void Add( const void * data, std::size_t size )
+    {
+    const unsigned char * bytes = static_cast< const unsigned char * >( data );
+    for( std::size_t i = 0; i < size; i++ )
+      {
+      m_Value = ( m_Value ^ bytes[i] ) * 1099511628211ULL;
+      }
+    }
+
+  void Add( std::uint64_t value ) { Add( &value, sizeof( value ) ); }
+  void Add( double value ) { Add( &value, sizeof( value ) ); }
+
+  void Add( const std::string & text )
+    {
+    Add( static_cast< std::uint64_t >( text.size() ) );
+    Add( text.data(), text.size() );
+    }
+
+  void Add( const ImageGeometry & geometry )
+    {
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      Add( static_cast< std::uint64_t >( geometry.Size[d] ) );
+      Add( geometry.Spacing[d] );
+      Add( geometry.Origin[d] );
+      for( unsigned int e = 0; e < 3; e++ )
+        {
+        Add( geometry.Direction[d][e] );
+        }
+      }
+    }
+
+  void Add( const AffineMapping & transform )
+    {
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      Add( transform.Offset[d] );
+      for( unsigned int e = 0; e < 3; e++ )
+        {
+        Add( transform.Matrix[d][e] );
+        }
+      }
+    }
+
+  std::uint64_t GetValue() const { return m_Value; }
+
+private:
+  std::uint64_t m_Value;
+};
+
+// Contents of a cache directory and its history.
+struct ResultCacheStatistics
+{
+  std::size_t   Entries;
+  std::uint64_t Bytes;
+  std::size_t   Hits;
+  std::size_t   Misses;
+  std::size_t   Evictions;
+};
+
+class ResultCache
+{
+public:
+  ResultCache() : m_SizeLimit( 1024ULL << 20 ) {}
+
+  void SetDirectory( const std::string & directory ) { m_Directory = directory; }
+
+  // Total size of the entries in bytes, enforced after every Store().
+  void SetSizeLimit( std::uint64_t bytes ) { m_SizeLimit = bytes; }
+
+  // "dir/name.nii.gz" -> ".nii.gz" (".gz" is kept with the extension
+  // before it), "" without an extension.
+  static std::string GetFileExtension( const std::string & fileName )
+    {
+    const std::size_t slash = fileName.find_last_of( "/\\" );
+    const std::size_t nameStart = ( slash == std::string::npos ) ? 0 : slash + 1;
+    std::size_t dot = fileName.find_last_of( '.' );
+    if( dot == std::string::npos || dot <= nameStart )
+      {
+      return std::string();
+      }
+    if( fileName.compare( dot, std::string::npos, ".gz" ) == 0 )
+      {
+      const std::size_t previous = fileName.find_last_of( '.', dot - 1 );
+      dot = ( previous != std::string::npos && previous > nameStart ) ? previous : dot;
+      }
+    return fileName.substr( dot );
+    }
+
+  // Formats an entry can hold: those ITK writes as one file, and the
+  // Analyze/NIfTI .hdr/.img pair (not e.g. MetaImage .mhd headers, whose
+  // data file name is stored in the header).
+  static bool IsCacheableFormat( const std::string & extension )
+    {
+    static const char * const formats[] = { ".nii", ".nii.gz", ".mha", ".nrrd", ".vtk", ".hdr", ".img" };
+    for( std::size_t n = 0; n < sizeof( formats ) / sizeof( formats[0] ); n++ )
+      {
+      if( extension == formats[n] )
+        {
+        return true;
+        }
+      }
+    return false;
+    }
+
+  // The other file ITK writes with an output of this extension: ".img" for
+  // ".hdr" and the reverse, "" for single-file formats.
+  static std::string GetCompanionExtension( const std::string & extension )
+    {
+    if( extension == ".hdr" )
+      {
+      return ".img";
+      }
+    if( extension == ".img" )
+      {
+      return ".hdr";
+      }
+    return std::string();
+    }
+
+  std::string GetEntryName( std::uint64_t key, const std::string & extension ) const
+    {
+    char name[32];
+    std::snprintf( name, sizeof( name ), "result-%016llx", static_cast< unsigned long long >( key ) );
+    return m_Directory + "/" + name + extension;
+    }
+
+  // Links (or copies) the entry of `key` to `output`, replacing it, and
+  // marks the entry used. Each link is made under a temporary name and
+  // renamed over its output file, which is left as it was if that fails.
+  // Returns false, and records a miss, if there is no such entry or it
+  // cannot be linked or copied.
+  bool Fetch( std::uint64_t key, const std::string & extension, const std::string & output )
+    {
+    const std::string entry = GetEntryName( key, extension );
+    std::ifstream probe( entry.c_str(), std::ios::binary );
+    if( !probe )
+      {
+      AppendHistory( 'm' );
+      return false;
+      }
+    probe.close();
+    const std::vector< std::pair< std::string, std::string > > files = GetEntryFiles( key, extension, output );
+    for( std::size_t n = 0; n < files.size(); n++ )
+      {
+      const std::string temporary = GetTemporaryName( files[n].second );
+      if( ( !LinkFile( files[n].first, temporary ) && !CopyFile( files[n].first, temporary ) )
+          || std::rename( temporary.c_str(), files[n].second.c_str() ) != 0 )
+        {
+        std::remove( temporary.c_str() );
+        AppendHistory( 'm' );
+        return false;
+        }
+      }
+    for( std::size_t n = 0; n < files.size(); n++ )
+      {
+      Touch( files[n].first );
+      }
+    AppendHistory( 'h' );
+    return true;
+    }
+
+  // Adds a copy of `output` (just written) as the entry of `key`, then
+  // evicts least recently used entries down to the size limit. The entry
+  // is a copy, not a link, so that making it read-only leaves `output`
+  // alone. Returns false if the entry cannot be written.
+  bool Store( std::uint64_t key, const std::string & extension, const std::string & output )
+    {
+    const std::vector< std::pair< std::string, std::string > > files = GetEntryFiles( key, extension, output );
+    for( std::size_t n = 0; n < files.size(); n++ )
+      {
+      const std::string temporary = GetTemporaryName( files[n].first );
+      if( !CopyFile( files[n].second, temporary ) )
+        {
+        std::remove( temporary.c_str() );
+        return false;
+        }
+#if !defined( _WIN32 )
+      chmod( temporary.c_str(), S_IRUSR | S_IRGRP | S_IROTH );
+#endif
+      if( std::rename( temporary.c_str(), files[n].first.c_str() ) != 0 )
+        {
+        std::remove( temporary.c_str() );
+        return false;
+        }
+      }
+    Evict( GetEntryName( key, std::string() ) );
+    return true;
+    }
+
+  ResultCacheStatistics GetStatistics() const
+    {
+    ResultCacheStatistics statistics;
+    std::vector< Entry > entries = ListEntries();
+    statistics.Entries = entries.size();
+    statistics.Bytes = 0;
+    for( std::size_t n = 0; n < entries.size(); n++ )
+      {
+      statistics.Bytes += entries[n].Bytes;
+      }
+    statistics.Hits = statistics.Misses = statistics.Evictions = 0;
+    std::ifstream history( ( m_Directory + "/history" ).c_str(), std::ios::binary );
+    char event;
+    while( history.get( event ) )
+      {
+      statistics.Hits += ( event == 'h' );
+      statistics.Misses += ( event == 'm' );
+      statistics.Evictions += ( event == 'e' );
+      }
+    return statistics;
+    }
+
+  // Removes `fileName` before it is written if it is an output fetched
+  // from a cache, so that the writer creates a new file: a read-only hard
+  // link to an entry, which writing in place would fail on (or, made
+  // writable, change the entry through). The data stays in the entry. Any
+  // other existing output is left to the writer, so a failed write does
+  // not lose it.
+  static void DetachFile( const std::string & fileName )
+    {
+#if !defined( _WIN32 )
+    const std::string extension = GetFileExtension( fileName );
+    const std::string companion = GetCompanionExtension( extension );
+    std::vector< std::string > files( 1, fileName );
+    if( !companion.empty() )
+      {
+      files.push_back( fileName.substr( 0, fileName.size() - extension.size() ) + companion );
+      }
+    for( std::size_t n = 0; n < files.size(); n++ )
+      {
+      struct stat status;
+      if( stat( files[n].c_str(), &status ) == 0 && S_ISREG( status.st_mode ) && status.st_nlink > 1
+          && !( status.st_mode & S_IWUSR ) )
+        {
+        std::remove( files[n].c_str() );
+        }
+      }
+#else
+    (void)fileName;
+#endif
+    }
+
+private:
+  // One key's files ("result-<key>" plus an extension); two for a
+  // .hdr/.img pair.
+  struct Entry
+  {
+    std::vector< std::string > Files;
+    std::uint64_t              Bytes;
+    long long                  Used; // latest modification time, ns
+
+    bool operator<( const Entry & other ) const { return Used < other.Used; }
+  };
+
+  // (entry file, output file) for each file of the entry of `key`; the
+  // companion of a pair comes first, so the file Fetch() probes for is
+  // the last one stored.
+  std::vector< std::pair< std::string, std::string > > GetEntryFiles( std::uint64_t key, const std::string & extension,
+                                                                      const std::string & output ) const
+    {
+    std::vector< std::pair< std::string, std::string > > files;
+    const std::string companion = GetCompanionExtension( extension );
+    if( !companion.empty() )
+      {
+      files.push_back( std::make_pair( GetEntryName( key, companion ),
+                                       output.substr( 0, output.size() - extension.size() ) + companion ) );
+      }
+    files.push_back( std::make_pair( GetEntryName( key, extension ), output ) );
+    return files;
+    }
+
+  // The complete entries of the directory (no temporary files), with the
+  // files of each key grouped together.
+  std::vector< Entry > ListEntries() const
+    {
+    std::vector< Entry > entries;
+#if !defined( _WIN32 )
+    DIR * directory = opendir( m_Directory.c_str() );
+    if( !directory )
+      {
+      return entries;
+      }
+    // "result-" and 16 hexadecimal digits.
+    const std::size_t keyLength = 23;
+    std::map< std::string, Entry > keys;
+    while( const dirent * item = readdir( directory ) )
+      {
+      const std::string name = item->d_name;
+      struct stat status;
+      if( name.compare( 0, 7, "result-" ) != 0 || name.size() < keyLength || name.find( ".tmp." ) != std::string::npos
+          || stat( ( m_Directory + "/" + name ).c_str(), &status ) != 0 || !S_ISREG( status.st_mode ) )
+        {
+        continue;
+        }
+#if defined( __APPLE__ )
+      const long long used = static_cast< long long >( status.st_mtimespec.tv_sec ) * 1000000000LL
+                           + status.st_mtimespec.tv_nsec;
+#else
+      const long long used = static_cast< long long >( status.st_mtim.tv_sec ) * 1000000000LL + status.st_mtim.tv_nsec;
+#endif
+      std::map< std::string, Entry >::iterator found = keys.find( name.substr( 0, keyLength ) );
+      if( found == keys.end() )
+        {
+        Entry entry;
+        entry.Bytes = 0;
+        entry.Used = used;
+        found = keys.insert( std::make_pair( name.substr( 0, keyLength ), entry ) ).first;
+        }
+      found->second.Files.push_back( m_Directory + "/" + name );
+      found->second.Bytes += static_cast< std::uint64_t >( status.st_size );
+      found->second.Used = std::max( found->second.Used, used );
+      }
+    closedir( directory );
+    for( std::map< std::string, Entry >::const_iterator k = keys.begin(); k != keys.end(); ++k )
+      {
+      entries.push_back( k->second );
+      }
+#endif
+    return entries;
+    }
+
+  // Removes the least recently used entries, other than the one whose
+  // files start with `keep`, until the rest fit the size limit.
+  void Evict( const std::string & keep )
+    {
+    std::vector< Entry > entries = ListEntries();
+    std::uint64_t total = 0;
+    for( std::size_t n = 0; n < entries.size(); n++ )
+      {
+      total += entries[n].Bytes;
+      }
+    std::sort( entries.begin(), entries.end() );
+    for( std::size_t n = 0; n < entries.size() && total > m_SizeLimit; n++ )
+      {
+      if( entries[n].Files[0].compare( 0, keep.size(), keep ) == 0 )
+        {
+        continue;
+        }
+      bool removed = true;
+      for( std::size_t f = 0; f < entries[n].Files.size(); f++ )
+        {
+        removed = std::remove( entries[n].Files[f].c_str() ) == 0 && removed;
+        }
+      if( removed )
+        {
+        total -= entries[n].Bytes;
+        AppendHistory( 'e' );
+        }
+      }
+    }
+
+  void AppendHistory( char event ) const
+    {
+    std::ofstream history( ( m_Directory + "/history" ).c_str(), std::ios::binary | std::ios::app );
+    history.put( event );
+    }
+
+  static bool LinkFile( const std::string & from, const std::string & to )
+    {
+#if !defined( _WIN32 )
+    return link( from.c_str(), to.c_str() ) == 0;
+#else
+    (void)from;
+    (void)to;
+    return false;
+#endif
+    }
+
+  static bool CopyFile( const std::string & from, const std::string & to )
+    {
+    std::ifstream source( from.c_str(), std::ios::binary );
+    std::ofstream target( to.c_str(), std::ios::binary | std::ios::trunc );
+    if( !source || !target )
+      {
+      return false;
+      }
+    target << source.rdbuf();
+    return static_cast< bool >( target.flush() );
+    }
+
+  // `fileName` with a random ".tmp." suffix, in the same directory (so
+  // that it can be renamed over `fileName`).
+  static std::string GetTemporaryName( const std::string & fileName )
+    {
+    std::ostringstream suffix;
+    suffix << ".tmp." << std::random_device()();
+    return fileName + suffix.str();
+    }
+
+  // Sets the modification time (the last use) to now.
+  static void Touch( const std::string & fileName )
+    {
+#if !defined( _WIN32 )
+    utime( fileName.c_str(), 0 );
+#else
+    (void)fileName;
+#endif
+    }
+
+  std::string   m_Directory;
+  std::uint64_t m_SizeLimit;
+};
+
+#endif
@@ -0,0 +1,518 @@
+// AUTHOR: Christian McDaniel
+//
+// Resampling of a 3D buffer with a separable interpolation kernel (linear,
+// cubic or windowed sinc) computed in a chosen floating point type. With
+// TReal = float the weights and sums are single precision, and when the
+// program is compiled for AVX2 the interior spans of unsigned char images
+// are evaluated eight output voxels at a time with gathered taps.
+//
+// Rows are split into outside / guarded / interior spans exactly like
+// {WindowedSincResampler.h}; the taps of a position c along one axis are
+// floor(c) - (Radius-1) ... floor(c) + Radius, clamped to the buffer near
+// the border, which is what ITK's linear and windowed sinc interpolators
+// use.
+
+#ifndef SeparableKernelResampler_h
+#define SeparableKernelResampler_h
+
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <thread>
+
+#if defined( __AVX2__ )
+#include <immintrin.h>
+#endif
+
+#include "ParallelFor.h"
+#include "ResampleGeometry.h"
+#include "WindowedSincResampler.h"
+
+// Trilinear interpolation (LinearInterpolateImageFunction).
+struct LinearKernel
+{
+  static const unsigned int Radius = 1;
+
+  template< typename TReal >
+  static void ComputeWeights( TReal distance, TReal weights[2] )
+    {
+    weights[0] = TReal( 1 ) - distance;
+    weights[1] = distance;
+    }
+
+#if defined( __AVX2__ )
+  static void ComputeWeights( __m256 distance, __m256 weights[2] )
+    {
+    weights[0] = _mm256_sub_ps( _mm256_set1_ps( 1.0f ), distance );
+    weights[1] = distance;
+    }
+#endif
+};
+
+// Nearest neighbor as a 2-tap kernel (halves rounded up, as in ITK), so
+// label maps can go through the deformable resamplers unmixed.
+struct NearestKernel
+{
+  static const unsigned int Radius = 1;
+
+  template< typename TReal >
+  static void ComputeWeights( TReal distance, TReal weights[2] )
+    {
+    weights[1] = distance >= TReal( 0.5 ) ? TReal( 1 ) : TReal( 0 );
+    weights[0] = TReal( 1 ) - weights[1];
+    }
+
+#if defined( __AVX2__ )
+  static void ComputeWeights( __m256 distance, __m256 weights[2] )
+    {
+    weights[1] = _mm256_and_ps( _mm256_cmp_ps( distance, _mm256_set1_ps( 0.5f ), _CMP_GE_OQ ),
+                                _mm256_set1_ps( 1.0f ) );
+    weights[0] = _mm256_sub_ps( _mm256_set1_ps( 1.0f ), weights[1] );
+    }
+#endif
+};
+
+// Keys cubic convolution with a = -0.5 (Catmull-Rom): interpolating, no
+// prefilter, 4 taps per axis. Overshoot at edges is clamped on output.
+struct CubicKernel
+{
+  static const unsigned int Radius = 2;
+
+  template< typename TReal >
+  static void ComputeWeights( TReal d, TReal weights[4] )
+    {
+    const TReal d2 = d * d;
+    const TReal d3 = d2 * d;
+    weights[0] = TReal( -0.5 ) * d3 + d2 - TReal( 0.5 ) * d;
+    weights[1] = TReal( 1.5 ) * d3 - TReal( 2.5 ) * d2 + TReal( 1 );
+    weights[2] = TReal( -1.5 ) * d3 + TReal( 2 ) * d2 + TReal( 0.5 ) * d;
+    weights[3] = TReal( 0.5 ) * d3 - TReal( 0.5 ) * d2;
+    }
+
+#if defined( __AVX2__ )
+  static void ComputeWeights( __m256 d, __m256 weights[4] )
+    {
+    const __m256 d2 = _mm256_mul_ps( d, d );
+    const __m256 d3 = _mm256_mul_ps( d2, d );
+    const __m256 half = _mm256_set1_ps( 0.5f );
+    weights[0] = _mm256_sub_ps( d2, _mm256_mul_ps( half, _mm256_add_ps( d3, d ) ) );
+    weights[1] = _mm256_add_ps( _mm256_sub_ps( _mm256_mul_ps( _mm256_set1_ps( 1.5f ), d3 ),
+                                               _mm256_mul_ps( _mm256_set1_ps( 2.5f ), d2 ) ),
+                                _mm256_set1_ps( 1.0f ) );
+    weights[2] = _mm256_add_ps( _mm256_sub_ps( _mm256_add_ps( d2, d2 ), _mm256_mul_ps( _mm256_set1_ps( 1.5f ), d3 ) ),
+                                _mm256_mul_ps( half, d ) );
+    weights[3] = _mm256_mul_ps( half, _mm256_sub_ps( d3, d2 ) );
+    }
+#endif
+};
+
+// The Hamming-windowed sinc of WindowedSincResampler (radius 3).
+struct SincKernel
+{
+  static const unsigned int Radius = 3;
+
+  template< typename TReal >
+  static void ComputeWeights( TReal distance, TReal weights[6] )
+    {
+    double w[6];
+    WindowedSincResampler< unsigned char, Radius >::ComputeWeights( static_cast< double >( distance ), w );
+    for( unsigned int i = 0; i < 6; i++ )
+      {
+      weights[i] = static_cast< TReal >( w[i] );
+      }
+    }
+
+#if defined( __AVX2__ )
+  // No vector sin/cos: the weights are evaluated lane by lane.
+  static void ComputeWeights( __m256 distance, __m256 weights[6] )
+    {
+    float d[8];
+    float w[6][8];
+    _mm256_storeu_ps( d, distance );
+    for( unsigned int lane = 0; lane < 8; lane++ )
+      {
+      float laneWeights[6];
+      ComputeWeights( d[lane], laneWeights );
+      for( unsigned int i = 0; i < 6; i++ )
+        {
+        w[i][lane] = laneWeights[i];
+        }
+      }
+    for( unsigned int i = 0; i < 6; i++ )
+      {
+      weights[i] = _mm256_loadu_ps( w[i] );
+      }
+    }
+#endif
+};
+
+// Resamples out[first ... last) of row (j, k) where every position is
+// interior; returns the first voxel it did not write. The generic version
+// writes nothing and leaves the row to the scalar loop.
+template< typename TKernel, typename TPixel, typename TReal >
+inline std::size_t ResampleInteriorSimd( const TPixel *, const std::size_t [3], const IndexMapping &,
+                                         std::size_t, std::size_t, std::size_t first, std::size_t,
+                                         TPixel *, const OutputThreshold &, TReal )
+{
+  return first;
+}
+
+#if defined( __AVX2__ )
+// Eight voxels per step: positions in float, one 32-bit gather per row of
+// taps (covering four neighboring bytes), weights and sums in float. The
+// gathers read up to three bytes past the last tap, so the caller keeps
+// one plane of margin at the end of the buffer.
+template< typename TKernel >
+inline std::size_t ResampleInteriorSimd( const unsigned char * input, const std::size_t inputSize[3],
+                                         const IndexMapping & mapping, std::size_t j, std::size_t k,
+                                         std::size_t first, std::size_t last, unsigned char * out,
+                                         const OutputThreshold & threshold, float )
+{
+  const unsigned int windowSize = 2 * TKernel::Radius;
+  if( inputSize[0] * inputSize[1] * inputSize[2] >= static_cast< std::size_t >( std::numeric_limits< int >::max() ) )
+    {
+    return first;
+    }
+  const int strides[3] = { 1, static_cast< int >( inputSize[0] ),
+                           static_cast< int >( inputSize[0] * inputSize[1] ) };
+  const __m256 lanes = _mm256_setr_ps( 0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f );
+  const __m256i byteMask = _mm256_set1_epi32( 0xFF );
+  const __m256i radiusOffset = _mm256_set1_epi32( static_cast< int >( TKernel::Radius ) - 1 );
+  const __m256 maximum = _mm256_set1_ps( 255.0f );
+  const __m256 thresholdValue = _mm256_set1_ps( static_cast< float >( threshold.Threshold ) );
+  const __m256 insideValue = _mm256_set1_ps( static_cast< float >( threshold.InsideValue ) );
+  const __m256 outsideValue = _mm256_set1_ps( static_cast< float >( threshold.OutsideValue ) );
+  __m256 steps[3];
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    steps[d] = _mm256_set1_ps( static_cast< float >( mapping.Matrix[d][0] ) );
+    }
+  const double dj = static_cast< double >( j );
+  const double dk = static_cast< double >( k );
+
+  std::size_t i = first;
+  for( ; i + 8 <= last; i += 8 )
+    {
+    double c[3];
+    mapping.Map( static_cast< double >( i ), dj, dk, c );
+    __m256 weights[3][windowSize];
+    __m256i base = _mm256_setzero_si256();
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      const __m256 position = _mm256_add_ps( _mm256_set1_ps( static_cast< float >( c[d] ) ),
+                                             _mm256_mul_ps( lanes, steps[d] ) );
+      const __m256 whole = _mm256_floor_ps( position );
+      TKernel::ComputeWeights( _mm256_sub_ps( position, whole ), weights[d] );
+      const __m256i index = _mm256_sub_epi32( _mm256_cvttps_epi32( whole ), radiusOffset );
+      base = _mm256_add_epi32( base, _mm256_mullo_epi32( index, _mm256_set1_epi32( strides[d] ) ) );
+      }
+
+    __m256 value = _mm256_setzero_ps();
+    for( unsigned int kz = 0; kz < windowSize; kz++ )
+      {
+      __m256 plane = _mm256_setzero_ps();
+      for( unsigned int ky = 0; ky < windowSize; ky++ )
+        {
+        const __m256i offsets = _mm256_add_epi32( base, _mm256_set1_epi32( static_cast< int >( kz ) * strides[2]
+                                                                           + static_cast< int >( ky ) * strides[1] ) );
+        __m256 row = _mm256_setzero_ps();
+        __m256i gathered = _mm256_setzero_si256();
+        for( unsigned int kx = 0; kx < windowSize; kx++ )
+          {
+          if( kx % 4 == 0 )
+            {
+            gathered = _mm256_i32gather_epi32( reinterpret_cast< const int * >( input + kx ), offsets, 1 );
+            }
+          const __m256i tap = _mm256_and_si256( _mm256_srlv_epi32( gathered, _mm256_set1_epi32( 8 * ( kx % 4 ) ) ),
+                                                byteMask );
+          row = _mm256_add_ps( row, _mm256_mul_ps( weights[0][kx], _mm256_cvtepi32_ps( tap ) ) );
+          }
+        plane = _mm256_add_ps( plane, _mm256_mul_ps( weights[1][ky], row ) );
+        }
+      value = _mm256_add_ps( value, _mm256_mul_ps( weights[2][kz], plane ) );
+      }
+
+    if( threshold.Enabled )
+      {
+      value = _mm256_blendv_ps( outsideValue, insideValue, _mm256_cmp_ps( value, thresholdValue, _CMP_GE_OQ ) );
+      }
+    else
+      {
+      // ClampCast: clamp to [0, 255] and truncate.
+      value = _mm256_min_ps( _mm256_max_ps( value, _mm256_setzero_ps() ), maximum );
+      }
+    int result[8];
+    _mm256_storeu_si256( reinterpret_cast< __m256i * >( result ), _mm256_cvttps_epi32( value ) );
+    for( unsigned int lane = 0; lane < 8; lane++ )
+      {
+      out[i + lane] = static_cast< unsigned char >( result[lane] );
+      }
+    }
+  return i;
+}
+#endif
+
+template< typename TPixel, typename TKernel, typename TReal = double >
+class SeparableKernelResampler
+{
+public:
+  static const unsigned int Radius = TKernel::Radius;
+  static const unsigned int WindowSize = 2 * Radius;
+
+  SeparableKernelResampler()
+    : m_Input( 0 ), m_Output( 0 ), m_DefaultPixelValue( 0 ),
+      m_NumberOfThreads( std::thread::hardware_concurrency() )
+    {
+    m_InputSize[0] = m_InputSize[1] = m_InputSize[2] = 0;
+    m_OutputSize[0] = m_OutputSize[1] = m_OutputSize[2] = 0;
+    SetIdentity( m_Mapping.Matrix );
+    m_Mapping.Offset[0] = m_Mapping.Offset[1] = m_Mapping.Offset[2] = 0.0;
+    }
+
+  void SetInput( const TPixel * buffer, const std::size_t size[3] )
+    {
+    m_Input = buffer;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_InputSize[d] = size[d];
+      }
+    }
+
+  void SetOutput( TPixel * buffer, const std::size_t size[3] )
+    {
+    m_Output = buffer;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_OutputSize[d] = size[d];
+      }
+    }
+
+  void SetIndexMapping( const IndexMapping & mapping ) { m_Mapping = mapping; }
+  void SetDefaultPixelValue( TPixel value ) { m_DefaultPixelValue = value; }
+  void SetOutputThreshold( const OutputThreshold & threshold ) { m_Threshold = threshold; }
+  void SetNumberOfThreads( unsigned int threads ) { m_NumberOfThreads = threads > 0 ? threads : 1; }
+
+  void Update()
+    {
+    RowFunctor functor( this );
+    ParallelFor( 0, m_OutputSize[1] * m_OutputSize[2], 16, m_NumberOfThreads, functor );
+    }
+
+  // The interpolated value at continuous input index c, for resamplers
+  // that compute their own positions (see {BSplineDeformation.h}); only
+  // SetInput() is needed. Returns false if c lies outside the input.
+  bool EvaluateAt( const double c[3], TReal & value ) const
+    {
+    bool interior = true;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      if( !( c[d] >= -0.5 && c[d] < static_cast< double >( m_InputSize[d] ) - 0.5 ) )
+        {
+        return false;
+        }
+      interior = interior && c[d] >= Radius - 1.0 && c[d] < static_cast< double >( m_InputSize[d] ) - Radius;
+      }
+    value = interior ? EvaluateInterior( c ) : EvaluateGuarded( c );
+    return true;
+    }
+
+private:
+  struct RowFunctor
+  {
+    explicit RowFunctor( const SeparableKernelResampler * self ) : m_Self( self ) {}
+
+    void operator()( std::size_t first, std::size_t last, unsigned int ) const
+      {
+      for( std::size_t row = first; row < last; row++ )
+        {
+        m_Self->ResampleRow( row % m_Self->m_OutputSize[1], row / m_Self->m_OutputSize[1] );
+        }
+      }
+
+    const SeparableKernelResampler * m_Self;
+  };
+
+  void ComputeWeights( const double c[3], TReal weights[3][WindowSize], std::ptrdiff_t first[3] ) const
+    {
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      const double b = std::floor( c[d] );
+      first[d] = static_cast< std::ptrdiff_t >( b ) - static_cast< std::ptrdiff_t >( Radius - 1 );
+      TKernel::ComputeWeights( static_cast< TReal >( c[d] - b ), weights[d] );
+      }
+    }
+
+  TReal EvaluateInterior( const double c[3] ) const
+    {
+    TReal weights[3][WindowSize];
+    std::ptrdiff_t first[3];
+    ComputeWeights( c, weights, first );
+    const std::ptrdiff_t strideY = static_cast< std::ptrdiff_t >( m_InputSize[0] );
+    const std::ptrdiff_t strideZ = strideY * static_cast< std::ptrdiff_t >( m_InputSize[1] );
+    const TPixel * pz = m_Input + first[2] * strideZ + first[1] * strideY + first[0];
+
+    TReal value = 0;
+    for( unsigned int kz = 0; kz < WindowSize; kz++, pz += strideZ )
+      {
+      const TPixel * py = pz;
+      TReal plane = 0;
+      for( unsigned int ky = 0; ky < WindowSize; ky++, py += strideY )
+        {
+        TReal row = 0;
+        for( unsigned int kx = 0; kx < WindowSize; kx++ )
+          {
+          row += weights[0][kx] * static_cast< TReal >( py[kx] );
+          }
+        plane += weights[1][ky] * row;
+        }
+      value += weights[2][kz] * plane;
+      }
+    return value;
+    }
+
+  TReal EvaluateGuarded( const double c[3] ) const
+    {
+    TReal weights[3][WindowSize];
+    std::ptrdiff_t first[3];
+    ComputeWeights( c, weights, first );
+    std::size_t taps[3][WindowSize];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      const std::ptrdiff_t last = static_cast< std::ptrdiff_t >( m_InputSize[d] ) - 1;
+      for( unsigned int i = 0; i < WindowSize; i++ )
+        {
+        std::ptrdiff_t index = first[d] + static_cast< std::ptrdiff_t >( i );
+        index = index < 0 ? 0 : ( index > last ? last : index );
+        taps[d][i] = static_cast< std::size_t >( index );
+        }
+      }
+    const std::size_t strideY = m_InputSize[0];
+    const std::size_t strideZ = strideY * m_InputSize[1];
+
+    TReal value = 0;
+    for( unsigned int kz = 0; kz < WindowSize; kz++ )
+      {
+      TReal plane = 0;
+      for( unsigned int ky = 0; ky < WindowSize; ky++ )
+        {
+        const TPixel * row = m_Input + taps[2][kz] * strideZ + taps[1][ky] * strideY;
+        TReal sum = 0;
+        for( unsigned int kx = 0; kx < WindowSize; kx++ )
+          {
+          sum += weights[0][kx] * static_cast< TReal >( row[taps[0][kx]] );
+          }
+        plane += weights[1][ky] * sum;
+        }
+      value += weights[2][kz] * plane;
+      }
+    return value;
+    }
+
+  void ResampleRow( std::size_t j, std::size_t k ) const
+    {
+    const std::size_t length = m_OutputSize[0];
+    TPixel * out = m_Output + ( k * m_OutputSize[1] + j ) * length;
+
+    double insideLower[3];
+    double insideUpper[3];
+    double interiorLower[3];
+    double interiorUpper[3];
+    // Interior positions kept clear of the float rounding of the vector
+    // path and of the bytes its gathers read past the last tap.
+    double vectorLower[3];
+    double vectorUpper[3];
+    const double margin = 1e-3;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      insideLower[d] = -0.5;
+      insideUpper[d] = static_cast< double >( m_InputSize[d] ) - 0.5;
+      interiorLower[d] = Radius - 1.0;
+      interiorUpper[d] = static_cast< double >( m_InputSize[d] ) - Radius;
+      vectorLower[d] = interiorLower[d] + margin;
+      vectorUpper[d] = interiorUpper[d] - margin - ( d == 2 ? 1.0 : 0.0 );
+      }
+
+    std::size_t insideFirst;
+    std::size_t insideLast;
+    ComputeRowSpan( m_Mapping, j, k, length, insideLower, insideUpper, insideFirst, insideLast );
+    std::size_t interiorFirst;
+    std::size_t interiorLast;
+    ComputeRowSpan( m_Mapping, j, k, length, interiorLower, interiorUpper, interiorFirst, interiorLast );
+    if( interiorFirst == interiorLast )
+      {
+      interiorFirst = interiorLast = insideLast;
+      }
+    std::size_t vectorFirst;
+    std::size_t vectorLast;
+    ComputeRowSpan( m_Mapping, j, k, length, vectorLower, vectorUpper, vectorFirst, vectorLast );
+    if( vectorFirst >= vectorLast || vectorFirst < interiorFirst || vectorLast > interiorLast )
+      {
+      vectorFirst = vectorLast = interiorLast;
+      }
+
+    const double dj = static_cast< double >( j );
+    const double dk = static_cast< double >( k );
+    double c[3];
+    std::size_t i = 0;
+    for( ; i < insideFirst; i++ )
+      {
+      out[i] = m_DefaultPixelValue;
+      }
+    for( ; i < interiorFirst; i++ )
+      {
+      m_Mapping.Map( static_cast< double >( i ), dj, dk, c );
+      out[i] = m_Threshold.Apply< TPixel >( static_cast< double >( EvaluateGuarded( c ) ) );
+      }
+    for( ; i < vectorFirst; i++ )
+      {
+      m_Mapping.Map( static_cast< double >( i ), dj, dk, c );
+      out[i] = m_Threshold.Apply< TPixel >( static_cast< double >( EvaluateInterior( c ) ) );
+      }
+    i = ResampleInteriorSimd< TKernel >( m_Input, m_InputSize, m_Mapping, j, k, i, vectorLast, out, m_Threshold,
+                                        TReal( 0 ) );
+    for( ; i < interiorLast; i++ )
+      {
+      m_Mapping.Map( static_cast< double >( i ), dj, dk, c );
+      out[i] = m_Threshold.Apply< TPixel >( static_cast< double >( EvaluateInterior( c ) ) );
+      }
+    for( ; i < insideLast; i++ )
+      {
+      m_Mapping.Map( static_cast< double >( i ), dj, dk, c );
+      out[i] = m_Threshold.Apply< TPixel >( static_cast< double >( EvaluateGuarded( c ) ) );
+      }
+    for( ; i < length; i++ )
+      {
+      out[i] = m_DefaultPixelValue;
+      }
+    }
+
+  const TPixel *  m_Input;
+  TPixel *        m_Output;
+  std::size_t     m_InputSize[3];
+  std::size_t     m_OutputSize[3];
+  IndexMapping    m_Mapping;
+  TPixel          m_DefaultPixelValue;
+  OutputThreshold m_Threshold;
+  unsigned int    m_NumberOfThreads;
+};
+
+// Resamples `input` into `output` through `mapping` with TKernel in TReal
+// arithmetic; voxels that map outside the input are set to 0 (or to the
+// thresholded 0).
+template< typename TKernel, typename TReal, typename TPixel >
+void ResampleWithKernel( const TPixel * input, const std::size_t inputSize[3],
+                         TPixel * output, const std::size_t outputSize[3],
+                         const IndexMapping & mapping, unsigned int numberOfThreads,
+                         const OutputThreshold & threshold = OutputThreshold() )
+{
+  SeparableKernelResampler< TPixel, TKernel, TReal > resampler;
+  resampler.SetInput( input, inputSize );
+  resampler.SetOutput( output, outputSize );
+  resampler.SetIndexMapping( mapping );
+  resampler.SetDefaultPixelValue( threshold.Apply< TPixel >( 0.0 ) );
+  resampler.SetOutputThreshold( threshold );
+  resampler.SetNumberOfThreads( numberOfThreads );
+  resampler.Update();
+}
+
+#endif
@@ -0,0 +1,693 @@
+// AUTHOR: Christian McDaniel
+//
+// Rotation by a sequence of 1D shears (Paeth/Unser). The rotation, expressed
+// in the grid-aligned frame, is split into Euler rotations about x, y and z;
+// each of those is a 2D rotation that Paeth's identity writes as three
+// shears along a single axis:
+//
+//   [ c -s ]   [ 1 a ] [ 1 0 ] [ 1 a ]
+//   [ s  c ] = [ 0 1 ] [ b 1 ] [ 0 1 ],   a = -tan(theta/2), b = sin(theta)
+//
+// (scaled by the voxel spacing ratios for anisotropic grids). A shear moves
+// every line along its axis by a constant amount, so one set of 1D sinc
+// weights serves a whole line and each pass is a streaming 1D resampling.
+// The translation part of the mapping is folded into the shifts of the
+// first passes. A single-axis rotation costs three 6-tap passes instead of
+// one 216-tap 3D sinc per voxel.
+
+#ifndef ShearRotationResampler_h
+#define ShearRotationResampler_h
+
+#include <cmath>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include "ParallelFor.h"
+#include "ResampleGeometry.h"
+#include "WindowedSincResampler.h"
+
+// One unit-diagonal shear pass: along Axis, the source position of voxel q is
+// q[Axis] + sum_j Coefficients[j] * q[j] + Shift (Coefficients[Axis] == 0).
+struct ShearPass
+{
+  unsigned int Axis;
+  double       Coefficients[3];
+  double       Shift;
+};
+
+template< typename TPixel, unsigned int VRadius = 3 >
+class ShearRotationResampler
+{
+public:
+  static const unsigned int WindowSize = 2 * VRadius;
+
+  ShearRotationResampler()
+    : m_Input( 0 ), m_Output( 0 ),
+      m_NumberOfThreads( std::thread::hardware_concurrency() )
+    {
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_InputSize[d] = m_OutputSize[d] = 0;
+      m_Spacing[d] = 1.0;
+      }
+    }
+
+  void SetInput( const TPixel * buffer, const std::size_t size[3] )
+    {
+    m_Input = buffer;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_InputSize[d] = size[d];
+      }
+    }
+
+  void SetOutput( TPixel * buffer, const std::size_t size[3] )
+    {
+    m_Output = buffer;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_OutputSize[d] = size[d];
+      }
+    }
+
+  void SetNumberOfThreads( unsigned int threads ) { m_NumberOfThreads = threads > 0 ? threads : 1; }
+
+  // Applied to the values of the last pass, as in WindowedSincResampler.
+  void SetOutputThreshold( const OutputThreshold & threshold ) { m_Threshold = threshold; }
+
+  const std::vector< ShearPass > & GetPasses() const { return m_Passes; }
+
+  // Decomposes the index mapping of a rotation between two grids that share
+  // spacing and direction. Returns false (and leaves the engine unusable) if
+  // the mapping is not a proper rotation in the grid-aligned frame.
+  bool SetIndexMapping( const IndexMapping & mapping, const double spacing[3] )
+    {
+    m_Passes.clear();
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      m_Spacing[d] = spacing[d];
+      }
+
+    // Rotation in the grid-aligned physical frame: R = S A S^-1.
+    double rotation[3][3];
+    for( unsigned int i = 0; i < 3; i++ )
+      {
+      for( unsigned int j = 0; j < 3; j++ )
+        {
+        rotation[i][j] = spacing[i] * mapping.Matrix[i][j] / spacing[j];
+        }
+      }
+    for( unsigned int i = 0; i < 3; i++ )
+      {
+      for( unsigned int j = 0; j < 3; j++ )
+        {
+        const double dot = rotation[0][i] * rotation[0][j] + rotation[1][i] * rotation[1][j]
+                         + rotation[2][i] * rotation[2][j];
+        if( std::fabs( dot - ( i == j ? 1.0 : 0.0 ) ) > 1e-6 )
+          {
+          return false;
+          }
+        }
+      }
+    if( Determinant( rotation ) < 0.0 )
+      {
+      return false;
+      }
+
+    // R = Rx(alpha) Ry(beta) Rz(gamma).
+    double alpha;
+    double beta;
+    double gamma;
+    const double sinBeta = std::max( -1.0, std::min( 1.0, rotation[0][2] ) );
+    beta = std::asin( sinBeta );
+    if( std::fabs( sinBeta ) < 1.0 - 1e-12 )
+      {
+      alpha = std::atan2( -rotation[1][2], rotation[2][2] );
+      gamma = std::atan2( -rotation[0][1], rotation[0][0] );
+      }
+    else
+      {
+      alpha = std::atan2( rotation[2][1], rotation[1][1] );
+      gamma = 0.0;
+      }
+
+    std::vector< ShearPass > passes;
+    AppendPlaneRotation( 1, 2, alpha, passes );
+    AppendPlaneRotation( 2, 0, beta, passes );
+    AppendPlaneRotation( 0, 1, gamma, passes );
+    FoldTranslation( mapping.Offset, passes );
+    m_Passes = passes;
+    return true;
+    }
+
+  void Update()
+    {
+    const std::size_t numberOfPasses = m_Passes.size();
+
+    // Box of each intermediate image: what the following passes read
+    // (worked out backwards from the output box), clipped to where the
+    // image can be nonzero at all (the input box carried forward through
+    // the passes done so far). Without the clipping, the shears of a
+    // general 3D rotation would compound into needlessly large boxes.
+    std::vector< Box > boxes( numberOfPasses + 1 );
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      boxes[numberOfPasses].Start[d] = 0;
+      boxes[numberOfPasses].Size[d] = m_OutputSize[d];
+      boxes[0].Start[d] = 0;
+      boxes[0].Size[d] = m_InputSize[d];
+      }
+    for( std::size_t i = numberOfPasses; i > 1; i-- )
+      {
+      boxes[i - 1] = Intersect( SourceBox( m_Passes[i - 1], boxes[i] ), ReachableBox( i - 1 ) );
+      }
+
+    std::vector< float > ping;
+    std::vector< float > pong;
+    const float * source = 0;
+    for( std::size_t i = 1; i <= numberOfPasses; i++ )
+      {
+      const bool last = ( i == numberOfPasses );
+      std::vector< float > & target = ( i % 2 ) ? ping : pong;
+      if( !last )
+        {
+        target.assign( boxes[i].GetNumberOfPixels(), 0.0f );
+        }
+      if( i == 1 )
+        {
+        if( last )
+          {
+          RunPass( m_Input, true, boxes[0], m_Output, boxes[1], m_Passes[0], m_Threshold );
+          }
+        else
+          {
+          RunPass( m_Input, true, boxes[0], &target[0], boxes[1], m_Passes[0] );
+          }
+        }
+      else
+        {
+        if( last )
+          {
+          RunPass( source, false, boxes[i - 1], m_Output, boxes[i], m_Passes[i - 1], m_Threshold );
+          }
+        else
+          {
+          RunPass( source, false, boxes[i - 1], &target[0], boxes[i], m_Passes[i - 1] );
+          }
+        }
+      source = last ? 0 : &target[0];
+      }
+    }
+
+private:
+  struct Box
+  {
+    long        Start[3];
+    std::size_t Size[3];
+
+    std::size_t GetNumberOfPixels() const { return Size[0] * Size[1] * Size[2]; }
+  };
+
+  // Paeth decomposition of a rotation by theta in the (u, v) plane, in index
+  // units. Rotations beyond 90 degrees are split in two to keep the shear
+  // factors bounded.
+  void AppendPlaneRotation( unsigned int u, unsigned int v, double theta,
+                            std::vector< ShearPass > & passes ) const
+    {
+    const double pi = 3.14159265358979323846;
+    if( std::fabs( theta ) < 1e-12 )
+      {
+      return;
+      }
+    if( std::fabs( theta ) > pi / 2.0 )
+      {
+      AppendPlaneRotation( u, v, theta / 2.0, passes );
+      AppendPlaneRotation( u, v, theta / 2.0, passes );
+      return;
+      }
+    const double a = -std::tan( theta / 2.0 ) * m_Spacing[v] / m_Spacing[u];
+    const double b = std::sin( theta ) * m_Spacing[u] / m_Spacing[v];
+    passes.push_back( MakePass( u, v, a ) );
+    passes.push_back( MakePass( v, u, b ) );
+    passes.push_back( MakePass( u, v, a ) );
+    }
+
+  static ShearPass MakePass( unsigned int axis, unsigned int other, double coefficient )
+    {
+    ShearPass pass;
+    pass.Axis = axis;
+    pass.Coefficients[0] = pass.Coefficients[1] = pass.Coefficients[2] = 0.0;
+    pass.Coefficients[other] = coefficient;
+    pass.Shift = 0.0;
+    return pass;
+    }
+
+  // Distributes the mapping offset over the shifts of passes whose
+  // directions (as seen from the input) are independent, adding pure
+  // translation passes in front for axes no pass covers.
+  static void FoldTranslation( const double offset[3], std::vector< ShearPass > & passes )
+    {
+    // direction[i] = F_1 ... F_{i-1} e_{axis_i}
+    std::vector< std::size_t > chosen;
+    double basis[3][3];
+    double product[3][3];
+    SetIdentity( product );
+    for( std::size_t i = 0; i < passes.size() && chosen.size() < 3; i++ )
+      {
+      double direction[3];
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        direction[d] = product[d][passes[i].Axis];
+        }
+      if( IsIndependent( basis, chosen.size(), direction ) )
+        {
+        for( unsigned int d = 0; d < 3; d++ )
+          {
+          basis[d][chosen.size()] = direction[d];
+          }
+        chosen.push_back( i );
+        }
+      double factor[3][3];
+      GetPassMatrix( passes[i], factor );
+      MultiplyMatrices( product, factor, product );
+      }
+
+    // Translation passes go first, so their direction is the bare axis.
+    std::vector< ShearPass > front;
+    for( unsigned int axis = 0; axis < 3 && chosen.size() + front.size() < 3; axis++ )
+      {
+      double direction[3] = { 0.0, 0.0, 0.0 };
+      direction[axis] = 1.0;
+      const std::size_t column = chosen.size() + front.size();
+      if( IsIndependent( basis, column, direction ) )
+        {
+        for( unsigned int d = 0; d < 3; d++ )
+          {
+          basis[d][column] = direction[d];
+          }
+        ShearPass pass = MakePass( axis, axis, 0.0 );
+        front.push_back( pass );
+        }
+      }
+
+    double inverse[3][3];
+    InvertMatrix( basis, inverse );
+    double shifts[3];
+    MultiplyMatrixVector( inverse, offset, shifts );
+    for( std::size_t c = 0; c < chosen.size(); c++ )
+      {
+      passes[chosen[c]].Shift = shifts[c];
+      }
+    for( std::size_t c = 0; c < front.size(); c++ )
+      {
+      front[c].Shift = shifts[chosen.size() + c];
+      }
+    passes.insert( passes.begin(), front.begin(), front.end() );
+    }
+
+  static bool IsIndependent( const double basis[3][3], std::size_t columns, const double direction[3] )
+    {
+    double test[3][3];
+    SetIdentity( test );
+    for( std::size_t c = 0; c < columns; c++ )
+      {
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        test[d][c] = basis[d][c];
+        }
+      }
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      test[d][columns] = direction[d];
+      }
+    // Fill the remaining columns with the axes that best complete the set.
+    double best = 0.0;
+    for( unsigned int a = 0; a < 3; a++ )
+      {
+      for( unsigned int b = 0; b < 3; b++ )
+        {
+        double candidate[3][3];
+        for( unsigned int i = 0; i < 3; i++ )
+          {
+          for( unsigned int j = 0; j < 3; j++ )
+            {
+            candidate[i][j] = test[i][j];
+            }
+          }
+        if( columns + 1 < 3 )
+          {
+          for( unsigned int d = 0; d < 3; d++ )
+            {
+            candidate[d][columns + 1] = ( d == a ) ? 1.0 : 0.0;
+            }
+          }
+        if( columns + 2 < 3 )
+          {
+          for( unsigned int d = 0; d < 3; d++ )
+            {
+            candidate[d][columns + 2] = ( d == b ) ? 1.0 : 0.0;
+            }
+          }
+        best = std::max( best, std::fabs( Determinant( candidate ) ) );
+        }
+      }
+    return best > 1e-6;
+    }
+
+  static void GetPassMatrix( const ShearPass & pass, double matrix[3][3] )
+    {
+    SetIdentity( matrix );
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      if( d != pass.Axis )
+        {
+        matrix[pass.Axis][d] = pass.Coefficients[d];
+        }
+      }
+    }
+
+  // Bounding box of the voxels of the image after `count` passes that can
+  // see the input, i.e. whose position after the first `count` passes
+  // lands within the input box grown by the kernel spread so far.
+  Box ReachableBox( std::size_t count ) const
+    {
+    double product[3][3];
+    double offset[3] = { 0.0, 0.0, 0.0 };
+    SetIdentity( product );
+    for( std::size_t i = 0; i < count; i++ )
+      {
+      double step[3] = { 0.0, 0.0, 0.0 };
+      step[m_Passes[i].Axis] = m_Passes[i].Shift;
+      double moved[3];
+      MultiplyMatrixVector( product, step, moved );
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        offset[d] += moved[d];
+        }
+      double factor[3][3];
+      GetPassMatrix( m_Passes[i], factor );
+      MultiplyMatrices( product, factor, product );
+      }
+    double inverse[3][3];
+    InvertMatrix( product, inverse );
+
+    const double margin = static_cast< double >( VRadius * ( count + 1 ) );
+    double lower[3];
+    double upper[3];
+    for( unsigned int corner = 0; corner < 8; corner++ )
+      {
+      double point[3];
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        point[d] = ( ( corner & ( 1u << d ) ) ? static_cast< double >( m_InputSize[d] ) - 1.0 + margin : -margin )
+                 - offset[d];
+        }
+      MultiplyMatrixVector( inverse, point, point );
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        lower[d] = ( corner == 0 ) ? point[d] : std::min( lower[d], point[d] );
+        upper[d] = ( corner == 0 ) ? point[d] : std::max( upper[d], point[d] );
+        }
+      }
+    Box box;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      box.Start[d] = static_cast< long >( std::floor( lower[d] - margin ) );
+      box.Size[d] = static_cast< std::size_t >( static_cast< long >( std::ceil( upper[d] + margin ) ) - box.Start[d] + 1 );
+      }
+    return box;
+    }
+
+  // Overlap of two boxes; never empty, so buffers stay addressable.
+  static Box Intersect( const Box & a, const Box & b )
+    {
+    Box box;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      const long start = std::max( a.Start[d], b.Start[d] );
+      const long end = std::min( a.Start[d] + static_cast< long >( a.Size[d] ),
+                                 b.Start[d] + static_cast< long >( b.Size[d] ) );
+      box.Start[d] = start;
+      box.Size[d] = end > start ? static_cast< std::size_t >( end - start ) : 1;
+      }
+    return box;
+    }
+
+  // Extent along the pass axis that the pass reads to fill `target`.
+  static Box SourceBox( const ShearPass & pass, const Box & target )
+    {
+    double minimum = 0.0;
+    double maximum = 0.0;
+    for( unsigned int corner = 0; corner < 8; corner++ )
+      {
+      double shift = pass.Shift;
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        const long position = ( corner & ( 1u << d ) )
+          ? target.Start[d] + static_cast< long >( target.Size[d] ) - 1 : target.Start[d];
+        shift += ( d == pass.Axis ? 1.0 : pass.Coefficients[d] ) * static_cast< double >( position );
+        }
+      if( corner == 0 || shift < minimum )
+        {
+        minimum = shift;
+        }
+      if( corner == 0 || shift > maximum )
+        {
+        maximum = shift;
+        }
+      }
+    Box source = target;
+    source.Start[pass.Axis] = static_cast< long >( std::floor( minimum ) ) - static_cast< long >( VRadius - 1 );
+    const long end = static_cast< long >( std::floor( maximum ) ) + static_cast< long >( VRadius ) + 1;
+    source.Size[pass.Axis] = static_cast< std::size_t >( end - source.Start[pass.Axis] );
+    return source;
+    }
+
+  // Line shift split into an integer part and sinc weights for the fraction.
+  static void LineWeights( double shift, long & whole, double weights[WindowSize] )
+    {
+    double base = std::floor( shift );
+    double fraction = shift - base;
+    if( fraction < 1e-9 )
+      {
+      fraction = 0.0;
+      }
+    else if( fraction > 1.0 - 1e-9 )
+      {
+      base += 1.0;
+      fraction = 0.0;
+      }
+    whole = static_cast< long >( base );
+    WindowedSincResampler< TPixel, VRadius >::ComputeWeights( fraction, weights );
+    }
+
+  template< typename TSource, typename TTarget >
+  struct PassFunctor
+  {
+    const TSource *   m_Source;
+    bool              m_SourceIsInput;
+    Box               m_SourceBox;
+    TTarget *         m_Target;
+    Box               m_TargetBox;
+    ShearPass         m_Pass;
+    unsigned int      m_Outer;
+    unsigned int      m_Middle;
+    OutputThreshold   m_Threshold;
+
+    // Intermediate passes get a disabled threshold and keep the gray levels;
+    // only the last pass, which writes the output, thresholds.
+    void Store( double value, TTarget & out ) const { out = m_Threshold.Apply< TTarget >( value ); }
+
+    // Source sample along the pass axis, with the boundary rule of the
+    // stage: the real input clamps its taps (and is empty outside
+    // [-0.5, size - 0.5)), intermediate boxes are zero outside.
+    double Sample( const TSource * line, std::ptrdiff_t stride, long length,
+                   long first, const double * weights, double position ) const
+      {
+      if( m_SourceIsInput && !( position >= -0.5 && position < static_cast< double >( length ) - 0.5 ) )
+        {
+        return 0.0;
+        }
+      double value = 0.0;
+      for( unsigned int m = 0; m < WindowSize; m++ )
+        {
+        long tap = first + static_cast< long >( m );
+        if( tap < 0 || tap >= length )
+          {
+          if( !m_SourceIsInput )
+            {
+            continue;
+            }
+          tap = tap < 0 ? 0 : length - 1;
+          }
+        value += weights[m] * static_cast< double >( line[tap * stride] );
+        }
+      return value;
+      }
+
+    // Processes one target slab (fixed m_Outer coordinate). Lines along the
+    // pass axis are handled together across x, so every access in the inner
+    // loop is contiguous.
+    void operator()( std::size_t first, std::size_t last, unsigned int ) const
+      {
+      const unsigned int axis = m_Pass.Axis;
+      std::ptrdiff_t sourceStride[3];
+      std::ptrdiff_t targetStride[3];
+      sourceStride[0] = targetStride[0] = 1;
+      sourceStride[1] = static_cast< std::ptrdiff_t >( m_SourceBox.Size[0] );
+      sourceStride[2] = sourceStride[1] * static_cast< std::ptrdiff_t >( m_SourceBox.Size[1] );
+      targetStride[1] = static_cast< std::ptrdiff_t >( m_TargetBox.Size[0] );
+      targetStride[2] = targetStride[1] * static_cast< std::ptrdiff_t >( m_TargetBox.Size[1] );
+      const long sourceLength = static_cast< long >( m_SourceBox.Size[axis] );
+      const long targetLength = static_cast< long >( m_TargetBox.Size[axis] );
+
+      for( std::size_t outer = first; outer < last; outer++ )
+        {
+        const long outerPosition = m_TargetBox.Start[m_Outer] + static_cast< long >( outer );
+        const long outerSource = outerPosition - m_SourceBox.Start[m_Outer];
+        const bool outerInside = outerSource >= 0 && outerSource < static_cast< long >( m_SourceBox.Size[m_Outer] );
+
+        if( axis == 0 )
+          {
+          // Rows are contiguous; one weight set per row.
+          for( std::size_t middle = 0; middle < m_TargetBox.Size[m_Middle]; middle++ )
+            {
+            const long middlePosition = m_TargetBox.Start[m_Middle] + static_cast< long >( middle );
+            const long middleSource = middlePosition - m_SourceBox.Start[m_Middle];
+            TTarget * out = m_Target + outer * targetStride[m_Outer] + middle * targetStride[m_Middle];
+            if( !outerInside || middleSource < 0 || middleSource >= static_cast< long >( m_SourceBox.Size[m_Middle] ) )
+              {
+              for( long t = 0; t < targetLength; t++ )
+                {
+                Store( 0.0, out[t] );
+                }
+              continue;
+              }
+            const double lineShift = m_Pass.Shift + m_Pass.Coefficients[m_Outer] * outerPosition
+                                   + m_Pass.Coefficients[m_Middle] * middlePosition;
+            long whole;
+            double weights[WindowSize];
+            LineWeights( lineShift, whole, weights );
+            const TSource * line = m_Source + outerSource * sourceStride[m_Outer] + middleSource * sourceStride[m_Middle];
+            // Source index of the first tap for target t.
+            const long offset = m_TargetBox.Start[0] + whole - static_cast< long >( VRadius - 1 ) - m_SourceBox.Start[0];
+            for( long t = 0; t < targetLength; t++ )
+              {
+              const long tap = t + offset;
+              if( tap >= 0 && tap + static_cast< long >( WindowSize ) <= sourceLength )
+                {
+                const TSource * p = line + tap;
+                double value = 0.0;
+                for( unsigned int m = 0; m < WindowSize; m++ )
+                  {
+                  value += weights[m] * static_cast< double >( p[m] );
+                  }
+                Store( value, out[t] );
+                }
+              else
+                {
+                const double position = static_cast< double >( m_TargetBox.Start[0] + t ) + lineShift
+                                      - static_cast< double >( m_SourceBox.Start[0] );
+                Store( Sample( line, 1, sourceLength, tap, weights, position ), out[t] );
+                }
+              }
+            }
+          continue;
+          }
+
+        // Axis 1 or 2: lines are strided, so keep x innermost and give each
+        // x its own weight set (the shift varies with x only through the
+        // shear coefficient on x).
+        const std::size_t width = m_TargetBox.Size[0];
+        std::vector< double > weights( width * WindowSize );
+        std::vector< long > offsets( width );
+        std::vector< double > shifts( width );
+        std::vector< char > valid( width );
+        for( std::size_t x = 0; x < width; x++ )
+          {
+          const long xPosition = m_TargetBox.Start[0] + static_cast< long >( x );
+          const long xSource = xPosition - m_SourceBox.Start[0];
+          valid[x] = outerInside && xSource >= 0 && xSource < static_cast< long >( m_SourceBox.Size[0] );
+          shifts[x] = m_Pass.Shift + m_Pass.Coefficients[0] * xPosition
+                    + m_Pass.Coefficients[m_Outer] * outerPosition;
+          long whole;
+          LineWeights( shifts[x], whole, &weights[x * WindowSize] );
+          offsets[x] = m_TargetBox.Start[axis] + whole - static_cast< long >( VRadius - 1 ) - m_SourceBox.Start[axis];
+          }
+        const long xShift = m_TargetBox.Start[0] - m_SourceBox.Start[0];
+        const TSource * sourceSlab = m_Source + ( outerInside ? outerSource : 0 ) * sourceStride[m_Outer];
+        TTarget * targetSlab = m_Target + outer * targetStride[m_Outer];
+        for( long t = 0; t < targetLength; t++ )
+          {
+          TTarget * out = targetSlab + t * targetStride[axis];
+          for( std::size_t x = 0; x < width; x++ )
+            {
+            if( !valid[x] )
+              {
+              Store( 0.0, out[x] );
+              continue;
+              }
+            const TSource * column = sourceSlab + ( static_cast< long >( x ) + xShift );
+            const long tap = t + offsets[x];
+            const double * w = &weights[x * WindowSize];
+            if( tap >= 0 && tap + static_cast< long >( WindowSize ) <= sourceLength )
+              {
+              const TSource * p = column + tap * sourceStride[axis];
+              double value = 0.0;
+              for( unsigned int m = 0; m < WindowSize; m++ )
+                {
+                value += w[m] * static_cast< double >( p[m * sourceStride[axis]] );
+                }
+              Store( value, out[x] );
+              }
+            else
+              {
+              const double position = static_cast< double >( m_TargetBox.Start[axis] + t ) + shifts[x]
+                                    - static_cast< double >( m_SourceBox.Start[axis] );
+              Store( Sample( column, sourceStride[axis], sourceLength, tap, w, position ), out[x] );
+              }
+            }
+          }
+        }
+      }
+  };
+
+  template< typename TSource, typename TTarget >
+  void RunPass( const TSource * source, bool sourceIsInput, const Box & sourceBox,
+                TTarget * target, const Box & targetBox, const ShearPass & pass,
+                const OutputThreshold & threshold = OutputThreshold() ) const
+    {
+    PassFunctor< TSource, TTarget > functor;
+    functor.m_Source = source;
+    functor.m_SourceIsInput = sourceIsInput;
+    functor.m_SourceBox = sourceBox;
+    functor.m_Target = target;
+    functor.m_TargetBox = targetBox;
+    functor.m_Pass = pass;
+    functor.m_Threshold = threshold;
+    // x-passes walk (z, y) rows; y-passes walk z slabs; z-passes walk y slabs.
+    if( pass.Axis == 0 )
+      {
+      functor.m_Outer = 2;
+      functor.m_Middle = 1;
+      }
+    else
+      {
+      functor.m_Outer = ( pass.Axis == 1 ) ? 2 : 1;
+      functor.m_Middle = pass.Axis;
+      }
+    ParallelFor( 0, targetBox.Size[functor.m_Outer], 1, m_NumberOfThreads, functor );
+    }
+
+  const TPixel *            m_Input;
+  TPixel *                  m_Output;
+  std::size_t               m_InputSize[3];
+  std::size_t               m_OutputSize[3];
+  double                    m_Spacing[3];
+  unsigned int              m_NumberOfThreads;
+  std::vector< ShearPass >  m_Passes;
+  OutputThreshold           m_Threshold;
+};
+
+#endif
@@ -0,0 +1,90 @@
+// AUTHOR: Christian McDaniel
+//
+// IntegerMappingResampler against a per-voxel copy for flips, axis swaps
+// and integer translations, with outputs that crop and pad the input.
+// Nothing is interpolated, so they must agree exactly.
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "IntegerMappingResampler.h"
+#include "ResamplingTest.h"
+
+int main()
+{
+  const std::size_t inputSize[3] = { 27, 22, 17 };
+  const std::size_t outputSize[3] = { 31, 15, 24 };
+  const std::vector< unsigned char > input = MakeTestVolume( inputSize, 4 );
+  bool passed = true;
+
+  // Rows of each matrix: which output axis (and sign) feeds input axis d.
+  const double matrices[4][3][3] = {
+    { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } },
+    { { -1, 0, 0 }, { 0, 1, 0 }, { 0, 0, -1 } },
+    { { 0, 1, 0 }, { 0, 0, -1 }, { 1, 0, 0 } },
+    { { 0, 0, -1 }, { -1, 0, 0 }, { 0, 1, 0 } } };
+  const double offsets[4][3] = { { -3, 4, -2 }, { 28, 1, 20 }, { 2, 14, -5 }, { 30, 25, 3 } };
+
+  for( unsigned int m = 0; m < 4; m++ )
+    {
+    IndexMapping mapping;
+    for( unsigned int i = 0; i < 3; i++ )
+      {
+      for( unsigned int j = 0; j < 3; j++ )
+        {
+        mapping.Matrix[i][j] = matrices[m][i][j];
+        }
+      mapping.Offset[i] = offsets[m][i];
+      }
+
+    IntegerMappingResampler< unsigned char > resampler;
+    if( !resampler.SetIndexMapping( mapping ) )
+      {
+      std::cout << "FAIL copy: mapping " << m << " was not accepted" << std::endl;
+      passed = false;
+      continue;
+      }
+    std::vector< unsigned char > output( outputSize[0] * outputSize[1] * outputSize[2] );
+    resampler.SetInput( &input[0], inputSize );
+    resampler.SetOutput( &output[0], outputSize );
+    resampler.SetNumberOfThreads( 4 );
+    resampler.Update();
+
+    std::vector< unsigned char > expected( output.size() );
+    std::size_t n = 0;
+    for( std::size_t k = 0; k < outputSize[2]; k++ )
+      {
+      for( std::size_t j = 0; j < outputSize[1]; j++ )
+        {
+        for( std::size_t i = 0; i < outputSize[0]; i++, n++ )
+          {
+          double c[3];
+          mapping.Map( static_cast< double >( i ), static_cast< double >( j ), static_cast< double >( k ), c );
+          long index[3];
+          bool inside = true;
+          for( unsigned int d = 0; d < 3; d++ )
+            {
+            index[d] = static_cast< long >( std::floor( c[d] + 0.5 ) );
+            inside = inside && index[d] >= 0 && index[d] < static_cast< long >( inputSize[d] );
+            }
+          expected[n] = inside ? input[( index[2] * inputSize[1] + index[1] ) * inputSize[0] + index[0]] : 0;
+          }
+        }
+      }
+    passed = CompareVolumes( "copy against per-voxel copy", output, expected, 0 ) && passed;
+    }
+
+  // A fractional offset is not a copy.
+  IndexMapping fractional;
+  SetIdentity( fractional.Matrix );
+  fractional.Offset[0] = 0.5;
+  fractional.Offset[1] = fractional.Offset[2] = 0.0;
+  IntegerMappingResampler< unsigned char > rejected;
+  const bool accepted = rejected.SetIndexMapping( fractional );
+  std::cout << ( accepted ? "FAIL " : "PASS " ) << "copy: fractional offset rejected" << std::endl;
+  passed = passed && !accepted;
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
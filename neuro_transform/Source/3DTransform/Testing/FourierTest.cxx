@@ -0,0 +1,130 @@
+// AUTHOR: Christian McDaniel
+//
+// FourierShiftResampler against a direct evaluation of what it computes:
+// the input zero padded to the engine's padded size, shifted as a
+// periodic signal by a DFT evaluated term by term along each axis, rounded
+// and cut back to the input grid. The two must agree exactly.
+
+#include <cmath>
+#include <complex>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "FourierShiftResampler.h"
+#include "ResamplingTest.h"
+
+namespace
+{
+
+// Shifts every line of `data` along `axis` by `shift` samples, periodically.
+void ShiftLines( std::vector< std::complex< double > > & data, const std::size_t size[3], unsigned int axis,
+                 double shift )
+{
+  const double pi = 3.14159265358979323846;
+  const std::size_t length = size[axis];
+  const std::size_t stride = ( axis == 0 ) ? 1 : ( axis == 1 ? size[0] : size[0] * size[1] );
+  std::vector< std::complex< double > > line( length );
+  std::vector< std::complex< double > > spectrum( length );
+  for( std::size_t start = 0; start < data.size(); start++ )
+    {
+    if( ( start / stride ) % length != 0 )
+      {
+      continue;
+      }
+    for( std::size_t n = 0; n < length; n++ )
+      {
+      line[n] = data[start + n * stride];
+      }
+    for( std::size_t k = 0; k < length; k++ )
+      {
+      spectrum[k] = 0.0;
+      for( std::size_t n = 0; n < length; n++ )
+        {
+        spectrum[k] += line[n] * std::polar( 1.0, -2.0 * pi * static_cast< double >( k * n % length ) / length );
+        }
+      // The same factor as the engine, including the real one at Nyquist.
+      if( length % 2 == 0 && k == length / 2 )
+        {
+        spectrum[k] *= std::cos( pi * shift );
+        }
+      else
+        {
+        const double frequency = ( k <= length / 2 ) ? static_cast< double >( k )
+                                                     : static_cast< double >( k ) - static_cast< double >( length );
+        spectrum[k] *= std::polar( 1.0, 2.0 * pi * frequency * shift / length );
+        }
+      }
+    for( std::size_t n = 0; n < length; n++ )
+      {
+      std::complex< double > value = 0.0;
+      for( std::size_t k = 0; k < length; k++ )
+        {
+        value += spectrum[k] * std::polar( 1.0, 2.0 * pi * static_cast< double >( k * n % length ) / length );
+        }
+      data[start + n * stride] = value / static_cast< double >( length );
+      }
+    }
+}
+
+}
+
+int main()
+{
+  const std::size_t size[3] = { 14, 11, 9 };
+  const std::vector< unsigned char > input = MakeTestVolume( size, 6 );
+  const double shifts[3][3] = { { 0.5, -1.25, 2.3 }, { -3.0, 2.0, 1.0 }, { 0.1, 0.0, -0.75 } };
+  bool passed = true;
+
+  FourierShiftResampler< unsigned char > resampler;
+  resampler.SetNumberOfThreads( 4 );
+  for( unsigned int s = 0; s < 3; s++ )
+    {
+    std::vector< unsigned char > output( input.size() );
+    resampler.SetInput( &input[0], size );
+    resampler.SetOutput( &output[0] );
+    resampler.SetShift( shifts[s] );
+    resampler.Update();
+
+    const std::size_t * padded = resampler.GetPaddedSize();
+    std::vector< std::complex< double > > data( padded[0] * padded[1] * padded[2], 0.0 );
+    for( std::size_t z = 0; z < size[2]; z++ )
+      {
+      for( std::size_t y = 0; y < size[1]; y++ )
+        {
+        for( std::size_t x = 0; x < size[0]; x++ )
+          {
+          data[( z * padded[1] + y ) * padded[0] + x] = input[( z * size[1] + y ) * size[0] + x];
+          }
+        }
+      }
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      ShiftLines( data, padded, d, shifts[s][d] );
+      }
+
+    std::vector< unsigned char > expected( input.size() );
+    std::size_t n = 0;
+    for( std::size_t z = 0; z < size[2]; z++ )
+      {
+      for( std::size_t y = 0; y < size[1]; y++ )
+        {
+        for( std::size_t x = 0; x < size[0]; x++, n++ )
+          {
+          const double position[3] = { x + shifts[s][0], y + shifts[s][1], z + shifts[s][2] };
+          bool inside = true;
+          for( unsigned int d = 0; d < 3; d++ )
+            {
+            inside = inside && position[d] >= -0.5 && position[d] < static_cast< double >( size[d] ) - 0.5;
+            }
+          double value = std::floor( data[( z * padded[1] + y ) * padded[0] + x].real() + 0.5 );
+          value = value < 0.0 ? 0.0 : ( value > 255.0 ? 255.0 : value );
+          expected[n] = inside ? static_cast< unsigned char >( value ) : 0;
+          }
+        }
+      }
+    passed = CompareVolumes( "Fourier shift against periodic DFT", output, expected, 0 ) && passed;
+    }
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,61 @@
+// AUTHOR: Christian McDaniel
+//
+// A ResamplingPlan against WindowedSincResampler for the same mapping. The
+// plan quantizes positions to 1/256 voxel, so it may differ by one gray
+// level; a plan saved and loaded again must give the same output as the
+// one built.
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "ResamplingPlan.h"
+#include "ResamplingTest.h"
+#include "WindowedSincResampler.h"
+
+int main()
+{
+  const unsigned int Radius = 3;
+  const std::size_t inputSize[3] = { 33, 31, 19 };
+  const std::size_t outputSize[3] = { 40, 36, 22 };
+  const std::vector< unsigned char > input = MakeTestVolume( inputSize, 2 );
+  const double shift[3] = { -0.25, 0.61, 1.4 };
+  const IndexMapping mapping = MakeRotationMapping( 2, 0.45, inputSize, outputSize, shift );
+  bool passed = true;
+
+  std::vector< unsigned char > expected( outputSize[0] * outputSize[1] * outputSize[2] );
+  WindowedSincResampler< unsigned char, Radius > resampler;
+  resampler.SetInput( &input[0], inputSize );
+  resampler.SetOutput( &expected[0], outputSize );
+  resampler.SetIndexMapping( mapping );
+  resampler.SetNumberOfThreads( 4 );
+  resampler.Update();
+
+  ResamplingPlan< Radius > plan;
+  plan.SetNumberOfThreads( 4 );
+  if( !plan.Build( mapping, inputSize, outputSize ) )
+    {
+    std::cout << "FAIL plan: could not build" << std::endl;
+    return EXIT_FAILURE;
+    }
+  std::vector< unsigned char > output( expected.size() );
+  plan.Apply( &input[0], &output[0], static_cast< unsigned char >( 0 ) );
+  passed = CompareVolumes( "plan against sinc", output, expected, 1 ) && passed;
+
+  const std::string fileName = "PlanTest.plan";
+  ResamplingPlan< Radius > loaded;
+  loaded.SetNumberOfThreads( 4 );
+  if( !plan.Save( fileName ) || !loaded.Load( fileName, mapping, inputSize, outputSize ) )
+    {
+    std::cout << "FAIL plan: could not save and load " << fileName << std::endl;
+    std::remove( fileName.c_str() );
+    return EXIT_FAILURE;
+    }
+  std::vector< unsigned char > reloaded( expected.size() );
+  loaded.Apply( &input[0], &reloaded[0], static_cast< unsigned char >( 0 ) );
+  passed = CompareVolumes( "loaded plan against built plan", reloaded, output, 0 ) && passed;
+  std::remove( fileName.c_str() );
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,51 @@
+// AUTHOR: Christian McDaniel
+//
+// The single precision kernels and the fixed point linear resampler
+// against the same kernels in double precision. Each may differ by one
+// gray level, where rounding moves a value across an integer before it is
+// truncated.
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "FixedPointLinearResampler.h"
+#include "ResamplingTest.h"
+#include "SeparableKernelResampler.h"
+
+int main()
+{
+  const std::size_t inputSize[3] = { 35, 30, 21 };
+  const std::size_t outputSize[3] = { 38, 34, 24 };
+  const std::vector< unsigned char > input = MakeTestVolume( inputSize, 3 );
+  const double shift[3] = { 0.3, -0.7, 0.45 };
+  const IndexMapping mapping = MakeRotationMapping( 0, -0.6, inputSize, outputSize, shift );
+  const std::size_t count = outputSize[0] * outputSize[1] * outputSize[2];
+  const unsigned int threads = 4;
+  bool passed = true;
+
+  std::vector< unsigned char > reference( count );
+  std::vector< unsigned char > output( count );
+
+  ResampleWithKernel< LinearKernel, double >( &input[0], inputSize, &reference[0], outputSize, mapping, threads );
+  ResampleWithKernel< LinearKernel, float >( &input[0], inputSize, &output[0], outputSize, mapping, threads );
+  passed = CompareVolumes( "linear, float against double", output, reference, 1 ) && passed;
+
+  FixedPointLinearResampler fixedResampler;
+  fixedResampler.SetInput( &input[0], inputSize );
+  fixedResampler.SetOutput( &output[0], outputSize );
+  fixedResampler.SetIndexMapping( mapping );
+  fixedResampler.SetNumberOfThreads( threads );
+  fixedResampler.Update();
+  passed = CompareVolumes( "linear, fixed point against double", output, reference, 1 ) && passed;
+
+  ResampleWithKernel< CubicKernel, double >( &input[0], inputSize, &reference[0], outputSize, mapping, threads );
+  ResampleWithKernel< CubicKernel, float >( &input[0], inputSize, &output[0], outputSize, mapping, threads );
+  passed = CompareVolumes( "cubic, float against double", output, reference, 1 ) && passed;
+
+  ResampleWithKernel< SincKernel, double >( &input[0], inputSize, &reference[0], outputSize, mapping, threads );
+  ResampleWithKernel< SincKernel, float >( &input[0], inputSize, &output[0], outputSize, mapping, threads );
+  passed = CompareVolumes( "sinc, float against double", output, reference, 1 ) && passed;
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,101 @@
+// AUTHOR: Christian McDaniel
+//
+// Helpers shared by the resampler tests: a reproducible test volume, the
+// index mapping of a rotation about the volume center, and the comparison
+// each test reports. The volume is smooth so that engines which
+// interpolate differently, e.g. shear passes against the 3D sinc, can be
+// held to a few gray levels.
+
+#ifndef ResamplingTest_h
+#define ResamplingTest_h
+
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ResampleGeometry.h"
+
+// Low-frequency waves with phases drawn from `seed`, rounded to gray
+// levels.
+inline std::vector< unsigned char > MakeTestVolume( const std::size_t size[3], unsigned int seed )
+{
+  const double pi = 3.14159265358979323846;
+  std::mt19937 generator( seed );
+  std::uniform_real_distribution< double > phase( 0.0, 2.0 * pi );
+  const double phases[3] = { phase( generator ), phase( generator ), phase( generator ) };
+  std::vector< unsigned char > volume( size[0] * size[1] * size[2] );
+  std::size_t n = 0;
+  for( std::size_t z = 0; z < size[2]; z++ )
+    {
+    for( std::size_t y = 0; y < size[1]; y++ )
+      {
+      for( std::size_t x = 0; x < size[0]; x++, n++ )
+        {
+        const double value = 128.0 + 60.0 * std::sin( 2.0 * pi * x / 11.0 + phases[0] )
+                                   * std::cos( 2.0 * pi * y / 13.0 + phases[1] )
+                           + 40.0 * std::sin( 2.0 * pi * ( y + z ) / 17.0 + phases[2] );
+        volume[n] = static_cast< unsigned char >( std::floor( value + 0.5 ) );
+        }
+      }
+    }
+  return volume;
+}
+
+// Output voxel i maps to R (i - outputCenter) + inputCenter + shift, with R
+// the rotation by `angle` radians about `axis`.
+inline IndexMapping MakeRotationMapping( unsigned int axis, double angle, const std::size_t inputSize[3],
+                                         const std::size_t outputSize[3], const double shift[3] )
+{
+  IndexMapping mapping;
+  SetIdentity( mapping.Matrix );
+  const unsigned int u = ( axis + 1 ) % 3;
+  const unsigned int v = ( axis + 2 ) % 3;
+  mapping.Matrix[u][u] = std::cos( angle );
+  mapping.Matrix[u][v] = -std::sin( angle );
+  mapping.Matrix[v][u] = std::sin( angle );
+  mapping.Matrix[v][v] = std::cos( angle );
+  double outputCenter[3];
+  double rotated[3];
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    outputCenter[d] = 0.5 * ( static_cast< double >( outputSize[d] ) - 1.0 );
+    }
+  MultiplyMatrixVector( mapping.Matrix, outputCenter, rotated );
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    mapping.Offset[d] = 0.5 * ( static_cast< double >( inputSize[d] ) - 1.0 ) + shift[d] - rotated[d];
+    }
+  return mapping;
+}
+
+// Compares `actual` with `expected` where `mask` is nonzero (everywhere
+// without a mask); passes when no voxel differs by more than `tolerance`.
+inline bool CompareVolumes( const std::string & name, const std::vector< unsigned char > & actual,
+                            const std::vector< unsigned char > & expected, int tolerance,
+                            const std::vector< char > * mask = 0 )
+{
+  std::size_t compared = 0;
+  std::size_t mismatches = 0;
+  int largest = 0;
+  for( std::size_t n = 0; n < expected.size(); n++ )
+    {
+    if( mask && !( *mask )[n] )
+      {
+      continue;
+      }
+    const int difference = std::abs( static_cast< int >( actual[n] ) - static_cast< int >( expected[n] ) );
+    compared++;
+    mismatches += ( difference > tolerance );
+    largest = difference > largest ? difference : largest;
+    }
+  const bool passed = ( actual.size() == expected.size() && mismatches == 0 && compared > 0 );
+  std::cout << ( passed ? "PASS " : "FAIL " ) << name << ": " << compared << " voxels, largest difference "
+            << largest << " (tolerance " << tolerance << "), " << mismatches << " over" << std::endl;
+  return passed;
+}
+
+#endif
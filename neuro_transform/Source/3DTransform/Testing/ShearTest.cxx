@@ -0,0 +1,101 @@
+// AUTHOR: Christian McDaniel
+//
+// ShearRotationResampler against WindowedSincResampler for rotations about
+// one and about several axes. Three 1D sinc passes are not the same
+// interpolation as one 3D sinc, so they are held to 4 gray levels, and
+// only away from the border, where the two treat the edge differently.
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "ResamplingTest.h"
+#include "ShearRotationResampler.h"
+#include "WindowedSincResampler.h"
+
+int main()
+{
+  const unsigned int Radius = 3;
+  const std::size_t size[3] = { 40, 36, 28 };
+  const std::vector< unsigned char > input = MakeTestVolume( size, 5 );
+  const double spacing[3] = { 1.0, 1.0, 1.0 };
+  const double shift[3] = { 0.4, -0.3, 0.2 };
+  // Voxels whose position is this far inside the input are compared:
+  // three supports, which keeps the nine passes of the general rotation
+  // clear of the border too.
+  const double margin = 3.0 * Radius;
+  bool passed = true;
+
+  IndexMapping mappings[3];
+  mappings[0] = MakeRotationMapping( 2, 0.35, size, size, shift );
+  mappings[1] = MakeRotationMapping( 0, -0.8, size, size, shift );
+  const IndexMapping second = MakeRotationMapping( 1, 0.25, size, size, shift );
+  mappings[2] = mappings[0];
+  MultiplyMatrices( mappings[0].Matrix, second.Matrix, mappings[2].Matrix );
+  double center[3];
+  double rotated[3];
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    center[d] = 0.5 * ( static_cast< double >( size[d] ) - 1.0 );
+    }
+  MultiplyMatrixVector( mappings[2].Matrix, center, rotated );
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    mappings[2].Offset[d] = center[d] + shift[d] - rotated[d];
+    }
+
+  for( unsigned int m = 0; m < 3; m++ )
+    {
+    const std::size_t count = size[0] * size[1] * size[2];
+    ShearRotationResampler< unsigned char, Radius > shearResampler;
+    if( !shearResampler.SetIndexMapping( mappings[m], spacing ) )
+      {
+      std::cout << "FAIL shear: rotation " << m << " was not accepted" << std::endl;
+      passed = false;
+      continue;
+      }
+    std::vector< unsigned char > output( count );
+    shearResampler.SetInput( &input[0], size );
+    shearResampler.SetOutput( &output[0], size );
+    shearResampler.SetNumberOfThreads( 4 );
+    shearResampler.Update();
+
+    std::vector< unsigned char > expected( count );
+    WindowedSincResampler< unsigned char, Radius > sincResampler;
+    sincResampler.SetInput( &input[0], size );
+    sincResampler.SetOutput( &expected[0], size );
+    sincResampler.SetIndexMapping( mappings[m] );
+    sincResampler.SetNumberOfThreads( 4 );
+    sincResampler.Update();
+
+    std::vector< char > interior( count, 0 );
+    std::size_t n = 0;
+    for( std::size_t k = 0; k < size[2]; k++ )
+      {
+      for( std::size_t j = 0; j < size[1]; j++ )
+        {
+        for( std::size_t i = 0; i < size[0]; i++, n++ )
+          {
+          double c[3];
+          mappings[m].Map( static_cast< double >( i ), static_cast< double >( j ), static_cast< double >( k ), c );
+          interior[n] = c[0] >= margin && c[0] < size[0] - 1.0 - margin
+                     && c[1] >= margin && c[1] < size[1] - 1.0 - margin
+                     && c[2] >= margin && c[2] < size[2] - 1.0 - margin;
+          }
+        }
+      }
+    passed = CompareVolumes( "shear against sinc, interior", output, expected, 4, &interior ) && passed;
+    }
+
+  // A scaling is not a rotation.
+  IndexMapping scaling;
+  SetIdentity( scaling.Matrix );
+  scaling.Matrix[0][0] = 1.5;
+  scaling.Offset[0] = scaling.Offset[1] = scaling.Offset[2] = 0.0;
+  ShearRotationResampler< unsigned char, Radius > rejected;
+  const bool accepted = rejected.SetIndexMapping( scaling, spacing );
+  std::cout << ( accepted ? "FAIL " : "PASS " ) << "shear: scaling rejected" << std::endl;
+  passed = passed && !accepted;
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,116 @@
+// AUTHOR: Christian McDaniel
+//
+// The row spans of ComputeRowSpan() against the inside test evaluated
+// voxel by voxel, and WindowedSincResampler, which relies on those spans
+// to skip the boundary condition, against a per-voxel loop that checks
+// every position and clamps every tap. Both must agree exactly.
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "ResamplingTest.h"
+#include "WindowedSincResampler.h"
+
+namespace
+{
+
+bool Inside( const IndexMapping & mapping, std::size_t i, std::size_t j, std::size_t k,
+             const double lower[3], const double upper[3] )
+{
+  double c[3];
+  mapping.Map( static_cast< double >( i ), static_cast< double >( j ), static_cast< double >( k ), c );
+  for( unsigned int d = 0; d < 3; d++ )
+    {
+    if( !( c[d] >= lower[d] && c[d] < upper[d] ) )
+      {
+      return false;
+      }
+    }
+  return true;
+}
+
+// Voxels whose membership in the span of their row differs from the
+// per-voxel test.
+std::size_t CountSpanMismatches( const IndexMapping & mapping, const std::size_t outputSize[3],
+                                 const double lower[3], const double upper[3] )
+{
+  std::size_t mismatches = 0;
+  for( std::size_t k = 0; k < outputSize[2]; k++ )
+    {
+    for( std::size_t j = 0; j < outputSize[1]; j++ )
+      {
+      std::size_t first;
+      std::size_t last;
+      ComputeRowSpan( mapping, j, k, outputSize[0], lower, upper, first, last );
+      for( std::size_t i = 0; i < outputSize[0]; i++ )
+        {
+        mismatches += ( ( i >= first && i < last ) != Inside( mapping, i, j, k, lower, upper ) );
+        }
+      }
+    }
+  return mismatches;
+}
+
+}
+
+int main()
+{
+  const unsigned int Radius = 3;
+  const std::size_t inputSize[3] = { 37, 29, 23 };
+  const std::size_t outputSize[3] = { 45, 41, 27 };
+  const std::vector< unsigned char > input = MakeTestVolume( inputSize, 1 );
+  const double shift[3] = { 0.37, -1.21, 0.5 };
+  bool passed = true;
+
+  const double angles[] = { 0.0, 0.3, -1.1, 2.6 };
+  for( unsigned int a = 0; a < sizeof( angles ) / sizeof( angles[0] ); a++ )
+    {
+    IndexMapping mapping = MakeRotationMapping( a % 3, angles[a], inputSize, outputSize, shift );
+    // Some scaling too, so that rows cross the input at other rates.
+    mapping.Matrix[0][0] *= 1.13;
+
+    double insideLower[3];
+    double insideUpper[3];
+    double interiorLower[3];
+    double interiorUpper[3];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      insideLower[d] = -0.5;
+      insideUpper[d] = static_cast< double >( inputSize[d] ) - 0.5;
+      interiorLower[d] = Radius - 1.0;
+      interiorUpper[d] = static_cast< double >( inputSize[d] ) - Radius;
+      }
+    const std::size_t spanMismatches = CountSpanMismatches( mapping, outputSize, insideLower, insideUpper )
+                                     + CountSpanMismatches( mapping, outputSize, interiorLower, interiorUpper );
+    std::cout << ( spanMismatches == 0 ? "PASS " : "FAIL " ) << "row spans, angle " << angles[a] << ": "
+              << spanMismatches << " mismatches" << std::endl;
+    passed = passed && spanMismatches == 0;
+
+    std::vector< unsigned char > output( outputSize[0] * outputSize[1] * outputSize[2] );
+    WindowedSincResampler< unsigned char, Radius > resampler;
+    resampler.SetInput( &input[0], inputSize );
+    resampler.SetOutput( &output[0], outputSize );
+    resampler.SetIndexMapping( mapping );
+    resampler.SetNumberOfThreads( 4 );
+    resampler.Update();
+
+    std::vector< unsigned char > expected( output.size() );
+    std::size_t n = 0;
+    for( std::size_t k = 0; k < outputSize[2]; k++ )
+      {
+      for( std::size_t j = 0; j < outputSize[1]; j++ )
+        {
+        for( std::size_t i = 0; i < outputSize[0]; i++, n++ )
+          {
+          double c[3];
+          mapping.Map( static_cast< double >( i ), static_cast< double >( j ), static_cast< double >( k ), c );
+          expected[n] = resampler.IsInsideBuffer( c ) ? ClampCast< unsigned char >( resampler.EvaluateGuarded( c ) ) : 0;
+          }
+        }
+      }
+    passed = CompareVolumes( "spans against per-voxel sinc", output, expected, 0 ) && passed;
+    }
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,799 @@
+// AUTHOR: Christian McDaniel
+//
+// Optional flags accepted after the nine positional arguments of
+// {3DTransform}. Each flag is documented in the project README.
+
+#ifndef TransformOptions_h
+#define TransformOptions_h
+
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ObliquePlane.h"
+#include "TransformParameters.h"
+
+struct TransformOptions
+{
+  // --itk-resample: run the stock ResampleImageFilter instead of the
+  // span-splitting sinc kernel (reference output for comparisons).
+  bool UseItkResample;
+
+  // --rotation-engine sinc|shear: "shear" resamples rotations as a sequence
+  // of 1D sinc shear passes instead of one 3D sinc pass.
+  std::string RotationEngine;
+
+  // --fourier-translation: apply pure translations as a phase ramp in the
+  // frequency domain (exact band-limited shift) instead of a sinc resample.
+  bool FourierTranslation;
+
+  // --header-only: for rigid transforms, move the image by rewriting its
+  // origin and direction cosines instead of resampling the voxels.
+  bool HeaderOnly;
+
+  // --crop x y z sx sy sz: restrict the output grid to sx*sy*sz voxels
+  // starting at index (x, y, z).
+  bool        Crop;
+  long        CropStart[3];
+  std::size_t CropSize[3];
+
+  // --pad lx ly lz ux uy uz: extend the output grid by the given number of
+  // voxels below and above each axis (applied after --crop).
+  bool        Pad;
+  std::size_t PadLower[3];
+  std::size_t PadUpper[3];
+
+  // --slice k: only axial slice k of the output grid (shorthand for
+  // --crop 0 0 k nx ny 1); -1 when not given.
+  long Slice;
+
+  // --apply-to in out (repeatable): resample further volumes on the grid of
+  // the input with the same transform, sharing all geometry work.
+  std::vector< std::pair< std::string, std::string > > ApplyTo;
+
+  // --plan-cache dir: keep sinc resampling plans in dir, keyed by transform
+  // and grids, and map them from there in later runs.
+  std::string PlanCache;
+
+  // --result-cache dir: keep output files in dir, keyed by the input voxels,
+  // transform, output grid and options, and link them from there when a
+  // later run has the same key. --result-cache-size MB bounds the entries
+  // (least recently used ones are removed); --cache-stats reports the
+  // contents and hit rate of the cache. Outputs in .nii, .nii.gz, .mha,
+  // .nrrd, .vtk and Analyze .hdr/.img pairs are cached.
+  std::string ResultCache;
+  double      ResultCacheSize;
+  bool        CacheStats;
+
+  // --augment N [--seed S] [--rotation-range r] [--scale-range lo hi]
+  // [--translation-range t]: write N randomly perturbed transforms of the
+  // input instead of one; --augment-file f takes the parameter sets from f.
+  std::size_t        AugmentCount;
+  unsigned long      Seed;
+  AugmentationRanges Ranges;
+  std::string        AugmentFile;
+
+  // --interpolator sinc|linear|cubic|nearest|majority: the kernel of the
+  // direct resampler; nearest and majority (the label with the largest
+  // share of the trilinear weights) keep the labels of label maps.
+  // --precision double|float|fixed: the arithmetic it runs in ("fixed" is
+  // the integer trilinear kernel for unsigned char images).
+  // --validate-precision: also run the double kernel and report the
+  // largest difference.
+  std::string Interpolator;
+  std::string Precision;
+  bool        ValidatePrecision;
+
+  // --reference file: resample onto the grid (size, spacing, origin and
+  // direction) of the image in file. --output-size nx ny nz,
+  // --output-spacing sx sy sz, --output-origin x y z and --output-direction
+  // d00 d01 d02 d10 ... d22 (row major) then replace parts of the output
+  // grid; a new spacing alone keeps the physical extent of the grid.
+  std::string ReferenceFile;
+  bool        OutputSizeSet;
+  std::size_t OutputSize[3];
+  bool        OutputSpacingSet;
+  double      OutputSpacing[3];
+  bool        OutputOriginSet;
+  double      OutputOrigin[3];
+  bool        OutputDirectionSet;
+  double      OutputDirection[3][3];
+
+  // --series file: the input is a 4D series; volume t is resampled with the
+  // transform on line t of file (after the one given by the arguments),
+  // and the result is written as one 4D image.
+  std::string SeriesFile;
+
+  // --no-pyramid: point-sample the full resolution input even when the
+  // transform minifies, instead of a Gaussian pyramid level.
+  bool UsePyramid;
+
+  // --reslice cx cy cz nx ny nz ux uy uz (repeatable) and --reslice-file f
+  // (one plane per line): write oblique planes of the transformed input,
+  // given by center, normal and up vector in world coordinates, instead of
+  // the volume. --reslice-size w h and --reslice-spacing s set the plane
+  // grid (0: the largest input size and the smallest input spacing).
+  std::vector< ObliquePlane > ReslicePlanes;
+  std::string                 ResliceFile;
+  std::size_t                 ResliceSize[2];
+  double                      ResliceSpacing;
+
+  // --threshold T or --otsu: write a mask instead of gray levels; voxels
+  // whose interpolated value, before truncation or rounding, is >= T (or
+  // Otsu's threshold of the input histogram) get --mask-value v (default
+  // 1), all others 0. Every engine, --itk-resample included, uses this
+  // rule.
+  bool   ThresholdSet;
+  double Threshold;
+  bool   Otsu;
+  long   MaskValue;
+
+  // --register fixed: estimate the transform that aligns the input to the
+  // image in fixed (starting from the one given by the arguments) and
+  // resample onto the grid of fixed with it. --register-type rigid|affine
+  // (or phase, see below) selects the parameters; --transform-out f writes
+  // the estimated matrix and offset to f as one line of a transform file.
+  std::string RegisterFile;
+  std::string RegisterType;
+  std::string TransformOutFile;
+
+  // --cohort list: register every subject of list ("input output
+  // [transform]" per line, after the input and output of the arguments) to
+  // the --register image, several subjects at a time, with the template
+  // side of the registration computed once for all of them.
+  std::string CohortFile;
+
+  // --metric mse|mi: the similarity measure of --register (mean squared
+  // difference, or Mattes mutual information for different modalities).
+  // --metric-sampling p: evaluate it at p percent of the fixed voxels
+  // (0: 100 for mse, 2 for mi), chosen by --sampling stratified|random.
+  // --histogram-bins b: bins per axis of the joint histogram of mi.
+  // --metric-benchmark: report the time and error of the metric at a range
+  // of sampling percentages for the registered images.
+  std::string Metric;
+  double      MetricSampling;
+  std::string Sampling;
+  long        HistogramBins;
+  bool        MetricBenchmark;
+
+  // --phase-correlate: start --register from the translation found by
+  // phase correlation instead of the arguments or centered images;
+  // --phase-correlate-axis x|y|z also estimates the rotation about that
+  // axis of the fixed grid. --register-type phase uses the phase
+  // correlation estimate as the result, without iterations.
+  bool PhaseCorrelate;
+  int  PhaseCorrelateAxis;
+
+  // --bspline file: a cubic B-spline free-form deformation (an ITK
+  // BSplineTransform file) defined on the output grid; output point x is
+  // moved by it before the affine transform maps it into the input.
+  std::string BSplineFile;
+
+  // --displacement-field file: a dense displacement field (a 3D image of
+  // 3-component vectors, in physical units) used the same way as --bspline.
+  std::string DisplacementFieldFile;
+
+  // --atlases list: fuse the atlas label maps of list ("labels transform
+  // [weight]" per line) by weighted voting on the output grid, each atlas
+  // mapped through the transform of the arguments and then its own; the
+  // input only supplies the grid.
+  std::string AtlasFile;
+
+  TransformOptions()
+    : UseItkResample( false ),
+      RotationEngine( "sinc" ),
+      FourierTranslation( false ),
+      HeaderOnly( false ),
+      Crop( false ),
+      Pad( false ),
+      Slice( -1 ),
+      ResultCacheSize( 1024.0 ),
+      CacheStats( false ),
+      AugmentCount( 0 ),
+      Seed( 0 ),
+      Interpolator( "sinc" ),
+      Precision( "double" ),
+      ValidatePrecision( false ),
+      OutputSizeSet( false ),
+      OutputSpacingSet( false ),
+      OutputOriginSet( false ),
+      OutputDirectionSet( false ),
+      UsePyramid( true ),
+      ResliceSpacing( 0.0 ),
+      ThresholdSet( false ),
+      Threshold( 0.0 ),
+      Otsu( false ),
+      MaskValue( 1 ),
+      RegisterType( "rigid" ),
+      Metric( "mse" ),
+      MetricSampling( 0.0 ),
+      Sampling( "stratified" ),
+      HistogramBins( 32 ),
+      MetricBenchmark( false ),
+      PhaseCorrelate( false ),
+      PhaseCorrelateAxis( -1 )
+    {
+    ResliceSize[0] = ResliceSize[1] = 0;
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      CropStart[d] = 0;
+      CropSize[d] = 0;
+      PadLower[d] = 0;
+      PadUpper[d] = 0;
+      OutputSize[d] = 0;
+      OutputSpacing[d] = 1.0;
+      OutputOrigin[d] = 0.0;
+      }
+    SetIdentity( OutputDirection );
+    }
+};
+
+// Reads `count` integers from argv[i + 1 ...], advancing i past them.
+// Returns false if there are too few or one is not an integer (or is
+// negative when `minimum` is 0).
+inline bool ParseIntegerValues( int argc, char * argv[], int & i, unsigned int count, long minimum, long * values )
+{
+  if( i + static_cast< int >( count ) >= argc )
+    {
+    return false;
+    }
+  for( unsigned int n = 0; n < count; n++ )
+    {
+    const char * text = argv[i + 1 + n];
+    char * end = 0;
+    values[n] = std::strtol( text, &end, 10 );
+    if( end == text || *end != '\0' || values[n] < minimum )
+      {
+      return false;
+      }
+    }
+  i += static_cast< int >( count );
+  return true;
+}
+
+// Reads `count` real numbers from argv[i + 1 ...], advancing i past them.
+inline bool ParseRealValues( int argc, char * argv[], int & i, unsigned int count, double * values )
+{
+  if( i + static_cast< int >( count ) >= argc )
+    {
+    return false;
+    }
+  for( unsigned int n = 0; n < count; n++ )
+    {
+    const char * text = argv[i + 1 + n];
+    char * end = 0;
+    values[n] = std::strtod( text, &end );
+    if( end == text || *end != '\0' )
+      {
+      return false;
+      }
+    }
+  i += static_cast< int >( count );
+  return true;
+}
+
+// Parses argv[first ... argc-1]; prints the offending flag and returns false
+// on unknown flags or missing values.
+inline bool ParseTransformOptions( int argc, char * argv[], int first, TransformOptions & options )
+{
+  for( int i = first; i < argc; i++ )
+    {
+    const std::string flag = argv[i];
+    if( flag == "--itk-resample" )
+      {
+      options.UseItkResample = true;
+      }
+    else if( flag == "--fourier-translation" )
+      {
+      options.FourierTranslation = true;
+      }
+    else if( flag == "--header-only" )
+      {
+      options.HeaderOnly = true;
+      }
+    else if( flag == "--validate-precision" )
+      {
+      options.ValidatePrecision = true;
+      }
+    else if( flag == "--no-pyramid" )
+      {
+      options.UsePyramid = false;
+      }
+    else if( flag == "--otsu" )
+      {
+      options.Otsu = true;
+      }
+    else if( flag == "--threshold" )
+      {
+      if( !ParseRealValues( argc, argv, i, 1, &options.Threshold )
+          || !( options.Threshold > 0.0 && options.Threshold <= 255.0 ) )
+        {
+        std::cerr << "--threshold expects a gray level in (0, 255]" << std::endl;
+        return false;
+        }
+      options.ThresholdSet = true;
+      }
+    else if( flag == "--mask-value" )
+      {
+      if( !ParseIntegerValues( argc, argv, i, 1, 1, &options.MaskValue ) || options.MaskValue > 255 )
+        {
+        std::cerr << "--mask-value expects a gray level in [1, 255]" << std::endl;
+        return false;
+        }
+      }
+    else if( flag == "--apply-to" && i + 2 < argc )
+      {
+      options.ApplyTo.push_back( std::make_pair( std::string( argv[i + 1] ), std::string( argv[i + 2] ) ) );
+      i += 2;
+      }
+    else if( flag == "--plan-cache" && i + 1 < argc )
+      {
+      options.PlanCache = argv[++i];
+      }
+    else if( flag == "--result-cache" && i + 1 < argc )
+      {
+      options.ResultCache = argv[++i];
+      }
+    else if( flag == "--result-cache-size" )
+      {
+      if( !ParseRealValues( argc, argv, i, 1, &options.ResultCacheSize ) || !( options.ResultCacheSize > 0.0 ) )
+        {
+        std::cerr << "--result-cache-size expects a size in MB greater than 0" << std::endl;
+        return false;
+        }
+      }
+    else if( flag == "--cache-stats" )
+      {
+      options.CacheStats = true;
+      }
+    else if( flag == "--augment" || flag == "--seed" )
+      {
+      long value;
+      if( !ParseIntegerValues( argc, argv, i, 1, 0, &value ) )
+        {
+        std::cerr << flag << " expects a non-negative integer" << std::endl;
+        return false;
+        }
+      if( flag == "--augment" )
+        {
+        options.AugmentCount = static_cast< std::size_t >( value );
+        }
+      else
+        {
+        options.Seed = static_cast< unsigned long >( value );
+        }
+      }
+    else if( flag == "--rotation-range" || flag == "--translation-range" )
+      {
+      double value;
+      if( !ParseRealValues( argc, argv, i, 1, &value ) || value < 0.0 )
+        {
+        std::cerr << flag << " expects a non-negative number" << std::endl;
+        return false;
+        }
+      if( flag == "--rotation-range" )
+        {
+        options.Ranges.RotationRange = value;
+        }
+      else
+        {
+        options.Ranges.TranslationRange = value;
+        }
+      }
+    else if( flag == "--scale-range" )
+      {
+      double values[2];
+      if( !ParseRealValues( argc, argv, i, 2, values ) || values[0] <= 0.0 || values[1] < values[0] )
+        {
+        std::cerr << "--scale-range expects lo hi with 0 < lo <= hi" << std::endl;
+        return false;
+        }
+      options.Ranges.ScaleMinimum = values[0];
+      options.Ranges.ScaleMaximum = values[1];
+      }
+    else if( flag == "--series" && i + 1 < argc )
+      {
+      options.SeriesFile = argv[++i];
+      }
+    else if( flag == "--register" && i + 1 < argc )
+      {
+      options.RegisterFile = argv[++i];
+      }
+    else if( flag == "--register-type" && i + 1 < argc )
+      {
+      options.RegisterType = argv[++i];
+      if( options.RegisterType != "rigid" && options.RegisterType != "affine" && options.RegisterType != "phase" )
+        {
+        std::cerr << "Unknown registration type: " << options.RegisterType << std::endl;
+        return false;
+        }
+      }
+    else if( flag == "--metric" && i + 1 < argc )
+      {
+      options.Metric = argv[++i];
+      if( options.Metric != "mse" && options.Metric != "mi" )
+        {
+        std::cerr << "Unknown metric: " << options.Metric << std::endl;
+        return false;
+        }
+      }
+    else if( flag == "--metric-sampling" )
+      {
+      if( !ParseRealValues( argc, argv, i, 1, &options.MetricSampling )
+          || !( options.MetricSampling > 0.0 && options.MetricSampling <= 100.0 ) )
+        {
+        std::cerr << "--metric-sampling expects a percentage in (0, 100]" << std::endl;
+        return false;
+        }
+      }
+    else if( flag == "--sampling" && i + 1 < argc )
+      {
+      options.Sampling = argv[++i];
+      if( options.Sampling != "stratified" && options.Sampling != "random" )
+        {
+        std::cerr << "Unknown sampling: " << options.Sampling << std::endl;
+        return false;
+        }
+      }
+    else if( flag == "--histogram-bins" )
+      {
+      if( !ParseIntegerValues( argc, argv, i, 1, 5, &options.HistogramBins ) || options.HistogramBins > 1024 )
+        {
+        std::cerr << "--histogram-bins expects an integer in [5, 1024]" << std::endl;
+        return false;
+        }
+      }
+    else if( flag == "--metric-benchmark" )
+      {
+      options.MetricBenchmark = true;
+      }
+    else if( flag == "--phase-correlate" )
+      {
+      options.PhaseCorrelate = true;
+      }
+    else if( flag == "--phase-correlate-axis" && i + 1 < argc )
+      {
+      const std::string axis = argv[++i];
+      options.PhaseCorrelateAxis = ( axis == "x" ) ? 0 : ( axis == "y" ) ? 1 : ( axis == "z" ) ? 2 : -1;
+      if( options.PhaseCorrelateAxis < 0 )
+        {
+        std::cerr << "--phase-correlate-axis expects x, y or z" << std::endl;
+        return false;
+        }
+      }
+    else if( flag == "--bspline" && i + 1 < argc )
+      {
+      options.BSplineFile = argv[++i];
+      }
+    else if( flag == "--displacement-field" && i + 1 < argc )
+      {
+      options.DisplacementFieldFile = argv[++i];
+      }
+    else if( flag == "--atlases" && i + 1 < argc )
+      {
+      options.AtlasFile = argv[++i];
+      }
+    else if( flag == "--cohort" && i + 1 < argc )
+      {
+      options.CohortFile = argv[++i];
+      }
+    else if( flag == "--transform-out" && i + 1 < argc )
+      {
+      options.TransformOutFile = argv[++i];
+      }
+    else if( flag == "--reference" && i + 1 < argc )
+      {
+      options.ReferenceFile = argv[++i];
+      }
+    else if( flag == "--output-size" )
+      {
+      long values[3];
+      if( !ParseIntegerValues( argc, argv, i, 3, 1, values ) )
+        {
+        std::cerr << "--output-size expects nx ny nz (positive integers)" << std::endl;
+        return false;
+        }
+      options.OutputSizeSet = true;
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        options.OutputSize[d] = static_cast< std::size_t >( values[d] );
+        }
+      }
+    else if( flag == "--output-spacing" )
+      {
+      if( !ParseRealValues( argc, argv, i, 3, options.OutputSpacing )
+          || !( options.OutputSpacing[0] > 0.0 && options.OutputSpacing[1] > 0.0 && options.OutputSpacing[2] > 0.0 ) )
+        {
+        std::cerr << "--output-spacing expects sx sy sz (positive numbers)" << std::endl;
+        return false;
+        }
+      options.OutputSpacingSet = true;
+      }
+    else if( flag == "--output-origin" )
+      {
+      if( !ParseRealValues( argc, argv, i, 3, options.OutputOrigin ) )
+        {
+        std::cerr << "--output-origin expects x y z" << std::endl;
+        return false;
+        }
+      options.OutputOriginSet = true;
+      }
+    else if( flag == "--output-direction" )
+      {
+      if( !ParseRealValues( argc, argv, i, 9, &options.OutputDirection[0][0] )
+          || std::fabs( Determinant( options.OutputDirection ) ) < 1e-6 )
+        {
+        std::cerr << "--output-direction expects 9 values of an invertible matrix (row major)" << std::endl;
+        return false;
+        }
+      options.OutputDirectionSet = true;
+      }
+    else if( flag == "--augment-file" && i + 1 < argc )
+      {
+      options.AugmentFile = argv[++i];
+      }
+    else if( flag == "--crop" )
+      {
+      long values[6];
+      if( !ParseIntegerValues( argc, argv, i, 6, 0, values ) )
+        {
+        std::cerr << "--crop expects x y z sx sy sz (non-negative integers)" << std::endl;
+        return false;
+        }
+      options.Crop = true;
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        options.CropStart[d] = values[d];
+        options.CropSize[d] = static_cast< std::size_t >( values[d + 3] );
+        }
+      }
+    else if( flag == "--slice" )
+      {
+      if( !ParseIntegerValues( argc, argv, i, 1, 0, &options.Slice ) )
+        {
+        std::cerr << "--slice expects a non-negative slice index" << std::endl;
+        return false;
+        }
+      }
+    else if( flag == "--reslice" )
+      {
+      double values[9];
+      if( !ParseRealValues( argc, argv, i, 9, values ) )
+        {
+        std::cerr << "--reslice expects cx cy cz nx ny nz ux uy uz" << std::endl;
+        return false;
+        }
+      ObliquePlane plane;
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        plane.Center[d] = values[d];
+        plane.Normal[d] = values[3 + d];
+        plane.Up[d] = values[6 + d];
+        }
+      options.ReslicePlanes.push_back( plane );
+      }
+    else if( flag == "--reslice-file" && i + 1 < argc )
+      {
+      options.ResliceFile = argv[++i];
+      }
+    else if( flag == "--reslice-size" )
+      {
+      long values[2];
+      if( !ParseIntegerValues( argc, argv, i, 2, 1, values ) )
+        {
+        std::cerr << "--reslice-size expects w h (positive integers)" << std::endl;
+        return false;
+        }
+      options.ResliceSize[0] = static_cast< std::size_t >( values[0] );
+      options.ResliceSize[1] = static_cast< std::size_t >( values[1] );
+      }
+    else if( flag == "--reslice-spacing" )
+      {
+      if( !ParseRealValues( argc, argv, i, 1, &options.ResliceSpacing ) || !( options.ResliceSpacing > 0.0 ) )
+        {
+        std::cerr << "--reslice-spacing expects a positive spacing" << std::endl;
+        return false;
+        }
+      }
+    else if( flag == "--pad" )
+      {
+      long values[6];
+      if( !ParseIntegerValues( argc, argv, i, 6, 0, values ) )
+        {
+        std::cerr << "--pad expects lx ly lz ux uy uz (non-negative integers)" << std::endl;
+        return false;
+        }
+      options.Pad = true;
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        options.PadLower[d] = static_cast< std::size_t >( values[d] );
+        options.PadUpper[d] = static_cast< std::size_t >( values[d + 3] );
+        }
+      }
+    else if( flag == "--rotation-engine" && i + 1 < argc )
+      {
+      options.RotationEngine = argv[++i];
+      if( options.RotationEngine != "sinc" && options.RotationEngine != "shear" )
+        {
+        std::cerr << "Unknown rotation engine: " << options.RotationEngine << std::endl;
+        return false;
+        }
+      }
+    else if( flag == "--interpolator" && i + 1 < argc )
+      {
+      options.Interpolator = argv[++i];
+      if( options.Interpolator != "sinc" && options.Interpolator != "linear" && options.Interpolator != "cubic"
+          && options.Interpolator != "nearest" && options.Interpolator != "majority" )
+        {
+        std::cerr << "Unknown interpolator: " << options.Interpolator << std::endl;
+        return false;
+        }
+      }
+    else if( flag == "--precision" && i + 1 < argc )
+      {
+      options.Precision = argv[++i];
+      if( options.Precision != "double" && options.Precision != "float" && options.Precision != "fixed" )
+        {
+        std::cerr << "Unknown precision: " << options.Precision << std::endl;
+        return false;
+        }
+      }
+    else
+      {
+      std::cerr << "Unknown option: " << flag << std::endl;
+      return false;
+      }
+    }
+  if( !options.SeriesFile.empty()
+      && ( options.AugmentCount > 0 || !options.AugmentFile.empty() || !options.ApplyTo.empty() ) )
+    {
+    std::cerr << "--series cannot be combined with --augment, --augment-file or --apply-to" << std::endl;
+    return false;
+    }
+  if( ( !options.ReslicePlanes.empty() || !options.ResliceFile.empty() )
+      && ( !options.SeriesFile.empty() || options.AugmentCount > 0 || !options.AugmentFile.empty()
+           || !options.ApplyTo.empty() || options.Slice >= 0 ) )
+    {
+    std::cerr << "--reslice cannot be combined with --series, --augment, --augment-file, --apply-to or --slice" << std::endl;
+    return false;
+    }
+  if( !options.RegisterFile.empty()
+      && ( !options.SeriesFile.empty() || options.AugmentCount > 0 || !options.AugmentFile.empty() ) )
+    {
+    std::cerr << "--register cannot be combined with --series, --augment or --augment-file" << std::endl;
+    return false;
+    }
+  if( ( !options.TransformOutFile.empty() || options.MetricBenchmark ) && options.RegisterFile.empty() )
+    {
+    std::cerr << "--transform-out and --metric-benchmark require --register" << std::endl;
+    return false;
+    }
+  if( ( options.PhaseCorrelate || options.PhaseCorrelateAxis >= 0 ) && options.RegisterFile.empty() )
+    {
+    std::cerr << "--phase-correlate and --phase-correlate-axis require --register" << std::endl;
+    return false;
+    }
+  if( options.RegisterType == "phase" && options.MetricBenchmark )
+    {
+    std::cerr << "--metric-benchmark cannot be combined with --register-type phase" << std::endl;
+    return false;
+    }
+  if( !options.CohortFile.empty()
+      && ( options.RegisterFile.empty() || options.MetricBenchmark || !options.ApplyTo.empty()
+           || !options.ReslicePlanes.empty() || !options.ResliceFile.empty() ) )
+    {
+    std::cerr << "--cohort requires --register and cannot be combined with --metric-benchmark, --apply-to or --reslice"
+              << std::endl;
+    return false;
+    }
+  // The modes that resample many volumes run each one with the copy, shear
+  // or kernel engines only.
+  if( ( !options.SeriesFile.empty() || options.AugmentCount > 0 || !options.AugmentFile.empty()
+        || !options.ReslicePlanes.empty() || !options.ResliceFile.empty() || !options.CohortFile.empty() )
+      && ( options.UseItkResample || options.FourierTranslation || options.HeaderOnly || !options.ApplyTo.empty()
+           || !options.PlanCache.empty() || options.ValidatePrecision ) )
+    {
+    std::cerr << "--series, --augment, --augment-file, --reslice and --cohort cannot be combined with "
+              << "--itk-resample, --fourier-translation, --header-only, --apply-to, --plan-cache or "
+              << "--validate-precision" << std::endl;
+    return false;
+    }
+  if( options.HeaderOnly
+      && ( !options.ReferenceFile.empty() || !options.RegisterFile.empty() || options.OutputSizeSet
+           || options.OutputSpacingSet || options.OutputOriginSet || options.OutputDirectionSet ) )
+    {
+    std::cerr << "--header-only keeps the voxels of the input and cannot be combined with --reference, --register or "
+              << "--output-size/spacing/origin/direction, which resample onto another grid" << std::endl;
+    return false;
+    }
+  if( !options.BSplineFile.empty() && !options.DisplacementFieldFile.empty() )
+    {
+    std::cerr << "--bspline cannot be combined with --displacement-field" << std::endl;
+    return false;
+    }
+  if( ( !options.BSplineFile.empty() || !options.DisplacementFieldFile.empty() )
+      && ( options.UseItkResample || options.FourierTranslation || options.HeaderOnly || options.Precision == "fixed"
+           || !options.SeriesFile.empty() || options.AugmentCount > 0 || !options.AugmentFile.empty()
+           || !options.ReslicePlanes.empty() || !options.ResliceFile.empty() || !options.CohortFile.empty() ) )
+    {
+    std::cerr << "--bspline and --displacement-field cannot be combined with --itk-resample, --fourier-translation, "
+              << "--header-only, --precision fixed, --series, --augment, --augment-file, --reslice or --cohort"
+              << std::endl;
+    return false;
+    }
+  if( !options.AtlasFile.empty()
+      && ( options.UseItkResample || options.FourierTranslation || options.HeaderOnly || options.Precision != "double"
+           || options.Interpolator == "linear" || options.Interpolator == "cubic" || options.ThresholdSet || options.Otsu
+           || !options.RegisterFile.empty() || !options.SeriesFile.empty() || options.AugmentCount > 0
+           || !options.AugmentFile.empty() || !options.ApplyTo.empty() || !options.ReslicePlanes.empty()
+           || !options.ResliceFile.empty() || !options.BSplineFile.empty() || !options.DisplacementFieldFile.empty() ) )
+    {
+    std::cerr << "--atlases resamples labels (--interpolator nearest or majority) and cannot be combined with "
+              << "--itk-resample, --fourier-translation, --header-only, --precision, --threshold, --otsu, --register, "
+              << "--series, --augment, --augment-file, --apply-to, --reslice, --bspline or --displacement-field"
+              << std::endl;
+    return false;
+    }
+  if( !options.ResultCache.empty()
+      && ( !options.ApplyTo.empty() || !options.SeriesFile.empty() || options.AugmentCount > 0
+           || !options.AugmentFile.empty() || !options.ReslicePlanes.empty() || !options.ResliceFile.empty()
+           || !options.RegisterFile.empty() || !options.AtlasFile.empty() || !options.BSplineFile.empty()
+           || !options.DisplacementFieldFile.empty() || options.ValidatePrecision ) )
+    {
+    std::cerr << "--result-cache caches single resampled volumes; it cannot be combined with --apply-to, --series, "
+              << "--augment, --augment-file, --reslice, --register, --atlases, --bspline, --displacement-field or "
+              << "--validate-precision" << std::endl;
+    return false;
+    }
+  if( options.CacheStats && options.ResultCache.empty() )
+    {
+    std::cerr << "--cache-stats requires --result-cache" << std::endl;
+    return false;
+    }
+  if( options.ThresholdSet && options.Otsu )
+    {
+    std::cerr << "--threshold cannot be combined with --otsu" << std::endl;
+    return false;
+    }
+  if( options.ValidatePrecision && ( options.ThresholdSet || options.Otsu ) )
+    {
+    std::cerr << "--validate-precision compares gray levels; it cannot be combined with --threshold or --otsu"
+              << std::endl;
+    return false;
+    }
+  if( options.Slice >= 0 && options.Crop )
+    {
+    std::cerr << "--slice cannot be combined with --crop" << std::endl;
+    return false;
+    }
+  if( options.Precision == "fixed" && options.Interpolator != "linear" )
+    {
+    std::cerr << "--precision fixed requires --interpolator linear" << std::endl;
+    return false;
+    }
+  if( options.Interpolator == "nearest" || options.Interpolator == "majority" )
+    {
+    if( options.Precision != "double" || options.FourierTranslation )
+      {
+      std::cerr << "--interpolator " << options.Interpolator
+                << " cannot be combined with --precision float or --fourier-translation" << std::endl;
+      return false;
+      }
+    if( options.Interpolator == "majority"
+        && ( options.UseItkResample || !options.BSplineFile.empty() || !options.DisplacementFieldFile.empty() ) )
+      {
+      std::cerr << "--interpolator majority cannot be combined with --itk-resample, --bspline or --displacement-field"
+                << std::endl;
+      return false;
+      }
+    // A Gaussian pyramid level would blend neighboring labels.
+    options.UsePyramid = false;
+    }
+  return true;
+}
+
+#endif
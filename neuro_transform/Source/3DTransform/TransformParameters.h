@@ -0,0 +1,420 @@
+// AUTHOR: Christian McDaniel
+//
+// The seven transform parameters of {3DTransform} (x/y/z rotation in
+// radians, global scaling factor, x/y/z translation) outside of the ITK
+// pipeline: composing them into the same affine map that main() builds
+// from AffineTransforms, drawing random parameter sets for augmentation
+// and reading them (and the other text files of batch runs) from a text
+// file.
+
+#ifndef TransformParameters_h
+#define TransformParameters_h
+
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ResampleGeometry.h"
+
+struct TransformParameters
+{
+  double Rotation[3];
+  double Scale;
+  double Translation[3];
+};
+
+// x_in = Matrix * x_out + Offset for the composition main() builds: x, y
+// and z rotation, scaling and translation, each about `center` and each
+// only when its parameter differs from the identity. Like the matrices in
+// main(), the rotation and scaling steps carry a translation of 1 on every
+// axis.
+inline AffineMapping ComposeTransform( const TransformParameters & parameters, const double center[3] )
+{
+  AffineMapping composed;
+  SetIdentity( composed.Matrix );
+  composed.Offset[0] = composed.Offset[1] = composed.Offset[2] = 0.0;
+
+  for( unsigned int step = 0; step < 5; step++ )
+    {
+    double matrix[3][3];
+    double translation[3] = { 1.0, 1.0, 1.0 };
+    SetIdentity( matrix );
+    if( step < 3 )
+      {
+      const double angle = parameters.Rotation[step];
+      if( angle == 0.0 )
+        {
+        continue;
+        }
+      const double c = std::cos( angle );
+      const double s = std::sin( angle );
+      if( step == 0 )
+        {
+        matrix[1][1] = c; matrix[1][2] = s;
+        matrix[2][1] = -s; matrix[2][2] = c;
+        }
+      else if( step == 1 )
+        {
+        matrix[0][0] = c; matrix[0][2] = s;
+        matrix[2][0] = -s; matrix[2][2] = c;
+        }
+      else
+        {
+        matrix[0][0] = c; matrix[0][1] = -s;
+        matrix[1][0] = s; matrix[1][1] = c;
+        }
+      }
+    else if( step == 3 )
+      {
+      if( parameters.Scale == 1.0 )
+        {
+        continue;
+        }
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        matrix[d][d] = parameters.Scale;
+        }
+      }
+    else
+      {
+      if( parameters.Translation[0] == 0.0 && parameters.Translation[1] == 0.0 && parameters.Translation[2] == 0.0 )
+        {
+        continue;
+        }
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        translation[d] = parameters.Translation[d];
+        }
+      }
+
+    // AffineTransform with a center: offset = translation + center - M center.
+    double offset[3];
+    MultiplyMatrixVector( matrix, center, offset );
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      offset[d] = translation[d] + center[d] - offset[d];
+      }
+    // Compose( step ): the step is applied after the transform so far.
+    MultiplyMatrixVector( matrix, composed.Offset, composed.Offset );
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      composed.Offset[d] += offset[d];
+      }
+    MultiplyMatrices( matrix, composed.Matrix, composed.Matrix );
+    }
+  return composed;
+}
+
+// Uniform perturbations of a base parameter set: every rotation by up to
+// +-RotationRange radians, the scale by a factor in [ScaleMinimum,
+// ScaleMaximum] and every translation by up to +-TranslationRange.
+struct AugmentationRanges
+{
+  double RotationRange;
+  double ScaleMinimum;
+  double ScaleMaximum;
+  double TranslationRange;
+
+  AugmentationRanges()
+    : RotationRange( 0.0 ), ScaleMinimum( 1.0 ), ScaleMaximum( 1.0 ), TranslationRange( 0.0 ) {}
+};
+
+// Draws `count` parameter sets; the same seed always gives the same sets.
+inline std::vector< TransformParameters > SampleTransformParameters( const TransformParameters & base,
+                                                                     const AugmentationRanges & ranges,
+                                                                     std::size_t count, unsigned long seed )
+{
+  std::mt19937_64 generator( seed );
+  std::uniform_real_distribution< double > unit( -1.0, 1.0 );
+  std::uniform_real_distribution< double > scale( ranges.ScaleMinimum, ranges.ScaleMaximum );
+  std::vector< TransformParameters > samples( count );
+  for( std::size_t n = 0; n < count; n++ )
+    {
+    TransformParameters & sample = samples[n];
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      sample.Rotation[d] = base.Rotation[d] + ranges.RotationRange * unit( generator );
+      }
+    sample.Scale = base.Scale * ( ranges.ScaleMinimum == ranges.ScaleMaximum ? ranges.ScaleMinimum : scale( generator ) );
+    for( unsigned int d = 0; d < 3; d++ )
+      {
+      sample.Translation[d] = base.Translation[d] + ranges.TranslationRange * unit( generator );
+      }
+    }
+  return samples;
+}
+
+// Reads one parameter set per line, "rx ry rz scale tx ty tz" in the
+// order of the command line arguments. Blank lines and lines starting with
+// '#' are skipped. Returns false if the file cannot be read or a line is
+// malformed.
+inline bool ReadTransformParameterFile( const std::string & fileName, std::vector< TransformParameters > & sets )
+{
+  std::ifstream file( fileName.c_str() );
+  if( !file )
+    {
+    return false;
+    }
+  std::string line;
+  while( std::getline( file, line ) )
+    {
+    std::istringstream fields( line );
+    std::string first;
+    if( !( fields >> first ) || first[0] == '#' )
+      {
+      continue;
+      }
+    fields.clear();
+    fields.str( line );
+    TransformParameters parameters;
+    std::string rest;
+    if( !( fields >> parameters.Rotation[0] >> parameters.Rotation[1] >> parameters.Rotation[2]
+                  >> parameters.Scale
+                  >> parameters.Translation[0] >> parameters.Translation[1] >> parameters.Translation[2] )
+        || ( fields >> rest ) )
+      {
+      return false;
+      }
+    sets.push_back( parameters );
+    }
+  return true;
+}
+
+// Reads one transform per line for a series of volumes, either as the
+// seven parameters "rx ry rz scale tx ty tz" (composed about `center` like
+// the command line arguments) or as twelve numbers: the 3x3 matrix row by
+// row and the offset of x_in = Matrix * x_out + Offset in physical
+// coordinates (ITK's GetMatrix() and GetOffset()). Blank lines and lines
+// starting with '#' are skipped. Returns false if the file cannot be read
+// or a line has another number of values.
+inline bool ReadAffineTransformFile( const std::string & fileName, const double center[3],
+                                     std::vector< AffineMapping > & transforms )
+{
+  std::ifstream file( fileName.c_str() );
+  if( !file )
+    {
+    return false;
+    }
+  std::string line;
+  while( std::getline( file, line ) )
+    {
+    std::istringstream fields( line );
+    std::vector< double > values;
+    std::string field;
+    while( fields >> field )
+      {
+      if( values.empty() && field[0] == '#' )
+        {
+        break;
+        }
+      std::istringstream number( field );
+      double value;
+      std::string rest;
+      if( !( number >> value ) || ( number >> rest ) )
+        {
+        return false;
+        }
+      values.push_back( value );
+      }
+    if( values.empty() )
+      {
+      continue;
+      }
+    AffineMapping transform;
+    if( values.size() == 7 )
+      {
+      TransformParameters parameters;
+      for( unsigned int d = 0; d < 3; d++ )
+        {
+        parameters.Rotation[d] = values[d];
+        parameters.Translation[d] = values[4 + d];
+        }
+      parameters.Scale = values[3];
+      transform = ComposeTransform( parameters, center );
+      }
+    else if( values.size() == 12 )
+      {
+      for( unsigned int i = 0; i < 3; i++ )
+        {
+        for( unsigned int j = 0; j < 3; j++ )
+          {
+          transform.Matrix[i][j] = values[3 * i + j];
+          }
+        transform.Offset[i] = values[9 + i];
+        }
+      }
+    else
+      {
+      return false;
+      }
+    transforms.push_back( transform );
+    }
+  return true;
+}
+
+// Writes `transform` as one line of twelve numbers (matrix row by row,
+// then offset) that ReadAffineTransformFile reads back. Returns false if
+// the file cannot be written.
+inline bool WriteAffineTransformFile( const std::string & fileName, const AffineMapping & transform )
+{
+  std::ofstream file( fileName.c_str() );
+  if( !file )
+    {
+    return false;
+    }
+  file.precision( 17 );
+  for( unsigned int i = 0; i < 3; i++ )
+    {
+    for( unsigned int j = 0; j < 3; j++ )
+      {
+      file << transform.Matrix[i][j] << ' ';
+      }
+    }
+  file << transform.Offset[0] << ' ' << transform.Offset[1] << ' ' << transform.Offset[2] << std::endl;
+  return static_cast< bool >( file );
+}
+
+// One subject of a cohort registered to a common template: its image, the
+// file its resampled image is written to and, optionally, the file its
+// estimated transform is written to.
+struct CohortSubject
+{
+  std::string Input;
+  std::string Output;
+  std::string TransformOut;
+};
+
+// Reads one subject per line, "input output [transform]"; blank lines and
+// lines starting with '#' are skipped. Returns false if the file cannot be
+// read or a line has fewer than two or more than three fields.
+inline bool ReadCohortFile( const std::string & fileName, std::vector< CohortSubject > & subjects )
+{
+  std::ifstream file( fileName.c_str() );
+  if( !file )
+    {
+    return false;
+    }
+  std::string line;
+  while( std::getline( file, line ) )
+    {
+    std::istringstream fields( line );
+    std::vector< std::string > names;
+    std::string field;
+    while( fields >> field )
+      {
+      if( names.empty() && field[0] == '#' )
+        {
+        break;
+        }
+      names.push_back( field );
+      }
+    if( names.empty() )
+      {
+      continue;
+      }
+    if( names.size() < 2 || names.size() > 3 )
+      {
+      return false;
+      }
+    CohortSubject subject;
+    subject.Input = names[0];
+    subject.Output = names[1];
+    if( names.size() == 3 )
+      {
+      subject.TransformOut = names[2];
+      }
+    subjects.push_back( subject );
+    }
+  return true;
+}
+
+// One atlas of a label fusion: its label map, the file with its transform
+// (the output grid to the atlas, as written by --transform-out; "-" for
+// an atlas already in subject space) and the weight of its votes.
+struct AtlasEntry
+{
+  std::string Labels;
+  std::string Transform;
+  double      Weight;
+};
+
+// Reads one atlas per line, "labels transform [weight]" (weight 1 if not
+// given); blank lines and lines starting with '#' are skipped. Returns
+// false if the file cannot be read or a line has fewer than two or more
+// than three fields, or a weight that is not a positive number.
+inline bool ReadAtlasFile( const std::string & fileName, std::vector< AtlasEntry > & atlases )
+{
+  std::ifstream file( fileName.c_str() );
+  if( !file )
+    {
+    return false;
+    }
+  std::string line;
+  while( std::getline( file, line ) )
+    {
+    std::istringstream fields( line );
+    std::vector< std::string > names;
+    std::string field;
+    while( fields >> field )
+      {
+      if( names.empty() && field[0] == '#' )
+        {
+        break;
+        }
+      names.push_back( field );
+      }
+    if( names.empty() )
+      {
+      continue;
+      }
+    if( names.size() < 2 || names.size() > 3 )
+      {
+      return false;
+      }
+    AtlasEntry atlas;
+    atlas.Labels = names[0];
+    atlas.Transform = names[1];
+    atlas.Weight = 1.0;
+    if( names.size() == 3 )
+      {
+      std::istringstream number( names[2] );
+      std::string rest;
+      if( !( number >> atlas.Weight ) || ( number >> rest ) || !( atlas.Weight > 0.0 ) )
+        {
+        return false;
+        }
+      }
+    atlases.push_back( atlas );
+    }
+  return true;
+}
+
+// "dir/name.img" -> "dir/name_0007.img" (".nii.gz" is kept as one extension).
+inline std::string GetIndexedFileName( const std::string & fileName, std::size_t index )
+{
+  const std::size_t slash = fileName.find_last_of( "/\\" );
+  const std::size_t nameStart = ( slash == std::string::npos ) ? 0 : slash + 1;
+  std::size_t dot = fileName.find_last_of( '.' );
+  if( dot != std::string::npos && dot > nameStart && fileName.compare( dot, std::string::npos, ".gz" ) == 0 )
+    {
+    const std::size_t previous = fileName.find_last_of( '.', dot - 1 );
+    dot = ( previous != std::string::npos && previous > nameStart ) ? previous : dot;
+    }
+  if( dot == std::string::npos || dot <= nameStart )
+    {
+    dot = fileName.size();
+    }
+  std::ostringstream indexed;
+  indexed << fileName.substr( 0, dot ) << '_';
+  indexed.width( 4 );
+  indexed.fill( '0' );
+  indexed << index;
+  indexed << fileName.substr( dot );
+  return indexed.str();
+}
+
+#endif